@@ -1,5 +1,8 @@
 #include "albumdialog.h"
+#include "photoalbummodel.h"
+#include "thumbnailcache.h"
 #include <QDir>
+#include <QItemSelectionModel>
 #include <QFileInfo>
 #include <QPixmap>
 #include <QMessageBox>
@@ -11,14 +14,23 @@ AlbumDialog::AlbumDialog(const QString &photoPath, QWidget *parent)
     this->setWindowTitle("相册");
     this->setMinimumSize(780, 460);  
 
+    // --- 缩略图缓存和模型 ---
+    m_cache = new ThumbnailCache(m_photoPath, QSize(100, 100), this);
+    m_model = new PhotoAlbumModel(m_photoPath, m_cache, this);
+
     // --- 创建控件 ---
-    m_listWidget = new QListWidget;
-    m_listWidget->setFlow(QListView::LeftToRight);    
-    m_listWidget->setWrapping(true);                  
-    m_listWidget->setViewMode(QListView::IconMode);   
-    m_listWidget->setIconSize(QSize(100, 100));       
-    m_listWidget->setSpacing(10);                     
-    m_listWidget->setFixedWidth(240);                 
+    m_listView = new QListView;
+    m_listView->setFlow(QListView::LeftToRight);    
+    m_listView->setWrapping(true);                  
+    m_listView->setViewMode(QListView::IconMode);   
+    m_listView->setIconSize(m_cache->thumbnailSize());       
+    m_listView->setSpacing(10);                     
+    m_listView->setFixedWidth(240);                 
+    m_listView->setMovement(QListView::Static);
+    // 每行一样大时视图不必为每一行取数据算尺寸，只为可见的行取图标；分批布局，照片再多打开也不卡
+    m_listView->setUniformItemSizes(true);
+    m_listView->setLayoutMode(QListView::Batched);
+    m_listView->setModel(m_model);
 
     m_imageLabel = new QLabel("请选择一张照片");
     m_imageLabel->setAlignment(Qt::AlignCenter);
@@ -38,13 +50,13 @@ AlbumDialog::AlbumDialog(const QString &photoPath, QWidget *parent)
     rightLayout->addWidget(m_imageLabel);
     rightLayout->addLayout(buttonLayout);
 
-    mainLayout->addWidget(m_listWidget);
+    mainLayout->addWidget(m_listView);
     mainLayout->addLayout(rightLayout);
 
     // --- 美化样式 ---
     this->setStyleSheet(R"(
         QDialog { background-color: #2D2D2D; color: #F0F0F0; }
-        QListWidget { border: 1px solid #444; }
+        QListView { border: 1px solid #444; }
         QPushButton {
             background-color: #0078D7; color: white; border: 1px solid #444;
             padding: 8px; border-radius: 8px;
@@ -55,7 +67,9 @@ AlbumDialog::AlbumDialog(const QString &photoPath, QWidget *parent)
 
 
     // --- 连接信号和槽 ---
-    connect(m_listWidget,   &QListWidget::itemClicked, this, &AlbumDialog::onPhotoSelected);
+    // 点击和方向键都会改变当前行
+    connect(m_listView->selectionModel(), &QItemSelectionModel::currentChanged, this, &AlbumDialog::onPhotoSelected);
+    connect(m_cache,        &ThumbnailCache::imageReady, this, &AlbumDialog::onImageReady);
     connect(m_deleteButton, &QPushButton::clicked, this, &AlbumDialog::onDeletePhotoButtonClicked);
     connect(m_closeButton,  &QPushButton::clicked, this, &QDialog::accept);
 
@@ -69,24 +83,14 @@ AlbumDialog::~AlbumDialog()
 
 void AlbumDialog::loadPhotos()
 {
-    m_listWidget->clear();
     m_imageLabel->setText("请选择一张照片");
+    m_currentPath.clear();
 
-    QDir dir(m_photoPath);
-    // 只查找 jpg 和 png 文件
-    QStringList filters;
-    filters << "*.jpg" << "*.jpeg" << "*.png";
-    dir.setNameFilters(filters);
-    dir.setSorting(QDir::Time); 
-
-    QFileInfoList list = dir.entryInfoList();
-    for (const QFileInfo &fileInfo : list) {
-        QListWidgetItem *item = new QListWidgetItem(QIcon(fileInfo.filePath()), fileInfo.fileName());
-        item->setData(Qt::UserRole, fileInfo.filePath()); 
-        m_listWidget->addItem(item);
-    }
+    // 只列出文件名，缩略图在滚动到时才加载
+    m_model->reload();
+    m_cache->prune(m_model->fileNames());
 
-    if(m_listWidget->count() == 0) {
+    if(m_model->rowCount() == 0) {
         m_imageLabel->setText("相册为空");
         m_deleteButton->setEnabled(false);
     } else {
@@ -94,43 +98,61 @@ void AlbumDialog::loadPhotos()
     }
 }
 
-void AlbumDialog::onPhotoSelected(QListWidgetItem *item)
+void AlbumDialog::onPhotoSelected(const QModelIndex &index)
 {
-    if (!item) return;
+    if (!index.isValid()) return;
+
+    m_currentPath = m_model->path(index.row());
+    showCurrentPhoto();
+    // 预取前后两张，翻看时不用等解码
+    for (int row : { index.row() + 1, index.row() - 1 }) {
+        const QString path = m_model->path(row);
+        if (!path.isEmpty()) m_cache->prefetchImage(path, m_imageLabel->size());
+    }
+}
 
-    QString filePath = item->data(Qt::UserRole).toString();
-    QPixmap pixmap(filePath);
-    if (pixmap.isNull()) {
+void AlbumDialog::onImageReady(const QString &path)
+{
+    if (path == m_currentPath) showCurrentPhoto();
+}
+
+// 大图在后台按 QLabel 的大小解码和缩放；还没加载好时保留上一张，加载好后由 onImageReady 再显示
+void AlbumDialog::showCurrentPhoto()
+{
+    if (m_currentPath.isEmpty()) return;
+    QPixmap pixmap = m_cache->image(m_currentPath, m_imageLabel->size());
+    if (!pixmap.isNull()) {
+        m_imageLabel->setPixmap(pixmap);
+    } else if (m_cache->failed(m_currentPath)) {
         m_imageLabel->setText("无法加载图片");
-        return;
     }
-    // 缩放图片以适应QLabel
-    m_imageLabel->setPixmap(pixmap.scaled(m_imageLabel->size(), Qt::KeepAspectRatio, Qt::SmoothTransformation));
 }
 
 void AlbumDialog::onDeletePhotoButtonClicked()
 {
-    QListWidgetItem *currentItem = m_listWidget->currentItem();
-    if (!currentItem) {
+    const QModelIndex current = m_listView->currentIndex();
+    if (!current.isValid()) {
         QMessageBox::warning(this, "提示", "请先选择一张要删除的照片。");
         return;
     }
 
     QMessageBox::StandardButton reply;
-    reply = QMessageBox::question(this, "确认删除", "您确定要永久删除这张照片吗？\n" + currentItem->text(),
+    reply = QMessageBox::question(this, "确认删除", "您确定要永久删除这张照片吗？\n" + current.data(Qt::DisplayRole).toString(),
                                   QMessageBox::Yes | QMessageBox::No);
 
     if (reply == QMessageBox::Yes) {
-        QString filePath = currentItem->data(Qt::UserRole).toString();
+        QString filePath = m_model->path(current.row());
         QFile file(filePath);
         if (file.remove()) {
             qDebug() << "Deleted:" << filePath;
-            // 从列表中移除并刷新
-            delete m_listWidget->takeItem(m_listWidget->row(currentItem));
-            if (m_listWidget->count() > 0) {
-                 m_listWidget->setCurrentRow(0); 
-                 onPhotoSelected(m_listWidget->currentItem());
+            // 从列表和缩略图缓存中移除并刷新
+            m_cache->remove(filePath);
+            m_model->removePhoto(current.row());
+            if (m_model->rowCount() > 0) {
+                 m_listView->setCurrentIndex(m_model->index(0)); 
+                 onPhotoSelected(m_listView->currentIndex());
             } else {
+                m_currentPath.clear();
                 m_imageLabel->setText("相册为空");
                 m_deleteButton->setEnabled(false);
             }
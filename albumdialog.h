@@ -2,12 +2,16 @@
 #define ALBUMDIALOG_H
 
 #include <QDialog>
-#include <QListWidget>
+#include <QListView>
 #include <QLabel>
 #include <QPushButton>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 
+class PhotoAlbumModel;
+class ThumbnailCache;
+
+// 相册：缩略图和大图都由 ThumbnailCache 在后台加载，打开对话框时只列出文件名
 class AlbumDialog : public QDialog
 {
     Q_OBJECT
@@ -17,16 +21,21 @@ public:
     ~AlbumDialog();
 
 private slots:
-    void onPhotoSelected(QListWidgetItem *item);    
-    void onDeletePhotoButtonClicked();              
+    void onPhotoSelected(const QModelIndex &index);
+    void onImageReady(const QString &path);
+    void onDeletePhotoButtonClicked();
 
 private:
     void loadPhotos();
-    QString m_photoPath;         
-    QListWidget *m_listWidget;   
-    QLabel *m_imageLabel;        
-    QPushButton *m_deleteButton; 
-    QPushButton *m_closeButton;  
+    void showCurrentPhoto();
+    QString m_photoPath;
+    ThumbnailCache *m_cache;
+    PhotoAlbumModel *m_model;
+    QListView *m_listView;
+    QLabel *m_imageLabel;
+    QPushButton *m_deleteButton;
+    QPushButton *m_closeButton;
+    QString m_currentPath;       // 右侧正在显示（或等待加载）的照片
 };
 
 #endif // ALBUMDIALOG_H
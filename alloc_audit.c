@@ -0,0 +1,62 @@
+#include "alloc_audit.h"
+
+#ifdef FR_ALLOC_AUDIT
+
+#include <errno.h>
+#include <stddef.h>
+
+// 在可执行文件中定义同名函数即可覆盖 glibc 的分配函数（ELF 符号优先级），
+// 共享库里的调用也会解析到这里；真正的分配仍交给 glibc 的内部入口。
+// libstdc++ 的 operator new 最终调用 malloc，因此不需要单独替换
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+// 可执行文件的静态 TLS，访问时不会再触发分配
+static __thread long thread_allocs;
+
+void *malloc(size_t size) {
+    thread_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    thread_allocs++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    thread_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    thread_allocs++;
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    thread_allocs++;
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    thread_allocs++;
+    void *p = __libc_memalign(alignment, size);
+    if (!p) return ENOMEM;
+    *ptr = p;
+    return 0;
+}
+
+long alloc_audit_thread_count(void) {
+    return thread_allocs;
+}
+
+#else
+
+long alloc_audit_thread_count(void) {
+    return -1;
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef ALLOC_AUDIT_H
+#define ALLOC_AUDIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief 返回调用线程到目前为止的堆分配次数（malloc/calloc/realloc/posix_memalign 及 operator new）。
+ * 只有用 CONFIG+=alloc_audit 编译（定义了 FR_ALLOC_AUDIT）时才统计，
+ * 此时整个进程（包括 Qt 和 OpenCV）的分配函数都会经过这里；否则恒返回 -1，没有任何开销。
+ * 用法：在一段代码前后各取一次，差值就是这段代码在本线程中的分配次数。
+ */
+long alloc_audit_thread_count(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ALLOC_AUDIT_H
@@ -0,0 +1,89 @@
+# 图形界面程序和守护进程共用的处理流水线与库配置
+
+# 使用 C++11 标准
+CONFIG += c++11
+
+# 采集、检测、追踪、识别流水线（不依赖 QtGui），多路摄像头共用一个识别器
+SOURCES += \
+    $$PWD/pipelinemanager.cpp \
+    $$PWD/videoprocessor.cpp \
+    $$PWD/face_tracker.cpp \
+    $$PWD/video_manager.c \
+    $$PWD/replay_source.c \
+    $$PWD/face_detector.cpp \
+    $$PWD/lbp_cascade.cpp \
+    $$PWD/face_quality.c \
+    $$PWD/face_recognizer.cpp \
+    $$PWD/db_crypto.cpp \
+    $$PWD/model_cache.cpp \
+    $$PWD/model_kernels.cpp \
+    $$PWD/gallery_rpc.c \
+    $$PWD/event_log.cpp \
+    $$PWD/photo_writer.cpp \
+    $$PWD/quitsignal.cpp \
+    $$PWD/alloc_audit.c
+
+HEADERS += \
+    $$PWD/pipelinemanager.h \
+    $$PWD/videoprocessor.h \
+    $$PWD/face_tracker.h \
+    $$PWD/video_manager.h \
+    $$PWD/replay_source.h \
+    $$PWD/face_detector.h \
+    $$PWD/lbp_cascade.h \
+    $$PWD/face_quality.h \
+    $$PWD/face_recognizer.h \
+    $$PWD/db_crypto.h \
+    $$PWD/model_cache.h \
+    $$PWD/model_kernels.h \
+    $$PWD/gallery_rpc.h \
+    $$PWD/event_log.h \
+    $$PWD/photo_writer.h \
+    $$PWD/quitsignal.h \
+    $$PWD/alloc_audit.h
+
+# qmake CONFIG+=alloc_audit 时统计处理线程每帧的堆分配次数，用来确认稳态下没有分配
+alloc_audit: DEFINES += FR_ALLOC_AUDIT
+
+# 识别模型的计算内核、LBP 级联检测和人脸库加密在 ARM 上使用 NEON（i.MX6ULL 的 Cortex-A7 支持 NEON-VFPv4），x86 上使用 SSE；
+# qmake CONFIG+=model_scalar / detector_scalar / db_crypto_scalar 时只用标量实现，用于对比结果
+contains(QT_ARCH, arm): QMAKE_CXXFLAGS += -mfpu=neon-vfpv4
+model_scalar: DEFINES += FR_MODEL_SCALAR
+detector_scalar: DEFINES += FR_DETECTOR_SCALAR
+db_crypto_scalar: DEFINES += FR_DB_CRYPTO_SCALAR
+
+# ======== 交叉编译和库配置 ==========
+# 引用你 Makefile 中的路径
+OPENCV_INSTALL_PATH = /home/book/opencv_for_imx6ull/install_opencv
+
+# 手动指定头文件和库路径，这比 pkg-config 更可靠
+INCLUDEPATH += $$OPENCV_INSTALL_PATH/include/opencv4
+INCLUDEPATH += /home/book/100ask_imx6ull-sdk/ToolChain/arm-buildroot-linux-gnueabihf_sdk-buildroot/arm-buildroot-linux-gnueabihf/sysroot/usr/include
+
+# LIBS 配置是解决 "undefined reference" 错误的关键
+# -L 指定库的搜索路径
+# -l 指定要链接的具体库
+LIBS += -L$$OPENCV_INSTALL_PATH/lib \
+        -lopencv_core \
+        -lopencv_imgproc \
+        -lopencv_imgcodecs \
+        -lopencv_dnn \
+        -lopencv_objdetect \
+        -lopencv_videoio \
+        -lopencv_highgui \
+        -lopencv_features2d \
+        -lopencv_calib3d \ # <--- 添加缺失的模块
+        -lopencv_video \    # <--- 添加 video 模块，用于 KalmanFilter
+        -lopencv_flann      # <--- 添加 flann 模块，它是 features2d 和 calib3d 的依赖
+# 添加其他依赖库
+LIBS += -lpthread -ljpeg -ldl -lrt
+
+# 针对交叉编译环境的配置 (可选，但在Qt Creator Kit中配置更好)
+unix {
+    # 如果你的交叉编译器不在系统 PATH 中，需要指定
+    # QMAKE_CC = arm-buildroot-linux-gnueabihf-gcc
+    # QMAKE_CXX = arm-buildroot-linux-gnueabihf-g++
+    # QMAKE_LINK = arm-buildroot-linux-gnueabihf-g++
+    # QMAKE_AR = arm-buildroot-linux-gnueabihf-ar cqs
+    # QMAKE_STRIP = arm-buildroot-linux-gnueabihf-strip
+}
@@ -0,0 +1,598 @@
+#include "pipelinemanager.h"
+#include "daemoncontroller.h"
+#include "gallery_rpc.h"
+#include "quitsignal.h"
+#include "alloc_audit.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QTimer>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <csignal>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+
+#define SHARD_MAX_CLIENTS 64   // 每个识别器的每个推理线程占用分片的一个连接
+
+static FaceRecognizer *importRecognizer = nullptr;
+
+static void onImportSignal(int)
+{
+    face_recognizer_cancel_import(importRecognizer);
+}
+
+static void printImportProgress(const BulkImportProgress *p, void *)
+{
+    double rate = p->elapsed_s > 0 ? p->images_done / p->elapsed_s : 0.0;
+    int remaining = p->images_total - p->images_done;
+    qInfo().noquote() << QString("[import] %1/%2 人 (跳过 %3, 失败 %4), 照片 %5/%6, 人脸 %7, %8 张/秒, 预计剩余 %9 秒")
+                         .arg(p->people_done + p->people_failed).arg(p->people_total - p->people_skipped)
+                         .arg(p->people_skipped).arg(p->people_failed)
+                         .arg(p->images_done).arg(p->images_total).arg(p->faces_embedded)
+                         .arg(rate, 0, 'f', 1)
+                         .arg(rate > 0 ? (int)(remaining / rate) : 0);
+}
+
+// 取命令行中 option 后面的参数，没有时返回 fallback
+static QString optionValue(const QStringList &args, const QString &option, const QString &fallback = QString())
+{
+    int index = args.indexOf(option);
+    return index >= 0 ? args.value(index + 1, fallback) : fallback;
+}
+
+// 批量导入模式：face_recognition_daemon --import <目录> [--threads N] [--db <文件>] [--partition i/n]
+// 不打开摄像头，导入完成后退出；Ctrl-C 会在写完已完成的人之后停止，再次运行即可继续。
+// --partition 只导入属于第 i 个分片（共 n 个）的人，用同一个目录为每个分片各建一个库
+static int runImport(const QStringList &args)
+{
+    QString root = optionValue(args, "--import");
+    if (root.isEmpty()) {
+        qCritical() << "用法: face_recognition_daemon --import <目录> [--threads N] [--db <文件>] [--partition i/n]";
+        return 1;
+    }
+    int threads = optionValue(args, "--threads").toInt();
+    QString dbPath = optionValue(args, "--db", FR_DATABASE_FILE);
+    QString partition = optionValue(args, "--partition");
+
+    if (face_detector_init(FR_CASCADE_FILE) != 0) {
+        qCritical() << "错误: 模型初始化失败";
+        return 1;
+    }
+    // 导入线程轮流借用推理网络，FR_RECOGNIZER_WORKERS 决定能同时推理的网络份数
+    importRecognizer = face_recognizer_create(FR_MODEL_FILE, dbPath.toUtf8().constData(), PipelineManager::recognizerWorkers());
+    if (!importRecognizer) {
+        qCritical() << "错误: 模型初始化失败";
+        face_detector_cleanup();
+        return 1;
+    }
+    if (!partition.isEmpty()
+        && face_recognizer_set_partition(importRecognizer, partition.section('/', 0, 0).toInt(),
+                                         partition.section('/', 1, 1).toInt()) != 0) {
+        qCritical() << "错误: 无效的分片" << partition << "，应写成 i/n，0 <= i < n";
+        face_recognizer_destroy(importRecognizer);
+        importRecognizer = nullptr;
+        face_detector_cleanup();
+        return 1;
+    }
+
+    std::signal(SIGINT, onImportSignal);
+    std::signal(SIGTERM, onImportSignal);
+    int imported = face_recognizer_import_directory(importRecognizer, root.toUtf8().constData(), threads,
+                                                    printImportProgress, nullptr);
+
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    FaceRecognizer *rec = importRecognizer;
+    importRecognizer = nullptr;
+    face_recognizer_destroy(rec);
+    face_detector_cleanup();
+    return imported < 0 ? 1 : 0;
+}
+
+static volatile sig_atomic_t shardStopping = 0;
+
+static void onShardSignal(int)
+{
+    shardStopping = 1;
+}
+
+// 在分片的库中查找最相似的人，身份 id 只在本进程内有效，回复中换成名字
+static int answerShardQuery(const float *feature, int dim, int k, GalleryHit *hits, void *userData)
+{
+    if (dim != FACE_FEATURE_DIM) return 0;
+    RecognitionCandidate candidates[GALLERY_MAX_HITS];
+    int count = face_recognizer_query_gallery(static_cast<FaceRecognizer *>(userData), feature,
+                                              std::min(k, GALLERY_MAX_HITS), candidates);
+    for (int i = 0; i < count; ++i) {
+        const char *name = face_recognizer_identity_name(candidates[i].identity_id);
+        qstrncpy(hits[i].name, name ? name : "", GALLERY_NAME_MAX);
+        hits[i].score = candidates[i].score;
+    }
+    return count;
+}
+
+// 分片模式：face_recognition_daemon --shard <地址> [--db <文件>]
+// 只加载人脸库，不加载模型、不打开摄像头，回答识别器发来的 top-k 查询（协议见 gallery_rpc.h）。
+// 在本机上可以同时运行多个分片，例如
+//   face_recognition_daemon --shard unix:/tmp/shard0.sock --db /root/shard0.db &
+//   face_recognition_daemon --shard unix:/tmp/shard1.sock --db /root/shard1.db &
+//   FR_GALLERY_SHARDS=unix:/tmp/shard0.sock,unix:/tmp/shard1.sock face_recognition_daemon
+static int runShard(const QStringList &args)
+{
+    QString address = optionValue(args, "--shard");
+    if (address.isEmpty()) {
+        qCritical() << "用法: face_recognition_daemon --shard <unix:/路径 | 主机:端口> [--db <文件>]";
+        return 1;
+    }
+    QString dbPath = optionValue(args, "--db", FR_DATABASE_FILE);
+
+    FaceRecognizer *gallery = face_recognizer_create(nullptr, dbPath.toUtf8().constData(), 0);
+    if (!gallery) {
+        qCritical() << "错误: 无法加载人脸库" << dbPath;
+        return 1;
+    }
+    GalleryShardServer *server = gallery_shard_server_create(address.toUtf8().constData(), SHARD_MAX_CLIENTS);
+    if (!server) {
+        qCritical() << "错误: 无法监听" << address;
+        face_recognizer_destroy(gallery);
+        return 1;
+    }
+
+    std::signal(SIGINT, onShardSignal);
+    std::signal(SIGTERM, onShardSignal);
+    qInfo().noquote() << QString("人脸库分片已启动: %1，库文件 %2").arg(address, dbPath);
+    int ret = gallery_shard_server_run(server, answerShardQuery, gallery, &shardStopping);
+
+    gallery_shard_server_destroy(server);
+    face_recognizer_destroy(gallery);
+    return ret < 0 ? 1 : 0;
+}
+
+// 取走结果流中的所有结果；一条都没有时最多等待 timeoutMs 毫秒。返回取走的条数
+static int drainResults(RecognitionStream *stream, int timeoutMs)
+{
+    struct pollfd pfd = {face_recognizer_result_fd(stream), POLLIN, 0};
+    for (;;) {
+        int total = 0;
+        const RecognitionResult *results = nullptr;
+        int n;
+        while ((n = face_recognizer_peek_results(stream, &results)) > 0) {
+            face_recognizer_consume_results(stream, n);
+            total += n;
+        }
+        if (total > 0) return total;
+        if (poll(&pfd, 1, timeoutMs) <= 0) return 0;
+        face_recognizer_clear_result_event(stream);
+    }
+}
+
+// 用一种线程配置测量：逐张提交时的单张延迟，以及每个推理线程保持两张在途时的吞吐
+static bool benchmarkConfig(const QString &dbPath, int workers, int threads, int faces, const FaceChip &chip,
+                            double &latencyMs, double &facesPerSecond)
+{
+    FaceRecognizer *rec = face_recognizer_create(FR_MODEL_FILE, dbPath.toUtf8().constData(), workers);
+    if (!rec) return false;
+    RecognizerCpuConfig cpu = {threads, 0, 0};
+    face_recognizer_set_cpu_config(rec, &cpu);
+    RecognitionStream *stream = face_recognizer_open_stream(rec, "benchmark", nullptr, 0);
+    if (!stream) {
+        face_recognizer_destroy(rec);
+        return false;
+    }
+
+    bool ok = true;
+    const int latencyRuns = qMin(faces, 20);
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < latencyRuns && ok; ++i) {
+        ok = face_recognizer_submit_chips(stream, &chip, 1) > 0 && drainResults(stream, 5000) > 0;
+    }
+    latencyMs = timer.nsecsElapsed() / 1e6 / latencyRuns;
+
+    // 队列每个结果流最多排8张，超过会挤掉排队的切片
+    const int window = qMin(8, 2 * workers);
+    int submitted = 0, done = 0;
+    timer.restart();
+    while (ok && done < faces) {
+        while (submitted - done < window && submitted < faces) {
+            if (face_recognizer_submit_chips(stream, &chip, 1) <= 0) break;
+            ++submitted;
+        }
+        const int n = drainResults(stream, 5000);
+        ok = n > 0;
+        done += n;
+    }
+    facesPerSecond = done * 1e9 / qMax<qint64>(1, timer.nsecsElapsed());
+
+    face_recognizer_close_stream(stream);
+    face_recognizer_destroy(rec);
+    return ok;
+}
+
+// 基准测试模式：face_recognition_daemon --benchmark [--faces N] [--db <文件>]
+// 对推理线程数 x 每次推理线程数的每种组合（总数不超过 CPU 数）测量单张延迟和吞吐，
+// 用来选择 FR_RECOGNIZER_WORKERS 和 FR_INFER_THREADS：多个推理线程提高吞吐，拆分一次推理降低延迟。
+// 人脸库（默认正式库）先复制到临时目录再打开，比对的开销与实际相同，正式库不会被改写。
+// 测量时不保留 CPU，也不调整优先级；应在停止守护进程后运行
+static int runBenchmark(const QStringList &args)
+{
+    const int faces = qMax(1, optionValue(args, "--faces", "100").toInt());
+    const int cpus = (int)qMax(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    const QString sourceDb = optionValue(args, "--db", FR_DATABASE_FILE);
+
+    QTemporaryDir tempDir;
+    if (!tempDir.isValid()) {
+        qCritical() << "错误: 无法创建临时目录";
+        return 1;
+    }
+    const QString dbPath = tempDir.filePath("benchmark.db");
+    if (QFileInfo::exists(sourceDb) && !QFile::copy(sourceDb, dbPath)) {
+        qCritical() << "错误: 无法复制人脸库" << sourceDb;
+        return 1;
+    }
+
+    // 一张合成的 112x112 切片：识别的耗时与内容无关
+    const int size = 112;
+    std::vector<unsigned char> pixels(size * size * 3);
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size * 3; ++x) pixels[y * size * 3 + x] = (unsigned char)((x * 7 + y * 13) & 0xff);
+    }
+    FaceChip chip = {};
+    chip.bgr = pixels.data();
+    chip.width = size;
+    chip.height = size;
+    chip.stride = size * 3;
+    chip.rect.width = size;
+    chip.rect.height = size;
+    chip.track_id = -1;
+    chip.priority = RECOGNITION_PRIORITY_NEW;
+
+    qInfo().noquote() << QString("[bench] %1 个 CPU，每种配置 %2 张人脸，人脸库 %3")
+                         .arg(cpus).arg(faces).arg(QFileInfo::exists(sourceDb) ? sourceDb : "空");
+    for (int workers = 1; workers <= cpus; ++workers) {
+        for (int threads = 1; workers * threads <= cpus; ++threads) {
+            double latencyMs = 0, facesPerSecond = 0;
+            if (!benchmarkConfig(dbPath, workers, threads, faces, chip, latencyMs, facesPerSecond)) {
+                qCritical() << "错误: 基准测试失败";
+                return 1;
+            }
+            qInfo().noquote() << QString("[bench] 推理线程 %1 x 每次推理 %2 线程: 单张延迟 %3 ms，吞吐 %4 张/秒")
+                                 .arg(workers).arg(threads).arg(latencyMs, 0, 'f', 1).arg(facesPerSecond, 0, 'f', 1);
+        }
+    }
+    return 0;
+}
+
+// 检测器对照模式：face_recognition_daemon --detector-benchmark <图片或目录> [--runs N]
+// 对每张图片（目录下的 jpg/png/bmp/pgm）用自有 LBP 级联和 cv::CascadeClassifier 各检测 N 次（默认10），
+// 比较两者的结果和每帧耗时。所有图片的结果都相同时返回0，可以作为一致性测试
+static int runDetectorBenchmark(const QStringList &args)
+{
+    QString path = optionValue(args, "--detector-benchmark");
+    if (path.isEmpty()) {
+        qCritical() << "用法: face_recognition_daemon --detector-benchmark <图片或目录> [--runs N]";
+        return 1;
+    }
+    const int runs = qMax(1, optionValue(args, "--runs", "10").toInt());
+    QStringList images;
+    if (QFileInfo(path).isDir()) {
+        QDir dir(path);
+        const QStringList filters = {"*.jpg", "*.jpeg", "*.png", "*.bmp", "*.pgm"};
+        for (const QString &name : dir.entryList(filters, QDir::Files, QDir::Name)) images << dir.filePath(name);
+    } else {
+        images << path;
+    }
+    if (face_detector_init(FR_CASCADE_FILE) != 0) {
+        qCritical() << "错误: 人脸检测器初始化失败";
+        return 1;
+    }
+
+    FaceDetectorParity total = {};
+    for (const QString &image : images) {
+        FaceDetectorParity p;
+        if (face_detector_compare_image(image.toUtf8().constData(), runs, &p) != 0) continue;
+        qInfo().noquote() << QString("[detector] %1: 人脸 %2 (OpenCV %3，配对 %4)%5，%6 ms (OpenCV %7 ms)")
+                             .arg(QFileInfo(image).fileName()).arg(p.faces).arg(p.reference_faces).arg(p.matched)
+                             .arg(p.differing_frames ? "，结果不同" : "")
+                             .arg(p.ms, 0, 'f', 1).arg(p.reference_ms, 0, 'f', 1);
+        total.frames += p.frames;
+        total.differing_frames += p.differing_frames;
+        total.faces += p.faces;
+        total.reference_faces += p.reference_faces;
+        total.matched += p.matched;
+        total.ms += p.ms;
+        total.reference_ms += p.reference_ms;
+    }
+    face_detector_cleanup();
+    if (total.frames == 0) {
+        qCritical() << "错误: 没有可以比较的图片";
+        return 1;
+    }
+    qInfo().noquote() << QString("[detector] %1 张图片，%2 张结果不同；人脸 %3 (OpenCV %4，配对 %5)；"
+                                 "平均 %6 ms/帧 (OpenCV %7 ms)")
+                         .arg(total.frames).arg(total.differing_frames)
+                         .arg(total.faces).arg(total.reference_faces).arg(total.matched)
+                         .arg(total.ms / total.frames, 0, 'f', 1).arg(total.reference_ms / total.frames, 0, 'f', 1);
+    return total.differing_frames == 0 ? 0 : 1;
+}
+
+// 追踪器基准测试：face_recognition_daemon --tracker-benchmark [--frames N]
+// 对 3 到 100 张同时出现的人脸，用合成的检测框（每张脸在自己的格子里移动，带抖动、顺序打乱、偶尔漏检）
+// 驱动 TrackerEngine 的 predict/update/removeExpired N 帧（默认1000），打印每帧耗时及其中卡尔曼滤波和匹配各占多少。
+// 新建追踪器数应等于人脸数，多出来的说明合成场景下丢失了追踪
+static int runTrackerBenchmark(const QStringList &args)
+{
+    const int frames = qMax(1, optionValue(args, "--frames", "1000").toInt());
+    const int counts[] = {3, 5, 10, 20, 35, 50, 75, 100};
+    const int width = 1280, height = 720;
+
+    for (int faces : counts) {
+        // 参数与 VideoProcessor 相同，容量放宽到人脸数
+        TrackerEngine tracker(faces, 30, 0.3f, 15);
+        TrackerEngine::Timing timing;
+        tracker.setTiming(&timing);
+
+        const int columns = (int)std::ceil(std::sqrt((double)faces));
+        const int rows = (faces + columns - 1) / columns;
+        const int cellW = width / columns, cellH = height / rows;
+        const int size = qMin(cellW, cellH) / 2;
+        std::mt19937 rng(faces);
+        std::uniform_real_distribution<float> phase(0.0f, 6.2832f), jitter(-1.5f, 1.5f), chance(0.0f, 1.0f);
+        std::vector<float> phases(faces);
+        for (float &p : phases) p = phase(rng);
+
+        std::vector<FaceRect> detections;
+        detections.reserve(faces);
+        std::vector<int> newIds, lostIds;
+        long long trackers = 0;
+        int created = 0;
+        QElapsedTimer timer;
+        timer.start();
+        for (int frame = 0; frame < frames; ++frame) {
+            detections.clear();
+            for (int i = 0; i < faces; ++i) {
+                if (frame > 0 && chance(rng) < 0.05f) continue;   // 5% 漏检
+                const float t = frame * 0.05f + phases[i];
+                const float cx = (i % columns + 0.5f) * cellW + std::sin(t) * cellW / 5 + jitter(rng);
+                const float cy = (i / columns + 0.5f) * cellH + std::cos(t * 0.7f) * cellH / 5 + jitter(rng);
+                FaceRect r;
+                r.x = (int)(cx - size / 2);
+                r.y = (int)(cy - size / 2);
+                r.width = size + (int)jitter(rng);
+                r.height = r.width;
+                detections.push_back(r);
+            }
+            std::shuffle(detections.begin(), detections.end(), rng);
+
+            newIds.clear();
+            lostIds.clear();
+            tracker.predict();
+            tracker.update(detections.data(), (int)detections.size(), &newIds);
+            tracker.removeExpired(&lostIds);
+            created += (int)newIds.size();
+            trackers += tracker.size();
+        }
+        const double totalUs = timer.nsecsElapsed() / 1e3 / frames;
+        qInfo().noquote() << QString("[tracker] %1 张人脸: %2 us/帧（卡尔曼 %3 us，匹配 %4 us），平均追踪器 %5，新建 %6")
+                             .arg(faces, 3).arg(totalUs, 0, 'f', 1)
+                             .arg(timing.kalmanNs / 1e3 / frames, 0, 'f', 1)
+                             .arg(timing.matchNs / 1e3 / frames, 0, 'f', 1)
+                             .arg((double)trackers / frames, 0, 'f', 1).arg(created);
+    }
+    return 0;
+}
+
+// 人脸库基准测试：face_recognition_daemon --db-benchmark [--people N] [--runs N] [--dir 目录]
+// 用 N 个合成的人（默认1000）在人脸库所在的目录（或 --dir）下分别测量明文和加密格式的整库写入、
+// 追加一个人和加载的耗时，每项重复 --runs 次（默认5），用来确认加密对启动和注册的影响
+static int runDbBenchmark(const QStringList &args)
+{
+    const int people = qMax(1, optionValue(args, "--people", "1000").toInt());
+    const int runs = qMax(1, optionValue(args, "--runs", "5").toInt());
+    const QString dir = optionValue(args, "--dir", QFileInfo(FR_DATABASE_FILE).absolutePath());
+
+    DatabaseBenchmark plain, encrypted;
+    if (face_recognizer_benchmark_database(dir.toUtf8().constData(), people, runs, &plain, &encrypted) != 0) {
+        qCritical() << "错误: 人脸库基准测试失败";
+        return 1;
+    }
+    qInfo().noquote() << QString("[db-bench] %1 人，%2 次平均，目录 %3").arg(people).arg(runs).arg(dir);
+    const DatabaseBenchmark *results[] = {&plain, &encrypted};
+    const char *names[] = {"明文", "加密"};
+    for (int i = 0; i < 2; ++i) {
+        qInfo().noquote() << QString("[db-bench] %1: 加载 %2 ms，整库写入 %3 ms，追加一人 %4 ms，文件 %5 KB")
+                             .arg(names[i]).arg(results[i]->load_ms, 0, 'f', 2).arg(results[i]->save_ms, 0, 'f', 2)
+                             .arg(results[i]->append_ms, 0, 'f', 3).arg(results[i]->file_bytes / 1024);
+    }
+    if (plain.load_ms > 0) {
+        qInfo().noquote() << QString("[db-bench] 加密使加载时间增加 %1%")
+                             .arg((encrypted.load_ms / plain.load_ms - 1) * 100, 0, 'f', 1);
+    }
+    return 0;
+}
+
+// 事件查询模式：face_recognition_daemon --events <开始> <结束> [--name 姓名] [--dir 目录] [--thumbnails 目录]
+// 只读打开事件日志（守护进程可以同时在写），每个事件打印一行 JSON；--thumbnails 把事件的人脸缩略图存成 JPEG
+static int runEvents(const QStringList &args)
+{
+    const int index = args.indexOf("--events");
+    const qint64 from = DaemonController::parseTime(args.value(index + 1));
+    const qint64 to = DaemonController::parseTime(args.value(index + 2));
+    if (from < 0 || to < 0) {
+        qCritical() << "用法: face_recognition_daemon --events <开始> <结束> [--name 姓名] [--dir 目录] [--thumbnails 目录]";
+        return 1;
+    }
+    const QString dir = optionValue(args, "--dir", qEnvironmentVariable("FR_EVENT_LOG_DIR", FR_EVENT_LOG_DIR));
+    const QString name = optionValue(args, "--name");
+    const QString thumbnailDir = optionValue(args, "--thumbnails");
+
+    EventLog::Options options;
+    options.readOnly = true;
+    std::string error;
+    std::unique_ptr<EventLog> log = EventLog::open(dir.toStdString(), options, &error);
+    if (!log) {
+        qCritical().noquote() << "错误: 无法打开事件日志" << QString::fromStdString(error);
+        return 1;
+    }
+    int identity = EVENT_LOG_ANY_IDENTITY;
+    if (!name.isEmpty() && (identity = log->findIdentity(name.toStdString())) == EVENT_LOG_NO_IDENTITY) {
+        qCritical() << "错误: 事件日志中没有" << name;
+        return 1;
+    }
+    if (!thumbnailDir.isEmpty()) QDir().mkpath(thumbnailDir);
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 printNs = 0;
+    std::vector<unsigned char> thumbnail;
+    const int count = log->query(from, to, identity, [&](const EventRecord &record, unsigned segment) {
+        QElapsedTimer print;
+        print.start();
+        QJsonObject obj = DaemonController::eventJson(*log, record);
+        if (!thumbnailDir.isEmpty() && log->readThumbnail(segment, record, thumbnail)) {
+            QFile file(QString("%1/%2_cam%3_%4.jpg").arg(thumbnailDir).arg(record.timestampMs)
+                       .arg(record.camera).arg(record.trackerId));
+            if (file.open(QIODevice::WriteOnly)) {
+                file.write((const char *)thumbnail.data(), thumbnail.size());
+                obj["thumbnail"] = file.fileName();
+            }
+        }
+        fprintf(stdout, "%s\n", QJsonDocument(obj).toJson(QJsonDocument::Compact).constData());
+        printNs += print.nsecsElapsed();
+        return true;
+    });
+    const EventLog::Stats stats = log->stats();
+    qInfo().noquote() << QString("[events] %1 段中命中 %2 个事件，查询 %3 ms（不含输出）")
+                         .arg(stats.segments).arg(count)
+                         .arg((timer.nsecsElapsed() - printNs) / 1e6, 0, 'f', 2);
+    return 0;
+}
+
+// 堆分配检查模式：face_recognition_daemon --alloc-check [--frames N] [--timeout S]
+// 按正常配置启动所有视频源，每一路在预热之后再处理 N 帧（默认1000）就停止，其间处理线程只要有一帧堆分配
+// （不含 JPEG 解码器内部和状态文字变化时的通知）就返回1，超时（默认300秒）也返回1，可以作为稳态不分配的测试。
+// 需要用 CONFIG+=alloc_audit 编译；不做检测器对照检查，检测器退回 cv::CascadeClassifier 时每帧都会分配，检查不会通过
+static int runAllocCheck(const QStringList &args)
+{
+    if (alloc_audit_thread_count() < 0) {
+        qCritical() << "错误: --alloc-check 需要用 qmake CONFIG+=alloc_audit 编译";
+        return 1;
+    }
+    const long frames = qMax(1, optionValue(args, "--frames", "1000").toInt());
+    const int timeoutS = qMax(1, optionValue(args, "--timeout", "300").toInt());
+    qunsetenv("FR_DETECTOR_PARITY");
+
+    PipelineManager pipelines;
+    pipelines.init();
+    QuitSignalNotifier quitSignal;
+
+    bool finished = false;
+    QElapsedTimer timer;
+    QTimer poll;
+    QObject::connect(&poll, &QTimer::timeout, [&]() {
+        bool done = true;
+        for (VideoProcessor *processor : pipelines.processors()) {
+            done = done && processor->allocAuditFrames() >= frames;
+        }
+        if (done || timer.elapsed() > timeoutS * 1000LL) {
+            finished = done;
+            QCoreApplication::quit();
+        }
+    });
+    pipelines.start();
+    timer.start();
+    poll.start(500);
+    QCoreApplication::exec();
+    pipelines.stop();
+
+    long failures = 0;
+    for (VideoProcessor *processor : pipelines.processors()) {
+        qInfo().noquote() << QString("[alloc-check] 摄像头 %1: 检查 %2 帧，其中 %3 帧有堆分配")
+                             .arg(processor->camera()).arg(processor->allocAuditFrames())
+                             .arg(processor->allocAuditFailures());
+        failures += processor->allocAuditFailures();
+    }
+    if (!finished) {
+        qCritical().noquote() << QString("错误: %1 秒内没有处理完 %2 帧").arg(timeoutS).arg(frames);
+        return 1;
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// 无界面守护进程：不依赖 QtGui/QtWidgets，识别事件通过 Unix 域套接字推送
+// FR_IPC_SOCKET 指定套接字路径，默认 /tmp/face_recognition.sock；--import 进入批量导入模式，--shard 进入分片模式，
+// --benchmark 测量不同推理线程配置的延迟和吞吐，--detector-benchmark 对照自有检测器和 OpenCV 的结果与速度，
+// --tracker-benchmark 测量不同人脸数下追踪器每帧的耗时，--db-benchmark 比较明文和加密人脸库的读写耗时，--events 查询识别事件日志，
+// --alloc-check 检查处理线程在稳态下是否有堆分配。
+// FR_VIDEO_SOURCES 可以指定多路摄像头，各路的识别事件带有 camera 字段
+int main(int argc, char *argv[])
+{
+    qRegisterMetaType<QVector<FaceOverlay>>("QVector<FaceOverlay>");
+    qRegisterMetaType<FrameFormat>("FrameFormat");
+    qRegisterMetaType<RecognitionEvent>("RecognitionEvent");
+    QCoreApplication a(argc, argv);
+
+    // 这几种模式不打开人脸库
+    if (a.arguments().contains("--detector-benchmark")) {
+        return runDetectorBenchmark(a.arguments());
+    }
+    if (a.arguments().contains("--tracker-benchmark")) {
+        return runTrackerBenchmark(a.arguments());
+    }
+    if (a.arguments().contains("--events")) {
+        return runEvents(a.arguments());
+    }
+    if (!PipelineManager::loadDatabaseKey()) return 1;
+
+    if (a.arguments().contains("--import")) {
+        return runImport(a.arguments());
+    }
+    if (a.arguments().contains("--shard")) {
+        return runShard(a.arguments());
+    }
+    if (a.arguments().contains("--benchmark")) {
+        return runBenchmark(a.arguments());
+    }
+    if (a.arguments().contains("--db-benchmark")) {
+        return runDbBenchmark(a.arguments());
+    }
+    if (a.arguments().contains("--alloc-check")) {
+        return runAllocCheck(a.arguments());
+    }
+
+    QString socketPath = qEnvironmentVariable("FR_IPC_SOCKET", "/tmp/face_recognition.sock");
+
+    PipelineManager pipelines;
+    pipelines.init();
+
+    DaemonController controller(pipelines.processors());
+    controller.setEventLog(pipelines.eventLog());
+    if (!controller.listen(socketPath)) {
+        qCritical() << "错误: 无法监听" << socketPath;
+        return 1;
+    }
+
+    for (VideoProcessor *processor : pipelines.processors()) {
+        QObject::connect(processor, &VideoProcessor::recognitionEvent, &controller, &DaemonController::onRecognitionEvent);
+        QObject::connect(processor, &VideoProcessor::statusMessage, &controller, &DaemonController::onStatusMessage);
+    }
+
+    QuitSignalNotifier quitSignal;
+
+    pipelines.start();
+    qInfo() << "人脸识别守护进程已启动，事件套接字:" << socketPath;
+    int ret = a.exec();
+
+    pipelines.stop();
+    return ret;
+}
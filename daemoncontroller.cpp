@@ -0,0 +1,218 @@
+#include "daemoncontroller.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QDebug>
+
+#define IPC_MAX_CLIENTS 8
+#define EVENTS_REPLY_LIMIT 500   // 一次 events 查询最多回复的事件数，太多时套接字发送缓冲区会满
+
+DaemonController::DaemonController(const QList<VideoProcessor *> &processors, QObject *parent)
+    : QObject(parent), m_processors(processors)
+{
+}
+
+DaemonController::~DaemonController()
+{
+    qDeleteAll(m_clientNotifiers);
+    m_clientNotifiers.clear();
+    ipc_server_destroy(m_server);
+}
+
+bool DaemonController::listen(const QString &socketPath)
+{
+    m_server = ipc_server_create(socketPath.toUtf8().constData(), IPC_MAX_CLIENTS);
+    if (!m_server) return false;
+
+    m_listenNotifier = new QSocketNotifier(ipc_server_listen_fd(m_server), QSocketNotifier::Read, this);
+    connect(m_listenNotifier, &QSocketNotifier::activated, this, &DaemonController::onNewConnection);
+    return true;
+}
+
+void DaemonController::onNewConnection()
+{
+    int fd;
+    while ((fd = ipc_server_accept(m_server)) >= 0) {
+        QSocketNotifier *notifier = new QSocketNotifier(fd, QSocketNotifier::Read);
+        connect(notifier, &QSocketNotifier::activated, this, &DaemonController::onClientReadable);
+        m_clientNotifiers.insert(fd, notifier);
+        qDebug() << "IPC 客户端已连接, fd =" << fd;
+    }
+}
+
+void DaemonController::onClientReadable(int fd)
+{
+    if (ipc_server_handle_readable(m_server, fd, &DaemonController::commandCallback, this) < 0) {
+        dropClient(fd);
+    }
+}
+
+void DaemonController::commandCallback(int clientFd, const char *line, void *userData)
+{
+    static_cast<DaemonController *>(userData)->handleCommand(clientFd, QString::fromUtf8(line).trimmed());
+}
+
+void DaemonController::handleCommand(int clientFd, const QString &line)
+{
+    if (line.isEmpty()) return;
+    QString cmd = line.section(' ', 0, 0);
+    QString arg = line.section(' ', 1).trimmed();
+
+    QJsonObject ack;
+    ack["type"] = "ack";
+    bool ok = true;
+
+    // 可选的 cam<N> 前缀
+    int camera = 0;
+    if (cmd.startsWith("cam") && cmd.size() > 3) {
+        camera = cmd.mid(3).toInt(&ok);
+        cmd = arg.section(' ', 0, 0);
+        arg = arg.section(' ', 1).trimmed();
+    }
+    VideoProcessor *processor = m_processors.value(camera);
+    ack["cmd"] = cmd;
+    ack["camera"] = camera;
+    if (!ok || !processor) {
+        ack["ok"] = false;
+        reply(clientFd, QJsonDocument(ack).toJson(QJsonDocument::Compact));
+        return;
+    }
+
+    if (cmd == "register" && !arg.isEmpty()) {
+        QMetaObject::invokeMethod(processor, "startRegistration", Qt::QueuedConnection, Q_ARG(QString, arg));
+    } else if (cmd == "delete" && !arg.isEmpty()) {
+        QMetaObject::invokeMethod(processor, "deletePerson", Qt::QueuedConnection, Q_ARG(QString, arg));
+    } else if (cmd == "clear") {
+        QMetaObject::invokeMethod(processor, "clearDatabase", Qt::QueuedConnection);
+    } else if (cmd == "brightness") {
+        int value = arg.toInt(&ok);
+        if (ok) QMetaObject::invokeMethod(processor, "setBrightness", Qt::QueuedConnection, Q_ARG(int, value));
+    } else if (cmd == "photo") {
+        QMetaObject::invokeMethod(processor, "takePhoto", Qt::QueuedConnection);
+    } else if (cmd == "events") {
+        ok = replyEvents(clientFd, arg, ack);
+    } else if (cmd == "ping") {
+        // 仅用于探活
+    } else {
+        ok = false;
+    }
+    ack["ok"] = ok;
+    reply(clientFd, QJsonDocument(ack).toJson(QJsonDocument::Compact));
+}
+
+void DaemonController::onRecognitionEvent(const RecognitionEvent &event)
+{
+    QJsonObject obj;
+    obj["type"] = "recognition";
+    obj["camera"] = event.camera;
+    obj["tracker"] = event.trackerId;
+    obj["name"] = QString::fromUtf8(face_recognizer_state_label(event.state, event.identityId));
+    obj["identity"] = event.identityId;
+    obj["score"] = event.score;
+    obj["rect"] = QJsonArray{ event.rect.x, event.rect.y, event.rect.width, event.rect.height };
+    obj["ts"] = event.timestampMs;
+    broadcast(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+}
+
+void DaemonController::onStatusMessage(const QString &message)
+{
+    // 处理线程每帧都会发状态，只转发变化
+    VideoProcessor *processor = qobject_cast<VideoProcessor *>(sender());
+    QString &last = m_lastStatus[processor];
+    if (message == last) return;
+    last = message;
+    QJsonObject obj;
+    obj["type"] = "status";
+    obj["camera"] = processor ? processor->camera() : 0;
+    obj["message"] = message;
+    broadcast(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+}
+qint64 DaemonController::parseTime(const QString &text)
+{
+    bool ok = false;
+    qint64 ms = text.toLongLong(&ok);
+    if (ok) return ms >= 0 ? ms : -1;
+    QDateTime time = QDateTime::fromString(text, Qt::ISODate);
+    return time.isValid() ? time.toMSecsSinceEpoch() : -1;
+}
+
+QJsonObject DaemonController::eventJson(const EventLog &log, const EventRecord &record)
+{
+    QJsonObject obj;
+    obj["type"] = "event";
+    obj["camera"] = record.camera;
+    obj["tracker"] = record.trackerId;
+    obj["name"] = record.state == RECOGNITION_STATE_KNOWN
+        ? QString::fromStdString(log.identityName(record.identity))
+        : QString::fromUtf8(face_recognizer_state_label((RecognitionState)record.state, FACE_IDENTITY_NONE));
+    obj["score"] = record.score;
+    obj["ts"] = (qint64)record.timestampMs;
+    obj["thumbnail"] = record.thumbnailLength > 0;
+    return obj;
+}
+
+// events <开始> <结束> [姓名]：先逐条回复事件，ack 中带回复的事件数、是否截断和查询耗时
+bool DaemonController::replyEvents(int clientFd, const QString &arg, QJsonObject &ack)
+{
+    const qint64 from = parseTime(arg.section(' ', 0, 0));
+    const qint64 to = parseTime(arg.section(' ', 1, 1));
+    const QString name = arg.section(' ', 2).trimmed();
+    if (!m_eventLog || from < 0 || to < 0) return false;
+
+    int identity = EVENT_LOG_ANY_IDENTITY;
+    if (!name.isEmpty()) {
+        identity = m_eventLog->findIdentity(name.toStdString());
+        if (identity == EVENT_LOG_NO_IDENTITY) {   // 日志中没有这个人
+            ack["count"] = 0;
+            return true;
+        }
+    }
+    QElapsedTimer timer;
+    timer.start();
+    QList<QByteArray> lines;
+    // 多取一条，用来判断是否截断
+    m_eventLog->query(from, to, identity, [&](const EventRecord &record, unsigned) {
+        lines << QJsonDocument(eventJson(*m_eventLog, record)).toJson(QJsonDocument::Compact);
+        return lines.size() <= EVENTS_REPLY_LIMIT;
+    });
+    ack["ms"] = timer.elapsed();
+    const bool truncated = lines.size() > EVENTS_REPLY_LIMIT;
+    if (truncated) lines.removeLast();
+    for (const QByteArray &line : lines) reply(clientFd, line);
+    ack["count"] = lines.size();
+    ack["truncated"] = truncated;
+    return true;
+}
+
+void DaemonController::reply(int clientFd, const QByteArray &json)
+{
+    QByteArray line = json + '\n';
+    if (ipc_server_send(m_server, clientFd, line.constData(), line.size()) < 0) {
+        dropClient(clientFd);
+    }
+}
+
+void DaemonController::broadcast(const QByteArray &json)
+{
+    if (!m_server || m_clientNotifiers.isEmpty()) return;
+    QByteArray line = json + '\n';
+    int closed[IPC_MAX_CLIENTS];
+    int n = ipc_server_broadcast(m_server, line.constData(), line.size(), closed, IPC_MAX_CLIENTS);
+    for (int i = 0; i < n && i < IPC_MAX_CLIENTS; ++i) {
+        dropClient(closed[i]);
+    }
+}
+
+void DaemonController::dropClient(int fd)
+{
+    QSocketNotifier *notifier = m_clientNotifiers.take(fd);
+    if (!notifier) return;
+    // 描述符已经在 ipc_server 中关闭，通知器需要延迟删除（可能正处于它的回调中）
+    notifier->setEnabled(false);
+    notifier->deleteLater();
+    ipc_server_close_client(m_server, fd);
+    qDebug() << "IPC 客户端已断开, fd =" << fd;
+}
@@ -0,0 +1,63 @@
+#ifndef DAEMONCONTROLLER_H
+#define DAEMONCONTROLLER_H
+
+#include "videoprocessor.h"
+
+#include <QObject>
+#include <QHash>
+#include <QJsonObject>
+#include <QSocketNotifier>
+
+extern "C" {
+#include "ipc_server.h"
+}
+
+// 无界面守护进程的控制器：通过 Unix 域套接字推送识别事件，并接收命令
+// 协议为每行一个 JSON 对象（事件）或一行文本命令：
+//   register <姓名> | delete <姓名> | clear | brightness <值> | photo | ping
+//   events <开始> <结束> [姓名]  查询事件日志，时间为毫秒时间戳或 ISO 8601（如 2024-05-01T08:00:00），
+//                               每个事件回复一行 {"type":"event",...}，最后是带 count 的 ack
+// 多路摄像头时命令前可加 cam<N> 指定摄像头，例如 "cam1 register 张三"，不加时为第一路；
+// 人脸库由各路共享，delete 和 clear 与摄像头无关
+class DaemonController : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DaemonController(const QList<VideoProcessor *> &processors, QObject *parent = nullptr);
+    ~DaemonController();
+
+    bool listen(const QString &socketPath);
+    // events 命令查询的事件日志，为 NULL 时该命令失败
+    void setEventLog(EventLog *log) { m_eventLog = log; }
+
+    // 解析时间：毫秒时间戳或 ISO 8601 日期时间，失败返回 -1
+    static qint64 parseTime(const QString &text);
+    // 事件日志中的一条事件转成 JSON
+    static QJsonObject eventJson(const EventLog &log, const EventRecord &record);
+
+public slots:
+    void onRecognitionEvent(const RecognitionEvent &event);
+    void onStatusMessage(const QString &message);   // 发送者必须是某一路的 VideoProcessor
+
+private slots:
+    void onNewConnection();
+    void onClientReadable(int fd);
+
+private:
+    static void commandCallback(int clientFd, const char *line, void *userData);
+    void handleCommand(int clientFd, const QString &line);
+    bool replyEvents(int clientFd, const QString &arg, QJsonObject &ack);
+    void reply(int clientFd, const QByteArray &json);
+    void broadcast(const QByteArray &json);
+    void dropClient(int fd);
+
+    QList<VideoProcessor *> m_processors;
+    EventLog *m_eventLog = nullptr;
+    IpcServer *m_server = nullptr;
+    QSocketNotifier *m_listenNotifier = nullptr;
+    QHash<int, QSocketNotifier *> m_clientNotifiers;
+    QHash<QObject *, QString> m_lastStatus;   // 每路最后一次转发的状态
+};
+
+#endif // DAEMONCONTROLLER_H
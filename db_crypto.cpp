@@ -0,0 +1,387 @@
+#include "db_crypto.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// ChaCha20 的4个块并行计算：向量的第 i 个分量属于第 i 个块，16个向量是16个状态字
+#if !defined(FR_DB_CRYPTO_SCALAR) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+
+typedef uint32x4_t U32x4;
+static inline U32x4 vecSet(uint32_t x) { return vdupq_n_u32(x); }
+static inline U32x4 vecLoad(const uint32_t *p) { return vld1q_u32(p); }
+static inline U32x4 vecAdd(U32x4 a, U32x4 b) { return vaddq_u32(a, b); }
+static inline U32x4 vecXor(U32x4 a, U32x4 b) { return veorq_u32(a, b); }
+template <int N> static inline U32x4 vecRotl(U32x4 x) { return vsriq_n_u32(vshlq_n_u32(x, N), x, 32 - N); }
+template <> inline U32x4 vecRotl<16>(U32x4 x) { return vreinterpretq_u32_u16(vrev32q_u16(vreinterpretq_u16_u32(x))); }
+// 4x4 转置：之后 a、b、c、d 依次是第 0、1、2、3 个块的这4个字
+static inline void vecTranspose(U32x4 &a, U32x4 &b, U32x4 &c, U32x4 &d)
+{
+    const uint32x4x2_t ab = vtrnq_u32(a, b);
+    const uint32x4x2_t cd = vtrnq_u32(c, d);
+    a = vcombine_u32(vget_low_u32(ab.val[0]), vget_low_u32(cd.val[0]));
+    b = vcombine_u32(vget_low_u32(ab.val[1]), vget_low_u32(cd.val[1]));
+    c = vcombine_u32(vget_high_u32(ab.val[0]), vget_high_u32(cd.val[0]));
+    d = vcombine_u32(vget_high_u32(ab.val[1]), vget_high_u32(cd.val[1]));
+}
+// p 处的 16 字节与 x 异或
+static inline void vecXorInto(uint8_t *p, U32x4 x)
+{
+    vst1q_u8(p, veorq_u8(vld1q_u8(p), vreinterpretq_u8_u32(x)));
+}
+
+#elif !defined(FR_DB_CRYPTO_SCALAR) && defined(__SSE2__)
+#include <emmintrin.h>
+
+typedef __m128i U32x4;
+static inline U32x4 vecSet(uint32_t x) { return _mm_set1_epi32((int)x); }
+static inline U32x4 vecLoad(const uint32_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline U32x4 vecAdd(U32x4 a, U32x4 b) { return _mm_add_epi32(a, b); }
+static inline U32x4 vecXor(U32x4 a, U32x4 b) { return _mm_xor_si128(a, b); }
+template <int N> static inline U32x4 vecRotl(U32x4 x) { return _mm_or_si128(_mm_slli_epi32(x, N), _mm_srli_epi32(x, 32 - N)); }
+static inline void vecTranspose(U32x4 &a, U32x4 &b, U32x4 &c, U32x4 &d)
+{
+    const __m128i t0 = _mm_unpacklo_epi32(a, b);
+    const __m128i t1 = _mm_unpacklo_epi32(c, d);
+    const __m128i t2 = _mm_unpackhi_epi32(a, b);
+    const __m128i t3 = _mm_unpackhi_epi32(c, d);
+    a = _mm_unpacklo_epi64(t0, t1);
+    b = _mm_unpackhi_epi64(t0, t1);
+    c = _mm_unpacklo_epi64(t2, t3);
+    d = _mm_unpackhi_epi64(t2, t3);
+}
+static inline void vecXorInto(uint8_t *p, U32x4 x)
+{
+    _mm_storeu_si128((__m128i *)p, _mm_xor_si128(_mm_loadu_si128((const __m128i *)p), x));
+}
+
+#else
+// 标量实现，逐分量做与向量版本相同的运算
+struct U32x4 { uint32_t v[4]; };
+static inline U32x4 vecSet(uint32_t x) { U32x4 r = {{x, x, x, x}}; return r; }
+static inline U32x4 vecLoad(const uint32_t *p) { U32x4 r = {{p[0], p[1], p[2], p[3]}}; return r; }
+static inline U32x4 vecAdd(U32x4 a, U32x4 b) { for (int i = 0; i < 4; ++i) a.v[i] += b.v[i]; return a; }
+static inline U32x4 vecXor(U32x4 a, U32x4 b) { for (int i = 0; i < 4; ++i) a.v[i] ^= b.v[i]; return a; }
+template <int N> static inline U32x4 vecRotl(U32x4 x)
+{
+    for (int i = 0; i < 4; ++i) x.v[i] = (x.v[i] << N) | (x.v[i] >> (32 - N));
+    return x;
+}
+static inline void vecTranspose(U32x4 &a, U32x4 &b, U32x4 &c, U32x4 &d)
+{
+    U32x4 *rows[4] = {&a, &b, &c, &d};
+    for (int i = 0; i < 4; ++i) {
+        for (int j = i + 1; j < 4; ++j) {
+            const uint32_t t = rows[i]->v[j];
+            rows[i]->v[j] = rows[j]->v[i];
+            rows[j]->v[i] = t;
+        }
+    }
+}
+static inline void vecXorInto(uint8_t *p, U32x4 x)
+{
+    uint32_t w[4];
+    memcpy(w, p, 16);
+    for (int i = 0; i < 4; ++i) w[i] ^= x.v[i];
+    memcpy(p, w, 16);
+}
+#endif
+
+namespace {
+
+const size_t CHACHA_BLOCK = 64;
+const size_t CHACHA_PARALLEL = 4 * CHACHA_BLOCK;
+
+inline uint32_t load32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline void store32(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+inline void store64(uint8_t *p, uint64_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+inline void quarterRound(U32x4 &a, U32x4 &b, U32x4 &c, U32x4 &d)
+{
+    a = vecAdd(a, b); d = vecRotl<16>(vecXor(d, a));
+    c = vecAdd(c, d); b = vecRotl<12>(vecXor(b, c));
+    a = vecAdd(a, b); d = vecRotl<8>(vecXor(d, a));
+    c = vecAdd(c, d); b = vecRotl<7>(vecXor(b, c));
+}
+
+// 以 state[12] 为起始块号的连续4个块的密钥流与 data 的 256 字节异或
+void chachaBlocks4(const uint32_t state[16], uint8_t *data)
+{
+    static const uint32_t increments[4] = {0, 1, 2, 3};
+    U32x4 input[16], x[16];
+    for (int i = 0; i < 16; ++i) input[i] = vecSet(state[i]);
+    input[12] = vecAdd(input[12], vecLoad(increments));
+    for (int i = 0; i < 16; ++i) x[i] = input[i];
+
+    for (int round = 0; round < 10; ++round) {
+        quarterRound(x[0], x[4], x[8], x[12]);
+        quarterRound(x[1], x[5], x[9], x[13]);
+        quarterRound(x[2], x[6], x[10], x[14]);
+        quarterRound(x[3], x[7], x[11], x[15]);
+        quarterRound(x[0], x[5], x[10], x[15]);
+        quarterRound(x[1], x[6], x[11], x[12]);
+        quarterRound(x[2], x[7], x[8], x[13]);
+        quarterRound(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; ++i) x[i] = vecAdd(x[i], input[i]);
+
+    // 每4个状态字转置一次，得到4个块各自的 16 字节
+    for (int g = 0; g < 4; ++g) {
+        U32x4 *w = x + 4 * g;
+        vecTranspose(w[0], w[1], w[2], w[3]);
+        for (int b = 0; b < 4; ++b) vecXorInto(data + b * CHACHA_BLOCK + 16 * g, w[b]);
+    }
+}
+
+// Poly1305，26 位一个 limb（poly1305-donna 的 32 位版本）
+class Poly1305
+{
+public:
+    explicit Poly1305(const uint8_t key[32])
+    {
+        r[0] = load32(key + 0) & 0x3ffffff;
+        r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+        r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+        r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+        r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+        for (int i = 0; i < 4; ++i) pad[i] = load32(key + 16 + 4 * i);
+    }
+    ~Poly1305()
+    {
+        dbWipe(r, sizeof(r));
+        dbWipe(pad, sizeof(pad));
+    }
+
+    // 按 16 字节的块累加，不足一块的末尾补零（AEAD 构造中 aad 和密文都这样补齐）
+    void updatePadded(const uint8_t *m, size_t length)
+    {
+        const size_t full = length & ~(size_t)15;
+        blocks(m, full);
+        if (length > full) {
+            uint8_t last[16] = {0};
+            memcpy(last, m + full, length - full);
+            blocks(last, 16);
+        }
+    }
+
+    void finish(uint8_t tag[16])
+    {
+        uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+        uint32_t c = h1 >> 26; h1 &= 0x3ffffff;
+        h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+        h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+        h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+
+        // 计算 h - p，不小于 p 时取差值；不用分支，耗时与数据无关
+        uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+        uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+        uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+        uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+        uint32_t g4 = h4 + c - (1UL << 26);
+        uint32_t mask = (g4 >> 31) - 1;
+        g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+        mask = ~mask;
+        h0 = (h0 & mask) | g0;
+        h1 = (h1 & mask) | g1;
+        h2 = (h2 & mask) | g2;
+        h3 = (h3 & mask) | g3;
+        h4 = (h4 & mask) | g4;
+
+        h0 = h0 | (h1 << 26);
+        h1 = (h1 >> 6) | (h2 << 20);
+        h2 = (h2 >> 12) | (h3 << 14);
+        h3 = (h3 >> 18) | (h4 << 8);
+
+        uint64_t f = (uint64_t)h0 + pad[0]; store32(tag + 0, (uint32_t)f);
+        f = (uint64_t)h1 + pad[1] + (f >> 32); store32(tag + 4, (uint32_t)f);
+        f = (uint64_t)h2 + pad[2] + (f >> 32); store32(tag + 8, (uint32_t)f);
+        f = (uint64_t)h3 + pad[3] + (f >> 32); store32(tag + 12, (uint32_t)f);
+    }
+
+private:
+    void blocks(const uint8_t *m, size_t length)
+    {
+        const uint32_t r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3], r4 = r[4];
+        const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+        uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+        for (; length >= 16; m += 16, length -= 16) {
+            h0 += load32(m + 0) & 0x3ffffff;
+            h1 += (load32(m + 3) >> 2) & 0x3ffffff;
+            h2 += (load32(m + 6) >> 4) & 0x3ffffff;
+            h3 += (load32(m + 9) >> 6) & 0x3ffffff;
+            h4 += (load32(m + 12) >> 8) | (1UL << 24);
+
+            const uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+            uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+            uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+            uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+            uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+            uint32_t c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+            d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+            d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+            d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+            d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+            h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+            h1 += c;
+        }
+        h[0] = h0; h[1] = h1; h[2] = h2; h[3] = h3; h[4] = h4;
+    }
+
+    uint32_t r[5];
+    uint32_t h[5] = {0, 0, 0, 0, 0};
+    uint32_t pad[4];
+};
+
+// RFC 8439 2.8：块0的密钥流的前 32 字节作为 Poly1305 的一次性密钥，之后对 aad、密文和两者的长度计算标签
+void computeTag(const uint8_t key[DB_KEY_BYTES], const uint8_t nonce[DB_NONCE_BYTES],
+                const uint8_t *aad, size_t aadLength, const uint8_t *cipher, size_t length, uint8_t tag[DB_TAG_BYTES])
+{
+    uint8_t polyKey[CHACHA_BLOCK] = {0};
+    dbChaCha20(key, nonce, 0, polyKey, sizeof(polyKey));
+    Poly1305 poly(polyKey);
+    dbWipe(polyKey, sizeof(polyKey));
+    poly.updatePadded(aad, aadLength);
+    poly.updatePadded(cipher, length);
+    uint8_t lengths[16];
+    store64(lengths, aadLength);
+    store64(lengths + 8, length);
+    poly.updatePadded(lengths, sizeof(lengths));
+    poly.finish(tag);
+}
+
+} // namespace
+
+void dbChaCha20(const uint8_t key[DB_KEY_BYTES], const uint8_t nonce[DB_NONCE_BYTES], uint32_t counter,
+                uint8_t *data, size_t length)
+{
+    uint32_t state[16] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+    for (int i = 0; i < 8; ++i) state[4 + i] = load32(key + 4 * i);
+    state[12] = counter;
+    for (int i = 0; i < 3; ++i) state[13 + i] = load32(nonce + 4 * i);
+
+    for (; length >= CHACHA_PARALLEL; data += CHACHA_PARALLEL, length -= CHACHA_PARALLEL) {
+        chachaBlocks4(state, data);
+        state[12] += 4;
+    }
+    if (length > 0) {
+        // 不足4块的末尾：在临时缓冲区里算出密钥流再异或
+        uint8_t tail[CHACHA_PARALLEL];
+        memcpy(tail, data, length);
+        chachaBlocks4(state, tail);
+        memcpy(data, tail, length);
+        dbWipe(tail, sizeof(tail));
+    }
+    dbWipe(state, sizeof(state));
+}
+
+void dbSeal(const uint8_t key[DB_KEY_BYTES], const uint8_t nonce[DB_NONCE_BYTES],
+            const uint8_t *aad, size_t aadLength, uint8_t *data, size_t length, uint8_t tag[DB_TAG_BYTES])
+{
+    dbChaCha20(key, nonce, 1, data, length);
+    computeTag(key, nonce, aad, aadLength, data, length, tag);
+}
+
+bool dbOpen(const uint8_t key[DB_KEY_BYTES], const uint8_t nonce[DB_NONCE_BYTES],
+            const uint8_t *aad, size_t aadLength, uint8_t *data, size_t length, const uint8_t tag[DB_TAG_BYTES])
+{
+    uint8_t expected[DB_TAG_BYTES];
+    computeTag(key, nonce, aad, aadLength, data, length, expected);
+    // 逐字节累积差异，比较耗时与标签内容无关
+    uint8_t diff = 0;
+    for (size_t i = 0; i < DB_TAG_BYTES; ++i) diff |= expected[i] ^ tag[i];
+    if (diff != 0) return false;
+    dbChaCha20(key, nonce, 1, data, length);
+    return true;
+}
+
+bool dbRandom(void *data, size_t length)
+{
+    const int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    uint8_t *p = static_cast<uint8_t *>(data);
+    while (length > 0) {
+        const ssize_t n = read(fd, p, length);
+        if (n <= 0) {
+            close(fd);
+            return false;
+        }
+        p += n;
+        length -= n;
+    }
+    close(fd);
+    return true;
+}
+
+void dbWipe(void *data, size_t length)
+{
+    volatile uint8_t *p = static_cast<volatile uint8_t *>(data);
+    while (length--) *p++ = 0;
+}
+
+LockedBuffer::~LockedBuffer()
+{
+    if (!m_data) return;
+    dbWipe(m_data, m_capacity);
+    munlock(m_data, m_capacity);
+    munmap(m_data, m_capacity);
+}
+
+bool LockedBuffer::resize(size_t size)
+{
+    if (size <= m_capacity) {
+        // 缩小时清掉不再使用的部分，放大时那部分已经是零
+        if (size < m_size) dbWipe(m_data + size, m_size - size);
+        m_size = size;
+        return true;
+    }
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t capacity = m_capacity ? m_capacity : page;
+    while (capacity < size) capacity *= 2;
+    void *p = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return false;
+    if (mlock(p, capacity) != 0) {
+        static bool warned = false;
+        if (!warned) perror("DB crypto: mlock (decrypted records may be swapped out)");
+        warned = true;
+    }
+#ifdef MADV_DONTDUMP
+    madvise(p, capacity, MADV_DONTDUMP);
+#endif
+    uint8_t *data = static_cast<uint8_t *>(p);
+    if (m_data) {
+        memcpy(data, m_data, m_size);
+        dbWipe(m_data, m_capacity);
+        munlock(m_data, m_capacity);
+        munmap(m_data, m_capacity);
+    }
+    m_data = data;
+    m_capacity = capacity;
+    m_size = size;
+    return true;
+}
+
+void LockedBuffer::clear()
+{
+    if (m_data) dbWipe(m_data, m_size);
+    m_size = 0;
+}
@@ -0,0 +1,66 @@
+#ifndef DB_CRYPTO_H
+#define DB_CRYPTO_H
+
+#include <cstddef>
+#include <cstdint>
+
+// 人脸库加密用的 ChaCha20-Poly1305（RFC 8439 的 AEAD 构造）和存放明文的锁定内存。
+// i.MX6ULL 的 Cortex-A7 没有 AES 指令，ChaCha20 只用加法、异或和移位，NEON 上一次并行算4个块；
+// x86 上用 SSE2，其他平台（或定义 FR_DB_CRYPTO_SCALAR）退回标量实现，结果相同。Poly1305 用 26 位分limb的标量实现，
+// 32 位 ARM 上只需要 32x32->64 的乘法。只支持小端平台。
+
+const size_t DB_KEY_BYTES = 32;
+const size_t DB_NONCE_BYTES = 12;
+const size_t DB_TAG_BYTES = 16;
+
+/**
+ * @brief 用 ChaCha20 的密钥流与 data 异或（加密和解密相同），counter 为第一个 64 字节块的块号。
+ */
+void dbChaCha20(const uint8_t key[DB_KEY_BYTES], const uint8_t nonce[DB_NONCE_BYTES], uint32_t counter,
+                uint8_t *data, size_t length);
+
+/**
+ * @brief 原地加密 data，并对 aad 和密文计算认证标签。同一个密钥下 nonce 绝不能重复使用。
+ */
+void dbSeal(const uint8_t key[DB_KEY_BYTES], const uint8_t nonce[DB_NONCE_BYTES],
+            const uint8_t *aad, size_t aadLength, uint8_t *data, size_t length, uint8_t tag[DB_TAG_BYTES]);
+
+/**
+ * @brief 先校验标签，通过后才原地解密 data；密文或 aad 被改动、密钥不对时返回 false，data 保持密文不变。
+ */
+bool dbOpen(const uint8_t key[DB_KEY_BYTES], const uint8_t nonce[DB_NONCE_BYTES],
+            const uint8_t *aad, size_t aadLength, uint8_t *data, size_t length, const uint8_t tag[DB_TAG_BYTES]);
+
+// 从 /dev/urandom 读取随机字节
+bool dbRandom(void *data, size_t length);
+
+// 清零，编译器不会因为之后不再读这块内存而把它优化掉
+void dbWipe(void *data, size_t length);
+
+// 存放密钥和解密出来的记录的缓冲区：mlock 锁在内存中不会被换出，不进入 core dump，释放和扩容时先清零。
+// 锁定失败（RLIMIT_MEMLOCK 太小）时仍然可用，只是不保证不被换出
+class LockedBuffer
+{
+public:
+    LockedBuffer() {}
+    explicit LockedBuffer(size_t size) { resize(size); }
+    ~LockedBuffer();
+    LockedBuffer(const LockedBuffer &) = delete;
+    LockedBuffer &operator=(const LockedBuffer &) = delete;
+
+    // 改变大小，保留原有内容；容量按页分配，只增不减
+    bool resize(size_t size);
+    // 清零内容并把大小置0，保留容量
+    void clear();
+
+    uint8_t *data() { return m_data; }
+    const uint8_t *data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_capacity = 0;
+};
+
+#endif // DB_CRYPTO_H
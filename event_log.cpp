@@ -0,0 +1,573 @@
+#include "event_log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char SEGMENT_MAGIC[8] = {'F', 'R', 'E', 'V', 'L', 'O', 'G', '1'};
+const uint32_t SEGMENT_VERSION = 1;
+const size_t SEGMENT_HEADER_BYTES = 128;   // 段头占用的空间，留出以后扩展的余量
+const size_t MIN_SEGMENT_BYTES = 64 * 1024;
+const size_t QUEUE_CAPACITY = 256;         // 写线程最多落后的事件数，超过时丢弃新事件
+const uint64_t MAX_THUMBNAIL_BYTES = 0x7fffffff;   // 每段 .thumbs 文件的上限，32位系统上 off_t 也放得下
+
+// 段头，后面依次是稀疏索引和记录
+struct SegmentHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t capacity;          // 记录数上限，EVENT_LOG_BLOCK_RECORDS 的倍数
+    uint32_t count;             // 已提交的记录数，每次提交最后写
+    uint32_t indexOffset;
+    uint32_t recordsOffset;
+    int64_t minTs, maxTs;       // 已提交记录的时间范围
+    uint64_t identityBits;      // 已提交记录的身份位图
+    uint64_t thumbnailBytes;    // .thumbs 文件中已提交的字节数
+};
+
+// 稀疏索引项：一块记录的时间范围和身份位图
+struct IndexEntry {
+    int64_t minTs, maxTs;
+    uint64_t identityBits;
+};
+
+static_assert(sizeof(EventRecord) == 32, "EventRecord is the on-disk record format");
+static_assert(sizeof(IndexEntry) == 24, "IndexEntry is part of the on-disk format");
+static_assert(sizeof(SegmentHeader) <= SEGMENT_HEADER_BYTES, "segment header too large");
+
+// 身份位图中每个身份占 编号 % 64 这一位，未知的人（-1）占最高位
+inline uint64_t identityBit(int identity)
+{
+    return 1ULL << ((unsigned)identity & 63);
+}
+
+// 按段文件大小安排索引和记录的位置，记录数取能放下的最多整块
+bool segmentLayout(size_t bytes, SegmentHeader &h)
+{
+    const size_t blockBytes = EVENT_LOG_BLOCK_RECORDS * sizeof(EventRecord) + sizeof(IndexEntry);
+    for (size_t blocks = (bytes - SEGMENT_HEADER_BYTES) / blockBytes; blocks > 0; --blocks) {
+        const size_t indexEnd = SEGMENT_HEADER_BYTES + blocks * sizeof(IndexEntry);
+        const size_t recordsOffset = (indexEnd + sizeof(EventRecord) - 1) / sizeof(EventRecord) * sizeof(EventRecord);
+        if (recordsOffset + blocks * EVENT_LOG_BLOCK_RECORDS * sizeof(EventRecord) <= bytes) {
+            h.capacity = (uint32_t)(blocks * EVENT_LOG_BLOCK_RECORDS);
+            h.indexOffset = (uint32_t)SEGMENT_HEADER_BYTES;
+            h.recordsOffset = (uint32_t)recordsOffset;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool validHeader(const SegmentHeader &h, uint64_t fileSize)
+{
+    return memcmp(h.magic, SEGMENT_MAGIC, sizeof(h.magic)) == 0 && h.version == SEGMENT_VERSION
+        && h.recordSize == sizeof(EventRecord) && h.count <= h.capacity
+        && h.capacity % EVENT_LOG_BLOCK_RECORDS == 0 && h.indexOffset >= sizeof(SegmentHeader)
+        && h.indexOffset + (uint64_t)h.capacity / EVENT_LOG_BLOCK_RECORDS * sizeof(IndexEntry) <= h.recordsOffset
+        && h.recordsOffset + (uint64_t)h.capacity * sizeof(EventRecord) <= fileSize;
+}
+
+// msync 要求起点按页对齐
+bool syncRange(char *base, size_t begin, size_t end)
+{
+    if (end <= begin) return true;
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    begin -= begin % page;
+    return msync(base + begin, end - begin, MS_SYNC) == 0;
+}
+
+} // namespace
+
+EventLog::EventLog(const std::string &dir, const Options &options)
+    : m_dir(dir)
+    , m_options(options)
+    , m_queue(QUEUE_CAPACITY)
+    , m_batch(QUEUE_CAPACITY)
+{
+}
+
+EventLog::~EventLog()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exiting = true;
+    }
+    m_wake.notify_one();
+    if (m_writer.joinable()) m_writer.join();
+    closeSegment();
+}
+
+std::unique_ptr<EventLog> EventLog::open(const std::string &dir, const Options &options, std::string *error)
+{
+    Options opts = options;
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    opts.segmentBytes = (std::max(opts.segmentBytes, MIN_SEGMENT_BYTES) + page - 1) / page * page;
+    opts.maxSegments = std::max(opts.maxSegments, 2);
+    opts.commitIntervalMs = std::max(opts.commitIntervalMs, 0);
+
+    if (!opts.readOnly && mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        if (error) *error = dir + ": " + strerror(errno);
+        return nullptr;
+    }
+    std::unique_ptr<EventLog> log(new EventLog(dir, opts));
+    if (!log->scanSegments(error)) return nullptr;
+    log->loadIdentities();
+    if (!opts.readOnly) {
+        // 上次写到一半的名字作废（引用它的记录不会已经提交）
+        if (truncate((dir + "/identities").c_str(), (off_t)log->m_identitiesRead) != 0 && errno != ENOENT) {
+            if (error) *error = dir + "/identities: " + strerror(errno);
+            return nullptr;
+        }
+        log->m_namesPersisted = log->m_names.size();
+        // 最后一段没写满就接着写，否则第一次提交时开新段
+        if (!log->m_segments.empty()) log->resumeSegment(log->m_segments.back());
+        log->m_writer = std::thread(&EventLog::writerLoop, log.get());
+    }
+    return log;
+}
+
+std::string EventLog::segmentPath(unsigned seq, const char *suffix) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/events-%08u%s", seq, suffix);
+    return m_dir + name;
+}
+
+// 列出目录中的段文件，按序号排序
+bool EventLog::scanSegments(std::string *error) const
+{
+    DIR *d = opendir(m_dir.c_str());
+    if (!d) {
+        if (error) *error = m_dir + ": " + strerror(errno);
+        return false;
+    }
+    std::vector<unsigned> segments;
+    while (struct dirent *entry = readdir(d)) {
+        unsigned seq = 0;
+        int end = 0;
+        if (sscanf(entry->d_name, "events-%u.log%n", &seq, &end) == 1 && end > 0 && entry->d_name[end] == '\0') {
+            segments.push_back(seq);
+        }
+    }
+    closedir(d);
+    std::sort(segments.begin(), segments.end());
+    m_segments.swap(segments);
+    return true;
+}
+
+// 读入 identities 文件中还没读过的完整行，每行一个名字，行号即编号
+void EventLog::loadIdentities() const
+{
+    const int fd = ::open((m_dir + "/identities").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    std::string data;
+    char buf[4096];
+    ssize_t n;
+    off_t pos = (off_t)m_identitiesRead;
+    while ((n = pread(fd, buf, sizeof(buf), pos)) > 0) {
+        data.append(buf, n);
+        pos += n;
+    }
+    close(fd);
+
+    size_t start = 0, end;
+    while ((end = data.find('\n', start)) != std::string::npos) {
+        m_names.push_back(data.substr(start, end - start));
+        m_nameIds.emplace(m_names.back(), (int)m_names.size() - 1);
+        start = end + 1;
+    }
+    m_identitiesRead += start;
+}
+
+int EventLog::identity(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_options.readOnly) loadIdentities();
+    auto it = m_nameIds.find(name);
+    if (it != m_nameIds.end()) return it->second;
+    if (m_options.readOnly || name.empty() || name.find('\n') != std::string::npos) return EVENT_LOG_NO_IDENTITY;
+
+    const int id = (int)m_names.size();
+    m_names.push_back(name);
+    m_nameIds.emplace(name, id);
+    return id;
+}
+
+int EventLog::findIdentity(const std::string &name) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_options.readOnly) loadIdentities();
+    auto it = m_nameIds.find(name);
+    return it != m_nameIds.end() ? it->second : EVENT_LOG_NO_IDENTITY;
+}
+
+std::string EventLog::identityName(int identity) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_options.readOnly && identity >= (int)m_names.size()) loadIdentities();
+    return identity >= 0 && identity < (int)m_names.size() ? m_names[identity] : std::string();
+}
+
+bool EventLog::append(const EventRecord &record, const void *thumbnail, size_t thumbnailLength)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_options.readOnly || m_exiting) return false;
+    if (m_queueCount == m_queue.size()) {
+        m_stats.dropped++;
+        return false;
+    }
+    Pending &p = m_queue[(m_queueHead + m_queueCount) % m_queue.size()];
+    p.record = record;
+    p.record.thumbnailOffset = 0;
+    p.record.thumbnailLength = 0;
+    const unsigned char *bytes = static_cast<const unsigned char *>(thumbnail);
+    p.thumbnail.assign(bytes, bytes + (bytes ? thumbnailLength : 0));   // 容量够时不分配
+    m_queueCount++;
+    m_stats.appended++;
+    m_wake.notify_one();
+    return true;
+}
+
+void EventLog::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_writer.joinable()) return;
+    const uint64_t target = m_stats.appended;
+    m_flushRequested = true;
+    m_wake.notify_one();
+    m_committedCv.wait(lock, [&] { return m_stats.committed >= target; });
+}
+
+EventLog::Stats EventLog::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats s = m_stats;
+    s.segments = (int)m_segments.size();
+    return s;
+}
+
+// 写线程：取走队列中的全部事件作为一组，写入后一次提交。距上一次提交不满 commitIntervalMs 时先继续攒，
+// flush、退出或队列满时立即提交
+void EventLog::writerLoop()
+{
+    const std::chrono::milliseconds interval(m_options.commitIntervalMs);
+    std::chrono::steady_clock::time_point lastCommit;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_wake.wait(lock, [this] { return m_exiting || m_queueCount > 0; });
+        if (m_queueCount == 0) break;   // 正在退出且队列已空
+        m_wake.wait_until(lock, lastCommit + interval, [this] {
+            return m_exiting || m_flushRequested || m_queueCount == m_queue.size();
+        });
+
+        const size_t n = m_queueCount;
+        for (size_t i = 0; i < n; ++i) std::swap(m_batch[i], m_queue[(m_queueHead + i) % m_queue.size()]);
+        m_queueHead = (m_queueHead + n) % m_queue.size();
+        m_queueCount = 0;
+        m_flushRequested = false;
+        const std::vector<std::string> names(m_names.begin() + m_namesPersisted, m_names.end());
+        m_namesPersisted = m_names.size();
+        lock.unlock();
+
+        writeIdentities(names);
+        writeBatch(n);
+        lastCommit = std::chrono::steady_clock::now();
+
+        lock.lock();
+        m_stats.committed += n;
+        m_stats.commits++;
+        m_committedCv.notify_all();
+    }
+}
+
+// 新分配的身份追加到 identities 文件，在引用它们的记录提交之前落盘
+void EventLog::writeIdentities(const std::vector<std::string> &names)
+{
+    if (names.empty()) return;
+    std::string data;
+    for (const std::string &name : names) data += name + '\n';
+    const std::string path = m_dir + "/identities";
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0 || write(fd, data.data(), data.size()) != (ssize_t)data.size() || fdatasync(fd) != 0) {
+        fprintf(stderr, "Event log: cannot write %s: %s\n", path.c_str(), strerror(errno));
+    }
+    if (fd >= 0) close(fd);
+}
+
+void EventLog::writeBatch(size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        SegmentHeader *h = reinterpret_cast<SegmentHeader *>(m_active.base);
+        if (h && m_active.count == h->capacity) {
+            commitSegment();
+            closeSegment();
+        }
+        if (!m_active.base && !startSegment()) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.writeErrors += n - i;
+            return;
+        }
+        h = reinterpret_cast<SegmentHeader *>(m_active.base);
+
+        EventRecord r = m_batch[i].record;
+        const std::vector<unsigned char> &thumbnail = m_batch[i].thumbnail;
+        if (!thumbnail.empty() && m_active.thumbnailBytes + thumbnail.size() <= MAX_THUMBNAIL_BYTES
+            && pwrite(m_active.thumbFd, thumbnail.data(), thumbnail.size(), (off_t)m_active.thumbnailBytes)
+               == (ssize_t)thumbnail.size()) {
+            r.thumbnailOffset = (uint32_t)m_active.thumbnailBytes;
+            r.thumbnailLength = (uint32_t)thumbnail.size();
+            m_active.thumbnailBytes += thumbnail.size();
+            m_active.thumbnailsDirty = true;
+        }
+
+        const uint32_t k = m_active.count;
+        const uint64_t bit = identityBit(r.identity);
+        IndexEntry &block = reinterpret_cast<IndexEntry *>(m_active.base + h->indexOffset)[k / EVENT_LOG_BLOCK_RECORDS];
+        if (k % EVENT_LOG_BLOCK_RECORDS == 0) {
+            block.minTs = block.maxTs = r.timestampMs;
+            block.identityBits = bit;
+        } else {
+            block.minTs = std::min(block.minTs, r.timestampMs);
+            block.maxTs = std::max(block.maxTs, r.timestampMs);
+            block.identityBits |= bit;
+        }
+        reinterpret_cast<EventRecord *>(m_active.base + h->recordsOffset)[k] = r;
+        m_active.minTs = std::min(m_active.minTs, r.timestampMs);
+        m_active.maxTs = std::max(m_active.maxTs, r.timestampMs);
+        m_active.identityBits |= bit;
+        m_active.count = k + 1;
+    }
+    commitSegment();
+}
+
+// 提交当前段新写的记录：缩略图、索引和记录先落盘，最后才更新段头
+void EventLog::commitSegment()
+{
+    SegmentHeader *h = reinterpret_cast<SegmentHeader *>(m_active.base);
+    if (!h || m_active.count == h->count) return;
+
+    bool ok = true;
+    if (m_active.thumbnailsDirty) {
+        ok = fdatasync(m_active.thumbFd) == 0;
+        m_active.thumbnailsDirty = false;
+    }
+    const size_t firstBlock = h->count / EVENT_LOG_BLOCK_RECORDS;
+    const size_t endBlock = (m_active.count + EVENT_LOG_BLOCK_RECORDS - 1) / EVENT_LOG_BLOCK_RECORDS;
+    ok = syncRange(m_active.base, h->indexOffset + firstBlock * sizeof(IndexEntry),
+                   h->indexOffset + endBlock * sizeof(IndexEntry)) && ok;
+    ok = syncRange(m_active.base, h->recordsOffset + (size_t)h->count * sizeof(EventRecord),
+                   h->recordsOffset + (size_t)m_active.count * sizeof(EventRecord)) && ok;
+
+    h->minTs = m_active.minTs;
+    h->maxTs = m_active.maxTs;
+    h->identityBits = m_active.identityBits;
+    h->thumbnailBytes = m_active.thumbnailBytes;
+    std::atomic_thread_fence(std::memory_order_release);   // 记录数最后写，同时查询的线程不会看到没写完的段头
+    h->count = m_active.count;
+    ok = syncRange(m_active.base, 0, sizeof(SegmentHeader)) && ok;
+    if (!ok) {
+        fprintf(stderr, "Event log: cannot sync %s: %s\n", segmentPath(m_active.seq, ".log").c_str(), strerror(errno));
+    }
+}
+
+// 新建下一段并映射；段数超过上限时删除最旧的段
+bool EventLog::startSegment()
+{
+    unsigned seq;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        seq = m_segments.empty() ? 1 : m_segments.back() + 1;
+    }
+    SegmentHeader h;
+    memset(&h, 0, sizeof(h));
+    if (!segmentLayout(m_options.segmentBytes, h)) return false;
+    memcpy(h.magic, SEGMENT_MAGIC, sizeof(h.magic));
+    h.version = SEGMENT_VERSION;
+    h.recordSize = sizeof(EventRecord);
+    h.minTs = INT64_MAX;
+    h.maxTs = INT64_MIN;
+
+    const std::string path = segmentPath(seq, ".log");
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    const int thumbFd = ::open(segmentPath(seq, ".thumbs").c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    // 预先分配整段的空间：稀疏文件在磁盘满时写映射会收到 SIGBUS
+    int err = fd < 0 || thumbFd < 0 ? errno : posix_fallocate(fd, 0, (off_t)m_options.segmentBytes);
+    void *base = MAP_FAILED;
+    if (!err) {
+        base = mmap(nullptr, m_options.segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) err = errno;
+    }
+    if (err) {
+        fprintf(stderr, "Event log: cannot create %s: %s\n", path.c_str(), strerror(err));
+        if (fd >= 0) close(fd);
+        if (thumbFd >= 0) close(thumbFd);
+        unlink(path.c_str());
+        unlink(segmentPath(seq, ".thumbs").c_str());
+        return false;
+    }
+    memcpy(base, &h, sizeof(h));
+    syncRange(static_cast<char *>(base), 0, sizeof(h));
+
+    m_active = ActiveSegment();
+    m_active.seq = seq;
+    m_active.fd = fd;
+    m_active.thumbFd = thumbFd;
+    m_active.base = static_cast<char *>(base);
+    m_active.size = m_options.segmentBytes;
+    m_active.minTs = h.minTs;
+    m_active.maxTs = h.maxTs;
+
+    std::vector<unsigned> expired;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_segments.push_back(seq);
+        while ((int)m_segments.size() > m_options.maxSegments) {
+            expired.push_back(m_segments.front());
+            m_segments.erase(m_segments.begin());
+        }
+    }
+    // 正在被查询的段删除后映射仍然有效
+    for (unsigned old : expired) {
+        unlink(segmentPath(old, ".log").c_str());
+        unlink(segmentPath(old, ".thumbs").c_str());
+    }
+    return true;
+}
+
+// 重新打开最后一段接着写：段头之后未提交的记录作废，缩略图文件截到已提交的长度，
+// 最后一块的索引项按已提交的记录重算。段已写满或无法使用时返回 false，之后开新段
+bool EventLog::resumeSegment(unsigned seq)
+{
+    const std::string path = segmentPath(seq, ".log");
+    const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < SEGMENT_HEADER_BYTES) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    void *base = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    SegmentHeader *h = static_cast<SegmentHeader *>(base);
+    const int thumbFd = validHeader(*h, st.st_size) && h->count < h->capacity
+        ? ::open(segmentPath(seq, ".thumbs").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644) : -1;
+    if (thumbFd < 0 || ftruncate(thumbFd, (off_t)h->thumbnailBytes) != 0) {
+        if (thumbFd >= 0) close(thumbFd);
+        munmap(base, st.st_size);
+        close(fd);
+        return false;
+    }
+
+    const uint32_t first = h->count / EVENT_LOG_BLOCK_RECORDS * EVENT_LOG_BLOCK_RECORDS;
+    if (first < h->count) {
+        const EventRecord *records = reinterpret_cast<const EventRecord *>(static_cast<char *>(base) + h->recordsOffset);
+        IndexEntry &block = reinterpret_cast<IndexEntry *>(static_cast<char *>(base) + h->indexOffset)[first / EVENT_LOG_BLOCK_RECORDS];
+        block.minTs = INT64_MAX;
+        block.maxTs = INT64_MIN;
+        block.identityBits = 0;
+        for (uint32_t i = first; i < h->count; ++i) {
+            block.minTs = std::min(block.minTs, records[i].timestampMs);
+            block.maxTs = std::max(block.maxTs, records[i].timestampMs);
+            block.identityBits |= identityBit(records[i].identity);
+        }
+    }
+
+    m_active = ActiveSegment();
+    m_active.seq = seq;
+    m_active.fd = fd;
+    m_active.thumbFd = thumbFd;
+    m_active.base = static_cast<char *>(base);
+    m_active.size = st.st_size;
+    m_active.count = h->count;
+    m_active.thumbnailBytes = h->thumbnailBytes;
+    m_active.minTs = h->minTs;
+    m_active.maxTs = h->maxTs;
+    m_active.identityBits = h->identityBits;
+    return true;
+}
+
+void EventLog::closeSegment()
+{
+    if (m_active.base) munmap(m_active.base, m_active.size);
+    if (m_active.fd >= 0) close(m_active.fd);
+    if (m_active.thumbFd >= 0) close(m_active.thumbFd);
+    m_active = ActiveSegment();
+}
+
+int EventLog::query(int64_t fromMs, int64_t toMs, int identity, const Visitor &visit) const
+{
+    std::vector<unsigned> segments;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_options.readOnly) scanSegments(nullptr);
+        segments = m_segments;
+    }
+    const uint64_t bits = identity == EVENT_LOG_ANY_IDENTITY ? ~0ULL : identityBit(identity);
+
+    int matched = 0;
+    for (unsigned seq : segments) {
+        // 先只读段头，时间或身份不沾边的段不映射
+        const int fd = ::open(segmentPath(seq, ".log").c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;   // 刚被轮转删除
+        SegmentHeader h;
+        struct stat st;
+        char *base = nullptr;
+        size_t mapped = 0;
+        if (fstat(fd, &st) == 0 && pread(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) && validHeader(h, st.st_size)
+            && h.count > 0 && h.maxTs >= fromMs && h.minTs < toMs && (h.identityBits & bits)) {
+            mapped = h.recordsOffset + (size_t)h.count * sizeof(EventRecord);
+            void *m = mmap(nullptr, mapped, PROT_READ, MAP_SHARED, fd, 0);
+            if (m != MAP_FAILED) base = static_cast<char *>(m);
+        }
+        close(fd);
+        if (!base) continue;
+
+        const IndexEntry *index = reinterpret_cast<const IndexEntry *>(base + h.indexOffset);
+        const EventRecord *records = reinterpret_cast<const EventRecord *>(base + h.recordsOffset);
+        bool stopped = false;
+        for (uint32_t first = 0; first < h.count && !stopped; first += EVENT_LOG_BLOCK_RECORDS) {
+            const IndexEntry &block = index[first / EVENT_LOG_BLOCK_RECORDS];
+            if (block.maxTs < fromMs || block.minTs >= toMs || !(block.identityBits & bits)) continue;
+            const uint32_t end = std::min<uint32_t>(h.count, first + EVENT_LOG_BLOCK_RECORDS);
+            for (uint32_t i = first; i < end; ++i) {
+                const EventRecord &r = records[i];
+                if (r.timestampMs < fromMs || r.timestampMs >= toMs) continue;
+                if (identity != EVENT_LOG_ANY_IDENTITY && r.identity != identity) continue;
+                ++matched;
+                if (!visit(r, seq)) {
+                    stopped = true;
+                    break;
+                }
+            }
+        }
+        munmap(base, mapped);
+        if (stopped) break;
+    }
+    return matched;
+}
+
+bool EventLog::readThumbnail(unsigned segment, const EventRecord &record, std::vector<unsigned char> &data) const
+{
+    data.clear();
+    if (record.thumbnailLength == 0) return false;
+    const int fd = ::open(segmentPath(segment, ".thumbs").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    data.resize(record.thumbnailLength);
+    const bool ok = pread(fd, data.data(), data.size(), (off_t)record.thumbnailOffset) == (ssize_t)data.size();
+    close(fd);
+    if (!ok) data.clear();
+    return ok;
+}
@@ -0,0 +1,164 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// 识别事件日志：只追加的审计记录，某人在什么时间经过哪一路摄像头。
+// 目录下按序号存放分段文件 events-<序号>.log，每段大小固定、整段 mmap，写满后换下一段，段数超过上限时删除最旧的段。
+// 每个事件是 32 字节的定长记录；段内每 EVENT_LOG_BLOCK_RECORDS 条记录有一个稀疏索引项（时间范围和身份位图），
+// 段头还有整段的时间范围和身份位图，按时间和身份查询时整段、整块地跳过，只扫描可能命中的块。
+// 追加只把事件放进内存队列，由后台写线程成组提交：先写记录和索引并 msync，最后才更新段头的记录数，
+// 提交到一半掉电时段头之后的记录会被忽略。人脸缩略图（JPEG）追加在同名的 .thumbs 文件中，记录里保存偏移和长度。
+// 身份编号是日志自己的（目录下 identities 文件的行号），与识别器进程内的身份 id 无关，重启后不变。
+
+const int EVENT_LOG_NO_IDENTITY = -1;    // 事件没有确定的身份（未知的人）
+const int EVENT_LOG_ANY_IDENTITY = -2;   // 查询时不按身份过滤
+const int EVENT_LOG_BLOCK_RECORDS = 64;  // 每个稀疏索引项覆盖的记录数
+
+// 一条识别事件，也是文件中记录的格式
+struct EventRecord {
+    int64_t timestampMs;        // 自1970年以来的毫秒数
+    int32_t identity;           // 日志的身份编号，EVENT_LOG_NO_IDENTITY 表示没有确定身份
+    int32_t trackerId;
+    float score;
+    uint16_t camera;
+    uint8_t state;              // RecognitionState
+    uint8_t reserved;
+    uint32_t thumbnailOffset;   // 缩略图在本段 .thumbs 文件中的偏移
+    uint32_t thumbnailLength;   // 0 表示没有缩略图
+};
+
+class EventLog
+{
+public:
+    struct Options {
+        size_t segmentBytes = 1 << 20;   // 每段文件的大小，1 MB 约可存 3 万条事件
+        int maxSegments = 64;            // 最多保留的段数
+        int commitIntervalMs = 1000;     // 两次提交（msync）之间至少间隔的时间，期间的事件合成一组提交
+        bool readOnly = false;           // 只查询，不写入；可以和正在写入的进程同时打开
+    };
+
+    struct Stats {
+        uint64_t appended = 0;     // 放进队列的事件数
+        uint64_t committed = 0;    // 写线程处理完的事件数
+        uint64_t dropped = 0;      // 队列满而丢弃的事件数
+        uint64_t commits = 0;      // 提交的组数
+        uint64_t writeErrors = 0;  // 写入失败而丢失的事件数
+        int segments = 0;
+    };
+
+    // 查询结果的回调，segment 用于读取缩略图；返回 false 时停止查询
+    typedef std::function<bool(const EventRecord &record, unsigned segment)> Visitor;
+
+    /**
+     * @brief 打开日志目录，不存在时创建（上一级目录必须存在）。可写时接着最后一段未写满的段继续写，并启动写线程。
+     * @return 失败时返回空指针并在 error 中说明原因。
+     */
+    static std::unique_ptr<EventLog> open(const std::string &dir, const Options &options, std::string *error);
+
+    // 提交队列中剩余的事件，停止写线程
+    ~EventLog();
+
+    /**
+     * @brief 返回名字对应的身份编号，新名字分配下一个编号，随下一组事件写进 identities 文件。
+     * 只读时只查找，找不到返回 EVENT_LOG_NO_IDENTITY。
+     */
+    int identity(const std::string &name);
+    // 只查找，不分配
+    int findIdentity(const std::string &name) const;
+    // 编号无效时返回空字符串
+    std::string identityName(int identity) const;
+
+    /**
+     * @brief 追加一条事件，不等待写入。可以从多个线程调用。
+     * @param thumbnail 可选的缩略图数据，复制进队列。
+     * @return 队列已满（写线程跟不上）或日志只读时返回 false，事件被丢弃。
+     */
+    bool append(const EventRecord &record, const void *thumbnail = nullptr, size_t thumbnailLength = 0);
+
+    // 等待此前追加的事件全部提交
+    void flush();
+
+    /**
+     * @brief 查询 [fromMs, toMs) 内的事件，按写入顺序对每条调用 visit。只能查到已经提交的事件。
+     * @param identity 身份编号、EVENT_LOG_NO_IDENTITY（只要未知的人）或 EVENT_LOG_ANY_IDENTITY。
+     * @return 命中的事件数。
+     */
+    int query(int64_t fromMs, int64_t toMs, int identity, const Visitor &visit) const;
+
+    // 读取一条事件的缩略图，没有缩略图或读取失败时返回 false
+    bool readThumbnail(unsigned segment, const EventRecord &record, std::vector<unsigned char> &data) const;
+
+    Stats stats() const;
+    const std::string &directory() const { return m_dir; }
+
+private:
+    // 队列中的一条事件，缩略图缓冲区在队列和写线程之间交换，容量保留复用
+    struct Pending {
+        EventRecord record;
+        std::vector<unsigned char> thumbnail;
+    };
+
+    // 写线程正在写的段，只由写线程访问
+    struct ActiveSegment {
+        unsigned seq = 0;
+        int fd = -1;
+        int thumbFd = -1;
+        char *base = nullptr;         // 整段的映射
+        size_t size = 0;
+        uint32_t count = 0;           // 已写进映射的记录数，提交后写进段头
+        uint64_t thumbnailBytes = 0;  // .thumbs 文件中已写的字节数
+        bool thumbnailsDirty = false;
+        int64_t minTs = 0, maxTs = 0;
+        uint64_t identityBits = 0;
+    };
+
+    EventLog(const std::string &dir, const Options &options);
+    bool scanSegments(std::string *error) const;
+    void loadIdentities() const;
+    bool resumeSegment(unsigned seq);
+    bool startSegment();
+    void closeSegment();
+    void commitSegment();
+    void writeIdentities(const std::vector<std::string> &names);
+    void writeBatch(size_t n);
+    void writerLoop();
+    std::string segmentPath(unsigned seq, const char *suffix) const;
+
+    const std::string m_dir;
+    const Options m_options;
+
+    mutable std::mutex m_mutex;             // 保护队列、身份表、段列表和统计
+    std::condition_variable m_wake;         // 通知写线程：有新事件、要求 flush 或退出
+    std::condition_variable m_committedCv;  // 通知 flush：一组事件已提交
+    std::vector<Pending> m_queue;           // 环形队列
+    size_t m_queueHead = 0;
+    size_t m_queueCount = 0;
+    bool m_flushRequested = false;
+    bool m_exiting = false;
+    Stats m_stats;
+    mutable std::vector<unsigned> m_segments;   // 现有段的序号，从旧到新；只读时每次查询重新扫描目录
+
+    // 身份表：只读时按需从 identities 文件增量读入新追加的名字
+    mutable std::deque<std::string> m_names;    // 编号 -> 名字，deque 追加时不移动已有元素
+    mutable std::unordered_map<std::string, int> m_nameIds;
+    mutable size_t m_identitiesRead = 0;        // 已经读入的 identities 文件字节数
+    size_t m_namesPersisted = 0;                // 已经写进文件的名字数
+
+    // 以下只由写线程访问
+    std::vector<Pending> m_batch;
+    ActiveSegment m_active;
+    std::thread m_writer;
+};
+
+#endif // EVENT_LOG_H
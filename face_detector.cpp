@@ -1,69 +1,283 @@
 #include "face_detector.h"
+#include "lbp_cascade.h"
 #include <opencv2/opencv.hpp>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <vector>
+#include <string>
+#include <algorithm>
 
-#include <cstdio>   
-#include <cstdlib>  
-#include <cstring>  
-#include <cerrno>   
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
 
-// 使用静态变量来保存分类器，避免每次都加载耗时的XML模型文件
-static cv::CascadeClassifier face_cascade;
+// 检测参数，自有实现和 OpenCV 实现相同
+#define DETECT_SCALE_FACTOR 1.1
+#define DETECT_MIN_NEIGHBORS 5
+#define DETECT_MIN_SIZE 100
+// 对照检查每比较这么多帧打印一次汇总
+#define PARITY_REPORT_FRAMES 100
+
+// 优先使用自有的 LBP 级联（见 lbp_cascade.h）：只加载一次，所有线程共用，每个线程有自己的缓冲区。
+// 级联文件不是它支持的格式时退回 cv::CascadeClassifier；detectMultiScale 每次检测都会分配内存，
+// 退回后处理线程做不到稳态不分配，--alloc-check 会失败
+static std::string cascade_file;
+static std::shared_ptr<const LbpCascade> lbp_cascade;
+static thread_local LbpScratch lbp_scratch;
+// cv::CascadeClassifier 不能被多个线程同时使用，每个线程在第一次用到时加载自己的一份，
+// 之后一直复用，避免每次都加载耗时的XML模型文件
+static thread_local cv::CascadeClassifier face_cascade;
+// 每个线程复用的中间缓冲区，图像尺寸不变时稳态下不再分配
+static thread_local cv::Mat equalized;
+static thread_local cv::Mat decoded;
+static thread_local std::vector<cv::Rect> found;
+
+// 对照检查：每个线程每 parity_interval 次检测用 OpenCV 再检测一次
+static std::atomic<int> parity_interval(0);
+static thread_local int parity_countdown = 0;
+static thread_local std::vector<cv::Rect> reference;
+static thread_local FaceDetectorParity parity_total;
+
+static bool ensure_cascade() {
+    if (!face_cascade.empty()) return true;
+    if (cascade_file.empty() || !face_cascade.load(cascade_file)) {
+        fprintf(stderr, "Error loading face cascade from %s\n", cascade_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// 两组结果是否包含同样的矩形（顺序可以不同）
+static bool same_detections(const std::vector<cv::Rect> &a, const std::vector<cv::Rect> &b) {
+    if (a.size() != b.size()) return false;
+    for (const cv::Rect &r : a) {
+        if (std::find(b.begin(), b.end(), r) == b.end()) return false;
+    }
+    return true;
+}
+
+// 按 IOU >= 0.5 贪心配对，返回配对上的个数
+static int matched_detections(const std::vector<cv::Rect> &a, const std::vector<cv::Rect> &b) {
+    unsigned long long used = 0;
+    int matched = 0;
+    for (const cv::Rect &r : a) {
+        for (size_t j = 0; j < b.size() && j < 64; j++) {
+            if ((used >> j) & 1) continue;
+            const double inter = (r & b[j]).area();
+            if (inter >= 0.5 * (r.area() + b[j].area() - inter)) {
+                used |= 1ULL << j;
+                matched++;
+                break;
+            }
+        }
+    }
+    return matched;
+}
+
+// 把一帧的对照结果累加到 parity
+static void add_parity(FaceDetectorParity *parity, double ms, double reference_ms) {
+    parity->frames++;
+    if (!same_detections(found, reference)) parity->differing_frames++;
+    parity->faces += (int)found.size();
+    parity->reference_faces += (int)reference.size();
+    parity->matched += matched_detections(found, reference);
+    parity->ms += ms;
+    parity->reference_ms += reference_ms;
+}
+
+// 用 OpenCV 在同一帧上再检测一次，与 found 比较，攒够一批后打印
+static void check_parity(const cv::Mat &mask, double ms) {
+    if (!ensure_cascade()) return;
+    const auto start = std::chrono::steady_clock::now();
+    face_cascade.detectMultiScale(equalized, reference, DETECT_SCALE_FACTOR, DETECT_MIN_NEIGHBORS, 0,
+                                  cv::Size(DETECT_MIN_SIZE, DETECT_MIN_SIZE));
+    const double reference_ms = elapsed_ms(start);
+    // 有掩码时 OpenCV 看的是整幅图，只比较中心在掩码内的
+    if (!mask.empty()) {
+        reference.erase(std::remove_if(reference.begin(), reference.end(), [&mask](const cv::Rect &r) {
+            return !mask.at<unsigned char>(r.y + r.height / 2, r.x + r.width / 2);
+        }), reference.end());
+    }
+    add_parity(&parity_total, ms, reference_ms);
+
+    FaceDetectorParity &p = parity_total;
+    if (p.frames < PARITY_REPORT_FRAMES) return;
+    printf("Detector parity: %d frames, %d differ; faces %d (OpenCV %d, %d matched); %.1f ms/frame (OpenCV %.1f ms)\n",
+           p.frames, p.differing_frames, p.faces, p.reference_faces, p.matched,
+           p.ms / p.frames, p.reference_ms / p.frames);
+    memset(&p, 0, sizeof(p));
+}
 
 extern "C" {
 
 int face_detector_init(const char *cascade_path) {
-    if (!face_cascade.load(cascade_path)) {
-        fprintf(stderr, "Error loading face cascade from %s\n", cascade_path);
+    cascade_file = cascade_path;
+    face_cascade = cv::CascadeClassifier();
+    std::string error;
+    lbp_cascade = LbpCascade::load(cascade_file, &error);
+    if (lbp_cascade) {
+        printf("Face detector initialized with in-house LBP cascade (%d stages).\n", lbp_cascade->stages());
+        return 0;
+    }
+    // 在初始化线程里加载一次，用来尽早发现路径错误
+    if (!ensure_cascade()) {
+        cascade_file.clear();
         return -1;
     }
-    printf("Face detector initialized with LBP cascade.\n");
+    printf("Face detector initialized with OpenCV cascade (%s).\n", error.c_str());
     return 0;
 }
 
-int face_detector_detect(const unsigned char *jpeg_buf, unsigned long jpeg_size, FaceRect **detected_faces) {
-    if (jpeg_buf == NULL || jpeg_size == 0) {
+void face_detector_set_parity_check(int interval) {
+    parity_interval = std::max(interval, 0);
+}
+
+// 在灰度图上执行检测，结果留在本线程的 found 中；mask 为空表示整幅图像
+static int detect_on_gray(const cv::Mat &gray, const cv::Mat &mask) {
+    if (!lbp_cascade && !ensure_cascade()) return -1;
+
+    // 直方图均衡化写到独立的缓冲区，调用者的数据（可能是mmap的摄像头缓冲区）保持不变
+    cv::equalizeHist(gray, equalized);
+
+    // 检测人脸
+    if (lbp_cascade) {
+        const int interval = parity_interval.load(std::memory_order_relaxed);
+        const bool check = interval > 0 && --parity_countdown <= 0;
+        const auto start = std::chrono::steady_clock::now();
+        lbp_cascade->detectMultiScale(equalized, found, lbp_scratch, DETECT_SCALE_FACTOR, DETECT_MIN_NEIGHBORS,
+                                      cv::Size(DETECT_MIN_SIZE, DETECT_MIN_SIZE), mask);
+        if (check) {
+            parity_countdown = interval;
+            check_parity(mask, elapsed_ms(start));
+        }
+    } else {
+        face_cascade.detectMultiScale(equalized, found, DETECT_SCALE_FACTOR, DETECT_MIN_NEIGHBORS, 0,
+                                      cv::Size(DETECT_MIN_SIZE, DETECT_MIN_SIZE));
+        // OpenCV 不支持掩码，只能检测完整幅图之后丢掉中心不在掩码内的
+        if (!mask.empty()) {
+            found.erase(std::remove_if(found.begin(), found.end(), [&mask](const cv::Rect &r) {
+                return !mask.at<unsigned char>(r.y + r.height / 2, r.x + r.width / 2);
+            }), found.end());
+        }
+    }
+    return (int)found.size();
+}
+
+// 把 found 复制到调用者提供的数组，最多 max_faces 个
+static void copy_found(FaceRect *faces, int max_faces) {
+    int n = std::min((int)found.size(), max_faces);
+    for (int i = 0; i < n; i++) {
+        faces[i].x = found[i].x;
+        faces[i].y = found[i].y;
+        faces[i].width = found[i].width;
+        faces[i].height = found[i].height;
+    }
+}
+
+// 为C接口的输出参数分配内存并复制结果
+static int return_found(int num_faces, FaceRect **detected_faces) {
+    *detected_faces = NULL;
+    if (num_faces <= 0) return num_faces;
+    *detected_faces = (FaceRect *)malloc(num_faces * sizeof(FaceRect));
+    if (*detected_faces == NULL) {
+        perror("malloc for detected_faces");
         return -1;
     }
+    copy_found(*detected_faces, num_faces);
+    return num_faces;
+}
 
-    // 将JPEG内存缓冲区解码为OpenCV的Mat对象
-    std::vector<unsigned char> jpeg_vec(jpeg_buf, jpeg_buf + jpeg_size);
-    cv::Mat frame = cv::imdecode(jpeg_vec, cv::IMREAD_COLOR);
-    if (frame.empty()) {
+static int decode_gray(const unsigned char *jpeg_buf, unsigned long jpeg_size) {
+    if (jpeg_buf == NULL || jpeg_size == 0) {
+        return -1;
+    }
+    // 直接解码为灰度图：libjpeg 会跳过色度通道的上采样和颜色转换
+    cv::Mat jpeg_mat(1, (int)jpeg_size, CV_8UC1, (void *)jpeg_buf);
+    cv::imdecode(jpeg_mat, cv::IMREAD_GRAYSCALE, &decoded);
+    if (decoded.empty()) {
         fprintf(stderr, "Failed to decode JPEG image\n");
         return -1;
     }
+    return 0;
+}
 
-    // 转换为灰度图以提高检测速度
-    cv::Mat gray_frame;
-    cv::cvtColor(frame, gray_frame, cv::COLOR_BGR2GRAY);
-    cv::equalizeHist(gray_frame, gray_frame); // 直方图均衡化
+int face_detector_detect(const unsigned char *jpeg_buf, unsigned long jpeg_size, FaceRect **detected_faces) {
+    if (decode_gray(jpeg_buf, jpeg_size) != 0) return -1;
+    return return_found(detect_on_gray(decoded, cv::Mat()), detected_faces);
+}
 
-    // 检测人脸
-    std::vector<cv::Rect> faces;  
-    face_cascade.detectMultiScale(gray_frame, faces, 1.1, 5, 0, cv::Size(100,100));
+int face_detector_detect_gray(const unsigned char *gray, int width, int height, int stride, FaceRect **detected_faces) {
+    if (gray == NULL || width <= 0 || height <= 0 || stride < width) {
+        return -1;
+    }
 
+    // 零拷贝地包装调用者的灰度平面
+    cv::Mat gray_frame(height, width, CV_8UC1, (void *)gray, (size_t)stride);
+    return return_found(detect_on_gray(gray_frame, cv::Mat()), detected_faces);
+}
 
-    int num_faces = faces.size();
-    // 如果检测到了人脸，为C接口的输出参数分配内存。
-    if (num_faces > 0) {
-        *detected_faces = (FaceRect *)malloc(num_faces * sizeof(FaceRect));
-        if (*detected_faces == NULL) {
-            perror("malloc for detected_faces");
-            return -1;
-        }
-        // 遍历OpenCV的检测结果，并将其复制到我们自己的C风格的FaceRect结构体数组中。
-        for (int i = 0; i < num_faces; i++) {
-            (*detected_faces)[i].x = faces[i].x;
-            (*detected_faces)[i].y = faces[i].y;
-            (*detected_faces)[i].width = faces[i].width;
-            (*detected_faces)[i].height = faces[i].height;
-        }
-    } else {
-        *detected_faces = NULL;
+int face_detector_detect_into(const unsigned char *jpeg_buf, unsigned long jpeg_size, FaceRect *faces, int max_faces) {
+    if (decode_gray(jpeg_buf, jpeg_size) != 0) return -1;
+    int n = detect_on_gray(decoded, cv::Mat());
+    if (n > 0) copy_found(faces, max_faces);
+    return n;
+}
+
+int face_detector_detect_gray_into(const unsigned char *gray, int width, int height, int stride,
+                                   FaceRect *faces, int max_faces) {
+    return face_detector_detect_gray_masked_into(gray, width, height, stride, NULL, 0, faces, max_faces);
+}
+
+int face_detector_detect_gray_masked_into(const unsigned char *gray, int width, int height, int stride,
+                                          const unsigned char *mask, int mask_stride,
+                                          FaceRect *faces, int max_faces) {
+    if (gray == NULL || width <= 0 || height <= 0 || stride < width || (mask != NULL && mask_stride < width)) {
+        return -1;
     }
+    cv::Mat gray_frame(height, width, CV_8UC1, (void *)gray, (size_t)stride);
+    cv::Mat mask_frame;
+    if (mask != NULL) mask_frame = cv::Mat(height, width, CV_8UC1, (void *)mask, (size_t)mask_stride);
+    int n = detect_on_gray(gray_frame, mask_frame);
+    if (n > 0) copy_found(faces, max_faces);
+    return n;
+}
 
-    return num_faces;
+int face_detector_compare_image(const char *image_path, int runs, FaceDetectorParity *parity) {
+    if (image_path == NULL || runs <= 0 || parity == NULL) return -1;
+    if (!lbp_cascade) {
+        fprintf(stderr, "In-house LBP cascade is not in use, nothing to compare\n");
+        return -1;
+    }
+    if (!ensure_cascade()) return -1;
+    cv::Mat gray = cv::imread(image_path, cv::IMREAD_GRAYSCALE);
+    if (gray.empty()) {
+        fprintf(stderr, "Failed to read image %s\n", image_path);
+        return -1;
+    }
+    cv::equalizeHist(gray, equalized);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) {
+        lbp_cascade->detectMultiScale(equalized, found, lbp_scratch, DETECT_SCALE_FACTOR, DETECT_MIN_NEIGHBORS,
+                                      cv::Size(DETECT_MIN_SIZE, DETECT_MIN_SIZE));
+    }
+    const double ms = elapsed_ms(start) / runs;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) {
+        face_cascade.detectMultiScale(equalized, reference, DETECT_SCALE_FACTOR, DETECT_MIN_NEIGHBORS, 0,
+                                      cv::Size(DETECT_MIN_SIZE, DETECT_MIN_SIZE));
+    }
+    const double reference_ms = elapsed_ms(start) / runs;
+
+    memset(parity, 0, sizeof(*parity));
+    add_parity(parity, ms, reference_ms);
+    return 0;
 }
 
 void face_detector_cleanup() {
@@ -14,13 +14,40 @@ typedef struct {
     int height;
 } FaceRect;
 
+// 自有 LBP 级联与 cv::CascadeClassifier 的对照结果
+typedef struct {
+    int frames;            // 比较的帧数
+    int differing_frames;  // 两者结果不完全相同的帧数
+    int faces;             // 自有实现检测到的人脸总数
+    int reference_faces;   // cv::CascadeClassifier 检测到的人脸总数
+    int matched;           // 两者按 IOU >= 0.5 配对上的人脸数
+    double ms;             // 自有实现的检测耗时之和（毫秒，不含解码和均衡化）
+    double reference_ms;   // cv::CascadeClassifier 的检测耗时之和
+} FaceDetectorParity;
+
 /**
  * @brief 初始化人脸检测器
+ * 优先使用自有的 LBP 级联实现（lbp_cascade.h，结果与 OpenCV 相同、更快），分类器只加载一次，所有线程共用；
+ * 级联文件不是它支持的格式时退回 cv::CascadeClassifier，每个线程第一次检测时加载一份自己的分类器。
+ * 检测函数可以在多个线程中同时调用。
  * @param cascade_path LBP分类器XML文件的路径
  * @return 成功返回0, 失败返回-1
  */
 int face_detector_init(const char *cascade_path);
 
+/**
+ * @brief 设置对照检查：每个检测线程每 interval 次检测额外用 cv::CascadeClassifier 在同一帧上再检测一次，
+ * 比较结果和耗时，每比较100帧打印一次汇总。0 关闭（默认）。只在使用自有实现时有效。
+ */
+void face_detector_set_parity_check(int interval);
+
+/**
+ * @brief 读入一张图片，用自有实现和 cv::CascadeClassifier 各检测 runs 次，
+ * 结果写入 parity（frames 为1，耗时为每次的平均值）。用于离线的一致性测试和速度对比。
+ * @return 成功返回0；图片无法读取，或级联格式不支持、只有 OpenCV 实现时返回-1。
+ */
+int face_detector_compare_image(const char *image_path, int runs, FaceDetectorParity *parity);
+
 /**
  * @brief 在JPEG图像数据中检测人脸
  * 
@@ -31,6 +58,44 @@ int face_detector_init(const char *cascade_path);
  */
 int face_detector_detect(const unsigned char *jpeg_buf, unsigned long jpeg_size, FaceRect **detected_faces);
 
+/**
+ * @brief 直接在8位灰度平面上检测人脸（例如 NV12 的 Y 平面），无需任何颜色转换。
+ *
+ * @param gray 指向灰度数据的指针，函数不会修改其内容。
+ * @param width 图像宽度
+ * @param height 图像高度
+ * @param stride 每行字节数
+ * @param detected_faces 同 face_detector_detect，调用者负责free()。
+ * @return 检测到的人脸数量，如果出错则为-1。
+ */
+int face_detector_detect_gray(const unsigned char *gray, int width, int height, int stride, FaceRect **detected_faces);
+
+
+/**
+ * @brief 同 face_detector_detect，但把结果写入调用者提供的数组，不做任何堆分配，
+ * 解码和均衡化使用每个线程复用的缓冲区。
+ * @param faces 输出数组。
+ * @param max_faces 数组容量，超出部分不写入。
+ * @return 检测到的人脸总数（可能大于 max_faces），出错返回-1。
+ */
+int face_detector_detect_into(const unsigned char *jpeg_buf, unsigned long jpeg_size, FaceRect *faces, int max_faces);
+
+/**
+ * @brief 同 face_detector_detect_gray，但把结果写入调用者提供的数组，返回值同 face_detector_detect_into。
+ */
+int face_detector_detect_gray_into(const unsigned char *gray, int width, int height, int stride,
+                                   FaceRect *faces, int max_faces);
+
+/**
+ * @brief 同 face_detector_detect_gray_into，但只在 mask 非0的区域找人脸：窗口中心落在0上的窗口不计算，
+ * 掩码外接矩形以外的行列整段跳过。可以用运动区域或追踪器附近的区域缩小搜索范围。
+ * 使用 OpenCV 实现时仍检测整幅图像，只丢掉中心不在掩码内的结果。
+ * @param mask 与灰度图同样大小的8位掩码，NULL 表示整幅图像。
+ * @param mask_stride 掩码每行字节数。
+ */
+int face_detector_detect_gray_masked_into(const unsigned char *gray, int width, int height, int stride,
+                                          const unsigned char *mask, int mask_stride,
+                                          FaceRect *faces, int max_faces);
 
 /**
  * @brief 清理人脸检测器使用的资源
@@ -0,0 +1,120 @@
+#include "face_quality.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLE_SIDE 64          // 每个方向大约抽样多少个点
+#define MIN_FACE_SIDE 16        // 小于该尺寸的区域不评估
+
+// 子分数的"满分"标定
+#define SHARPNESS_GOOD 150.0f   // 拉普拉斯方差达到该值视为清晰
+#define SIZE_MIN 48.0f          // 短边小于该值得0分
+#define SIZE_GOOD 112.0f        // 识别网络的输入尺寸，达到即满分
+#define BRIGHTNESS_TOLERANCE 40.0f  // 平均灰度在 128±40 以内不扣分
+#define CONTRAST_GOOD 40.0f
+#define SYMMETRY_MIN 0.6f       // 镜像相似度低于该值视为侧脸
+#define SYMMETRY_GOOD 0.9f
+
+// 各子分数在综合分中的权重
+#define W_SHARPNESS 0.30f
+#define W_SIZE 0.20f
+#define W_BRIGHTNESS 0.15f
+#define W_CONTRAST 0.15f
+#define W_SYMMETRY 0.20f
+
+enum { SUB_SHARPNESS, SUB_SIZE, SUB_BRIGHTNESS, SUB_CONTRAST, SUB_SYMMETRY, SUB_COUNT };
+
+static float clamp01(float v) {
+    return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+}
+
+static void sub_scores(const FaceQuality *q, float s[SUB_COUNT]) {
+    s[SUB_SHARPNESS] = clamp01(q->sharpness / SHARPNESS_GOOD);
+    s[SUB_SIZE] = clamp01((q->size - SIZE_MIN) / (SIZE_GOOD - SIZE_MIN));
+    s[SUB_BRIGHTNESS] = clamp01(1.0f - (fabsf(q->brightness - 128.0f) - BRIGHTNESS_TOLERANCE) / (128.0f - BRIGHTNESS_TOLERANCE));
+    s[SUB_CONTRAST] = clamp01(q->contrast / CONTRAST_GOOD);
+    s[SUB_SYMMETRY] = clamp01((q->symmetry - SYMMETRY_MIN) / (SYMMETRY_GOOD - SYMMETRY_MIN));
+}
+
+int face_quality_evaluate(const unsigned char *gray, int width, int height, int stride,
+                          const FaceRect *rect, FaceQuality *quality) {
+    memset(quality, 0, sizeof(*quality));
+    if (!gray || !rect) return -1;
+
+    // 裁到图像内，留出拉普拉斯算子需要的一像素边界
+    int x0 = rect->x < 1 ? 1 : rect->x;
+    int y0 = rect->y < 1 ? 1 : rect->y;
+    int x1 = rect->x + rect->width > width - 1 ? width - 1 : rect->x + rect->width;
+    int y1 = rect->y + rect->height > height - 1 ? height - 1 : rect->y + rect->height;
+    int w = x1 - x0, h = y1 - y0;
+    if (w < MIN_FACE_SIDE || h < MIN_FACE_SIDE) return -1;
+    quality->size = w < h ? w : h;
+
+    int step = quality->size / SAMPLE_SIDE;
+    if (step < 1) step = 1;
+
+    // 一次遍历同时累计灰度和拉普拉斯响应的一阶、二阶矩
+    long long sum = 0, sum_sq = 0, lap_sum = 0, lap_sq = 0;
+    long long count = 0;
+    for (int y = y0; y < y1; y += step) {
+        const unsigned char *row = gray + (size_t)y * stride;
+        const unsigned char *up = row - stride, *down = row + stride;
+        for (int x = x0; x < x1; x += step) {
+            int v = row[x];
+            int lap = up[x] + down[x] + row[x - 1] + row[x + 1] - 4 * v;
+            sum += v;
+            sum_sq += v * v;
+            lap_sum += lap;
+            lap_sq += lap * lap;
+            count++;
+        }
+    }
+    double mean = (double)sum / count;
+    double lap_mean = (double)lap_sum / count;
+    quality->brightness = (float)mean;
+    quality->contrast = (float)sqrt(fmax(0.0, (double)sum_sq / count - mean * mean));
+    quality->sharpness = (float)((double)lap_sq / count - lap_mean * lap_mean);
+
+    // 左半边与右半边镜像的平均绝对差，正脸时较小
+    long long diff = 0, pairs = 0;
+    int half = w / 2;
+    for (int y = y0; y < y1; y += step) {
+        const unsigned char *row = gray + (size_t)y * stride;
+        for (int dx = 0; dx < half; dx += step) {
+            diff += abs((int)row[x0 + dx] - (int)row[x1 - 1 - dx]);
+            pairs++;
+        }
+    }
+    quality->symmetry = pairs ? clamp01(1.0f - (float)((double)diff / pairs) / 64.0f) : 0.0f;
+
+    float s[SUB_COUNT];
+    sub_scores(quality, s);
+    static const float weights[SUB_COUNT] = { W_SHARPNESS, W_SIZE, W_BRIGHTNESS, W_CONTRAST, W_SYMMETRY };
+    float log_score = 0.0f, worst = 1.0f;
+    for (int i = 0; i < SUB_COUNT; i++) {
+        log_score += weights[i] * logf(s[i] > 1e-3f ? s[i] : 1e-3f);
+        if (s[i] < worst) worst = s[i];
+    }
+    // 几何平均对单项很差的情况不够敏感，任何一项低于0.5时再按比例压低
+    quality->score = expf(log_score) * clamp01(worst * 2.0f);
+    return 0;
+}
+
+const char *face_quality_problem(const FaceQuality *quality, float min_score) {
+    if (quality->score >= min_score) return "";
+    if (quality->size == 0) return "人脸不完整";
+
+    float s[SUB_COUNT];
+    sub_scores(quality, s);
+    int worst = 0;
+    for (int i = 1; i < SUB_COUNT; i++) {
+        if (s[i] < s[worst]) worst = i;
+    }
+    switch (worst) {
+    case SUB_SHARPNESS: return "图像模糊";
+    case SUB_SIZE: return "人脸太小";
+    case SUB_BRIGHTNESS: return quality->brightness < 128.0f ? "光线过暗" : "光线过亮";
+    case SUB_CONTRAST: return "对比度不足";
+    default: return "未正对摄像头";
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef FACE_QUALITY_H
+#define FACE_QUALITY_H
+
+#include "face_detector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 一张人脸切片的质量指标
+typedef struct {
+    float sharpness;   // 拉普拉斯响应的方差，越大越清晰
+    float brightness;  // 平均灰度 (0-255)
+    float contrast;    // 灰度标准差
+    float symmetry;    // 左右镜像的相似度 (0-1)，没有关键点时用来粗略估计是否正脸
+    int size;          // 人脸框短边的像素数
+    float score;       // 综合质量分 (0-1)，各项子分数的加权几何平均，任何一项过低都会被压低
+} FaceQuality;
+
+/**
+ * @brief 在8位灰度平面上评估一个人脸区域的质量。
+ * 只做整数运算，大人脸按步长抽样，单张人脸的开销在几十微秒量级，
+ * 可以在每个检测帧对所有人脸调用，用来决定哪些切片值得送进识别网络。
+ * @param gray 灰度数据（例如检测时使用的灰度图或 NV12 的 Y 平面）。
+ * @param width 图像宽度。
+ * @param height 图像高度。
+ * @param stride 每行字节数。
+ * @param rect 人脸区域，超出图像的部分会被裁掉。
+ * @param quality 输出的质量指标。
+ * @return 成功返回0，区域太小或参数无效返回-1（此时 quality->score 为0）。
+ */
+int face_quality_evaluate(const unsigned char *gray, int width, int height, int stride,
+                          const FaceRect *rect, FaceQuality *quality);
+
+/**
+ * @brief 返回质量不达标的主要原因，用于提示用户，例如 "模糊"、"过暗"。
+ * @return 静态字符串，质量达标时返回空字符串。
+ */
+const char *face_quality_problem(const FaceQuality *quality, float min_score);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FACE_QUALITY_H
@@ -0,0 +1,20 @@
+# 无界面守护进程：只依赖 QtCore，识别事件通过 Unix 域套接字推送
+# 与图形界面程序在同一目录构建时请指定不同的 Makefile: qmake face_recognition_daemon.pro -o Makefile.daemon
+QT       = core
+CONFIG  += console
+CONFIG  -= app_bundle
+
+# 目标可执行文件名
+TARGET = video_face_recognition_daemon
+
+SOURCES += \
+    daemon_main.cpp \
+    daemoncontroller.cpp \
+    ipc_server.c
+
+HEADERS += \
+    daemoncontroller.h \
+    ipc_server.h
+
+# 流水线源码、OpenCV 和交叉编译配置
+include(common.pri)
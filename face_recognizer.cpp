@@ -3,50 +3,293 @@
 #include <thread>
 #include <mutex>
 #include <atomic>
-#include <queue>
 #include <condition_variable>
 #include <fstream>
+#include <deque>
+#include <unordered_map>
 #include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <chrono>
+#include <cctype>
+#include <algorithm>
+#include <memory>
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/dnn.hpp>
+#include <linux/videodev2.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sched.h>
 
 #include "face_recognizer.h"
+#include "db_crypto.h"
+#include "gallery_rpc.h"
+#include "model_cache.h"
 
-// --- 全局和异步处理组件 ---
+// --- 识别任务、结果流和识别器实例 ---
+// 队列中的一项是一张人脸切片（BGR）及其调度信息，而不是整帧图像
 struct RecognitionTask {
-    cv::Mat image;
-    std::vector<FaceRect> faces;
+    int submission_id = 0;
+    FaceRect face;
+    int track_id = -1;            // 结果按 id 回到对应的追踪器
+    cv::Mat chip;
+    cv::Mat chip_buffer;          // chip 所在的缓冲区（face_recognizer_submit_chips 提交的才有），任务结束后还给结果流
+    int priority = RECOGNITION_PRIORITY_NEW;
+    long long capture_ms = 0;     // 采集时间 (face_recognizer_now_ms)
+    long long deadline_ms = 0;    // 超过该时间仍未开始推理就丢弃，0 表示不限
 };
-using RecognitionResultVec = std::vector<RecognitionResult>;  
 
-static std::queue<RecognitionTask> task_queue;  
-static std::mutex task_queue_mutex;
-static std::condition_variable task_queue_cv;    
+// 人脸库模板（聚类的和向量与中心）所用的 cv::Mat 分配器：内存从 LockedBuffer 中按特征向量大小切块，
+// 与解密用的缓冲区一样锁定、不进入 core dump。释放的块清零后放回空闲链表，整块的 LockedBuffer 不归还，
+// 模板数回落后锁定内存也不减少。只能分配不超过一个特征向量大小的矩阵
+class LockedFeatureAllocator : public cv::MatAllocator {
+public:
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data0, size_t* step,
+                           cv::AccessFlag, cv::UMatUsageFlags) const override {
+        size_t total = CV_ELEM_SIZE(type);
+        for (int i = dims - 1; i >= 0; --i) {
+            if (step) step[i] = total;
+            total *= sizes[i];
+        }
+        CV_Assert(!data0 && total <= BLOCK_BYTES);
+        cv::UMatData* u = new cv::UMatData(this);
+        u->data = u->origdata = take_block();
+        u->size = total;
+        return u;
+    }
+    bool allocate(cv::UMatData* u, cv::AccessFlag, cv::UMatUsageFlags) const override {
+        return u != nullptr;
+    }
+    void deallocate(cv::UMatData* u) const override {
+        if (!u) return;
+        CV_Assert(u->urefcount == 0 && u->refcount == 0);
+        dbWipe(u->origdata, BLOCK_BYTES);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            free_blocks.push_back(u->origdata);
+        }
+        delete u;
+    }
+
+private:
+    static const size_t BLOCK_BYTES = FACE_FEATURE_DIM * sizeof(float);
+    static const size_t CHUNK_BLOCKS = 64;   // 每次锁定 32KB
+
+    uchar* take_block() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (free_blocks.empty()) {
+            std::unique_ptr<LockedBuffer> chunk(new LockedBuffer);
+            if (!chunk->resize(BLOCK_BYTES * CHUNK_BLOCKS)) CV_Error(cv::Error::StsNoMem, "cannot map locked template memory");
+            for (size_t i = 0; i < CHUNK_BLOCKS; ++i) free_blocks.push_back(chunk->data() + i * BLOCK_BYTES);
+            chunks.push_back(std::move(chunk));
+        }
+        uchar* block = free_blocks.back();
+        free_blocks.pop_back();
+        return block;
+    }
+
+    mutable std::mutex mutex;
+    mutable std::vector<std::unique_ptr<LockedBuffer>> chunks;
+    mutable std::vector<uchar*> free_blocks;
+};
+
+// 人脸库的读写锁：比对只读模板，各推理线程（和分片节点上的查询）可以同时进行，注册、删除、导入等修改才独占。
+// 写者优先，推理线程一直在比对时注册也不会饿死。lock/unlock 是独占锁，可以直接用于 std::lock_guard
+class DatabaseRwLock {
+public:
+    DatabaseRwLock() {
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        pthread_rwlock_init(&rwlock, &attr);
+        pthread_rwlockattr_destroy(&attr);
+    }
+    ~DatabaseRwLock() { pthread_rwlock_destroy(&rwlock); }
+    DatabaseRwLock(const DatabaseRwLock&) = delete;
+    DatabaseRwLock& operator=(const DatabaseRwLock&) = delete;
+
+    void lock() { pthread_rwlock_wrlock(&rwlock); }
+    void unlock() { pthread_rwlock_unlock(&rwlock); }
+    void lock_shared() { pthread_rwlock_rdlock(&rwlock); }
+    void unlock_shared() { pthread_rwlock_unlock(&rwlock); }
+
+private:
+    pthread_rwlock_t rwlock;
+};
+
+// 一个放在锁定内存中的 1xFACE_FEATURE_DIM CV_32F 向量。分配器故意不析构：进程退出时全局对象中的模板可能晚于它释放
+static cv::Mat locked_feature() {
+    static LockedFeatureAllocator* allocator = new LockedFeatureAllocator;
+    cv::Mat m;
+    m.allocator = allocator;
+    m.create(1, FACE_FEATURE_DIM, CV_32F);
+    return m;
+}
+
+// 一个聚类只保存充分统计量：归一化特征之和与样本数，聚类中心就是和向量的方向，
+// 新样本可以直接累加进去，不需要保留原始特征。两个向量都在锁定内存中（见 LockedFeatureAllocator），
+// 只能原地写入或 copyTo，赋值为别的 Mat 会换成普通堆内存
+struct TemplateCluster {
+    cv::Mat sum = locked_feature();      // 1x128 CV_32F
+    int count = 0;
+    cv::Mat center = locked_feature();   // sum 归一化后的结果，识别时直接与之做点积
+};
+
+struct PersonTemplates {
+    int id = FACE_IDENTITY_NONE;
+    std::string name;
+    std::vector<TemplateCluster> clusters;
+};
+
+// 与一个远程人脸库分片的连接。每个推理线程各有一组，只在该线程中使用，不需要加锁
+struct ShardConnection {
+    std::string address;
+    int fd = -1;
+    GalleryRpcReader reader;
+    uint32_t next_request = 1;
+    uint32_t pending_request = 0;   // 本次查询正在等待的请求号，0 表示没有
+    long long retry_after_ms = 0;   // 连接出错后在此之前不再重连
+};
+
+// 一个推理线程和它独占的网络。cv::dnn::Net 不能被多个线程同时 forward，
+// 每个线程各有一份就不必互相等待；注册和批量导入临时借用其中一个，借用期间由 net_mutex 互斥。
+// 模型编译成功时用 executor（各线程共享映射的权重，只各有一份激活缓冲区），net 为空
+struct InferenceWorker {
+    cv::dnn::Net net;
+    std::unique_ptr<ModelThreadPool> pool;       // 一次推理内的辅助线程，见 face_recognizer_set_cpu_config
+    std::unique_ptr<ModelExecutor> executor;
+    unsigned int cpu_generation = 0;             // 已应用到本线程的 cpu_config 版本，受 owner->queue_mutex 保护
+    std::mutex net_mutex;
+    std::thread thread;
+    std::vector<ShardConnection> shards;
+};
+
+struct RecognitionStream {
+    FaceRecognizer *owner = nullptr;
+    std::string name;
 
-static std::queue<RecognitionResultVec> result_queue;   
-static std::mutex result_queue_mutex;                   
-static std::condition_variable result_queue_cv;        
+    // 调度队列：出队时先丢弃过期任务，再取优先级最高、截止时间最早的一项；
+    // 同一追踪器的新切片直接替换队列中的旧切片。以下三项受 owner->queue_mutex 保护
+    std::vector<RecognitionTask> queue;
+    int in_flight = 0;            // 已出队、尚未写完结果的任务数，关闭时等它归零
+    bool closing = false;
+    // 切片缓冲区池，也受 queue_mutex 保护：任务结束、过期或被替换时缓冲区回到这里，
+    // 都按见过的最大切片尺寸分配，稳态下提交切片不再分配内存
+    std::vector<cv::Mat> chip_pool;
+    int chip_rows = 0;
+    int chip_cols = 0;
 
-static cv::dnn::Net net;   
-static std::vector<std::pair<std::string, std::vector<cv::Mat>>> face_database_clustered;
-static std::thread worker_thread;           
-static std::atomic<bool> exit_flag(false);   
-static std::string g_database_path;          
+    // 结果环形缓冲区：推理线程在 ring_mutex 下写入（可能有多个），调用者是唯一的消费者。
+    // head/tail 单调递增，用 & (capacity - 1) 取槽位，容量必须是2的幂
+    RecognitionResult *ring_slots = nullptr;
+    unsigned int ring_capacity = 0;
+    std::vector<RecognitionResult> ring_storage;   // 调用者没有提供缓冲区时使用
+    std::mutex ring_mutex;
+    std::atomic<unsigned int> ring_head{0};
+    std::atomic<unsigned int> ring_tail{0};
+
+    int event_fd = -1;
+    RecognitionResultCallback callback = nullptr;  // 受 ring_mutex 保护
+    void *callback_user = nullptr;
+
+    std::atomic<unsigned long> submitted{0};
+    std::atomic<unsigned long> completed{0};
+    std::atomic<unsigned long> expired{0};
+    std::atomic<unsigned long> replaced{0};
+    std::atomic<unsigned long> rejected{0};
+    std::atomic<unsigned long> dropped{0};
+    std::atomic<long long> wait_ms_total{0};
+    std::atomic<long long> inference_ms_total{0};
+};
+
+struct FaceRecognizer {
+    std::vector<std::unique_ptr<InferenceWorker>> workers;
+    std::atomic<unsigned int> next_borrow{0};
+    std::atomic<bool> batch_forward_supported{true};
+
+    // 所有结果流的队列共用一把锁。推理线程从 next_stream 开始轮转查找，
+    // 取走一个任务后下一次从下一个结果流开始，各摄像头因此平分推理线程，与谁提交得更多无关
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::condition_variable idle_cv;            // 关闭结果流时等待它的在途任务
+    std::vector<RecognitionStream*> streams;
+    size_t next_stream = 0;
+    RecognizerCpuConfig cpu_config = {1, 0, 0};  // 以下两项也受 queue_mutex 保护
+    unsigned int cpu_generation = 0;
+    int next_submission_id = 1;
+    bool exiting = false;
+
+    std::vector<PersonTemplates> database;      // 模板向量在锁定内存中，见 LockedFeatureAllocator
+    DatabaseRwLock database_mutex;              // 保护 database、person_slots 和数据库文件；比对持共享锁，修改持独占锁
+    std::atomic<bool> database_loaded{false};   // 数据库在第一次访问时才加载，见 DatabaseLock
+    std::vector<int> person_slots;              // 身份 id -> database 下标，-1 表示不在库中
+    long db_log_records = 0;                    // 数据库文件中的记录数，包含已被后续记录覆盖的
+    bool db_writable = true;                    // 文件版本比程序新时不能写入，以免破坏它
+    std::string database_path;
+    std::shared_ptr<const LockedBuffer> db_key; // 数据库主密钥，空表示不加密，见 face_recognizer_set_database_key
+    LockedBuffer db_file_key;                   // 当前加密数据库文件的子密钥，尚未有文件时为空
+    uint64_t db_next_chunk = 0;                 // 下一个追加块的序号，用作块的 nonce，同一个子密钥下绝不能重复
+    std::atomic<bool> import_cancelled{false};
+    int partition_index = 0;                    // 批量导入只取名字哈希落在本分片的人
+    int partition_count = 1;
+
+    int shard_timeout_ms = 0;                   // 远程分片，见 face_recognizer_set_gallery_shards
+    std::atomic<unsigned long> shard_timeouts{0};
+    std::atomic<unsigned long> shard_failures{0};
+};
+
+// 身份表：名字只在这里保存一份，结果、追踪器和界面之间只传递身份 id。
+// 身份表在进程内共享，各识别器实例中同名的人得到同一个 id，界面不必知道结果来自哪个实例；
+// id 从1开始按首次出现的顺序分配，进程内只增不减，名字的指针因此一直有效
+static std::deque<std::string> identity_names;             // identity_names[id - 1]
+static std::unordered_map<std::string, int> identity_ids;  // 名字 -> 身份 id
+static std::mutex identity_mutex;
+
+static const unsigned int DEFAULT_RING_CAPACITY = 64;
+static const size_t MAX_QUEUED_TASKS = 8;      // 每个结果流中最多排队的人脸数
+static const size_t CHIP_POOL_SLACK = 16;      // 切片缓冲区池在排队和推理中的任务之外多留的容量（一次提交的切片数）
+static const int DEFAULT_SHARD_TIMEOUT_MS = 30;
+static const int SHARD_RETRY_MS = 1000;         // 分片连接出错后多久再试
 
 const cv::Size INPUT_SIZE(112, 112);    
 const float THRESHOLD = 0.363f;          
-const int NUM_CLUSTERS = 3;              
+const int MIN_REGISTRATION_SAMPLES = 3;         // 新建一个人至少需要的有效照片数
+const int MAX_CLUSTERS_PER_PERSON = 8;
+const float CLUSTER_JOIN_SIMILARITY = 0.75f;    // 样本与最近中心的相似度不低于该值时并入该聚类，否则新开一个
+const float CLUSTER_MERGE_SIMILARITY = 0.85f;   // 两个中心比这更接近时合并成一个
 
-// --- 内部辅助函数 ---
-// 计算两个特征向量的余弦相似度
-static double cosine_similarity(const cv::Mat& a, const cv::Mat& b) {
-    cv::Mat a_norm, b_norm;
-    cv::normalize(a, a_norm);
-    cv::normalize(b, b_norm);
-    return a_norm.dot(b_norm);
-}
+// 数据库文件是只追加的记录日志，每条记录覆盖或删除一个人，启动时按顺序重放；
+// 失效记录过多时整体重写一次（压缩）。没有文件头的文件是旧格式，加载后立即转换
+static const char DB_MAGIC[4] = { 'F', 'R', 'D', 'B' };
+static const uint32_t DB_VERSION = 2;
+static const uint32_t DB_RECORD_PERSON = 1;     // 载荷：聚类数，每个聚类为样本数 + 128 维和向量
+static const uint32_t DB_RECORD_DELETE = 2;     // 无载荷
+static const long DB_COMPACT_SLACK = 32;        // 失效记录超过 在库人数 + 该值 时压缩
+
+// 设置了密钥时数据库文件是加密容器：文件头 [魔数][版本][随机文件 id][校验标签]，之后是若干块
+// [明文长度][密文][标签]，每块是若干条完整的记录，用 ChaCha20-Poly1305 加密，可以单独解密和重放。
+// 子密钥由主密钥和文件 id 派生，每次压缩换一个文件 id；块按序号作 nonce，块被调换顺序或改动都通不过校验
+static const char DB_CRYPT_MAGIC[4] = { 'F', 'R', 'D', 'E' };
+static const uint32_t DB_CRYPT_VERSION = 1;
+static const size_t DB_CRYPT_HEADER_BYTES = sizeof(DB_CRYPT_MAGIC) + sizeof(uint32_t) + DB_NONCE_BYTES;
+static const size_t DB_CHUNK_BYTES = 64 * 1024;            // 压缩和批量追加时每块大约装这么多明文
+static const uint32_t DB_MAX_CHUNK_BYTES = 16 * 1024 * 1024;
+
+// 数据库主密钥，进程内的识别器共用，创建识别器时各取一份引用
+static std::shared_ptr<const LockedBuffer> database_key;
+static std::mutex database_key_mutex;
 
+// --- 内部辅助函数 ---
 // 对人脸切片进行预处理，增强图像质量
 static cv::Mat preprocess_face_chip(const cv::Mat& face_chip) {
     if (face_chip.empty()) {
@@ -69,34 +312,77 @@ static cv::Mat preprocess_face_chip(const cv::Mat& face_chip) {
     return processed_chip;
 }
 
-// 从一个Mat格式的人脸切片中提取128维特征向量
-static int get_feature(const cv::Mat& face_chip, cv::Mat& feature) {
+// 用一个推理线程的网络从一个Mat格式的人脸切片中提取128维特征向量
+static int get_feature(InferenceWorker& worker, const cv::Mat& face_chip, cv::Mat& feature) {
     cv::Mat processed_chip = preprocess_face_chip(face_chip);
     cv::Mat blob;    
     cv::dnn::blobFromImage(processed_chip, blob, 1.0/255.0, INPUT_SIZE, cv::Scalar(), true, false);
 
-    net.setInput(blob);
-    feature = net.forward();        
+    {
+        std::lock_guard<std::mutex> lock(worker.net_mutex);
+        if (worker.executor) {
+            // 输出在执行器内部，下一次 run 会覆盖它，在锁内归一化到 feature
+            const float *out = worker.executor->run(blob.ptr<float>());
+            cv::normalize(cv::Mat(1, FACE_FEATURE_DIM, CV_32F, (void*)out), feature, 1.0, 0.0, cv::NORM_L2);
+            return 0;
+        }
+        worker.net.setInput(blob);
+        feature = worker.net.forward();
+    }
     cv::normalize(feature, feature, 1.0, 0.0, cv::NORM_L2);    
     return 0;
 }
 
-// 从一个图像文件路径中提取主导人脸的特征
-static int get_feature_from_path(const char* image_path, cv::Mat& feature) {
-    cv::Mat img = cv::imread(image_path);
-    if (img.empty()) {
-        fprintf(stderr, "Failed to read image %s\n", image_path);
-        return -1;
+// 一次前向推理提取多张切片的特征；模型的批大小固定为1时退回逐张提取
+static int get_features_batch(FaceRecognizer* rec, InferenceWorker& worker, const std::vector<cv::Mat>& chips,
+                              std::vector<cv::Mat>& features) {
+    features.clear();
+    if (chips.empty()) return 0;
+
+    if (rec->batch_forward_supported && chips.size() > 1) {
+        std::vector<cv::Mat> processed;
+        processed.reserve(chips.size());
+        for (const auto& chip : chips) processed.push_back(preprocess_face_chip(chip));
+        cv::Mat blob;
+        cv::dnn::blobFromImages(processed, blob, 1.0/255.0, INPUT_SIZE, cv::Scalar(), true, false);
+        try {
+            cv::Mat out;
+            {
+                std::lock_guard<std::mutex> lock(worker.net_mutex);
+                worker.net.setInput(blob);
+                out = worker.net.forward();
+            }
+            out = out.reshape(1, (int)chips.size());
+            if (out.cols == FACE_FEATURE_DIM) {
+                for (int i = 0; i < out.rows; ++i) {
+                    cv::Mat feature;
+                    cv::normalize(out.row(i), feature, 1.0, 0.0, cv::NORM_L2);
+                    features.push_back(feature);
+                }
+                return 0;
+            }
+        } catch (const cv::Exception& e) {
+            fprintf(stderr, "Batched forward not supported by the model (%s), falling back to single images.\n", e.what());
+        }
+        rec->batch_forward_supported = false;
     }
 
-    std::vector<uchar> jpeg_buf;
-    cv::imencode(".jpg", img, jpeg_buf);
+    for (const auto& chip : chips) {
+        cv::Mat feature;
+        if (get_feature(worker, chip, feature) != 0) return -1;
+        features.push_back(feature);
+    }
+    return 0;
+}
 
+// 在一张彩色图中检测人脸，返回面积最大的人脸切片（与原图共享数据）
+static int detect_largest_face(const cv::Mat& img, cv::Mat& face_chip) {
+    cv::Mat gray;
+    cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
     FaceRect* faces = nullptr;
-    int num_faces = face_detector_detect(jpeg_buf.data(), jpeg_buf.size(), &faces);
+    int num_faces = face_detector_detect_gray(gray.data, gray.cols, gray.rows, (int)gray.step, &faces);
     if (num_faces <= 0) {
         if (faces) free(faces);
-        fprintf(stderr, "No faces found in %s\n", image_path);
         return -1;
     }
     // 找到面积最大的人脸作为目标
@@ -108,272 +394,1782 @@ static int get_feature_from_path(const char* image_path, cv::Mat& feature) {
     }
     free(faces);
     cv::Rect roi(target_face.x, target_face.y, target_face.width, target_face.height);
-    cv::Mat face_chip = img(roi);
+    face_chip = img(roi & cv::Rect(0, 0, img.cols, img.rows));
+    return 0;
+}
+
+// 从一个图像文件路径中提取主导人脸的特征
+static int get_feature_from_path(InferenceWorker& worker, const char* image_path, cv::Mat& feature) {
+    cv::Mat img = cv::imread(image_path);
+    if (img.empty()) {
+        fprintf(stderr, "Failed to read image %s\n", image_path);
+        return -1;
+    }
+
+    cv::Mat face_chip;
+    if (detect_largest_face(img, face_chip) != 0) {
+        fprintf(stderr, "No faces found in %s\n", image_path);
+        return -1;
+    }
+    return get_feature(worker, face_chip, feature);
+}
 
-    return get_feature(face_chip, feature);
+// 注册和批量导入轮流借用推理线程的网络，多个导入线程因此可以同时推理
+static InferenceWorker& borrow_worker(FaceRecognizer* rec) {
+    return *rec->workers[rec->next_borrow++ % rec->workers.size()];
 }
 
-// --- 数据库持久化函数 (声明为 static) ---
-static void load_database_clustered() {
-    std::ifstream db_file(g_database_path, std::ios::binary);
-    if (!db_file.is_open()) {
-        printf("Clustered DB file '%s' not found. A new one will be created upon registration.\n", g_database_path.c_str());
-        return;
+// --- 模板维护 ---
+static void refresh_center(TemplateCluster& cluster) {
+    cv::normalize(cluster.sum, cluster.center);
+}
+
+// 反复合并最接近的两个聚类，直到聚类数不超过上限且任意两个中心都不够接近
+static void merge_close_clusters(PersonTemplates& person) {
+    auto& clusters = person.clusters;
+    while (clusters.size() > 1) {
+        size_t a = 0, b = 1;
+        double best = -2.0;
+        for (size_t i = 0; i < clusters.size(); ++i) {
+            for (size_t j = i + 1; j < clusters.size(); ++j) {
+                double sim = clusters[i].center.dot(clusters[j].center);
+                if (sim > best) { best = sim; a = i; b = j; }
+            }
+        }
+        if (clusters.size() <= (size_t)MAX_CLUSTERS_PER_PERSON && best < CLUSTER_MERGE_SIMILARITY) break;
+        clusters[a].sum += clusters[b].sum;
+        clusters[a].count += clusters[b].count;
+        refresh_center(clusters[a]);
+        clusters.erase(clusters.begin() + b);
+    }
+}
+
+// 把一批归一化特征并入一个人的模板：每个样本并入最接近的聚类，与所有中心都不够接近时新开一个聚类，
+// 最后合并过近或超出上限的聚类。聚类数由样本分布决定，外观稳定的人通常只有一两个，
+// 戴眼镜、不同光照等情况会各自形成聚类
+static void add_samples(PersonTemplates& person, const std::vector<cv::Mat>& features) {
+    for (const auto& feature : features) {
+        int best = -1;
+        double best_sim = -2.0;
+        for (size_t i = 0; i < person.clusters.size(); ++i) {
+            double sim = feature.dot(person.clusters[i].center);
+            if (sim > best_sim) { best_sim = sim; best = (int)i; }
+        }
+        if (best >= 0 && best_sim >= CLUSTER_JOIN_SIMILARITY) {
+            TemplateCluster& cluster = person.clusters[best];
+            cluster.sum += feature;
+            cluster.count++;
+            refresh_center(cluster);
+        } else {
+            TemplateCluster cluster;
+            feature.copyTo(cluster.sum);
+            cluster.count = 1;
+            feature.copyTo(cluster.center);
+            person.clusters.push_back(cluster);
+        }
+    }
+    merge_close_clusters(person);
+}
+
+// 返回名字的身份 id，第一次出现时分配一个
+static int identity_for(const std::string& name) {
+    std::lock_guard<std::mutex> lock(identity_mutex);
+    auto it = identity_ids.find(name);
+    if (it != identity_ids.end()) return it->second;
+    identity_names.push_back(name);
+    const int id = (int)identity_names.size();
+    identity_ids.emplace(name, id);
+    return id;
+}
+
+// 以下函数的调用者都持有 rec->database_mutex 的独占锁（find_person 只读，共享锁即可）
+// 返回这个人在 rec->database 中的下标，不在库中返回 -1
+static int find_person(FaceRecognizer* rec, const std::string& name) {
+    int id;
+    {
+        std::lock_guard<std::mutex> lock(identity_mutex);
+        auto it = identity_ids.find(name);
+        if (it == identity_ids.end()) return -1;
+        id = it->second;
+    }
+    return id < (int)rec->person_slots.size() ? rec->person_slots[id] : -1;
+}
+
+// 新建一个没有模板的人，返回下标
+static int add_person(FaceRecognizer* rec, const std::string& name) {
+    PersonTemplates person;
+    person.id = identity_for(name);
+    person.name = name;
+    if ((int)rec->person_slots.size() <= person.id) rec->person_slots.resize(person.id + 1, -1);
+    rec->person_slots[person.id] = (int)rec->database.size();
+    rec->database.push_back(std::move(person));
+    return (int)rec->database.size() - 1;
+}
+
+// 把最后一个人搬到空位，只需更新一个下标
+static void remove_person(FaceRecognizer* rec, int index) {
+    auto& database = rec->database;
+    rec->person_slots[database[index].id] = -1;
+    if (index != (int)database.size() - 1) {
+        database[index] = std::move(database.back());
+        rec->person_slots[database[index].id] = index;
+    }
+    database.pop_back();
+}
+
+static void clear_persons(FaceRecognizer* rec) {
+    for (const auto& person : rec->database) rec->person_slots[person.id] = -1;
+    rec->database.clear();
+}
+
+// --- 数据库文件 ---
+static void write_u32(std::ostream& out, uint32_t value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static bool read_u32(std::istream& in, uint32_t& value) {
+    return (bool)in.read(reinterpret_cast<char*>(&value), sizeof(value));
+}
+
+static void write_header(std::ostream& out) {
+    out.write(DB_MAGIC, sizeof(DB_MAGIC));
+    write_u32(out, DB_VERSION);
+}
+
+static void write_person_record(std::ostream& out, const PersonTemplates& person) {
+    write_u32(out, DB_RECORD_PERSON);
+    write_u32(out, (uint32_t)person.name.size());
+    out.write(person.name.data(), person.name.size());
+    write_u32(out, (uint32_t)person.clusters.size());
+    for (const auto& cluster : person.clusters) {
+        write_u32(out, (uint32_t)cluster.count);
+        out.write(reinterpret_cast<const char*>(cluster.sum.ptr<float>(0)), FACE_FEATURE_DIM * sizeof(float));
+    }
+}
+
+static void write_delete_record(std::ostream& out, const std::string& name) {
+    write_u32(out, DB_RECORD_DELETE);
+    write_u32(out, (uint32_t)name.size());
+    out.write(name.data(), name.size());
+}
+
+static bool read_cluster(std::istream& in, TemplateCluster& cluster) {
+    cluster.sum.create(1, FACE_FEATURE_DIM, CV_32F);
+    if (!in.read(reinterpret_cast<char*>(cluster.sum.ptr<float>(0)), FACE_FEATURE_DIM * sizeof(float))) return false;
+    refresh_center(cluster);
+    return true;
+}
+
+// 读一条记录并应用到 rec->database；文件在记录中间结束（写到一半断电）或内容损坏时返回 false，
+// 此时 rec->database 保持不变
+static bool replay_record(FaceRecognizer* rec, std::istream& in) {
+    uint32_t type, name_len;
+    if (!read_u32(in, type) || !read_u32(in, name_len) || name_len == 0 || name_len > 1024) return false;
+    std::string name(name_len, '\0');
+    if (!in.read(&name[0], name_len)) return false;
+
+    int index = find_person(rec, name);
+    if (type == DB_RECORD_DELETE) {
+        if (index >= 0) remove_person(rec, index);
+        return true;
     }
+    uint32_t num_clusters;
+    if (type != DB_RECORD_PERSON || !read_u32(in, num_clusters) || num_clusters > 1024) return false;
+
+    std::vector<TemplateCluster> clusters;
+    for (uint32_t i = 0; i < num_clusters; ++i) {
+        TemplateCluster cluster;
+        uint32_t count;
+        if (!read_u32(in, count) || !read_cluster(in, cluster)) return false;
+        cluster.count = (int)count;
+        clusters.push_back(cluster);
+    }
+    if (index < 0) index = add_person(rec, name);
+    rec->database[index].clusters = std::move(clusters);
+    return true;
+}
 
-    face_database_clustered.clear();
+// 旧格式：[名字长度][名字][中心数][中心...]，每个 k-means 中心当作样本数为1的聚类
+static bool load_legacy_database(FaceRecognizer* rec, std::istream& in) {
     int name_len;
-    while (db_file.read(reinterpret_cast<char*>(&name_len), sizeof(name_len))) {
+    while (in.read(reinterpret_cast<char*>(&name_len), sizeof(name_len))) {
+        if (name_len <= 0 || name_len > 1024) return false;
         std::string name(name_len, '\0');
-        db_file.read(&name[0], name_len);
-
         int num_features;
-        db_file.read(reinterpret_cast<char*>(&num_features), sizeof(num_features));
-
-        std::vector<cv::Mat> features;
+        if (!in.read(&name[0], name_len) || !in.read(reinterpret_cast<char*>(&num_features), sizeof(num_features))) {
+            return false;
+        }
+        std::vector<TemplateCluster> clusters;
         for (int i = 0; i < num_features; ++i) {
-            cv::Mat feature(1, 128, CV_32F);
-            db_file.read(reinterpret_cast<char*>(feature.ptr<float>(0)), 128 * sizeof(float));
-            if (db_file.gcount() != 128 * sizeof(float)) {
+            TemplateCluster cluster;
+            if (!read_cluster(in, cluster)) {
                 fprintf(stderr, "DB Error: Incomplete feature read for %s\n", name.c_str());
-                face_database_clustered.clear();
-                return;
+                return false;
             }
-            features.push_back(feature.clone());
+            cluster.count = 1;
+            clusters.push_back(cluster);
         }
+        int index = find_person(rec, name);
+        if (index < 0) index = add_person(rec, name);
+        rec->database[index].clusters = std::move(clusters);
+    }
+    return true;
+}
+
+// --- 加密容器 ---
+// 记录先序列化到锁定内存中，加密后才交给文件流，明文不经过 ofstream 的缓冲区
+class LockedStreamBuf : public std::streambuf {
+public:
+    explicit LockedStreamBuf(LockedBuffer& buffer) : buffer(buffer) {}
+
+protected:
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        const size_t old_size = buffer.size();
+        if (!buffer.resize(old_size + n)) return 0;
+        memcpy(buffer.data() + old_size, s, n);
+        return n;
+    }
+    int_type overflow(int_type c) override {
+        if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+        const char ch = traits_type::to_char_type(c);
+        return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+    }
+
+private:
+    LockedBuffer& buffer;
+};
+
+// 在一块已解密的内存上重放记录
+class MemoryStreamBuf : public std::streambuf {
+public:
+    MemoryStreamBuf(uint8_t* data, size_t size) {
+        char* p = reinterpret_cast<char*>(data);
+        setg(p, p, p + size);
+    }
+};
+
+static void chunk_nonce(uint64_t index, uint8_t nonce[DB_NONCE_BYTES]) {
+    memset(nonce, 0, DB_NONCE_BYTES - sizeof(index));
+    memcpy(nonce + DB_NONCE_BYTES - sizeof(index), &index, sizeof(index));
+}
+
+// 文件头校验标签的 nonce，前4个字节不为0，与任何块序号都不同
+static void check_nonce(uint8_t nonce[DB_NONCE_BYTES]) {
+    memset(nonce, 0xff, DB_NONCE_BYTES);
+}
+
+// 子密钥 = 以文件 id 为 nonce 的主密钥 ChaCha20 密钥流的前 32 字节
+static bool derive_file_key(const LockedBuffer& master, const uint8_t* file_id, LockedBuffer& file_key) {
+    if (!file_key.resize(DB_KEY_BYTES)) return false;
+    memset(file_key.data(), 0, DB_KEY_BYTES);
+    dbChaCha20(master.data(), file_id, 0, file_key.data(), DB_KEY_BYTES);
+    return true;
+}
+
+// 写加密文件头：生成新的文件 id，派生的子密钥放进 file_key，校验标签用来在加载时确认密钥正确
+static bool write_crypt_header(std::ostream& out, const LockedBuffer& master, LockedBuffer& file_key) {
+    uint8_t header[DB_CRYPT_HEADER_BYTES];
+    memcpy(header, DB_CRYPT_MAGIC, sizeof(DB_CRYPT_MAGIC));
+    memcpy(header + sizeof(DB_CRYPT_MAGIC), &DB_CRYPT_VERSION, sizeof(DB_CRYPT_VERSION));
+    uint8_t* file_id = header + sizeof(DB_CRYPT_MAGIC) + sizeof(DB_CRYPT_VERSION);
+    if (!dbRandom(file_id, DB_NONCE_BYTES) || !derive_file_key(master, file_id, file_key)) return false;
+    uint8_t nonce[DB_NONCE_BYTES], tag[DB_TAG_BYTES];
+    check_nonce(nonce);
+    dbSeal(file_key.data(), nonce, header, sizeof(header), nullptr, 0, tag);
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(tag), sizeof(tag));
+    return true;
+}
+
+// 把记录分块加密写出。每写完一条记录调用一次 end_record，攒够 DB_CHUNK_BYTES 才封成一块，记录不跨块；
+// 最后用 end_record(true) 封掉剩下的
+struct ChunkWriter {
+    ChunkWriter(std::ostream& out, const LockedBuffer& key, uint64_t first_chunk)
+        : out(out), key(key), next_chunk(first_chunk), buf(plain), records(&buf) {}
+
+    void end_record(bool flush = false) {
+        if (plain.size() == 0 || (!flush && plain.size() < DB_CHUNK_BYTES)) return;
+        uint8_t nonce[DB_NONCE_BYTES], tag[DB_TAG_BYTES];
+        chunk_nonce(next_chunk++, nonce);
+        const uint32_t length = (uint32_t)plain.size();
+        dbSeal(key.data(), nonce, reinterpret_cast<const uint8_t*>(&length), sizeof(length), plain.data(), length, tag);
+        write_u32(out, length);
+        out.write(reinterpret_cast<const char*>(plain.data()), length);
+        out.write(reinterpret_cast<const char*>(tag), sizeof(tag));
+        plain.clear();
+    }
 
-        face_database_clustered.emplace_back(name, features);
+    std::ostream& out;
+    const LockedBuffer& key;
+    uint64_t next_chunk;
+    LockedBuffer plain;
+    LockedStreamBuf buf;
+    std::ostream records;   // 记录写到这里，序列化失败（锁定内存分配不到）时处于失败状态
+};
+
+// 调用者持有 rec->database_mutex。把当前内容重写成每人一条记录；
+// 先写临时文件再改名，写到一半被中断也不会损坏原数据库。设置了密钥时写成加密容器，并换一个新的文件 id
+static bool compact_database(FaceRecognizer* rec) {
+    if (!rec->db_writable) {
+        fprintf(stderr, "Error: DB file '%s' is read-only.\n", rec->database_path.c_str());
+        return false;
+    }
+    const std::string tmp_path = rec->database_path + ".tmp";
+    std::ofstream db_file(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!db_file.is_open()) {
+        fprintf(stderr, "Error: Could not open DB file '%s' for writing.\n", tmp_path.c_str());
+        return false;
+    }
+    LockedBuffer file_key;
+    uint64_t num_chunks = 0;
+    if (rec->db_key) {
+        if (!write_crypt_header(db_file, *rec->db_key, file_key)) {
+            fprintf(stderr, "Error: Could not generate a key for DB file '%s'.\n", rec->database_path.c_str());
+            db_file.close();
+            remove(tmp_path.c_str());
+            return false;
+        }
+        ChunkWriter writer(db_file, file_key, 0);
+        for (const auto& person : rec->database) {
+            write_person_record(writer.records, person);
+            writer.end_record();
+        }
+        writer.end_record(true);
+        if (!writer.records) db_file.setstate(std::ios::failbit);
+        num_chunks = writer.next_chunk;
+    } else {
+        write_header(db_file);
+        for (const auto& person : rec->database) write_person_record(db_file, person);
     }
     db_file.close();
-    printf("Loaded %zu clustered faces from DB '%s'.\n", face_database_clustered.size(), g_database_path.c_str());
+    if (!db_file || rename(tmp_path.c_str(), rec->database_path.c_str()) != 0) {
+        fprintf(stderr, "Error: Could not write DB file '%s'.\n", rec->database_path.c_str());
+        return false;
+    }
+    if (rec->db_key && rec->db_file_key.resize(DB_KEY_BYTES)) {
+        memcpy(rec->db_file_key.data(), file_key.data(), DB_KEY_BYTES);
+        rec->db_next_chunk = num_chunks;
+    }
+    rec->db_log_records = (long)rec->database.size();
+    printf("Saved %zu people to %sDB file.\n", rec->database.size(), rec->db_key ? "encrypted " : "");
+    return true;
 }
 
-static void save_database_clustered() {
-    std::ofstream db_file(g_database_path, std::ios::binary | std::ios::trunc);
+// 调用者持有 rec->database_mutex。把若干人的新模板和删除操作追加到数据库文件末尾，其他人的记录保持不动；
+// 加密时这一批记录（通常只有一个人）单独成为一块，不用重新加密其他块。
+// 返回 false 时文件中没有这批记录（至多留下之后加载时会丢弃的半条），调用者应撤销内存中的修改
+static bool append_records(FaceRecognizer* rec, const std::vector<const PersonTemplates*>& updated, const std::vector<std::string>& deleted) {
+    if (updated.empty() && deleted.empty()) return true;
+    if (!rec->db_writable) {
+        fprintf(stderr, "Error: DB file '%s' is read-only.\n", rec->database_path.c_str());
+        return false;
+    }
+    struct stat st;
+    const bool fresh = stat(rec->database_path.c_str(), &st) != 0 || st.st_size == 0;
+    // 加密的新文件先要有文件头和子密钥，整体写一次
+    if (rec->db_key && (fresh || rec->db_file_key.size() == 0)) return compact_database(rec);
+    std::ofstream db_file(rec->database_path, std::ios::binary | std::ios::app);
     if (!db_file.is_open()) {
-        fprintf(stderr, "Error: Could not open DB file '%s' for writing.\n", g_database_path.c_str());
+        fprintf(stderr, "Error: Could not open DB file '%s' for writing.\n", rec->database_path.c_str());
+        return false;
+    }
+    if (rec->db_key) {
+        ChunkWriter writer(db_file, rec->db_file_key, rec->db_next_chunk);
+        for (const auto* person : updated) {
+            write_person_record(writer.records, *person);
+            writer.end_record();
+        }
+        for (const auto& name : deleted) {
+            write_delete_record(writer.records, name);
+            writer.end_record();
+        }
+        writer.end_record(true);
+        if (!writer.records) db_file.setstate(std::ios::failbit);
+        // 写失败时用过的序号也不再使用，失败后的压缩反正会换一个文件 id
+        rec->db_next_chunk = writer.next_chunk;
+    } else {
+        if (fresh) write_header(db_file);
+        for (const auto* person : updated) write_person_record(db_file, *person);
+        for (const auto& name : deleted) write_delete_record(db_file, name);
+    }
+    db_file.close();
+    if (!db_file) {
+        // 末尾可能留下半条记录，整体重写一次，否则之后追加的记录在重放时都会被丢弃
+        fprintf(stderr, "Error: Could not append to DB file '%s', rewriting it.\n", rec->database_path.c_str());
+        return compact_database(rec);
+    }
+    rec->db_log_records += (long)(updated.size() + deleted.size());
+    // 记录已经写入；压缩失败时原文件不变，下次追加再试
+    if (rec->db_log_records > 2 * (long)rec->database.size() + DB_COMPACT_SLACK) compact_database(rec);
+    return true;
+}
+
+// 丢弃文件末尾不完整的部分，之后的追加才能接在一条完整记录后面
+static void truncate_database(FaceRecognizer* rec, std::streamoff valid_end) {
+    fprintf(stderr, "DB: dropping incomplete data after offset %lld in '%s'\n",
+            (long long)valid_end, rec->database_path.c_str());
+    if (truncate(rec->database_path.c_str(), valid_end) != 0) perror("truncate");
+}
+
+// 调用者持有 rec->database_mutex，db_file 位于文件开头。逐块校验，通过后解密到锁定内存中重放并立即清零，
+// 任何时候锁定内存中只有一块的明文记录；重放出的模板向量也在锁定内存中
+static void load_encrypted_database(FaceRecognizer* rec, std::ifstream& db_file) {
+    uint8_t header[DB_CRYPT_HEADER_BYTES], tag[DB_TAG_BYTES], nonce[DB_NONCE_BYTES];
+    if (!db_file.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+        !db_file.read(reinterpret_cast<char*>(tag), sizeof(tag))) {
+        db_file.close();
+        truncate_database(rec, 0);
+        return;
+    }
+    uint32_t version;
+    memcpy(&version, header + sizeof(DB_CRYPT_MAGIC), sizeof(version));
+    if (version > DB_CRYPT_VERSION) {
+        fprintf(stderr, "Encrypted DB '%s' has version %u, newer than supported %u; opened read-only.\n",
+                rec->database_path.c_str(), version, DB_CRYPT_VERSION);
+        rec->db_writable = false;
+        return;
+    }
+    if (!rec->db_key) {
+        fprintf(stderr, "DB '%s' is encrypted but no key is set; opened read-only.\n", rec->database_path.c_str());
+        rec->db_writable = false;
+        return;
+    }
+    check_nonce(nonce);
+    const uint8_t* file_id = header + sizeof(DB_CRYPT_MAGIC) + sizeof(version);
+    if (!derive_file_key(*rec->db_key, file_id, rec->db_file_key) ||
+        !dbOpen(rec->db_file_key.data(), nonce, header, sizeof(header), nullptr, 0, tag)) {
+        fprintf(stderr, "DB Error: the key does not match '%s', opened read-only.\n", rec->database_path.c_str());
+        rec->db_file_key.clear();
+        rec->db_writable = false;
         return;
     }
 
-    for (const auto& entry : face_database_clustered) {
-        const std::string& name = entry.first;
-        const auto& features = entry.second;
+    LockedBuffer plain;
+    uint64_t index = 0;
+    bool corrupt = false;
+    std::streamoff valid_end = db_file.tellg();
+    for (;; ++index) {
+        uint32_t length;
+        if (!read_u32(db_file, length)) break;
+        if (length > DB_MAX_CHUNK_BYTES || !plain.resize(length)) {
+            corrupt = true;
+            break;
+        }
+        if (!db_file.read(reinterpret_cast<char*>(plain.data()), length) ||
+            !db_file.read(reinterpret_cast<char*>(tag), sizeof(tag))) {
+            break;
+        }
+        chunk_nonce(index, nonce);
+        if (!dbOpen(rec->db_file_key.data(), nonce, reinterpret_cast<const uint8_t*>(&length), sizeof(length),
+                    plain.data(), length, tag)) {
+            // 最后一块通不过校验是写到一半断电，按不完整的末尾处理；中间的块通不过说明文件被改动或损坏
+            db_file.peek();
+            corrupt = !db_file.eof();
+            break;
+        }
+        MemoryStreamBuf buf(plain.data(), length);
+        std::istream records(&buf);
+        while (!corrupt && records.peek() != EOF) {
+            if (replay_record(rec, records)) rec->db_log_records++;
+            else corrupt = true;
+        }
+        plain.clear();
+        if (corrupt) break;
+        valid_end = db_file.tellg();
+    }
+    if (corrupt) {
+        fprintf(stderr, "DB Error: chunk %llu of '%s' failed authentication, opened read-only.\n",
+                (unsigned long long)index, rec->database_path.c_str());
+        clear_persons(rec);
+        rec->db_file_key.clear();
+        rec->db_writable = false;
+        return;
+    }
+    rec->db_next_chunk = index;
+    db_file.clear();
+    db_file.seekg(0, std::ios::end);
+    const std::streamoff file_end = db_file.tellg();
+    db_file.close();
 
-        int name_len = name.length();
-        db_file.write(reinterpret_cast<const char*>(&name_len), sizeof(name_len));
-        db_file.write(name.c_str(), name_len);
+    printf("Loaded %zu people (%ld records, %llu encrypted chunks) from DB '%s'.\n", rec->database.size(),
+           rec->db_log_records, (unsigned long long)index, rec->database_path.c_str());
+    if (file_end > valid_end) {
+        // 被截掉的那一块可能已经有一部分落盘，它的序号不能再用来加密别的内容，换一个文件 id 重写
+        truncate_database(rec, valid_end);
+        if (!compact_database(rec)) rec->db_writable = false;
+    } else if (rec->db_log_records > 2 * (long)rec->database.size() + DB_COMPACT_SLACK) {
+        compact_database(rec);
+    }
+}
 
-        int num_features = features.size();
-        db_file.write(reinterpret_cast<const char*>(&num_features), sizeof(num_features));
+// 调用者持有 rec->database_mutex
+static void load_database(FaceRecognizer* rec) {
+    clear_persons(rec);
+    rec->db_log_records = 0;
+    rec->db_writable = true;
+    rec->db_file_key.clear();
+    std::ifstream db_file(rec->database_path, std::ios::binary);
+    if (!db_file.is_open()) {
+        printf("Face DB file '%s' not found. A new one will be created upon registration.\n", rec->database_path.c_str());
+        return;
+    }
 
-        for (const auto& feature : features) {
-            db_file.write(reinterpret_cast<const char*>(feature.ptr<float>(0)), 128 * sizeof(float));
+    char magic[sizeof(DB_MAGIC)];
+    const bool has_magic = (bool)db_file.read(magic, sizeof(magic));
+    if (has_magic && memcmp(magic, DB_CRYPT_MAGIC, sizeof(magic)) == 0) {
+        db_file.seekg(0);
+        load_encrypted_database(rec, db_file);
+        return;
+    }
+    if (has_magic && memcmp(magic, DB_MAGIC, sizeof(magic)) != 0) {
+        db_file.clear();
+        db_file.seekg(0);
+        if (!load_legacy_database(rec, db_file)) {
+            fprintf(stderr, "DB Error: '%s' is corrupt, opened read-only.\n", rec->database_path.c_str());
+            clear_persons(rec);
+            rec->db_writable = false;
+            return;
         }
+        db_file.close();
+        printf("Converting legacy DB '%s' (%zu people) to the record log format.\n",
+               rec->database_path.c_str(), rec->database.size());
+        compact_database(rec);
+        return;
+    }
+
+    uint32_t version = 0;
+    if (!db_file || !read_u32(db_file, version)) {
+        // 文件头都没写完，相当于空库
+        db_file.close();
+        truncate_database(rec, 0);
+        return;
     }
+    if (version > DB_VERSION) {
+        fprintf(stderr, "DB '%s' has version %u, newer than supported %u; opened read-only.\n",
+                rec->database_path.c_str(), version, DB_VERSION);
+        rec->db_writable = false;
+        return;
+    }
+
+    std::streamoff valid_end = db_file.tellg();
+    while (replay_record(rec, db_file)) {
+        rec->db_log_records++;
+        valid_end = db_file.tellg();
+    }
+    db_file.clear();
+    db_file.seekg(0, std::ios::end);
+    const std::streamoff file_end = db_file.tellg();
     db_file.close();
-    printf("Saved %zu clustered faces to DB file.\n", face_database_clustered.size());
+    if (file_end > valid_end) truncate_database(rec, valid_end);
+
+    printf("Loaded %zu people (%ld records) from DB '%s'.\n", rec->database.size(), rec->db_log_records,
+           rec->database_path.c_str());
+    if (rec->db_key) {
+        printf("Encrypting DB '%s'.\n", rec->database_path.c_str());
+        compact_database(rec);
+    } else if (rec->db_log_records > 2 * (long)rec->database.size() + DB_COMPACT_SLACK) {
+        compact_database(rec);
+    }
 }
 
-static bool is_name_registered(const std::string& name) {
-    for (const auto& entry : face_database_clustered) {
-        if (entry.first == name) return true;
+// 持有 database_mutex 的独占锁并保证数据库已经加载。创建识别器时不读数据库文件，
+// 库很大时加载要花不少时间，推到第一次识别、注册或导入时再做，不耽误视频启动
+struct DatabaseLock {
+    std::lock_guard<DatabaseRwLock> guard;
+    explicit DatabaseLock(FaceRecognizer* rec) : guard(rec->database_mutex) {
+        if (rec->database_loaded) return;
+        const long long start = face_recognizer_now_ms();
+        load_database(rec);
+        rec->database_loaded = true;
+        printf("Face DB loaded on first use: %zu people in %lld ms.\n",
+               rec->database.size(), face_recognizer_now_ms() - start);
+    }
+};
+
+// 持有 database_mutex 的共享锁并保证数据库已经加载，只读 database 和 person_slots 的地方用它。
+// 第一次访问时先以独占锁加载
+struct DatabaseReadLock {
+    FaceRecognizer* rec;
+    explicit DatabaseReadLock(FaceRecognizer* rec) : rec(rec) {
+        if (!rec->database_loaded) DatabaseLock load(rec);
+        rec->database_mutex.lock_shared();
+    }
+    ~DatabaseReadLock() { rec->database_mutex.unlock_shared(); }
+    DatabaseReadLock(const DatabaseReadLock&) = delete;
+    DatabaseReadLock& operator=(const DatabaseReadLock&) = delete;
+};
+
+// 颜色转换时按色度对齐扩大后的区域，每个线程复用一块
+static thread_local cv::Mat crop_aligned;
+
+// 从原始格式图像中裁剪出一个人脸区域并只对这一小块做颜色转换，结果复制到 bgr（尺寸不变时不重新分配）
+static bool crop_raw_to_bgr(const unsigned char *buf, int width, int height, int stride,
+                            unsigned int fourcc, const cv::Rect& roi, cv::Mat& bgr) {
+    cv::Mat& aligned = crop_aligned;
+    int x0 = roi.x & ~1, y0 = roi.y;
+    if (fourcc == V4L2_PIX_FMT_YUYV) {
+        // YUYV 两个像素共享一组色度，横向必须按偶数对齐
+        int x1 = std::min((roi.x + roi.width + 1) & ~1, width & ~1);
+        if (x1 - x0 < 2) return false;
+        cv::Mat yuyv(height, width, CV_8UC2, (void *)buf, (size_t)stride);
+        cv::cvtColor(yuyv(cv::Rect(x0, roi.y, x1 - x0, roi.height)), aligned, cv::COLOR_YUV2BGR_YUYV);
+    } else if (fourcc == V4L2_PIX_FMT_NV12) {
+        // NV12 的色度是 2x2 下采样，横纵都按偶数对齐
+        y0 = roi.y & ~1;
+        int x1 = std::min((roi.x + roi.width + 1) & ~1, width & ~1);
+        int y1 = std::min((roi.y + roi.height + 1) & ~1, height & ~1);
+        if (x1 - x0 < 2 || y1 - y0 < 2) return false;
+        cv::Mat y_plane(height, width, CV_8UC1, (void *)buf, (size_t)stride);
+        cv::Mat uv_plane(height / 2, width / 2, CV_8UC2, (void *)(buf + (size_t)stride * height), (size_t)stride);
+        cv::cvtColorTwoPlane(y_plane(cv::Rect(x0, y0, x1 - x0, y1 - y0)),
+                             uv_plane(cv::Rect(x0 / 2, y0 / 2, (x1 - x0) / 2, (y1 - y0) / 2)),
+                             aligned, cv::COLOR_YUV2BGR_NV12);
+    } else {
+        return false;
+    }
+    // 宽高为奇数的图像最后一行/列没有完整的色度，落在那里的区域转换不出来
+    const cv::Rect inner(roi.x - x0, roi.y - y0, roi.width, roi.height);
+    if ((inner & cv::Rect(0, 0, aligned.cols, aligned.rows)) != inner) return false;
+    aligned(inner).copyTo(bgr);
+    return true;
+}
+
+// 计数并在 1、2、4、8... 次时打印，避免日志刷屏
+static void count_event(const RecognitionStream* stream, std::atomic<unsigned long>& counter, const char *what) {
+    unsigned long n = ++counter;
+    if ((n & (n - 1)) == 0) fprintf(stderr, "Recognition queue [%s]: %lu tasks %s so far\n", stream->name.c_str(), n, what);
+}
+
+// a 是否比 b 更应该先处理：优先级高的优先，同优先级截止时间早的优先，再其次是更新的切片
+static bool task_before(const RecognitionTask& a, const RecognitionTask& b) {
+    if (a.priority != b.priority) return a.priority > b.priority;
+    long long da = a.deadline_ms ? a.deadline_ms : LLONG_MAX;
+    long long db = b.deadline_ms ? b.deadline_ms : LLONG_MAX;
+    if (da != db) return da < db;
+    return a.capture_ms > b.capture_ms;
+}
+
+// 以下三个函数的调用者持有 queue_mutex
+// 从结果流的缓冲区池中取一块能放下 rows x cols 切片的缓冲区，池空或都太小时按最大尺寸新分配
+static cv::Mat take_chip_buffer(RecognitionStream* stream, int rows, int cols) {
+    stream->chip_rows = std::max(stream->chip_rows, rows);
+    stream->chip_cols = std::max(stream->chip_cols, cols);
+    auto& pool = stream->chip_pool;
+    while (!pool.empty()) {
+        cv::Mat buffer = pool.back();
+        pool.pop_back();
+        if (buffer.rows >= rows && buffer.cols >= cols) return buffer;
+    }
+    return cv::Mat(stream->chip_rows, stream->chip_cols, CV_8UC3);
+}
+
+// 任务不再需要切片时把缓冲区还给池
+static void recycle_chip(RecognitionStream* stream, RecognitionTask& task) {
+    task.chip.release();
+    if (task.chip_buffer.empty()) return;
+    stream->chip_pool.push_back(task.chip_buffer);
+    task.chip_buffer.release();
+}
+
+// 删除一个结果流中已过期的任务
+static void drop_expired_tasks(RecognitionStream* stream, long long now) {
+    auto& queue = stream->queue;
+    for (size_t i = 0; i < queue.size();) {
+        if (queue[i].deadline_ms && queue[i].deadline_ms < now) {
+            recycle_chip(stream, queue[i]);
+            queue[i] = std::move(queue.back());
+            queue.pop_back();
+            count_event(stream, stream->expired, "expired");
+        } else {
+            ++i;
+        }
+    }
+}
+
+// 把一批人脸放入结果流的调度队列，返回提交编号；一张都没有入队时返回-1
+static int enqueue_tasks(RecognitionStream* stream, std::vector<RecognitionTask>& tasks) {
+    FaceRecognizer* rec = stream->owner;
+    std::lock_guard<std::mutex> lock(rec->queue_mutex);
+    if (stream->closing || rec->exiting) return -1;
+    // 编号先只取不占，至少一张入队后才递增，被拒绝的提交不消耗编号
+    const int id = rec->next_submission_id;
+    auto& queue = stream->queue;
+    drop_expired_tasks(stream, face_recognizer_now_ms());
+
+    int accepted = 0;
+    for (RecognitionTask& task : tasks) {
+        task.submission_id = id;   // 没有入队的任务随即丢弃，编号不会出现在结果里
+        // 同一追踪器已有排队的切片：用新的替换旧的
+        auto same = queue.end();
+        if (task.track_id >= 0) {
+            same = std::find_if(queue.begin(), queue.end(),
+                                [&](const RecognitionTask& t) { return t.track_id == task.track_id; });
+        }
+        if (same != queue.end()) {
+            recycle_chip(stream, *same);
+            *same = std::move(task);
+            count_event(stream, stream->replaced, "replaced by newer frames");
+            accepted++;
+            continue;
+        }
+        if (queue.size() < MAX_QUEUED_TASKS) {
+            queue.push_back(std::move(task));
+            accepted++;
+            continue;
+        }
+        // 队列已满：挤掉价值最低的任务，除非新任务本身就是价值最低的
+        auto worst = std::min_element(queue.begin(), queue.end(),
+                                      [](const RecognitionTask& a, const RecognitionTask& b) { return task_before(b, a); });
+        if (task_before(task, *worst)) {
+            recycle_chip(stream, *worst);
+            *worst = std::move(task);
+            accepted++;
+        } else {
+            recycle_chip(stream, task);
+        }
+        count_event(stream, stream->rejected, "rejected or evicted");
+    }
+    if (accepted == 0) return -1;
+    if (++rec->next_submission_id <= 0) rec->next_submission_id = 1;
+    stream->submitted += accepted;
+    if (accepted > 1) rec->queue_cv.notify_all();
+    else rec->queue_cv.notify_one();
+    return id;
+}
+
+// 从 next_stream 开始轮转，取第一个非空结果流中最该处理的任务，调用者持有 queue_mutex。
+// 所有队列都为空（或全部过期）时返回 false
+static bool pop_next_task(FaceRecognizer* rec, RecognitionTask& out, RecognitionStream*& from) {
+    const long long now = face_recognizer_now_ms();
+    const size_t n = rec->streams.size();
+    for (size_t k = 0; k < n; ++k) {
+        const size_t index = (rec->next_stream + k) % n;
+        RecognitionStream* stream = rec->streams[index];
+        drop_expired_tasks(stream, now);
+        auto& queue = stream->queue;
+        if (queue.empty()) continue;
+        auto best = std::min_element(queue.begin(), queue.end(), task_before);
+        out = std::move(*best);
+        *best = std::move(queue.back());
+        queue.pop_back();
+        stream->in_flight++;
+        rec->next_stream = (index + 1) % n;
+        from = stream;
+        return true;
     }
     return false;
 }
 
-// --- 消费者线程函数 ---
-void recognition_worker_func() {
-    while (!exit_flag) {
-        RecognitionTask task;
-        {
-            std::unique_lock<std::mutex> lock(task_queue_mutex);
+// 一个任务处理完（或被放弃），正在关闭的结果流可能在等它
+static void finish_task(RecognitionStream* stream, RecognitionTask& task) {
+    FaceRecognizer* rec = stream->owner;
+    std::lock_guard<std::mutex> lock(rec->queue_mutex);
+    recycle_chip(stream, task);
+    if (--stream->in_flight == 0 && stream->closing) rec->idle_cv.notify_all();
+}
+
+// 环形缓冲区是否已满；已满时结果无处可写，不必浪费一次推理
+static bool ring_full(RecognitionStream* stream) {
+    const unsigned int head = stream->ring_head.load(std::memory_order_relaxed);
+    if (head - stream->ring_tail.load(std::memory_order_acquire) < stream->ring_capacity) return false;
+    count_event(stream, stream->dropped, "dropped because the result ring is full");
+    return true;
+}
 
-            task_queue_cv.wait(lock, []{ return !task_queue.empty() || exit_flag; });
-            if (exit_flag) break;
-            
-            task = task_queue.front();
-            task_queue.pop();
+// 把一个候选按分数降序插入 top（容量 capacity），返回新的候选数。
+// 同一身份只保留最高分：分片迁移期间同一个人可能同时出现在两个分片中
+static int insert_candidate(RecognitionCandidate* top, int count, int capacity, int identity_id, float score) {
+    for (int k = 0; k < count; ++k) {
+        if (top[k].identity_id != identity_id) continue;
+        if (top[k].score >= score) return count;
+        for (int j = k; j + 1 < count; ++j) top[j] = top[j + 1];
+        --count;
+        break;
+    }
+    int pos = count;
+    while (pos > 0 && top[pos - 1].score < score) --pos;
+    if (pos >= capacity) return count;
+    int last = std::min(count, capacity - 1);
+    for (int k = last; k > pos; --k) top[k] = top[k - 1];
+    top[pos].identity_id = identity_id;
+    top[pos].score = score;
+    return std::min(count + 1, capacity);
+}
+
+// 与本实例库中的所有模板比对，每人取最相似的聚类中心，合并进 top；返回新的候选数
+static int scan_database(FaceRecognizer* rec, const float* feature, RecognitionCandidate* top, int count, int capacity) {
+    const cv::Mat query(1, FACE_FEATURE_DIM, CV_32F, (void*)feature);
+    DatabaseReadLock db_lock(rec);
+    for (const auto& person : rec->database) {
+        if (person.clusters.empty()) continue;
+        float person_score = -1.f;
+        for (const auto& cluster : person.clusters) {
+            person_score = std::max(person_score, (float)query.dot(cluster.center));
         }
+        count = insert_candidate(top, count, capacity, person.id, person_score);
+    }
+    return count;
+}
 
-        //  执行耗时的识别任务 
-        RecognitionResultVec results;
-        for (const auto& face_rect : task.faces) {
-            cv::Rect roi(face_rect.x, face_rect.y, face_rect.width, face_rect.height);
-            roi = roi & cv::Rect(0, 0, task.image.cols, task.image.rows); 
-            if(roi.width <= 1 || roi.height <= 1) continue;
+// 分片连接出错：关闭连接，SHARD_RETRY_MS 之内不再重连
+static void shard_failed(FaceRecognizer* rec, ShardConnection& shard, const char* what) {
+    if (shard.fd >= 0) close(shard.fd);
+    shard.fd = -1;
+    shard.pending_request = 0;
+    shard.retry_after_ms = face_recognizer_now_ms() + SHARD_RETRY_MS;
+    unsigned long n = ++rec->shard_failures;
+    if ((n & (n - 1)) == 0) {
+        fprintf(stderr, "Gallery shard %s: %s failed (%lu shard failures so far)\n", shard.address.c_str(), what, n);
+    }
+}
 
-            cv::Mat face_chip = task.image(roi);
-            cv::Mat feature;
-            if (get_feature(face_chip, feature) != 0) continue; 
-            
-            // --- 与数据库中的所有模板进行比对 ---
-            float best_score = 0.f;
-            std::string best_name = "Unknown";
-
-            for (const auto& db_entry : face_database_clustered) {       
-                for (const auto& cluster_center : db_entry.second) {    
-                    double score = cosine_similarity(feature, cluster_center);
-                    if (score > best_score) {
-                        best_score = score;
-                        if (score > THRESHOLD) {
-                            best_name = db_entry.first;
-                        } else {
-                            best_name = "Unknown";
-                        }
-                    }
+// 把特征同时发给这个推理线程连接的所有分片，在 shard_timeout_ms 内收集回复并合并进 top；
+// 超时的分片这一次不参与合并，连接保留，它迟到的回复在下一次查询时按请求号丢弃。返回新的候选数
+static int query_shards(FaceRecognizer* rec, InferenceWorker& worker, const float* feature,
+                        RecognitionCandidate* top, int count, int capacity) {
+    const long long deadline = face_recognizer_now_ms() + rec->shard_timeout_ms;
+    int pending = 0;
+    for (auto& shard : worker.shards) {
+        shard.pending_request = 0;
+        if (shard.fd < 0) {
+            if (face_recognizer_now_ms() < shard.retry_after_ms) continue;
+            shard.fd = gallery_rpc_connect(shard.address.c_str(), rec->shard_timeout_ms);
+            if (shard.fd < 0) {
+                shard_failed(rec, shard, "connect");
+                continue;
+            }
+            shard.reader.used = 0;
+            shard.reader.frame_size = 0;
+        }
+        const uint32_t request_id = shard.next_request++;
+        if (shard.next_request == 0) shard.next_request = 1;
+        if (gallery_rpc_send_query(shard.fd, request_id, feature, FACE_FEATURE_DIM, capacity) != 0) {
+            shard_failed(rec, shard, "send");
+            continue;
+        }
+        shard.pending_request = request_id;
+        pending++;
+    }
+
+    struct pollfd fds[GALLERY_MAX_SHARDS];
+    ShardConnection* owners[GALLERY_MAX_SHARDS];
+    while (pending > 0) {
+        const long long now = face_recognizer_now_ms();
+        if (now >= deadline) break;
+        int n = 0;
+        for (auto& shard : worker.shards) {
+            if (!shard.pending_request) continue;
+            fds[n].fd = shard.fd;
+            fds[n].events = POLLIN;
+            fds[n].revents = 0;
+            owners[n++] = &shard;
+        }
+        int ready = poll(fds, n, (int)(deadline - now));
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("poll gallery shards");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (!fds[i].revents) continue;
+            ShardConnection& shard = *owners[i];
+            GalleryRpcHeader header;
+            const unsigned char *payload;
+            int got;
+            while ((got = gallery_rpc_read_frame(shard.fd, &shard.reader, &header, &payload)) == 1) {
+                if (header.type != GALLERY_MSG_REPLY || header.request_id != shard.pending_request) continue;
+                GalleryHit hits[GALLERY_MAX_HITS];
+                const int num_hits = gallery_rpc_decode_reply(payload, header.length, hits, GALLERY_MAX_HITS);
+                if (num_hits < 0) {
+                    got = -1;
+                    break;
                 }
+                // 分片只知道名字，身份 id 由本进程的身份表分配
+                for (int h = 0; h < num_hits; ++h) {
+                    count = insert_candidate(top, count, capacity, identity_for(hits[h].name), hits[h].score);
+                }
+                shard.pending_request = 0;
+                pending--;
+                break;
+            }
+            if (got < 0) {
+                shard_failed(rec, shard, "read");
+                pending--;
+            }
+        }
+    }
+
+    for (auto& shard : worker.shards) {
+        if (!shard.pending_request) continue;
+        unsigned long n = ++rec->shard_timeouts;
+        if ((n & (n - 1)) == 0) {
+            fprintf(stderr, "Gallery shard %s: no reply within %d ms (%lu shard timeouts so far)\n",
+                    shard.address.c_str(), rec->shard_timeout_ms, n);
+        }
+    }
+    return count;
+}
+
+// 与本地库和所有分片中的模板进行比对，每人取最相似的聚类中心，结果写到 res
+static void match_feature(FaceRecognizer* rec, InferenceWorker& worker, const cv::Mat& feature, RecognitionResult& res) {
+    RecognitionCandidate top[RECOGNITION_TOP_K];
+    const float *fp = feature.ptr<float>();
+    int num_top = insert_candidate(top, 0, RECOGNITION_TOP_K, FACE_IDENTITY_NONE, THRESHOLD);
+    num_top = scan_database(rec, fp, top, num_top, RECOGNITION_TOP_K);
+    if (!worker.shards.empty()) num_top = query_shards(rec, worker, fp, top, num_top, RECOGNITION_TOP_K);
+
+    // 单帧结论与原先一致：最高分超过阈值才给出名字
+    float best_score = 0.f;
+    int best_id = FACE_IDENTITY_NONE;
+    for (int k = 0; k < num_top; ++k) {
+        if (top[k].identity_id == FACE_IDENTITY_NONE) continue;
+        best_score = std::max(top[k].score, 0.f);
+        if (top[k].score > THRESHOLD) best_id = top[k].identity_id;
+        break;
+    }
+    res.state = best_id == FACE_IDENTITY_NONE ? RECOGNITION_STATE_UNKNOWN : RECOGNITION_STATE_KNOWN;
+    res.identity_id = best_id;
+    res.score = best_score;
+    std::copy(fp, fp + FACE_FEATURE_DIM, res.feature);
+    res.num_candidates = num_top;
+    std::copy(top, top + num_top, res.candidates);
+}
+
+// 把一条结果写进结果流的环形缓冲区并通知消费者，缓冲区已满时返回 false
+static bool publish_result(RecognitionStream* stream, const RecognitionTask& task, const RecognitionResult& match) {
+    RecognitionResultCallback callback;
+    void *callback_user;
+    {
+        std::lock_guard<std::mutex> lock(stream->ring_mutex);
+        const unsigned int head = stream->ring_head.load(std::memory_order_relaxed);
+        if (head - stream->ring_tail.load(std::memory_order_acquire) >= stream->ring_capacity) {
+            // 推理期间其他线程写满了缓冲区
+            count_event(stream, stream->dropped, "dropped because the result ring is full");
+            return false;
+        }
+        RecognitionResult& res = stream->ring_slots[head & (stream->ring_capacity - 1)];
+        res = match;
+        res.rect = task.face;
+        res.submission_id = task.submission_id;
+        res.track_id = task.track_id;
+        stream->ring_head.store(head + 1, std::memory_order_release);
+        callback = stream->callback;
+        callback_user = stream->callback_user;
+    }
+    uint64_t one = 1;
+    if (write(stream->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) perror("write eventfd");
+    if (callback) callback(callback_user);
+    return true;
+}
+
+// --- 推理线程 ---
+// 每个推理线程用自己的网络，轮流为各个结果流服务
+static void recognition_worker_func(FaceRecognizer* rec, InferenceWorker* worker) {
+    for (;;) {
+        RecognitionTask task;
+        RecognitionStream* stream = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(rec->queue_mutex);
+            while (!rec->exiting && !pop_next_task(rec, task, stream)) rec->queue_cv.wait(lock);
+            if (rec->exiting) break;
+            if (worker->cpu_generation != rec->cpu_generation) {
+                worker->cpu_generation = rec->cpu_generation;
+                face_recognizer_set_thread_cpu(rec->cpu_config.cpu_mask, rec->cpu_config.nice);
             }
-            //  将识别结果打包 
-            RecognitionResult res;
-            res.rect = face_rect;
-            strncpy(res.name, best_name.c_str(), sizeof(res.name) - 1);
-            res.name[sizeof(res.name) - 1] = '\0';
-            res.score = best_score;
-            results.push_back(res);
         }
-        {   
-            std::lock_guard<std::mutex> lock(result_queue_mutex);
-            result_queue.push(results);
+
+        if (!ring_full(stream)) {
+            const long long start = face_recognizer_now_ms();
+            cv::Mat feature;
+            if (get_feature(*worker, task.chip, feature) == 0) {
+                RecognitionResult match;
+                match_feature(rec, *worker, feature, match);
+                const long long end = face_recognizer_now_ms();
+                if (publish_result(stream, task, match)) {
+                    stream->completed++;
+                    if (task.capture_ms > 0) stream->wait_ms_total += start - task.capture_ms;
+                    stream->inference_ms_total += end - start;
+                }
+            }
         }
-        result_queue_cv.notify_one();
+        finish_task(stream, task);
     }
     printf("Recognition worker thread has exited.\n");
 }
 
+// --- 批量导入 ---
+static const int IMPORT_CHECKPOINT_PEOPLE = 100;   // 每导入多少人写一次数据库，中断后可以从这里继续
+static const int IMPORT_MAX_IMAGE_SIDE = 1280;     // 更大的照片先缩小再检测
+static const int IMPORT_EMBED_BATCH = 16;          // 每次前向推理的切片数
+
+struct ImportPerson {
+    std::string name;
+    std::vector<std::string> files;
+};
+
+static bool has_image_extension(const char *file_name) {
+    const char *dot = strrchr(file_name, '.');
+    if (!dot) return false;
+    std::string ext(dot + 1);
+    for (auto& c : ext) c = (char)tolower((unsigned char)c);
+    return ext == "jpg" || ext == "jpeg" || ext == "png" || ext == "bmp";
+}
+
+static bool is_directory(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// 按 <root>/<name>/*.jpg 的布局列出所有人和他们的照片，按名字排序保证每次运行顺序一致
+static int list_import_people(const std::string& root, std::vector<ImportPerson>& people) {
+    DIR *dir = opendir(root.c_str());
+    if (!dir) {
+        perror(root.c_str());
+        return -1;
+    }
+    while (struct dirent *entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') continue;
+        ImportPerson person;
+        person.name = entry->d_name;
+        const std::string person_dir = root + "/" + person.name;
+        if (!is_directory(person_dir)) continue;
+
+        DIR *sub = opendir(person_dir.c_str());
+        if (!sub) continue;
+        while (struct dirent *file = readdir(sub)) {
+            if (file->d_name[0] != '.' && has_image_extension(file->d_name)) {
+                person.files.push_back(person_dir + "/" + file->d_name);
+            }
+        }
+        closedir(sub);
+        std::sort(person.files.begin(), person.files.end());
+        if (!person.files.empty()) people.push_back(std::move(person));
+    }
+    closedir(dir);
+    std::sort(people.begin(), people.end(),
+              [](const ImportPerson& a, const ImportPerson& b) { return a.name < b.name; });
+    return 0;
+}
+
+// 名字到分片的映射（FNV-1a），只取决于名字本身，各分片用同一个照片目录导入时互不重叠
+static uint32_t partition_hash(const std::string& name) {
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : name) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// 解码、检测一个人的全部照片，批量提取特征并聚类；可以在多个线程中同时调用
+static int import_one_person(FaceRecognizer* rec, const ImportPerson& person, PersonTemplates& out,
+                             std::atomic<int>& images_done, std::atomic<int>& faces_embedded) {
+    std::vector<cv::Mat> chips;
+    for (const auto& file : person.files) {
+        if (rec->import_cancelled) return -1;
+        cv::Mat img = cv::imread(file, cv::IMREAD_COLOR);
+        images_done++;
+        if (img.empty()) {
+            fprintf(stderr, "Failed to read image %s\n", file.c_str());
+            continue;
+        }
+        int side = std::max(img.cols, img.rows);
+        if (side > IMPORT_MAX_IMAGE_SIDE) {
+            double scale = (double)IMPORT_MAX_IMAGE_SIDE / side;
+            cv::resize(img, img, cv::Size(), scale, scale, cv::INTER_AREA);
+        }
+        cv::Mat chip;
+        if (detect_largest_face(img, chip) == 0) chips.push_back(chip);
+    }
+
+    std::vector<cv::Mat> all_features, batch_features;
+    for (size_t start = 0; start < chips.size(); start += IMPORT_EMBED_BATCH) {
+        size_t end = std::min(chips.size(), start + IMPORT_EMBED_BATCH);
+        std::vector<cv::Mat> batch(chips.begin() + start, chips.begin() + end);
+        if (get_features_batch(rec, borrow_worker(rec), batch, batch_features) != 0) return -1;
+        all_features.insert(all_features.end(), batch_features.begin(), batch_features.end());
+        faces_embedded += (int)batch_features.size();
+    }
+
+    if (all_features.size() < (size_t)MIN_REGISTRATION_SAMPLES) return -1;
+    out.name = person.name;
+    add_samples(out, all_features);
+    return 0;
+}
+
+// 把已经完成的人一次性加入数据库，每人追加一条记录
+static void commit_imported(FaceRecognizer* rec, std::vector<PersonTemplates>& imported) {
+    if (imported.empty()) return;
+    DatabaseLock lock(rec);
+    auto& database = rec->database;
+    const size_t first = database.size();
+    for (auto& person : imported) {
+        if (find_person(rec, person.name) >= 0) continue;
+        database[add_person(rec, person.name)].clusters = std::move(person.clusters);
+    }
+    std::vector<const PersonTemplates*> added;
+    for (size_t i = first; i < database.size(); ++i) added.push_back(&database[i]);
+    append_records(rec, added, std::vector<std::string>());
+    imported.clear();
+}
+
+// 在 path 上用合成的人脸库测一种格式：整库重写、追加一条记录和加载的平均耗时，key 为空时是明文
+static void benchmark_database_format(const std::string& path, const std::shared_ptr<const LockedBuffer>& key,
+                                      int people, int runs, DatabaseBenchmark& out) {
+    typedef std::chrono::steady_clock Clock;
+    auto ms_since = [](Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    };
+    FaceRecognizer rec;
+    rec.database_path = path;
+    rec.db_key = key;
+    std::lock_guard<DatabaseRwLock> lock(rec.database_mutex);
+    rec.database_loaded = true;
+    remove(path.c_str());
+
+    // 每人按上限的一半放聚类，与实际注册几次之后的大小相近
+    cv::RNG rng(12345);
+    for (int i = 0; i < people; ++i) {
+        char name[32];
+        snprintf(name, sizeof(name), "benchmark_%06d", i);
+        PersonTemplates& person = rec.database[add_person(&rec, name)];
+        for (int c = 0; c < MAX_CLUSTERS_PER_PERSON / 2; ++c) {
+            TemplateCluster cluster;
+            cluster.sum.create(1, FACE_FEATURE_DIM, CV_32F);
+            rng.fill(cluster.sum, cv::RNG::NORMAL, 0, 1);
+            cluster.count = 1;
+            refresh_center(cluster);
+            person.clusters.push_back(cluster);
+        }
+    }
+
+    Clock::time_point start = Clock::now();
+    for (int r = 0; r < runs; ++r) compact_database(&rec);
+    out.save_ms = ms_since(start) / runs;
+    struct stat st;
+    out.file_bytes = stat(path.c_str(), &st) == 0 ? (long)st.st_size : 0;
+
+    start = Clock::now();
+    for (int r = 0; r < runs; ++r) append_records(&rec, { &rec.database[r % people] }, std::vector<std::string>());
+    out.append_ms = ms_since(start) / runs;
+
+    start = Clock::now();
+    for (int r = 0; r < runs; ++r) load_database(&rec);
+    out.load_ms = ms_since(start) / runs;
+
+    clear_persons(&rec);
+    remove(path.c_str());
+}
 
 // --- C风格API实现 ---
 // 所有对外接口都放在这个 extern "C" 块中
 extern "C" {
 
-int face_recognizer_init(const char *model_path, const char* db_path) {
-    g_database_path = db_path;
-    try {
-        net = cv::dnn::readNet(model_path);
-        if (net.empty()) return -1;
-    } catch (const cv::Exception& e) {
-        fprintf(stderr, "OpenCV Exception during model loading: %s\n", e.what());
-        return -1;
+FaceRecognizer *face_recognizer_create(const char *model_path, const char *db_path, int num_workers) {
+    if (num_workers <= 0) num_workers = 1;
+    if (!model_path) num_workers = 0;      // 分片节点只需要人脸库
+    FaceRecognizer *rec = new FaceRecognizer;
+    rec->database_path = db_path;
+    {
+        std::lock_guard<std::mutex> lock(database_key_mutex);
+        rec->db_key = database_key;
+    }
+    // 优先使用编译缓存：权重只映射一份，启动时不再解析 ONNX；编译不了的模型照旧交给 cv::dnn
+    std::shared_ptr<CompiledModel> compiled;
+    if (num_workers > 0) {
+        compiled = CompiledModel::open(model_path, 3, INPUT_SIZE.height, INPUT_SIZE.width);
+        if (compiled && compiled->outputSize() != FACE_FEATURE_DIM) {
+            fprintf(stderr, "Compiled model outputs %d values instead of %d, using cv::dnn.\n",
+                    compiled->outputSize(), FACE_FEATURE_DIM);
+            compiled.reset();
+        }
+        // 执行器一次只处理一张切片
+        if (compiled) rec->batch_forward_supported = false;
+    }
+    // 否则每个推理线程读一份自己的网络，cv::dnn::Net 的拷贝共享内部状态，不能代替重新加载
+    for (int i = 0; i < num_workers; ++i) {
+        std::unique_ptr<InferenceWorker> worker(new InferenceWorker);
+        if (compiled) {
+            worker->executor.reset(new ModelExecutor(compiled));
+            rec->workers.push_back(std::move(worker));
+            continue;
+        }
+        try {
+            worker->net = cv::dnn::readNet(model_path);
+        } catch (const cv::Exception& e) {
+            fprintf(stderr, "OpenCV Exception during model loading: %s\n", e.what());
+        }
+        if (worker->net.empty()) {
+            delete rec;
+            return NULL;
+        }
+        rec->workers.push_back(std::move(worker));
     }
 
-    load_database_clustered();
+    // 预热：第一次 forward 时 OpenCV 才分配各层的缓冲区、选择实现，比之后慢好几倍，不让它落在第一张人脸上；
+    // 编译好的模型第一次执行时要把映射的权重读进页缓存，同样在这里完成
+    if (!rec->workers.empty()) {
+        const long long start = face_recognizer_now_ms();
+        const cv::Mat blank(INPUT_SIZE, CV_8UC3, cv::Scalar::all(128));
+        cv::Mat feature;
+        for (auto& worker : rec->workers) get_feature(*worker, blank, feature);
+        printf("Warm-up inference on %zu networks took %lld ms.\n", rec->workers.size(), face_recognizer_now_ms() - start);
+    } else {
+        // 分片节点只为回答查询而存在，立即加载，第一次查询不必等它
+        DatabaseLock lock(rec);
+    }
 
-    exit_flag = false;
-    worker_thread = std::thread(recognition_worker_func);
-    printf("Face recognizer (Clustered Features) initialized.\n");
-    return 0;
+    for (auto& worker : rec->workers) {
+        worker->thread = std::thread(recognition_worker_func, rec, worker.get());
+    }
+    if (num_workers > 0) printf("Face recognizer (Clustered Features) initialized with %d inference threads.\n", num_workers);
+    else printf("Face gallery loaded without a model (%zu people).\n", rec->database.size());
+    return rec;
 }
 
-void face_recognizer_cleanup() {
-    if (exit_flag) return;
-    exit_flag = true;
-    task_queue_cv.notify_all();
-    result_queue_cv.notify_all();
-    if (worker_thread.joinable()) {
-        worker_thread.join();
+void face_recognizer_destroy(FaceRecognizer *rec) {
+    if (!rec) return;
+    {
+        std::lock_guard<std::mutex> lock(rec->queue_mutex);
+        rec->exiting = true;
+    }
+    rec->queue_cv.notify_all();
+    for (auto& worker : rec->workers) {
+        if (worker->thread.joinable()) worker->thread.join();
+        for (auto& shard : worker->shards) {
+            if (shard.fd >= 0) close(shard.fd);
+        }
+    }
+    // 推理线程都已退出，没有在途任务，剩下的结果流可以直接释放
+    for (RecognitionStream* stream : rec->streams) {
+        fprintf(stderr, "Result stream '%s' was still open when the recognizer was destroyed.\n", stream->name.c_str());
+        if (stream->event_fd >= 0) close(stream->event_fd);
+        delete stream;
     }
-    face_database_clustered.clear();
+    rec->streams.clear();
+    {
+        std::lock_guard<DatabaseRwLock> lock(rec->database_mutex);
+        clear_persons(rec);
+    }
+    delete rec;
     printf("Face recognizer cleaned up.\n");
 }
 
-int face_recognizer_register_face(const unsigned char *jpeg_buf, unsigned long jpeg_size, const char *name) {
-    fprintf(stderr, "Warning: Single photo registration is disabled. Please use 'register_faces_from_paths'.\n");
-    return -1;
+RecognitionStream *face_recognizer_open_stream(FaceRecognizer *rec, const char *name,
+                                               RecognitionResult *slots, int capacity) {
+    if (!rec) return NULL;
+    if (rec->workers.empty()) {
+        fprintf(stderr, "Recognizer was created without a model and cannot run recognition\n");
+        return NULL;
+    }
+    if (slots && (capacity <= 0 || (capacity & (capacity - 1)) != 0)) {
+        fprintf(stderr, "Result ring capacity must be a power of two\n");
+        return NULL;
+    }
+    RecognitionStream *stream = new RecognitionStream;
+    stream->owner = rec;
+    stream->name = name ? name : "";
+    if (slots) {
+        stream->ring_slots = slots;
+        stream->ring_capacity = capacity;
+    } else {
+        stream->ring_storage.resize(DEFAULT_RING_CAPACITY);
+        stream->ring_slots = stream->ring_storage.data();
+        stream->ring_capacity = DEFAULT_RING_CAPACITY;
+    }
+    stream->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stream->event_fd < 0) {
+        perror("eventfd");
+        delete stream;
+        return NULL;
+    }
+    // 队列和缓冲区池的容量一次给够，提交时不再扩容
+    stream->queue.reserve(MAX_QUEUED_TASKS);
+    stream->chip_pool.reserve(MAX_QUEUED_TASKS + rec->workers.size() + CHIP_POOL_SLACK);
+    std::lock_guard<std::mutex> lock(rec->queue_mutex);
+    rec->streams.push_back(stream);
+    return stream;
 }
 
-int face_recognizer_register_faces_from_paths(const char* const* image_paths, int num_images, const char* name) {
-    if (is_name_registered(name)) {
-        printf("Name '%s' is already registered. Skipping registration.\n", name);
-        return 0;
+void face_recognizer_close_stream(RecognitionStream *stream) {
+    if (!stream) return;
+    FaceRecognizer *rec = stream->owner;
+    {
+        std::unique_lock<std::mutex> lock(rec->queue_mutex);
+        stream->closing = true;
+        stream->queue.clear();
+        auto it = std::find(rec->streams.begin(), rec->streams.end(), stream);
+        if (it != rec->streams.end()) {
+            const size_t index = it - rec->streams.begin();
+            rec->streams.erase(it);
+            if (rec->next_stream > index) rec->next_stream--;
+            if (rec->next_stream >= rec->streams.size()) rec->next_stream = 0;
+        }
+        rec->idle_cv.wait(lock, [&]{ return stream->in_flight == 0; });
     }
+    close(stream->event_fd);
+    delete stream;
+}
+
+int face_recognizer_set_gallery_shards(FaceRecognizer *rec, const char *const *addresses, int count, int timeout_ms) {
+    if (!rec || rec->workers.empty() || count < 0 || count > GALLERY_MAX_SHARDS) return -1;
+    std::lock_guard<std::mutex> lock(rec->queue_mutex);
+    if (!rec->streams.empty()) {
+        fprintf(stderr, "Gallery shards must be set before any result stream is opened\n");
+        return -1;
+    }
+    // 还没有结果流，推理线程不会碰各自的分片连接；它们下次取任务时经过 queue_mutex，能看到这里的修改
+    rec->shard_timeout_ms = timeout_ms > 0 ? timeout_ms : DEFAULT_SHARD_TIMEOUT_MS;
+    for (auto& worker : rec->workers) {
+        for (auto& shard : worker->shards) {
+            if (shard.fd >= 0) close(shard.fd);
+        }
+        worker->shards.clear();
+        worker->shards.resize(count);
+        for (int i = 0; i < count; ++i) worker->shards[i].address = addresses[i];
+    }
+    if (count > 0) printf("Recognizer queries %d gallery shards with a %d ms timeout.\n", count, rec->shard_timeout_ms);
+    return 0;
+}
+
+int face_recognizer_set_cpu_config(FaceRecognizer *rec, const RecognizerCpuConfig *config) {
+    if (!rec || !config || rec->workers.empty()) return -1;
+    std::lock_guard<std::mutex> lock(rec->queue_mutex);
+    if (!rec->streams.empty()) {
+        fprintf(stderr, "CPU settings must be applied before any result stream is opened\n");
+        return -1;
+    }
+    const RecognizerCpuConfig cpu = *config;
+    rec->cpu_config = cpu;
+    rec->cpu_generation++;
+    const int threads = std::max(1, cpu.intra_op_threads);
+    for (auto& worker : rec->workers) {
+        if (!worker->executor) continue;
+        // 注册和批量导入可能正借用这个推理线程的执行器
+        std::lock_guard<std::mutex> net_lock(worker->net_mutex);
+        worker->executor->setThreadPool(nullptr);
+        worker->pool.reset();
+        if (threads > 1) {
+            worker->pool.reset(new ModelThreadPool(threads - 1, [cpu]() {
+                face_recognizer_set_thread_cpu(cpu.cpu_mask, cpu.nice);
+            }));
+            worker->executor->setThreadPool(worker->pool.get());
+        }
+    }
+    printf("Recognizer uses %zu inference threads x %d threads per inference (CPU mask 0x%lx, nice %d).\n",
+           rec->workers.size(), rec->workers[0]->executor ? threads : 1, cpu.cpu_mask, cpu.nice);
+    return 0;
+}
+
+int face_recognizer_set_thread_cpu(unsigned long cpu_mask, int nice) {
+    int rc = 0;
+    // OpenCV 的线程池在第一次并行计算时创建，池中线程继承创建者的亲和性，之后由所有线程共用，
+    // 会把推理线程的工作带到保留的 CPU 上（反之亦然）。关掉它，OpenCV 的计算都在调用线程上完成；
+    // 按线程计数的后端（OpenMP）也要在每个线程里设置一次
+    cv::setNumThreads(0);
+    if (cpu_mask) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (unsigned int cpu = 0; cpu < sizeof(cpu_mask) * CHAR_BIT; ++cpu) {
+            if (cpu_mask & (1UL << cpu)) CPU_SET(cpu, &set);
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            perror("sched_setaffinity");
+            rc = -1;
+        }
+    }
+    // Linux 的 nice 值属于线程，按线程号设置只影响调用线程
+    if (nice != 0 && setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice) != 0) {
+        perror("setpriority");
+        rc = -1;
+    }
+    return rc;
+}
 
+int face_recognizer_query_gallery(FaceRecognizer *rec, const float *feature, int k, RecognitionCandidate *out) {
+    if (!rec || k <= 0) return 0;
+    return scan_database(rec, feature, out, 0, k);
+}
+
+int face_recognizer_set_partition(FaceRecognizer *rec, int index, int count) {
+    if (!rec || count <= 0 || index < 0 || index >= count) return -1;
+    rec->partition_index = index;
+    rec->partition_count = count;
+    return 0;
+}
+
+int face_recognizer_register_face(FaceRecognizer *rec, const unsigned char *jpeg_buf, unsigned long jpeg_size,
+                                  const char *name) {
+    fprintf(stderr, "Warning: Single photo registration is disabled. Please use 'register_faces_from_paths'.\n");
+    return -1;
+}
+
+int face_recognizer_register_faces_from_paths(FaceRecognizer *rec, const char* const* image_paths, int num_images,
+                                              const char* name) {
+    if (rec->workers.empty()) return 0;
+    InferenceWorker& worker = borrow_worker(rec);
     std::vector<cv::Mat> all_features;
     for (int i = 0; i < num_images; ++i) {
         cv::Mat feature;
-        if (get_feature_from_path(image_paths[i], feature) == 0) {
+        if (get_feature_from_path(worker, image_paths[i], feature) == 0) {
             all_features.push_back(feature);
         } else {
             fprintf(stderr, "Warning: Could not get feature from %s\n", image_paths[i]);
         }
     }
 
-    if (all_features.size() < NUM_CLUSTERS) {
-        fprintf(stderr, "Error: Not enough valid photos (%zu) to create %d clusters for '%s'.\n", all_features.size(), NUM_CLUSTERS, name);
-        return 0; 
+    DatabaseLock lock(rec);
+    if (!rec->db_writable) {
+        fprintf(stderr, "Error: DB file '%s' is read-only.\n", rec->database_path.c_str());
+        return -1;
     }
-
-    cv::Mat features_matrix(all_features.size(), 128, CV_32F);
-    for (size_t i = 0; i < all_features.size(); ++i) {
-        all_features[i].copyTo(features_matrix.row(i));
+    int index = find_person(rec, name);
+    const bool existing = index >= 0;
+    const size_t needed = existing ? 1 : MIN_REGISTRATION_SAMPLES;
+    if (all_features.size() < needed) {
+        fprintf(stderr, "Error: Not enough valid photos (%zu, need %zu) for '%s'.\n", all_features.size(), needed, name);
+        return 0;
+    }
+    if (!existing) index = add_person(rec, name);
+    PersonTemplates& person = rec->database[index];
+    // add_samples 原地累加 sum，撤销用的副本要深拷贝
+    std::vector<TemplateCluster> old_clusters;
+    for (const auto& cluster : person.clusters) {
+        old_clusters.emplace_back();
+        cluster.sum.copyTo(old_clusters.back().sum);
+        old_clusters.back().count = cluster.count;
+        cluster.center.copyTo(old_clusters.back().center);
+    }
+    add_samples(person, all_features);
+    if (!append_records(rec, { &person }, std::vector<std::string>())) {
+        // 写盘失败：撤销内存中的修改，保持与文件一致
+        if (existing) person.clusters.swap(old_clusters);
+        else remove_person(rec, index);
+        return -1;
     }
 
-    cv::Mat labels, centers;
-    cv::kmeans(features_matrix, NUM_CLUSTERS, labels,
-               cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 10, 1.0),
-               3, cv::KMEANS_PP_CENTERS, centers);
+    printf("%s '%s' with %zu photos, %zu feature clusters.\n", existing ? "Updated" : "Registered", name,
+           all_features.size(), person.clusters.size());
+    return all_features.size();
+}
 
-    std::vector<cv::Mat> cluster_features;
-    for (int i = 0; i < centers.rows; ++i) {
-        cv::Mat center_row = centers.row(i);
-        cv::normalize(center_row, center_row);
-        cluster_features.push_back(center_row.clone());
-    }
+const char *face_recognizer_identity_name(int identity_id) {
+    std::lock_guard<std::mutex> lock(identity_mutex);
+    if (identity_id <= 0 || identity_id > (int)identity_names.size()) return NULL;
+    return identity_names[identity_id - 1].c_str();
+}
 
-    face_database_clustered.emplace_back(std::string(name), cluster_features);
-    save_database_clustered();
+const char *face_recognizer_state_label(RecognitionState state, int identity_id) {
+    switch (state) {
+    case RECOGNITION_STATE_KNOWN: {
+        const char *name = face_recognizer_identity_name(identity_id);
+        return name ? name : "Unknown";
+    }
+    case RECOGNITION_STATE_UNKNOWN: return "Unknown";
+    case RECOGNITION_STATE_POSITIONING: return "Positioning...";
+    default: return "Tracking...";
+    }
+}
 
-    printf("Registered %d feature clusters for '%s'.\n", NUM_CLUSTERS, name);
-    return all_features.size();
+int face_recognizer_delete_person(FaceRecognizer *rec, const char *name) {
+    DatabaseLock lock(rec);
+    const int index = find_person(rec, name);
+    if (index < 0) {
+        printf("Name '%s' is not registered.\n", name);
+        return -1;
+    }
+    if (!rec->db_writable) {
+        fprintf(stderr, "Error: DB file '%s' is read-only.\n", rec->database_path.c_str());
+        return -1;
+    }
+    // 先留一份，写盘失败时放回去
+    PersonTemplates removed = rec->database[index];
+    remove_person(rec, index);
+    if (!append_records(rec, std::vector<const PersonTemplates*>(), { removed.name })) {
+        rec->person_slots[removed.id] = (int)rec->database.size();
+        rec->database.push_back(std::move(removed));
+        return -1;
+    }
+    printf("Deleted '%s' from face database.\n", name);
+    return 0;
 }
-// 异步接口 - 任务生产者
-int face_recognizer_submit_task(const unsigned char *jpeg_buf, unsigned long jpeg_size, const FaceRect *faces, int num_faces) {
-    std::vector<FaceRect> faces_vec(faces, faces + num_faces);
 
-    std::vector<unsigned char> jpeg_vec(jpeg_buf, jpeg_buf + jpeg_size);
-    cv::Mat image = cv::imdecode(jpeg_vec, cv::IMREAD_COLOR);
+int face_recognizer_submit_task(RecognitionStream *stream, const unsigned char *jpeg_buf, unsigned long jpeg_size,
+                                const FaceRect *faces, const int *track_ids, int num_faces) {
+    cv::Mat jpeg_mat(1, (int)jpeg_size, CV_8UC1, (void *)jpeg_buf);
+    cv::Mat image = cv::imdecode(jpeg_mat, cv::IMREAD_COLOR);
     if (image.empty()) {
         fprintf(stderr, "Failed to decode JPEG in submit_task\n");
         return -1;
     }
 
-    std::lock_guard<std::mutex> lock(task_queue_mutex);
-    if (task_queue.size() > 2) {
+    std::vector<RecognitionTask> tasks;
+    const long long now = face_recognizer_now_ms();
+    for (int i = 0; i < num_faces; ++i) {
+        cv::Rect roi(faces[i].x, faces[i].y, faces[i].width, faces[i].height);
+        roi = roi & cv::Rect(0, 0, image.cols, image.rows);
+        if (roi.width <= 1 || roi.height <= 1) continue;
+        RecognitionTask task;
+        task.face = faces[i];
+        task.track_id = track_ids ? track_ids[i] : -1;
+        task.chip = image(roi);   // 切片共享解码后的整帧，无需拷贝
+        task.capture_ms = now;
+        tasks.push_back(std::move(task));
+    }
+    if (tasks.empty()) return -1;
+    return enqueue_tasks(stream, tasks);
+}
+
+int face_recognizer_crop_raw(const unsigned char *buf, unsigned long size, int width, int height, int stride,
+                             unsigned int fourcc, const FaceRect *rect, unsigned char *bgr, int bgr_stride) {
+    if (!buf || !rect || !bgr || width <= 0 || height <= 0) return -1;
+    unsigned long needed;
+    if (fourcc == V4L2_PIX_FMT_YUYV) {
+        needed = (unsigned long)stride * height;
+    } else if (fourcc == V4L2_PIX_FMT_NV12) {
+        needed = (unsigned long)stride * height * 3 / 2;
+    } else {
         return -1;
     }
-    task_queue.push({image.clone(), faces_vec});
-    task_queue_cv.notify_one();
-    return 0;
+    const cv::Rect roi(rect->x, rect->y, rect->width, rect->height);
+    if (size < needed || roi.width <= 0 || roi.height <= 0 || (roi & cv::Rect(0, 0, width, height)) != roi) return -1;
+    cv::Mat out(roi.height, roi.width, CV_8UC3, bgr, (size_t)bgr_stride);
+    return crop_raw_to_bgr(buf, width, height, stride, fourcc, roi, out) ? 0 : -1;
+}
+
+long long face_recognizer_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int face_recognizer_submit_chips(RecognitionStream *stream, const FaceChip *chips, int num_chips) {
+    // 每个提交线程复用一个任务数组；切片复制到池中的缓冲区里，稳态下整个提交不分配内存
+    static thread_local std::vector<RecognitionTask> tasks;
+    tasks.clear();
+    tasks.resize(std::max(num_chips, 0));
+    int n = 0;
+    {
+        std::lock_guard<std::mutex> lock(stream->owner->queue_mutex);
+        for (int i = 0; i < num_chips; ++i) {
+            const FaceChip& c = chips[i];
+            if (!c.bgr || c.width <= 1 || c.height <= 1) continue;
+            tasks[n++].chip_buffer = take_chip_buffer(stream, c.height, c.width);
+        }
+    }
+    tasks.resize(n);
+    n = 0;
+    for (int i = 0; i < num_chips; ++i) {
+        const FaceChip& c = chips[i];
+        if (!c.bgr || c.width <= 1 || c.height <= 1) continue;
+        RecognitionTask& task = tasks[n++];
+        task.face = c.rect;
+        task.track_id = c.track_id;
+        task.chip = task.chip_buffer(cv::Rect(0, 0, c.width, c.height));
+        cv::Mat(c.height, c.width, CV_8UC3, (void *)c.bgr, (size_t)c.stride).copyTo(task.chip);
+        task.priority = c.priority;
+        task.capture_ms = c.capture_ms;
+        task.deadline_ms = c.deadline_ms;
+    }
+    if (tasks.empty()) return -1;
+    return enqueue_tasks(stream, tasks);
 }
+
 // 异步接口 - 结果消费者
-int face_recognizer_get_results(RecognitionResult **out_results) {
-    std::unique_lock<std::mutex> lock(result_queue_mutex, std::try_to_lock);
-    if (lock.owns_lock() && !result_queue.empty()) {
-        RecognitionResultVec results_vec = result_queue.front();
-        result_queue.pop();
-        lock.unlock();
-
-        int num_results = results_vec.size();
-        if (num_results > 0) {
-            *out_results = (RecognitionResult*)malloc(num_results * sizeof(RecognitionResult));
-            if (!*out_results) {
-                perror("malloc for results failed");
-                return -1;
+void face_recognizer_set_result_callback(RecognitionStream *stream, RecognitionResultCallback callback,
+                                         void *user_data) {
+    std::lock_guard<std::mutex> lock(stream->ring_mutex);
+    stream->callback_user = user_data;
+    stream->callback = callback;
+}
+
+int face_recognizer_result_fd(RecognitionStream *stream) {
+    return stream ? stream->event_fd : -1;
+}
+
+void face_recognizer_clear_result_event(RecognitionStream *stream) {
+    uint64_t count;
+    if (read(stream->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("read eventfd");
+    }
+}
+
+int face_recognizer_peek_results(RecognitionStream *stream, const RecognitionResult **results) {
+    const unsigned int tail = stream->ring_tail.load(std::memory_order_relaxed);
+    const unsigned int head = stream->ring_head.load(std::memory_order_acquire);
+    if (head == tail) {
+        *results = NULL;
+        return 0;
+    }
+    // 只返回到缓冲区末尾为止的连续部分，回绕后的部分留给下一次调用
+    const unsigned int index = tail & (stream->ring_capacity - 1);
+    *results = &stream->ring_slots[index];
+    return (int)std::min(head - tail, stream->ring_capacity - index);
+}
+
+void face_recognizer_consume_results(RecognitionStream *stream, int count) {
+    if (count <= 0) return;
+    stream->ring_tail.store(stream->ring_tail.load(std::memory_order_relaxed) + count, std::memory_order_release);
+}
+
+void face_recognizer_stream_stats(RecognitionStream *stream, RecognitionStreamStats *stats) {
+    stats->submitted = stream->submitted;
+    stats->completed = stream->completed;
+    stats->expired = stream->expired;
+    stats->replaced = stream->replaced;
+    stats->rejected = stream->rejected;
+    stats->dropped = stream->dropped;
+    stats->wait_ms_total = stream->wait_ms_total;
+    stats->inference_ms_total = stream->inference_ms_total;
+    std::lock_guard<std::mutex> lock(stream->owner->queue_mutex);
+    stats->queued = (int)stream->queue.size();
+}
+
+int face_recognizer_clear_database(FaceRecognizer *rec) {
+    DatabaseLock lock(rec);
+    clear_persons(rec);
+    if (!compact_database(rec)) return -1;
+
+    printf("Face database has been cleared.\n");
+    return 0;
+}
+
+int face_recognizer_import_directory(FaceRecognizer *rec, const char *root_dir, int num_threads,
+                                    BulkImportProgressCallback callback, void *user_data) {
+    if (!rec || rec->workers.empty()) {
+        fprintf(stderr, "Recognizer is not initialized, cannot import.\n");
+        return -1;
+    }
+    std::vector<ImportPerson> people;
+    if (list_import_people(root_dir, people) != 0) return -1;
+    if (rec->partition_count > 1) {
+        people.erase(std::remove_if(people.begin(), people.end(), [rec](const ImportPerson& person) {
+                         return (int)(partition_hash(person.name) % rec->partition_count) != rec->partition_index;
+                     }), people.end());
+        printf("Partition %d/%d: %zu people belong to this shard.\n",
+               rec->partition_index, rec->partition_count, people.size());
+    }
+
+    BulkImportProgress progress;
+    memset(&progress, 0, sizeof(progress));
+    progress.people_total = (int)people.size();
+
+    // 已经在库中的人直接跳过，中断后重新运行会从上一个检查点继续
+    std::vector<const ImportPerson*> todo;
+    {
+        DatabaseReadLock lock(rec);
+        for (const auto& person : people) {
+            if (find_person(rec, person.name) >= 0) progress.people_skipped++;
+            else todo.push_back(&person);
+        }
+    }
+    for (const auto* person : todo) progress.images_total += (int)person->files.size();
+
+    if (num_threads <= 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+    printf("Importing %zu people (%d images) from %s with %d threads, %d already registered.\n",
+           todo.size(), progress.images_total, root_dir, num_threads, progress.people_skipped);
+
+    rec->import_cancelled = false;
+    std::atomic<size_t> next_person(0);
+    std::atomic<int> images_done(0), faces_embedded(0), people_done(0), people_failed(0);
+    std::mutex imported_mutex;
+    std::condition_variable imported_cv;
+    std::vector<PersonTemplates> imported;
+    int workers_running = num_threads;
+
+    auto worker = [&]() {
+        for (;;) {
+            size_t index = next_person++;
+            if (index >= todo.size() || rec->import_cancelled) break;
+            PersonTemplates result;
+            bool ok = import_one_person(rec, *todo[index], result, images_done, faces_embedded) == 0;
+            std::lock_guard<std::mutex> lock(imported_mutex);
+            if (ok) {
+                imported.push_back(std::move(result));
+                people_done++;
+            } else if (!rec->import_cancelled) {
+                fprintf(stderr, "Import: not enough usable photos for '%s'\n", todo[index]->name.c_str());
+                people_failed++;
             }
-            memcpy(*out_results, results_vec.data(), num_results * sizeof(RecognitionResult));
-        } else {
-            *out_results = NULL;
+            imported_cv.notify_one();
         }
-        return num_results;
+        std::lock_guard<std::mutex> lock(imported_mutex);
+        workers_running--;
+        imported_cv.notify_one();
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) threads.emplace_back(worker);
+
+    const auto start = std::chrono::steady_clock::now();
+    auto last_report = start;
+    std::vector<PersonTemplates> to_commit;
+    for (;;) {
+        bool finished;
+        {
+            std::unique_lock<std::mutex> lock(imported_mutex);
+            imported_cv.wait_for(lock, std::chrono::seconds(1));
+            finished = workers_running == 0;
+            // 攒够一个检查点再写盘，结束时写入剩余部分
+            if ((int)imported.size() >= IMPORT_CHECKPOINT_PEOPLE || finished) {
+                to_commit.swap(imported);
+            }
+        }
+        commit_imported(rec, to_commit);
+
+        // 每完成一个人都会醒来检查检查点，进度最多每秒报告一次，结束时一定报告
+        const auto now = std::chrono::steady_clock::now();
+        if (!finished && now - last_report < std::chrono::seconds(1)) continue;
+        last_report = now;
+        progress.people_done = people_done;
+        progress.people_failed = people_failed;
+        progress.images_done = images_done;
+        progress.faces_embedded = faces_embedded;
+        progress.elapsed_s = std::chrono::duration<double>(now - start).count();
+        if (callback) callback(&progress, user_data);
+        if (finished) break;
     }
+    for (auto& t : threads) t.join();
 
-    *out_results = NULL;
-    return 0;
+    printf("Import %s: %d people added, %d failed, %d images in %.1f s (%.1f images/s).\n",
+           rec->import_cancelled ? "cancelled" : "finished", progress.people_done, progress.people_failed,
+           progress.images_done, progress.elapsed_s,
+           progress.elapsed_s > 0 ? progress.images_done / progress.elapsed_s : 0.0);
+    return progress.people_done;
 }
 
-int face_recognizer_clear_database() {
-    face_database_clustered.clear();
-    save_database_clustered(); 
+void face_recognizer_cancel_import(FaceRecognizer *rec) {
+    if (rec) rec->import_cancelled = true;
+}
 
-    printf("Face database has been cleared.\n");
+int face_recognizer_set_database_key(const unsigned char *key) {
+    std::shared_ptr<LockedBuffer> copy;
+    if (key) {
+        copy = std::make_shared<LockedBuffer>();
+        if (!copy->resize(DB_KEY_BYTES)) return -1;
+        memcpy(copy->data(), key, DB_KEY_BYTES);
+    }
+    std::lock_guard<std::mutex> lock(database_key_mutex);
+    database_key = copy;
+    return 0;
+}
+
+int face_recognizer_benchmark_database(const char *dir, int people, int runs,
+                                       DatabaseBenchmark *plain, DatabaseBenchmark *encrypted) {
+    if (!dir || people <= 0 || runs <= 0 || !plain || !encrypted) return -1;
+    std::shared_ptr<const LockedBuffer> key;
+    {
+        std::lock_guard<std::mutex> lock(database_key_mutex);
+        key = database_key;
+    }
+    if (!key) {
+        std::shared_ptr<LockedBuffer> temporary = std::make_shared<LockedBuffer>();
+        if (!temporary->resize(DB_KEY_BYTES) || !dbRandom(temporary->data(), DB_KEY_BYTES)) return -1;
+        key = temporary;
+    }
+    const std::string path = std::string(dir) + "/db_benchmark.db";
+    benchmark_database_format(path, nullptr, people, runs, *plain);
+    benchmark_database_format(path, key, people, runs, *encrypted);
     return 0;
 }
 
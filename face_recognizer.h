@@ -7,71 +7,373 @@
 extern "C" {
 #endif
 
+#define FACE_FEATURE_DIM 128   // 特征向量维度
+#define RECOGNITION_TOP_K 3     // 每条结果携带的候选身份数量
+
+#define FACE_IDENTITY_NONE 0     // 不对应库中任何人（候选中的 "Unknown"，以及未确定身份时）
+
+// 一个人脸框的身份状态，界面据此选择颜色，名字只在显示时才通过身份 id 查出
+typedef enum {
+    RECOGNITION_STATE_TRACKING = 0,    // 追踪中，身份尚未确定
+    RECOGNITION_STATE_UNKNOWN,         // 不是库中的任何人
+    RECOGNITION_STATE_KNOWN,           // 已识别，identity_id 有效
+    RECOGNITION_STATE_POSITIONING      // 注册时的定位框
+} RecognitionState;
+
+// 一个候选身份及其相似度
+typedef struct {
+    int identity_id;   // FACE_IDENTITY_NONE 表示 "Unknown"
+    float score;
+} RecognitionCandidate;
+
 // 用于保存单条识别结果的结构体
 typedef struct {
     FaceRect rect;
-    char name[64]; // 识别出的人名
+    RecognitionState state; // UNKNOWN 或 KNOWN
+    int identity_id; // 识别出的身份，state 为 KNOWN 时有效
     float score;   // 置信度分数
+    int submission_id; // 提交任务时返回的编号
+    int track_id;  // 提交任务时传入的追踪器 id，未指定时为 -1
+    float feature[FACE_FEATURE_DIM]; // 本次提取的特征（L2 归一化）
+    // 按相似度降序的候选身份，每人取其最相似的聚类中心。
+    // "Unknown" (FACE_IDENTITY_NONE) 以识别阈值作为分数参与排序，用于时序投票时代表"不是库中任何人"
+    int num_candidates;
+    RecognitionCandidate candidates[RECOGNITION_TOP_K];
 } RecognitionResult;
 
+// 识别器实例，由 face_recognizer_create 创建。多个摄像头流水线共用一个实例：
+// 实例持有人脸数据库和一组推理线程（每个线程独占一份网络）
+typedef struct FaceRecognizer FaceRecognizer;
+
+// 一个摄像头的结果流：自己的任务队列、结果环形缓冲区和统计，由 face_recognizer_open_stream 创建。
+// 推理线程按轮转顺序从各个结果流取任务，一个摄像头再忙也不会让其他摄像头饿死
+typedef struct RecognitionStream RecognitionStream;
+
+// 一批结果写入环形缓冲区后，在识别线程中调用的回调
+typedef void (*RecognitionResultCallback)(void *user_data);
+
+// 识别任务的优先级，同一结果流的队列繁忙时先处理数值大的
+typedef enum {
+    RECOGNITION_PRIORITY_REVERIFY = 0, // 已确定身份的定期复核
+    RECOGNITION_PRIORITY_NEW = 1,      // 新出现、尚未识别过的人脸
+    RECOGNITION_PRIORITY_UNKNOWN = 2   // 识别过但身份未知或不确定
+} RecognitionPriority;
+
+// 调用者已经裁剪好的一张 BGR 人脸切片
+typedef struct {
+    const unsigned char *bgr; // 像素数据，3字节/像素
+    int width;
+    int height;
+    int stride;               // 每行字节数
+    FaceRect rect;            // 切片在原图中的位置，原样写回结果
+    int track_id;             // 原样写回结果的 track_id；>=0 时队列中同一追踪器的旧切片会被替换
+    int priority;             // RecognitionPriority
+    long long capture_ms;     // 采集时间，使用 face_recognizer_now_ms() 的时钟
+    long long deadline_ms;    // 到该时间仍未开始推理就丢弃，0 表示不限
+} FaceChip;
+
+// 一个结果流自打开以来的累计统计，调用者定期取两次之差得到一个周期内的数字
+typedef struct {
+    unsigned long submitted;      // 入队的人脸数（包括替换了旧切片的）
+    unsigned long completed;      // 写入结果缓冲区的结果数
+    unsigned long expired;        // 超过截止时间被丢弃的
+    unsigned long replaced;       // 被同一追踪器的新切片替换的
+    unsigned long rejected;       // 队列满时被拒绝或挤掉的
+    unsigned long dropped;        // 结果缓冲区满而丢弃的
+    long long wait_ms_total;      // completed 个任务从采集到开始推理的等待时间之和
+    long long inference_ms_total; // completed 个任务的推理时间之和
+    int queued;                   // 当前排队的人脸数
+} RecognitionStreamStats;
+
 /**
- * @brief 初始化人脸识别引擎。
- * 加载ONNX模型，从文件加载人脸数据库，并启动后台识别工作线程。
- * @param model_path ONNX 模型的路径。
+ * @brief 创建人脸识别器实例。
+ * 加载ONNX模型，用一张空白切片预热每个推理线程，然后启动推理线程。
+ * 模型第一次加载时被编译成模型旁边的缓存文件 <模型>.<哈希>.frm，之后直接映射它，不再解析ONNX；
+ * 模型含有编译器不支持的层时，每个推理线程各读一份 cv::dnn 网络。
+ * 人脸数据库在第一次识别、查询、注册或导入时才从文件加载。
+ * 人脸检测器需要先用 face_detector_init 初始化，注册和批量导入会用到它。
+ * @param model_path ONNX 模型的路径；NULL 表示只加载人脸库（立即加载）、不启动推理线程，
+ *                   用于只回答 face_recognizer_query_gallery 的分片节点。
  * @param db_path 人脸数据库文件的路径。
+ * @param num_workers 推理线程数，<=0 时为1。
+ * @return 成功返回实例，失败返回 NULL。
+ */
+FaceRecognizer *face_recognizer_create(const char *model_path, const char *db_path, int num_workers);
+
+/**
+ * @brief 停止推理线程并释放实例。调用前应关闭所有结果流，仍未关闭的会在这里一并释放。
+ */
+void face_recognizer_destroy(FaceRecognizer *rec);
+
+/**
+ * @brief 设置远程人脸库分片（见 gallery_rpc.h），必须在打开结果流之前调用。
+ * 设置后每次识别除了比对本地库，还把特征同时发给所有分片，合并各分片返回的候选。
+ * 每个推理线程与每个分片各保持一条连接；分片超时的那一次只用其余分片的候选，
+ * 连接出错的分片每秒最多重连一次，期间跳过它。
+ * @param addresses 分片地址数组。
+ * @param count 地址数量，0 表示不使用分片。
+ * @param timeout_ms 每次查询等待分片回复的最长时间，所有分片共用这个期限。
+ * @return 成功返回0；已有打开的结果流或实例没有推理线程时返回-1。
+ */
+int face_recognizer_set_gallery_shards(FaceRecognizer *rec, const char *const *addresses, int count, int timeout_ms);
+
+// 推理相关线程的 CPU 设置，见 face_recognizer_set_cpu_config
+typedef struct {
+    int intra_op_threads;     // 每次推理拆给几个线程（包括推理线程自己），<=1 不拆
+    unsigned long cpu_mask;   // 推理线程及其辅助线程可以运行的 CPU 位图，0 表示不限制
+    int nice;                 // 推理线程及其辅助线程的 nice 值，0 表示不调整
+} RecognizerCpuConfig;
+
+/**
+ * @brief 设置推理的线程数、CPU 亲和性和优先级，必须在打开结果流之前调用。
+ * 每个推理线程另有 intra_op_threads-1 个辅助线程，一次推理中每个较大的卷积按输出通道分给它们同时计算；
+ * 只对编译好的模型有效，退回 cv::dnn 时每次推理只用推理线程自己（见 face_recognizer_set_thread_cpu）。
+ * 推理线程在取到下一个任务时应用 cpu_mask 和 nice，辅助线程在创建时应用。
+ * 把 cpu_mask 设为不包含采集/检测和界面线程所在的 CPU，并调高 nice，
+ * 可以保证推理再忙也不会挤占它们（见 face_recognizer_set_thread_cpu）。
+ * @return 成功返回0；已有打开的结果流或实例没有推理线程时返回-1。
+ */
+int face_recognizer_set_cpu_config(FaceRecognizer *rec, const RecognizerCpuConfig *config);
+
+/**
+ * @brief 设置调用线程的 CPU 亲和性和 nice 值，流水线用它把采集/检测和界面线程留在保留的 CPU 上。
+ * 之后由这个线程创建的线程继承它的亲和性。同时关闭 OpenCV 自己的线程池（cv::setNumThreads(0)），
+ * 调用线程中的 OpenCV 计算不会分到其他 CPU 上；应在线程第一次调用 OpenCV 之前调用。
+ * @param cpu_mask CPU 位图，0 表示不改变亲和性。
+ * @param nice nice 值，0 表示不改变。
  * @return 成功返回0，失败返回-1。
  */
-int face_recognizer_init(const char *model_path, const char* db_path);
+int face_recognizer_set_thread_cpu(unsigned long cpu_mask, int nice);
+
+/**
+ * @brief 在本实例的库中查找与特征最相似的至多 k 个人，分片节点用它回答查询。
+ * @param feature L2 归一化的特征，FACE_FEATURE_DIM 维。
+ * @param k 最多返回的人数。
+ * @param out 输出，按相似度降序，每人取其最相似的聚类中心，不包含 "Unknown"。
+ * @return 写入 out 的人数。
+ */
+int face_recognizer_query_gallery(FaceRecognizer *rec, const float *feature, int k, RecognitionCandidate *out);
+
+/**
+ * @brief 让批量导入只导入属于某个分片的人，用同一个照片目录为各个分片分别建库。
+ * 人按名字的哈希值分到 count 个分片中，同一个名字总是落在同一个分片。
+ * @param index 本分片的编号，从0开始。
+ * @param count 分片总数，1 表示不分片。
+ * @return 成功返回0，参数无效返回-1。
+ */
+int face_recognizer_set_partition(FaceRecognizer *rec, int index, int count);
+
+/**
+ * @brief 为一个摄像头打开结果流。
+ * @param rec 识别器实例。
+ * @param name 用于日志的名字，例如 "cam0"。
+ * @param slots 调用者拥有的结果数组（单生产者单消费者的环形缓冲区），在关闭结果流之前必须保持有效；
+ *              NULL 时使用内部的64项缓冲区。缓冲区满时新结果会被丢弃，不会阻塞推理线程。
+ * @param capacity 数组长度，必须是2的幂。
+ * @return 成功返回结果流，参数无效时返回 NULL。
+ */
+RecognitionStream *face_recognizer_open_stream(FaceRecognizer *rec, const char *name,
+                                               RecognitionResult *slots, int capacity);
+
+/**
+ * @brief 关闭结果流：丢弃排队的任务，等待正在推理的任务写完后释放。
+ * 返回后 eventfd 已关闭，调用者应先停止监视它。
+ */
+void face_recognizer_close_stream(RecognitionStream *stream);
 
 /**
  * @brief 从多个图像文件路径注册一张人脸，以提高鲁棒性。
+ * 名字已经存在时把这些照片作为新样本并入他的模板，无需清空数据库重新注册；
+ * 每人的聚类数随样本分布自动增减。数据库文件只追加这个人的一条记录。
+ * @param rec 识别器实例。
  * @param image_paths 一个包含多个JPEG文件路径的字符串数组。
  * @param num_images 数组中的路径数量。
  * @param name 要与这些图像关联的名字。
- * @return 成功注册的图片数量，如果一张都未成功则返回0或-1。
+ * @return 成功使用的图片数量；新名字少于3张有效照片时返回0；数据库只读或写盘失败时返回-1，内存中的库不变。
+ */
+int face_recognizer_register_faces_from_paths(FaceRecognizer *rec, const char* const* image_paths, int num_images,
+                                              const char* name);
+
+/**
+ * @brief 按身份 id 查名字，供显示时使用。
+ * 身份表在进程内共享，身份 id 固定不变，同名的人删除后重新注册仍得到同一个 id。
+ * @return 名字，指针在进程退出前一直有效；id 无效时返回 NULL。
  */
-int face_recognizer_register_faces_from_paths(const char* const* image_paths, int num_images, const char* name);
+const char *face_recognizer_identity_name(int identity_id);
 
 /**
- * @brief 清理人脸识别器使用的所有资源。
- * 停止工作线程并释放内存。
+ * @brief 返回人脸框上显示的文字：已识别时为名字，其余状态为 "Tracking..."、"Unknown"、"Positioning..."。
  */
-void face_recognizer_cleanup();
+const char *face_recognizer_state_label(RecognitionState state, int identity_id);
+
+/**
+ * @brief 从数据库中删除一个人，只向数据库文件追加一条删除记录。
+ * @return 成功返回0，名字不存在、数据库只读或写盘失败返回-1（此时这个人仍在库中）。
+ */
+int face_recognizer_delete_person(FaceRecognizer *rec, const char *name);
 
 /**
  * @brief 异步提交一个识别任务。
- * 这个函数是非阻塞的，它会把任务放入一个队列中，由后台线程处理。
+ * 这个函数是非阻塞的，它会把任务放入结果流的队列中，由推理线程处理。
+ * 人脸以 RECOGNITION_PRIORITY_NEW 优先级排队，没有截止时间。
+ * @param stream 结果流，结果写回这里。
  * @param jpeg_buf 指向JPEG图像数据的指针。
  * @param jpeg_size JPEG数据的大小。
  * @param faces 在该图像中已检测到的人脸矩形数组。
+ * @param track_ids 与 faces 一一对应的追踪器 id，原样写回结果的 track_id；可为 NULL。
  * @param num_faces 矩形数组中的人脸数量。
- * @return 成功将任务入队返回0，如果队列已满或出错则返回-1。
+ * @return 成功将任务入队返回提交编号 (>0)，结果的 submission_id 与之对应；如果队列已满或出错则返回-1。
+ */
+int face_recognizer_submit_task(RecognitionStream *stream, const unsigned char *jpeg_buf, unsigned long jpeg_size,
+                                const FaceRect *faces, const int *track_ids, int num_faces);
+
+/**
+ * @brief 从原始格式 (YUYV / NV12) 图像中裁剪一个区域，只把这一块转换为 BGR，整帧不做颜色转换。
+ * 用于在多帧中挑选人脸切片再通过 face_recognizer_submit_chips 提交；不分配与帧大小相关的内存。
+ * @param buf 指向原始图像数据的指针。
+ * @param size 数据的大小。
+ * @param width 图像宽度。
+ * @param height 图像高度。
+ * @param stride 每行字节数（NV12 为 Y 平面的步长，UV 平面紧随其后）。
+ * @param fourcc 像素格式 (V4L2_PIX_FMT_YUYV 或 V4L2_PIX_FMT_NV12)。
+ * @param rect 要裁剪的区域，必须完全在图像内。
+ * @param bgr 输出缓冲区，rect->height 行，每行 bgr_stride 字节（至少 rect->width * 3）。
+ * @return 成功返回0；格式不支持、区域越界或数据不足时返回-1。
+ */
+int face_recognizer_crop_raw(const unsigned char *buf, unsigned long size, int width, int height, int stride,
+                             unsigned int fourcc, const FaceRect *rect, unsigned char *bgr, int bgr_stride);
+
+/**
+ * @brief 返回识别器调度使用的单调时钟（毫秒），用于填写 FaceChip 的时间字段。
+ */
+long long face_recognizer_now_ms();
+
+/**
+ * @brief 异步提交一批已经裁剪好的 BGR 人脸切片。
+ * 用于调用者先在多帧中挑选质量最好的切片再送去识别的场景。
+ * 每张切片独立排队：过期的切片在推理前被丢弃，同一追踪器的新切片替换旧切片，
+ * 结果流的队列满时挤掉其中优先级最低的切片，不影响其他结果流。
+ * 切片数据在函数内被复制，返回后调用者可以释放。
+ * @param stream 结果流，结果写回这里。
+ * @param chips 切片数组。
+ * @param num_chips 切片数量。
+ * @return 至少一张切片入队时返回提交编号 (>0)，结果的 submission_id 与之对应；一张都没有入队返回-1。
+ */
+int face_recognizer_submit_chips(RecognitionStream *stream, const FaceChip *chips, int num_chips);
+
+/**
+ * @brief 设置结果回调。回调在推理线程中执行，应当尽快返回（例如只投递一个事件）。
+ * @param stream 结果流。
+ * @param callback 回调函数，NULL 表示取消。
+ * @param user_data 原样传给回调。
+ */
+void face_recognizer_set_result_callback(RecognitionStream *stream, RecognitionResultCallback callback,
+                                         void *user_data);
+
+/**
+ * @brief 返回结果流的 eventfd，有新结果写入环形缓冲区时变为可读，
+ * 可以放进事件循环（例如 QSocketNotifier）而不必轮询。
+ */
+int face_recognizer_result_fd(RecognitionStream *stream);
+
+/**
+ * @brief 读空 eventfd 的计数，在事件回调中先于 peek 调用，避免重复唤醒。
  */
-int face_recognizer_submit_task(const unsigned char *jpeg_buf, unsigned long jpeg_size, const FaceRect *faces, int num_faces);
+void face_recognizer_clear_result_event(RecognitionStream *stream);
 
 /**
- * @brief 尝试获取一批已完成的识别结果。
- * 这个函数是非阻塞的。
- * @param results 指向 RecognitionResult 数组的指针。如果成功获取，函数会为该数组分配内存。
- *                调用者在使用完毕后必须负责 free(*results)。
- * @return > 0: 成功获取到的结果数量。
- *         = 0: 当前没有可用的结果。
- *         < 0: 发生错误。
+ * @brief 取得结果流的环形缓冲区中一段连续的、尚未消费的结果，不复制、不分配内存。
+ * 这个函数是非阻塞的。结果在调用 face_recognizer_consume_results 之前保持有效。
+ * 数据回绕时只返回到缓冲区末尾的部分，调用者应循环调用直到返回0。
+ * @param results 输出，指向第一条结果。
+ * @return 可读的结果数量，没有结果时返回0。
  */
-int face_recognizer_get_results(RecognitionResult **results);
+int face_recognizer_peek_results(RecognitionStream *stream, const RecognitionResult **results);
 
 /**
- * @brief 清理人脸识别器使用的所有资源。
- * 停止工作线程并释放内存。
+ * @brief 把 peek 得到的前 count 条结果标记为已消费，槽位交还给推理线程。
  */
-void face_recognizer_cleanup();
+void face_recognizer_consume_results(RecognitionStream *stream, int count);
+
+/**
+ * @brief 读取结果流自打开以来的累计统计。
+ */
+void face_recognizer_stream_stats(RecognitionStream *stream, RecognitionStreamStats *stats);
+
+// 批量导入的进度
+typedef struct {
+    int people_total;     // 目录中的总人数
+    int people_skipped;   // 已在库中而跳过的人数
+    int people_done;      // 本次成功导入的人数
+    int people_failed;    // 有效照片不足而失败的人数
+    int images_total;     // 需要处理的照片数
+    int images_done;      // 已解码的照片数
+    int faces_embedded;   // 已提取特征的人脸数
+    double elapsed_s;     // 已用时间（秒）
+} BulkImportProgress;
+
+// 批量导入过程中最多每秒调用一次，导入结束（包括取消）时再调用一次，在调用 face_recognizer_import_directory 的线程中执行
+typedef void (*BulkImportProgressCallback)(const BulkImportProgress *progress, void *user_data);
+
+/**
+ * @brief 从 <root_dir>/<名字>/ 下的照片批量注册人脸（jpg/png/bmp）。
+ * 多个线程并行解码和检测，特征按批提取，每人聚类后每隔一个检查点向数据库文件追加一批记录。
+ * 已经注册的名字会被跳过，因此中断后重新运行会从上一个检查点继续。
+ * 设置了 face_recognizer_set_partition 时只导入属于本分片的人。
+ * 函数阻塞直到导入完成或被 face_recognizer_cancel_import 取消。
+ * @param rec 识别器实例，导入线程轮流借用它的推理网络。
+ * @param root_dir 照片根目录。
+ * @param num_threads 解码/检测线程数，<=0 时使用CPU核数。
+ * @param callback 可选的进度回调。
+ * @param user_data 原样传给回调。
+ * @return 本次成功导入的人数，出错返回-1。
+ */
+int face_recognizer_import_directory(FaceRecognizer *rec, const char *root_dir, int num_threads,
+                                    BulkImportProgressCallback callback, void *user_data);
+
+/**
+ * @brief 请求取消正在进行的批量导入，已完成的人仍会写入数据库。
+ * 只设置一个原子标志，可以在信号处理函数中调用。
+ */
+void face_recognizer_cancel_import(FaceRecognizer *rec);
 
 /**
  * @brief 清空所有已注册的人脸数据。
  * 这会清空内存中的数据库，并用一个空数据库覆盖磁盘上的文件。
  * @return 成功返回0，失败返回-1。
  */
-int face_recognizer_clear_database();
+int face_recognizer_clear_database(FaceRecognizer *rec);
+
+/**
+ * @brief 设置人脸数据库的加密密钥，之后创建的识别器使用它，应在 face_recognizer_create 之前调用。
+ * 设置了密钥时数据库文件用 ChaCha20-Poly1305 分块加密（见 db_crypto.h），每次注册或删除追加一个加密块；
+ * 加载时逐块校验并解密到锁定内存中，用完即清零。已有的明文数据库在第一次加载时转换成加密格式。
+ * 解析出的模板同样放在锁定内存中（每个聚类 1KB，受 RLIMIT_MEMLOCK 限制，超出时照常运行但可能被换出）。
+ * 注意：识别时为每张人脸计算的特征向量和推理的中间结果仍在普通的堆内存中，
+ * 可能被换出到交换分区或出现在 core dump 里；需要防范时应关闭交换分区和 core dump。
+ * 没有设置密钥时遇到加密的数据库、或密钥不对时，数据库以只读方式打开并且为空。
+ * 函数复制密钥，返回后调用者应清除自己的副本。
+ * @param key 32 字节的密钥；NULL 表示不加密。
+ * @return 成功返回0，分配锁定内存失败返回-1。
+ */
+int face_recognizer_set_database_key(const unsigned char *key);
+
+// face_recognizer_benchmark_database 对一种格式的测量结果
+typedef struct {
+    double save_ms;     // 整库重写（压缩）一次的平均耗时
+    double append_ms;   // 追加一个人的一条记录的平均耗时
+    double load_ms;     // 加载整个库的平均耗时（文件在页缓存中）
+    long file_bytes;    // 整库重写后的文件大小
+} DatabaseBenchmark;
+
+/**
+ * @brief 在 dir 下用 people 个合成的人分别测量明文和加密数据库的写入、追加和加载耗时，每项重复 runs 次取平均。
+ * 加密测量使用 face_recognizer_set_database_key 设置的密钥，没有设置时用一个临时的随机密钥。
+ * 测试文件用完即删，不影响正式的数据库。
+ * @return 成功返回0，参数无效或无法生成密钥时返回-1。
+ */
+int face_recognizer_benchmark_database(const char *dir, int people, int runs,
+                                       DatabaseBenchmark *plain, DatabaseBenchmark *encrypted);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,440 @@
+#include "face_tracker.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+// 与原先 cv::KalmanFilter 的配置一致：processNoiseCov=1e-2*I, measurementNoiseCov=1e-1*I, errorCovPost=I
+static const float KF_PROCESS_NOISE = 1e-2f;
+static const float KF_MEASUREMENT_NOISE = 1e-1f;
+static const float KF_INITIAL_COV = 1.0f;
+
+// 身份管理参数
+static const int MAX_VERIFY_FACTOR = 8;           // 复核间隔最多放大到识别间隔的倍数
+static const float SAME_FACE_SIMILARITY = 0.5f;   // 与滑动平均特征的余弦相似度低于该值视为换了一张脸
+static const float EMBEDDING_MOMENTUM = 0.3f;     // 新特征在滑动平均中的权重
+static const float VOTE_DECAY = 0.7f;             // 每来一次新结果，旧票数乘以该系数
+static const float DEFAULT_VOTE_MARGIN = 0.3f;    // 第一名票数领先第二名多少才确定身份
+
+static long long nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TrackerEngine::TrackerEngine(int capacity, int lifespan, float iouThreshold, int recognitionInterval)
+    : m_capacity(capacity), m_maxLifespan(lifespan), m_iouThreshold(iouThreshold)
+    , m_recognitionInterval(recognitionInterval), m_maxVerifyInterval(recognitionInterval * MAX_VERIFY_FACTOR)
+    , m_voteMargin(DEFAULT_VOTE_MARGIN)
+{
+    for (int d = 0; d < 4; ++d) {
+        m_pos[d].resize(capacity);
+        m_vel[d].resize(capacity);
+        m_p00[d].resize(capacity);
+        m_p01[d].resize(capacity);
+        m_p11[d].resize(capacity);
+    }
+    m_rect.resize(capacity);
+    m_id.resize(capacity);
+    m_lifespan.resize(capacity);
+    m_score.resize(capacity);
+    m_state.resize(capacity);
+    m_identity.resize(capacity);
+    m_matched.resize(capacity);
+    m_detRect.resize(capacity);
+    m_embedding.resize((size_t)capacity * FACE_FEATURE_DIM);
+    m_hasEmbedding.resize(capacity);
+    m_confidence.resize(capacity);
+    m_identitySince.resize(capacity);
+    m_nextRecognition.resize(capacity);
+    m_verifyInterval.resize(capacity);
+    m_pendingSince.resize(capacity);
+    m_voteId.resize((size_t)capacity * VOTE_SLOTS);
+    m_voteWeight.resize((size_t)capacity * VOTE_SLOTS);
+    m_trackMatch.resize(capacity);
+}
+
+void TrackerEngine::predict()
+{
+    const long long start = m_timing ? nowNs() : 0;
+    // x' = F x, P' = F P F^T + Q，F 对每一维都是 [[1,1],[0,1]]
+    for (int d = 0; d < 4; ++d) {
+        float *pos = m_pos[d].data(), *vel = m_vel[d].data();
+        float *p00 = m_p00[d].data(), *p01 = m_p01[d].data(), *p11 = m_p11[d].data();
+        for (int i = 0; i < m_count; ++i) {
+            pos[i] += vel[i];
+            p00[i] += 2.0f * p01[i] + p11[i] + KF_PROCESS_NOISE;
+            p01[i] += p11[i];
+            p11[i] += KF_PROCESS_NOISE;
+        }
+    }
+    for (int i = 0; i < m_count; ++i) updateRect(i);
+    if (m_timing) m_timing->kalmanNs += nowNs() - start;
+}
+
+void TrackerEngine::correct(int i, const FaceRect &r)
+{
+    const float z[4] = { r.x + r.width / 2.0f, r.y + r.height / 2.0f, (float)r.width, (float)r.height };
+    // H = [1 0]：S = P00 + R，K = [P00, P01] / S
+    for (int d = 0; d < 4; ++d) {
+        float p00 = m_p00[d][i], p01 = m_p01[d][i], p11 = m_p11[d][i];
+        float s = p00 + KF_MEASUREMENT_NOISE;
+        float k0 = p00 / s, k1 = p01 / s;
+        float y = z[d] - m_pos[d][i];
+        m_pos[d][i] += k0 * y;
+        m_vel[d][i] += k1 * y;
+        m_p00[d][i] = p00 - k0 * p00;
+        m_p01[d][i] = p01 - k0 * p01;
+        m_p11[d][i] = p11 - k1 * p01;
+    }
+    updateRect(i);
+}
+
+void TrackerEngine::updateRect(int i)
+{
+    float cx = m_pos[0][i], cy = m_pos[1][i], w = m_pos[2][i], h = m_pos[3][i];
+    m_rect[i] = { int(cx - w / 2), int(cy - h / 2), int(w), int(h) };
+}
+
+int TrackerEngine::add(const FaceRect &r)
+{
+    if (m_count >= m_capacity) return -1;
+    int i = m_count++;
+    const float z[4] = { r.x + r.width / 2.0f, r.y + r.height / 2.0f, (float)r.width, (float)r.height };
+    for (int d = 0; d < 4; ++d) {
+        m_pos[d][i] = z[d];
+        m_vel[d][i] = 0;
+        m_p00[d][i] = KF_INITIAL_COV;
+        m_p01[d][i] = 0;
+        m_p11[d][i] = KF_INITIAL_COV;
+    }
+    m_rect[i] = r;
+    m_id[i] = m_nextId++;
+    m_lifespan[i] = m_maxLifespan;
+    m_score[i] = 0;
+    setIdentity(i, RECOGNITION_STATE_TRACKING, FACE_IDENTITY_NONE);
+    m_matched[i] = 1;
+    m_detRect[i] = r;
+    m_hasEmbedding[i] = 0;
+    m_confidence[i] = 0;
+    m_identitySince[i] = 0;
+    m_nextRecognition[i] = 0;     // 新追踪器立即可以识别
+    m_verifyInterval[i] = m_recognitionInterval;
+    m_pendingSince[i] = -1;
+    clearVotes(i);
+    return i;
+}
+
+// 把最后一个追踪器搬到空位，保持活动区间紧凑
+void TrackerEngine::remove(int i)
+{
+    int last = --m_count;
+    if (i == last) return;
+    for (int d = 0; d < 4; ++d) {
+        m_pos[d][i] = m_pos[d][last];
+        m_vel[d][i] = m_vel[d][last];
+        m_p00[d][i] = m_p00[d][last];
+        m_p01[d][i] = m_p01[d][last];
+        m_p11[d][i] = m_p11[d][last];
+    }
+    m_rect[i] = m_rect[last];
+    m_id[i] = m_id[last];
+    m_lifespan[i] = m_lifespan[last];
+    m_score[i] = m_score[last];
+    m_state[i] = m_state[last];
+    m_identity[i] = m_identity[last];
+    m_matched[i] = m_matched[last];
+    m_detRect[i] = m_detRect[last];
+    std::copy(embedding(last), embedding(last) + FACE_FEATURE_DIM, embedding(i));
+    m_hasEmbedding[i] = m_hasEmbedding[last];
+    m_confidence[i] = m_confidence[last];
+    m_identitySince[i] = m_identitySince[last];
+    m_nextRecognition[i] = m_nextRecognition[last];
+    m_verifyInterval[i] = m_verifyInterval[last];
+    m_pendingSince[i] = m_pendingSince[last];
+    for (int k = 0; k < VOTE_SLOTS; ++k) {
+        m_voteId[(size_t)i * VOTE_SLOTS + k] = m_voteId[(size_t)last * VOTE_SLOTS + k];
+        m_voteWeight[(size_t)i * VOTE_SLOTS + k] = m_voteWeight[(size_t)last * VOTE_SLOTS + k];
+    }
+}
+
+void TrackerEngine::setIdentity(int i, RecognitionState state, int identityId)
+{
+    m_state[i] = state;
+    m_identity[i] = identityId;
+}
+
+void TrackerEngine::update(const FaceRect *detections, int n, std::vector<int> *newIds)
+{
+    std::fill(m_matched.begin(), m_matched.begin() + m_count, 0);
+    if (n <= 0) {
+        for (int i = 0; i < m_count; ++i) m_lifespan[i]--;
+        return;
+    }
+
+    // 代价矩阵的行取较少的一方，匈牙利算法要求 行数 <= 列数
+    const int tracks = m_count;
+    const bool transposed = tracks > n;
+    const int rows = transposed ? n : tracks;
+    const int cols = transposed ? tracks : n;
+    std::fill(m_trackMatch.begin(), m_trackMatch.begin() + tracks, -1);
+    m_detUsed.assign(n, 0);
+
+    long long start = m_timing ? nowNs() : 0;
+    if (rows > 0) {
+        m_cost.resize((size_t)rows * cols);
+        for (int t = 0; t < tracks; ++t) {
+            for (int j = 0; j < n; ++j) {
+                float c = 1.0f - iou(m_rect[t], detections[j]);
+                if (transposed) m_cost[(size_t)j * cols + t] = c;
+                else m_cost[(size_t)t * cols + j] = c;
+            }
+        }
+        solveAssignment(rows, cols);
+
+        // m_p[col] 是分配给该列的行（1起始，0表示未分配）
+        for (int c = 1; c <= cols; ++c) {
+            int r = m_p[c];
+            if (r == 0) continue;
+            int t = transposed ? c - 1 : r - 1;
+            int j = transposed ? r - 1 : c - 1;
+            // 全局最优匹配中 IOU 不足的配对视为未匹配
+            if (1.0f - m_cost[(size_t)(r - 1) * cols + (c - 1)] > m_iouThreshold) {
+                m_trackMatch[t] = j;
+                m_detUsed[j] = 1;
+            }
+        }
+    }
+    if (m_timing) {
+        const long long now = nowNs();
+        m_timing->matchNs += now - start;
+        start = now;
+    }
+
+    for (int t = 0; t < tracks; ++t) {
+        if (m_trackMatch[t] >= 0) {
+            correct(t, detections[m_trackMatch[t]]);
+            m_lifespan[t] = m_maxLifespan;
+            m_matched[t] = 1;
+            m_detRect[t] = detections[m_trackMatch[t]];
+        } else {
+            m_lifespan[t]--;
+        }
+    }
+    if (m_timing) m_timing->kalmanNs += nowNs() - start;
+
+    // 新目标初始化
+    for (int j = 0; j < n; ++j) {
+        if (m_detUsed[j]) continue;
+        int i = add(detections[j]);
+        if (i < 0) break;   // 容量已满
+        if (newIds) newIds->push_back(m_id[i]);
+    }
+}
+
+void TrackerEngine::removeExpired(std::vector<int> *lostIds)
+{
+    for (int i = m_count - 1; i >= 0; --i) {
+        if (m_lifespan[i] > 0) continue;
+        if (lostIds) lostIds->push_back(m_id[i]);
+        remove(i);
+    }
+}
+
+int TrackerEngine::bestOverlap(const FaceRect &rect, float *bestIou) const
+{
+    int best = -1;
+    float bestValue = 0;
+    for (int i = 0; i < m_count; ++i) {
+        float v = iou(m_rect[i], rect);
+        if (v > bestValue) { bestValue = v; best = i; }
+    }
+    if (bestIou) *bestIou = bestValue;
+    return best;
+}
+
+int TrackerEngine::indexOf(int id) const
+{
+    for (int i = 0; i < m_count; ++i) {
+        if (m_id[i] == id) return i;
+    }
+    return -1;
+}
+
+bool TrackerEngine::needsRecognition(int i, int frame) const
+{
+    // 任务可能因为队列满被丢弃，超过两个识别间隔仍未返回就允许重新提交
+    if (m_pendingSince[i] >= 0 && frame - m_pendingSince[i] < 2 * m_recognitionInterval) return false;
+    return frame >= m_nextRecognition[i];
+}
+
+void TrackerEngine::markSubmitted(int i, int frame)
+{
+    m_pendingSince[i] = frame;
+}
+
+void TrackerEngine::clearVotes(int i)
+{
+    for (int k = 0; k < VOTE_SLOTS; ++k) {
+        m_voteId[(size_t)i * VOTE_SLOTS + k] = VOTE_EMPTY;
+        m_voteWeight[(size_t)i * VOTE_SLOTS + k] = 0;
+    }
+}
+
+// 给某个身份加票；槽位已满时挤掉票数最少且少于本次票数的那个
+void TrackerEngine::addVote(int i, int identityId, float weight)
+{
+    int *ids = &m_voteId[(size_t)i * VOTE_SLOTS];
+    float *weights = &m_voteWeight[(size_t)i * VOTE_SLOTS];
+    int slot = -1, weakest = 0;
+    for (int k = 0; k < VOTE_SLOTS; ++k) {
+        if (ids[k] == identityId) { slot = k; break; }
+        if (slot < 0 && ids[k] == VOTE_EMPTY) slot = k;
+        if (weights[k] < weights[weakest]) weakest = k;
+    }
+    if (slot < 0) {
+        if (weights[weakest] >= weight) return;
+        slot = weakest;
+    }
+    if (ids[slot] != identityId) {
+        ids[slot] = identityId;
+        weights[slot] = 0;
+    }
+    weights[slot] += weight;
+}
+
+void TrackerEngine::blendEmbedding(int i, const float *feature)
+{
+    float *e = embedding(i);
+    if (!m_hasEmbedding[i]) {
+        std::copy(feature, feature + FACE_FEATURE_DIM, e);
+        m_hasEmbedding[i] = 1;
+        return;
+    }
+    float norm = 0;
+    for (int k = 0; k < FACE_FEATURE_DIM; ++k) {
+        e[k] = (1.0f - EMBEDDING_MOMENTUM) * e[k] + EMBEDDING_MOMENTUM * feature[k];
+        norm += e[k] * e[k];
+    }
+    if (norm > 0) {
+        float inv = 1.0f / std::sqrt(norm);
+        for (int k = 0; k < FACE_FEATURE_DIM; ++k) e[k] *= inv;
+    }
+}
+
+bool TrackerEngine::applyRecognition(int i, const RecognitionResult &r, int frame)
+{
+    m_pendingSince[i] = -1;
+    bool changed = false;
+
+    float similarity = 1.0f;
+    if (m_hasEmbedding[i]) {
+        const float *e = embedding(i);
+        similarity = 0;
+        for (int k = 0; k < FACE_FEATURE_DIM; ++k) similarity += e[k] * r.feature[k];
+    }
+
+    if (similarity < SAME_FACE_SIMILARITY) {
+        // 人脸交叉或遮挡后追踪器关联到了另一张脸，旧身份和票数作废，重新投票
+        std::copy(r.feature, r.feature + FACE_FEATURE_DIM, embedding(i));
+        m_hasEmbedding[i] = 1;
+        clearVotes(i);
+        changed = m_state[i] != RECOGNITION_STATE_TRACKING;
+        setIdentity(i, RECOGNITION_STATE_TRACKING, FACE_IDENTITY_NONE);
+        m_score[i] = 0;
+        m_identitySince[i] = frame;
+    } else {
+        blendEmbedding(i, r.feature);
+    }
+
+    // 旧票衰减后累加本次的候选相似度（"Unknown" 的票数就是识别阈值）
+    float *weights = &m_voteWeight[(size_t)i * VOTE_SLOTS];
+    for (int k = 0; k < VOTE_SLOTS; ++k) weights[k] *= VOTE_DECAY;
+    for (int k = 0; k < r.num_candidates; ++k) {
+        addVote(i, r.candidates[k].identity_id, std::max(r.candidates[k].score, 0.0f));
+    }
+
+    int leader = -1;
+    float best = 0, second = 0;
+    for (int k = 0; k < VOTE_SLOTS; ++k) {
+        if (m_voteId[(size_t)i * VOTE_SLOTS + k] == VOTE_EMPTY) continue;
+        if (leader < 0 || weights[k] > best) {
+            second = best;
+            best = weights[k];
+            leader = k;
+        } else if (weights[k] > second) {
+            second = weights[k];
+        }
+    }
+    m_confidence[i] = best - second;
+
+    const int lastInterval = m_verifyInterval[i];
+    m_verifyInterval[i] = m_recognitionInterval;
+    if (leader >= 0 && m_confidence[i] >= m_voteMargin) {
+        const int leaderId = m_voteId[(size_t)i * VOTE_SLOTS + leader];
+        const RecognitionState leaderState =
+            leaderId == FACE_IDENTITY_NONE ? RECOGNITION_STATE_UNKNOWN : RECOGNITION_STATE_KNOWN;
+        if (m_state[i] != leaderState || m_identity[i] != leaderId) {
+            setIdentity(i, leaderState, leaderId);
+            m_identitySince[i] = frame;
+            changed = true;
+        } else if (identified(i) && r.state == RECOGNITION_STATE_KNOWN && r.identity_id == leaderId) {
+            // 已确定的身份又得到一次一致的结果，复核间隔翻倍
+            m_verifyInterval[i] = std::min(lastInterval * 2, m_maxVerifyInterval);
+        }
+    }
+    if (r.state == m_state[i] && r.identity_id == m_identity[i]) m_score[i] = r.score;
+
+    m_nextRecognition[i] = frame + m_verifyInterval[i];
+    return changed;
+}
+
+// 匈牙利算法（势函数版本，O(rows^2 * cols)），代价矩阵为 m_cost[rows][cols]
+void TrackerEngine::solveAssignment(int rows, int cols)
+{
+    const float INF = std::numeric_limits<float>::max();
+    m_u.assign(rows + 1, 0);
+    m_v.assign(cols + 1, 0);
+    m_p.assign(cols + 1, 0);
+    m_way.assign(cols + 1, 0);
+    for (int i = 1; i <= rows; ++i) {
+        m_p[0] = i;
+        int j0 = 0;
+        m_minv.assign(cols + 1, INF);
+        m_usedCol.assign(cols + 1, 0);
+        do {
+            m_usedCol[j0] = 1;
+            int i0 = m_p[j0], j1 = 0;
+            float delta = INF;
+            const float *row = &m_cost[(size_t)(i0 - 1) * cols];
+            for (int j = 1; j <= cols; ++j) {
+                if (m_usedCol[j]) continue;
+                float cur = row[j - 1] - m_u[i0] - m_v[j];
+                if (cur < m_minv[j]) { m_minv[j] = cur; m_way[j] = j0; }
+                if (m_minv[j] < delta) { delta = m_minv[j]; j1 = j; }
+            }
+            for (int j = 0; j <= cols; ++j) {
+                if (m_usedCol[j]) { m_u[m_p[j]] += delta; m_v[j] -= delta; }
+                else m_minv[j] -= delta;
+            }
+            j0 = j1;
+        } while (m_p[j0] != 0);
+        do {
+            int j1 = m_way[j0];
+            m_p[j0] = m_p[j1];
+            j0 = j1;
+        } while (j0);
+    }
+}
+
+//计算交集的左上角和右下角坐标，从而得到交集面积
+float TrackerEngine::iou(const FaceRect &r1, const FaceRect &r2)
+{
+    int x1 = std::max(r1.x, r2.x), y1 = std::max(r1.y, r2.y);
+    int x2 = std::min(r1.x + r1.width, r2.x + r2.width), y2 = std::min(r1.y + r1.height, r2.y + r2.height);
+    int w = std::max(0, x2 - x1), h = std::max(0, y2 - y1);
+    int inter = w * h;
+    int unio = r1.width * r1.height + r2.width * r2.height - inter;
+    return unio > 0 ? (float)inter / unio : 0.0f;
+}
@@ -0,0 +1,168 @@
+#ifndef FACE_TRACKER_H
+#define FACE_TRACKER_H
+
+#include <cstddef>
+#include <vector>
+
+extern "C" {
+#include "face_detector.h"
+#include "face_recognizer.h"
+}
+
+// 多目标人脸追踪引擎
+// 状态按"结构体数组"(SoA)存放，活动追踪器始终紧凑地排在 [0, size()) 区间内，
+// 预测/校正是逐维展开的 8 状态卡尔曼滤波（中心x/y、宽、高及其速度），
+// 不分配任何 cv::Mat；检测框与追踪器的关联使用匈牙利算法求 IOU 全局最优匹配。
+// 每个追踪器还维护身份信息：身份状态和身份 id、滑动平均的特征向量、各候选身份的累计票数和下一次识别的帧号，
+// 名字不在这里保存，显示时再由 face_recognizer_state_label 解析。
+// 每次识别结果的前K名候选按相似度投票，旧票逐次衰减，第一名领先第二名超过设定的差值才确定身份；
+// 身份确定后复核间隔逐次翻倍，识别算力集中在新出现或不确定的追踪器上。
+// 注意：删除追踪器时会把最后一个元素移到空位，下标不稳定，对外请使用 id。
+class TrackerEngine
+{
+public:
+    /**
+     * @param recognitionInterval 新追踪器/不确定身份的识别间隔（帧），
+     *        身份稳定后的复核间隔从它开始翻倍，最多放大到 8 倍。
+     */
+    explicit TrackerEngine(int capacity, int lifespan, float iouThreshold, int recognitionInterval);
+
+    // 所有活动追踪器做一次卡尔曼预测，并刷新预测框
+    void predict();
+
+    /**
+     * @brief 用本帧的检测结果更新追踪器：全局匹配、校正、为未匹配的检测新建追踪器。
+     * 未匹配的追踪器寿命减一；n 为 0 时等价于所有追踪器寿命减一。
+     * @param newIds 可选，返回本帧新建的追踪器 id。
+     */
+    void update(const FaceRect *detections, int n, std::vector<int> *newIds = nullptr);
+
+    /**
+     * @brief 删除寿命耗尽的追踪器。
+     * @param lostIds 可选，返回被删除的追踪器 id。
+     */
+    void removeExpired(std::vector<int> *lostIds = nullptr);
+
+    // 返回与 rect 的 IOU 最大的活动追踪器下标，找不到返回 -1
+    int bestOverlap(const FaceRect &rect, float *iou) const;
+
+    // 返回 id 对应的下标，追踪器已不存在时返回 -1
+    int indexOf(int id) const;
+
+    // 最近一次 update() 中该追踪器是否与检测框匹配（含新建），以及匹配到的检测框
+    bool matched(int i) const { return m_matched[i] != 0; }
+    const FaceRect &detection(int i) const { return m_detRect[i]; }
+
+    // --- 身份 ---
+    // 该追踪器在第 frame 帧是否需要送去识别（已提交且未超时的不会重复提交）
+    bool needsRecognition(int i, int frame) const;
+    void markSubmitted(int i, int frame);
+
+    /**
+     * @brief 把一次识别结果合并到追踪器的身份上。
+     * 特征与追踪器的滑动平均特征差异过大时认为追踪器上换了一张脸，清空票数重新投票；
+     * 否则累加候选票数，领先差值达到 voteMargin 时才改变身份。
+     * @return 身份（状态或身份 id）是否发生变化。
+     */
+    bool applyRecognition(int i, const RecognitionResult &result, int frame);
+
+    // 确定身份所需的票数领先差值，越大越稳、需要的识别次数也越多
+    void setVoteMargin(float margin) { m_voteMargin = margin; }
+    float voteMargin() const { return m_voteMargin; }
+
+    // 身份已确定为库中的某人
+    bool identified(int i) const { return m_state[i] == RECOGNITION_STATE_KNOWN; }
+    // 第一名与第二名候选的票数差
+    float confidence(int i) const { return m_confidence[i]; }
+    // 当前身份已持续的帧数
+    int identityAge(int i, int frame) const { return frame - m_identitySince[i]; }
+
+    int size() const { return m_count; }
+    int capacity() const { return m_capacity; }
+    int id(int i) const { return m_id[i]; }
+    const FaceRect &rect(int i) const { return m_rect[i]; }
+    int lifespan(int i) const { return m_lifespan[i]; }
+    void refresh(int i) { m_lifespan[i] = m_maxLifespan; }
+
+    RecognitionState state(int i) const { return m_state[i]; }
+    int identity(int i) const { return m_identity[i]; }
+    float score(int i) const { return m_score[i]; }
+    void setScore(int i, float score) { m_score[i] = score; }
+
+    static float iou(const FaceRect &a, const FaceRect &b);
+
+    // 累计耗时（纳秒），用于基准测试区分卡尔曼滤波（预测和校正）与匹配（代价矩阵和匈牙利算法）
+    struct Timing {
+        long long kalmanNs = 0;
+        long long matchNs = 0;
+    };
+    // timing 不为 NULL 时 predict()/update() 把耗时累加到其中；默认不计时
+    void setTiming(Timing *timing) { m_timing = timing; }
+
+private:
+    static const int VOTE_EMPTY = -1;                       // 空的投票槽；0 是 "Unknown" 的票
+    static const int VOTE_SLOTS = RECOGNITION_TOP_K + 1;   // 每个追踪器保留的候选身份数
+
+    int add(const FaceRect &r);
+    void remove(int i);
+    void correct(int i, const FaceRect &r);
+    void updateRect(int i);
+    void solveAssignment(int rows, int cols);
+    void clearVotes(int i);
+    void addVote(int i, int identityId, float weight);
+    void setIdentity(int i, RecognitionState state, int identityId);
+    void blendEmbedding(int i, const float *feature);
+    float *embedding(int i) { return &m_embedding[(size_t)i * FACE_FEATURE_DIM]; }
+    const float *embedding(int i) const { return &m_embedding[(size_t)i * FACE_FEATURE_DIM]; }
+
+    int m_capacity;
+    int m_maxLifespan;
+    float m_iouThreshold;
+    int m_recognitionInterval;
+    int m_maxVerifyInterval;
+    float m_voteMargin;
+    int m_count = 0;
+    int m_nextId = 0;
+    Timing *m_timing = nullptr;
+
+    // --- 卡尔曼状态 (SoA)：每一维是 [位置, 速度]，协方差是对称 2x2 ---
+    // 由于转移矩阵按维度分块、噪声矩阵为对角阵，四个维度互不耦合，
+    // 每维只需保存 P00/P01/P11 三个数，与 cv::KalmanFilter 的 8x8 结果完全等价
+    std::vector<float> m_pos[4];      // cx, cy, w, h
+    std::vector<float> m_vel[4];
+    std::vector<float> m_p00[4];
+    std::vector<float> m_p01[4];
+    std::vector<float> m_p11[4];
+
+    // --- 每个追踪器的其余信息 ---
+    std::vector<FaceRect> m_rect;
+    std::vector<int> m_id;
+    std::vector<int> m_lifespan;
+    std::vector<float> m_score;
+    std::vector<RecognitionState> m_state;
+    std::vector<int> m_identity;
+    std::vector<char> m_matched;
+    std::vector<FaceRect> m_detRect;
+
+    // --- 身份状态 ---
+    std::vector<float> m_embedding;   // capacity x FACE_FEATURE_DIM，滑动平均后重新归一化
+    std::vector<char> m_hasEmbedding;
+    std::vector<float> m_confidence;
+    std::vector<int> m_voteId;          // capacity x VOTE_SLOTS，身份 id，VOTE_EMPTY 表示空槽
+    std::vector<float> m_voteWeight;
+    std::vector<int> m_identitySince;   // 当前身份确定时的帧号
+    std::vector<int> m_nextRecognition; // 不早于该帧再次识别
+    std::vector<int> m_verifyInterval;  // 当前的复核间隔
+    std::vector<int> m_pendingSince;    // 已提交识别的帧号，-1 表示没有待返回的结果
+
+    // --- 匹配用的预分配缓冲区，稳态下不再分配内存 ---
+    std::vector<float> m_cost;        // rows x cols，行是追踪器
+    std::vector<float> m_u, m_v;      // 匈牙利算法的对偶变量
+    std::vector<int> m_p, m_way;
+    std::vector<float> m_minv;
+    std::vector<char> m_usedCol;
+    std::vector<int> m_trackMatch;    // 追踪器 -> 检测下标，-1 表示未匹配
+    std::vector<char> m_detUsed;
+};
+
+#endif // FACE_TRACKER_H
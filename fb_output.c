@@ -0,0 +1,291 @@
+#include "fb_output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fb.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FB_USE_NEON 1
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define FB_USE_SSSE3 1
+#endif
+
+#ifndef FBIO_WAITFORVSYNC
+#define FBIO_WAITFORVSYNC _IOW('F', 0x20, uint32_t)
+#endif
+
+// 用普通文件模拟帧缓冲：文件中连续存放两个缓冲区
+static int fb_open_file(FbDevice *dev, const char *path, int width, int height, int bpp) {
+    if (width <= 0 || height <= 0 || (bpp != 16 && bpp != 32)) {
+        fprintf(stderr, "Invalid simulated framebuffer geometry %dx%d@%d\n", width, height, bpp);
+        return -1;
+    }
+    dev->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (dev->fd < 0) {
+        fprintf(stderr, "Can't open framebuffer file %s\n", path);
+        return -1;
+    }
+    dev->is_file = 1;
+    dev->width = width;
+    dev->height = height;
+    dev->line_length = width * bpp / 8;
+    dev->format = (bpp == 16) ? FB_FORMAT_RGB565 : FB_FORMAT_XRGB8888;
+    dev->num_buffers = 2;
+    dev->buffer_size = (size_t)dev->line_length * height;
+    dev->mem_size = dev->buffer_size * dev->num_buffers;
+    if (ftruncate(dev->fd, dev->mem_size) < 0) {
+        perror("ftruncate framebuffer file");
+        return -1;
+    }
+    return 0;
+}
+
+// 打开真实的 /dev/fbX，尽量开启双缓冲
+static int fb_open_device(FbDevice *dev) {
+    struct fb_var_screeninfo vinfo;
+    struct fb_fix_screeninfo finfo;
+    if (ioctl(dev->fd, FBIOGET_VSCREENINFO, &vinfo) < 0) {
+        perror("FBIOGET_VSCREENINFO");
+        return -1;
+    }
+
+    if (vinfo.bits_per_pixel == 16) {
+        dev->format = FB_FORMAT_RGB565;
+    } else if (vinfo.bits_per_pixel == 32) {
+        dev->format = (vinfo.red.offset == 0) ? FB_FORMAT_XBGR8888 : FB_FORMAT_XRGB8888;
+    } else {
+        fprintf(stderr, "Unsupported framebuffer depth %u bpp\n", vinfo.bits_per_pixel);
+        return -1;
+    }
+
+    // 申请两倍高度的虚拟分辨率用于翻页
+    dev->num_buffers = 1;
+    if (vinfo.yres_virtual < vinfo.yres * 2) {
+        struct fb_var_screeninfo want = vinfo;
+        want.yres_virtual = vinfo.yres * 2;
+        want.yoffset = 0;
+        if (ioctl(dev->fd, FBIOPUT_VSCREENINFO, &want) == 0) {
+            ioctl(dev->fd, FBIOGET_VSCREENINFO, &vinfo);
+        }
+    }
+    if (vinfo.yres_virtual >= vinfo.yres * 2) {
+        dev->num_buffers = 2;
+    } else {
+        fprintf(stderr, "Framebuffer does not support panning, falling back to single buffering\n");
+    }
+
+    if (ioctl(dev->fd, FBIOGET_FSCREENINFO, &finfo) < 0) {
+        perror("FBIOGET_FSCREENINFO");
+        return -1;
+    }
+    dev->width = vinfo.xres;
+    dev->height = vinfo.yres;
+    dev->line_length = finfo.line_length;
+    dev->buffer_size = (size_t)finfo.line_length * vinfo.yres;
+    dev->mem_size = dev->buffer_size * dev->num_buffers;
+    if (dev->mem_size > finfo.smem_len) {
+        dev->num_buffers = 1;
+        dev->mem_size = dev->buffer_size;
+    }
+    return 0;
+}
+
+FbDevice *fb_output_open(const char *path, int file_width, int file_height, int file_bpp) {
+    FbDevice *dev = calloc(1, sizeof(FbDevice));
+    if (!dev) {
+        perror("calloc FbDevice");
+        return NULL;
+    }
+    dev->fd = -1;
+
+    struct stat st;
+    int rc;
+    if (stat(path, &st) == 0 && S_ISCHR(st.st_mode)) {
+        dev->fd = open(path, O_RDWR);
+        if (dev->fd < 0) {
+            fprintf(stderr, "Can't open framebuffer %s\n", path);
+            goto fail;
+        }
+        rc = fb_open_device(dev);
+    } else if (file_width > 0) {
+        rc = fb_open_file(dev, path, file_width, file_height, file_bpp);
+    } else {
+        // 没有要求模拟时不能退回普通文件：fbdev 驱动没加载时会在 /dev 下建一个普通文件，界面画进去却没有任何报错
+        fprintf(stderr, "%s is not a framebuffer device (is the fbdev driver loaded?)\n", path);
+        goto fail;
+    }
+    if (rc < 0) goto fail;
+
+    dev->mem = mmap(NULL, dev->mem_size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, 0);
+    if (dev->mem == MAP_FAILED) {
+        dev->mem = NULL;
+        perror("mmap framebuffer");
+        goto fail;
+    }
+    memset(dev->mem, 0, dev->mem_size);
+    // 双缓冲时从第二个缓冲区开始画，第一个正在显示
+    dev->back_index = dev->num_buffers > 1 ? 1 : 0;
+
+    printf("Framebuffer %s opened: %dx%d, %s, %d buffer(s)%s.\n", path, dev->width, dev->height,
+           dev->format == FB_FORMAT_RGB565 ? "RGB565" : "32bpp", dev->num_buffers,
+           dev->is_file ? " (file-backed)" : "");
+    return dev;
+
+fail:
+    fb_output_close(dev);
+    return NULL;
+}
+
+unsigned char *fb_output_back_buffer(FbDevice *dev) {
+    return dev->mem + dev->buffer_size * dev->back_index;
+}
+
+int fb_output_flip(FbDevice *dev) {
+    if (dev->is_file) {
+        // 文件模式下没有扫描输出，只把刚画完的缓冲区刷到文件，供外部工具查看
+        msync(fb_output_back_buffer(dev), dev->buffer_size, MS_ASYNC);
+    } else if (dev->num_buffers > 1) {
+        struct fb_var_screeninfo vinfo;
+        if (ioctl(dev->fd, FBIOGET_VSCREENINFO, &vinfo) < 0) {
+            perror("FBIOGET_VSCREENINFO");
+            return -1;
+        }
+        vinfo.yoffset = dev->height * dev->back_index;
+        if (ioctl(dev->fd, FBIOPAN_DISPLAY, &vinfo) < 0) {
+            perror("FBIOPAN_DISPLAY");
+            return -1;
+        }
+    }
+    if (!dev->is_file) {
+        uint32_t crtc = 0;
+        ioctl(dev->fd, FBIO_WAITFORVSYNC, &crtc); // 不支持的驱动会返回错误，忽略即可
+    }
+    if (dev->num_buffers > 1) {
+        dev->back_index = 1 - dev->back_index;
+    }
+    return 0;
+}
+
+void fb_output_close(FbDevice *dev) {
+    if (!dev) return;
+    if (dev->mem) {
+        if (!dev->is_file && dev->num_buffers > 1) {
+            // 恢复到第一个缓冲区，避免控制台停留在第二页
+            struct fb_var_screeninfo vinfo;
+            if (ioctl(dev->fd, FBIOGET_VSCREENINFO, &vinfo) == 0) {
+                vinfo.yoffset = 0;
+                ioctl(dev->fd, FBIOPAN_DISPLAY, &vinfo);
+            }
+        }
+        munmap(dev->mem, dev->mem_size);
+    }
+    if (dev->fd >= 0) {
+        close(dev->fd);
+    }
+    free(dev);
+    printf("Framebuffer closed.\n");
+}
+
+// --- 颜色转换内核 ---
+static inline uint16_t pack_rgb565(uint8_t r, uint8_t g, uint8_t b) {
+    return (uint16_t)(((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3));
+}
+
+static void convert_rgb565(const uint8_t *src, uint16_t *dst, int count) {
+    int i = 0;
+#if defined(FB_USE_NEON)
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x3_t bgr = vld3q_u8(src + i * 3);
+        uint16x8_t r_lo = vshll_n_u8(vget_low_u8(bgr.val[2]), 8);
+        uint16x8_t r_hi = vshll_n_u8(vget_high_u8(bgr.val[2]), 8);
+        uint16x8_t g_lo = vshll_n_u8(vget_low_u8(bgr.val[1]), 8);
+        uint16x8_t g_hi = vshll_n_u8(vget_high_u8(bgr.val[1]), 8);
+        uint16x8_t b_lo = vshll_n_u8(vget_low_u8(bgr.val[0]), 8);
+        uint16x8_t b_hi = vshll_n_u8(vget_high_u8(bgr.val[0]), 8);
+        // 高5位保留R，依次右移插入G的高6位和B的高5位
+        uint16x8_t lo = vsriq_n_u16(vsriq_n_u16(r_lo, g_lo, 5), b_lo, 11);
+        uint16x8_t hi = vsriq_n_u16(vsriq_n_u16(r_hi, g_hi, 5), b_hi, 11);
+        vst1q_u16(dst + i, lo);
+        vst1q_u16(dst + i + 8, hi);
+    }
+#elif defined(FB_USE_SSSE3)
+    const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i mask8 = _mm_set1_epi32(0xFF);
+    const __m128i bias = _mm_set1_epi32(0x8000);
+    const __m128i flip = _mm_set1_epi16((short)0x8000);
+    // 每次读16字节只用12字节，保证不越过行尾
+    for (; i + 8 + 6 <= count; i += 8) {
+        __m128i p0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 3)), spread);
+        __m128i p1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 3 + 12)), spread);
+        __m128i v[2];
+        __m128i p[2] = { p0, p1 };
+        for (int k = 0; k < 2; ++k) {
+            __m128i b = _mm_and_si128(p[k], mask8);
+            __m128i g = _mm_and_si128(_mm_srli_epi32(p[k], 8), mask8);
+            __m128i r = _mm_and_si128(_mm_srli_epi32(p[k], 16), mask8);
+            __m128i px = _mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(r, 3), 11),
+                         _mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(g, 2), 5), _mm_srli_epi32(b, 3)));
+            v[k] = _mm_sub_epi32(px, bias);   // packs 是有符号饱和，先平移到有符号范围
+        }
+        __m128i packed = _mm_xor_si128(_mm_packs_epi32(v[0], v[1]), flip);
+        _mm_storeu_si128((__m128i *)(dst + i), packed);
+    }
+#endif
+    for (; i < count; ++i) {
+        dst[i] = pack_rgb565(src[i * 3 + 2], src[i * 3 + 1], src[i * 3]);
+    }
+}
+
+static void convert_rgb32(const uint8_t *src, uint8_t *dst, int count, int swap_rb) {
+    int i = 0;
+#if defined(FB_USE_NEON)
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x3_t bgr = vld3q_u8(src + i * 3);
+        uint8x16x4_t out;
+        out.val[0] = swap_rb ? bgr.val[2] : bgr.val[0];
+        out.val[1] = bgr.val[1];
+        out.val[2] = swap_rb ? bgr.val[0] : bgr.val[2];
+        out.val[3] = vdupq_n_u8(0xFF);
+        vst4q_u8(dst + i * 4, out);
+    }
+#elif defined(FB_USE_SSSE3)
+    const __m128i spread = swap_rb
+        ? _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+        : _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+    for (; i + 6 <= count; i += 4) {
+        __m128i p = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 3)), spread);
+        _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_or_si128(p, alpha));
+    }
+#endif
+    for (; i < count; ++i) {
+        const uint8_t *s = src + i * 3;
+        uint8_t *d = dst + i * 4;
+        d[0] = swap_rb ? s[2] : s[0];
+        d[1] = s[1];
+        d[2] = swap_rb ? s[0] : s[2];
+        d[3] = 0xFF;
+    }
+}
+
+void fb_convert_bgr24_row(const uint8_t *src, void *dst, int count, FbPixelFormat format) {
+    switch (format) {
+    case FB_FORMAT_RGB565:
+        convert_rgb565(src, (uint16_t *)dst, count);
+        break;
+    case FB_FORMAT_XRGB8888:
+        convert_rgb32(src, (uint8_t *)dst, count, 0);
+        break;
+    case FB_FORMAT_XBGR8888:
+        convert_rgb32(src, (uint8_t *)dst, count, 1);
+        break;
+    }
+}
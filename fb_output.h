@@ -0,0 +1,78 @@
+#ifndef FB_OUTPUT_H
+#define FB_OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 面板的原生像素格式
+typedef enum {
+    FB_FORMAT_RGB565 = 0,
+    FB_FORMAT_XRGB8888,   // 内存中字节顺序为 B,G,R,X
+    FB_FORMAT_XBGR8888    // 内存中字节顺序为 R,G,B,X
+} FbPixelFormat;
+
+// 用于保存帧缓冲设备状态的结构体
+typedef struct {
+    int fd;
+    int is_file;              // 1 表示用普通文件模拟的帧缓冲（桌面调试用）
+    int width;                // 可见区域宽度
+    int height;               // 可见区域高度
+    int line_length;          // 每行字节数
+    FbPixelFormat format;
+    int num_buffers;          // 1 = 单缓冲，2 = 双缓冲翻页
+    int back_index;           // 当前用于绘制的缓冲区序号
+    unsigned char *mem;       // mmap 映射的起始地址
+    size_t mem_size;          // 映射的总长度
+    size_t buffer_size;       // 单个缓冲区的长度 (line_length * height)
+} FbDevice;
+
+/**
+ * @brief 打开帧缓冲设备并映射显存。
+ *
+ * 优先把虚拟分辨率设为两倍高度以实现双缓冲翻页，驱动不支持时退化为单缓冲。
+ * 如果 path 不是字符设备并且 file_width > 0，则按 file_width/file_height/file_bpp 创建一个
+ * 包含两个缓冲区的文件来模拟帧缓冲，便于在桌面 Linux 上调试；file_width <= 0 时只接受真实设备。
+ * @param path 设备路径，例如 "/dev/fb0"，或者一个文件路径。
+ * @param file_width 文件模拟模式下的宽度，<=0 表示不允许文件模拟。
+ * @param file_height 文件模拟模式下的高度。
+ * @param file_bpp 文件模拟模式下的位深，16 或 32。
+ * @return 成功返回 FbDevice 指针，失败返回 NULL。
+ */
+FbDevice *fb_output_open(const char *path, int file_width, int file_height, int file_bpp);
+
+/**
+ * @brief 返回当前可以绘制的后台缓冲区的起始地址。
+ */
+unsigned char *fb_output_back_buffer(FbDevice *dev);
+
+/**
+ * @brief 把后台缓冲区切换到前台显示 (FBIOPAN_DISPLAY)，并等待垂直同步。
+ * 单缓冲时只做同步。
+ * @return 成功返回0，失败返回-1。
+ */
+int fb_output_flip(FbDevice *dev);
+
+/**
+ * @brief 恢复显示偏移，解除映射并关闭设备。
+ */
+void fb_output_close(FbDevice *dev);
+
+/**
+ * @brief 把一行 BGR24 像素转换为面板的原生格式。
+ * 在 ARM 上使用 NEON，x86 上使用 SSSE3（如果编译器启用），否则使用标量实现。
+ * @param src BGR24 源数据。
+ * @param dst 目标地址（可以直接是显存）。
+ * @param count 像素个数。
+ * @param format 目标格式。
+ */
+void fb_convert_bgr24_row(const uint8_t *src, void *dst, int count, FbPixelFormat format);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FB_OUTPUT_H
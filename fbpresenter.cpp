@@ -0,0 +1,146 @@
+#include "fbpresenter.h"
+
+#include <QMutexLocker>
+#include <QDebug>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <cerrno>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+FbPresenter::FbPresenter(QObject *parent) : QObject(parent)
+{
+    // 通知器是本对象的子对象，随 moveToThread 一起移到显示线程
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeFd >= 0) {
+        m_wakeNotifier = new QSocketNotifier(m_wakeFd, QSocketNotifier::Read, this);
+        connect(m_wakeNotifier, &QSocketNotifier::activated, this, &FbPresenter::onWake);
+    }
+    m_pendingResults.reserve(64);
+    m_presentResults.reserve(64);
+}
+
+FbPresenter::~FbPresenter()
+{
+    delete m_wakeNotifier;
+    if (m_wakeFd >= 0) close(m_wakeFd);
+    if (m_fb) {
+        fb_output_close(m_fb);
+    }
+}
+
+bool FbPresenter::open(const QString &path, int fileWidth, int fileHeight, int fileBpp)
+{
+    m_fb = fb_output_open(path.toUtf8().constData(), fileWidth, fileHeight, fileBpp);
+    return m_fb != nullptr;
+}
+
+void FbPresenter::submitFrame(const QByteArray &frameData, const FrameFormat &format, const QVector<FaceOverlay> &results)
+{
+    QMutexLocker locker(&m_mailboxMutex);
+    m_pendingData = frameData;
+    m_pendingFormat = format;
+    m_pendingResults.clear();
+    for (const auto &r : results) m_pendingResults.append(r);
+    if (m_presentScheduled) return;
+    m_presentScheduled = true;
+    locker.unlock();
+    if (m_wakeFd >= 0) {
+        uint64_t one = 1;
+        if (write(m_wakeFd, &one, sizeof(one)) < 0) perror("write eventfd");
+    } else {
+        QMetaObject::invokeMethod(this, "presentPending", Qt::QueuedConnection);
+    }
+}
+
+void FbPresenter::onWake()
+{
+    uint64_t count;
+    if (read(m_wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("read eventfd");
+    presentPending();
+}
+
+void FbPresenter::presentPending()
+{
+    QByteArray data;
+    FrameFormat format;
+    QVector<FaceOverlay> &results = m_presentResults;
+    {
+        QMutexLocker locker(&m_mailboxMutex);
+        data.swap(m_pendingData);
+        format = m_pendingFormat;
+        results.swap(m_pendingResults);
+        m_presentScheduled = false;
+    }
+    if (!m_fb || data.isEmpty()) return;
+    if (!decodeFrame(data, format)) return;
+
+    // 保持宽高比，最近邻缩放到面板大小；两侧留黑的区域打开设备时已清零且不会被改写
+    double scale = std::min((double)m_fb->width / m_bgr.cols, (double)m_fb->height / m_bgr.rows);
+    cv::Size scaled(std::max(1, (int)(m_bgr.cols * scale)), std::max(1, (int)(m_bgr.rows * scale)));
+    if (scaled == m_bgr.size()) {
+        m_scaled = m_bgr;
+    } else {
+        cv::resize(m_bgr, m_scaled, scaled, 0, 0, cv::INTER_NEAREST);
+    }
+    int frameWidth = format.width > 0 ? format.width : m_bgr.cols;
+    drawResults(results, (double)m_scaled.cols / frameWidth);
+
+    // 逐行转换为面板原生格式，直接写入后台缓冲区
+    int bytesPerPixel = (m_fb->format == FB_FORMAT_RGB565) ? 2 : 4;
+    int x0 = (m_fb->width - m_scaled.cols) / 2;
+    int y0 = (m_fb->height - m_scaled.rows) / 2;
+    unsigned char *back = fb_output_back_buffer(m_fb);
+    for (int y = 0; y < m_scaled.rows; ++y) {
+        unsigned char *dst = back + (size_t)(y0 + y) * m_fb->line_length + (size_t)x0 * bytesPerPixel;
+        fb_convert_bgr24_row(m_scaled.ptr<uint8_t>(y), dst, m_scaled.cols, m_fb->format);
+    }
+    fb_output_flip(m_fb);
+}
+
+bool FbPresenter::decodeFrame(const QByteArray &frameData, const FrameFormat &format)
+{
+    uchar *data = (uchar *)frameData.constData();
+    if (format.fourcc == V4L2_PIX_FMT_MJPEG) {
+        // 面板比图像小一半以上时直接按1/2解码，减少IDCT计算量
+        int flags = cv::IMREAD_COLOR;
+        if (format.width >= 2 * m_fb->width && format.height >= 2 * m_fb->height) {
+            flags = cv::IMREAD_REDUCED_COLOR_2;
+        }
+        cv::Mat jpeg(1, frameData.size(), CV_8UC1, data);
+        cv::imdecode(jpeg, flags, &m_bgr);   // 解码到 m_bgr 已有的缓冲区，尺寸不变时不重新分配
+        if (m_bgr.empty()) {
+            qWarning() << "帧缓冲输出: JPEG解码失败";
+            return false;
+        }
+    } else if (format.fourcc == V4L2_PIX_FMT_YUYV) {
+        cv::Mat yuyv(format.height, format.width, CV_8UC2, data, format.stride);
+        cv::cvtColor(yuyv, m_bgr, cv::COLOR_YUV2BGR_YUYV);
+    } else if (format.fourcc == V4L2_PIX_FMT_NV12) {
+        cv::Mat y_plane(format.height, format.width, CV_8UC1, data, format.stride);
+        cv::Mat uv_plane(format.height / 2, format.width / 2, CV_8UC2,
+                         data + (size_t)format.stride * format.height, format.stride);
+        cv::cvtColorTwoPlane(y_plane, uv_plane, m_bgr, cv::COLOR_YUV2BGR_NV12);
+    } else {
+        qWarning() << "帧缓冲输出: 不支持的帧格式";
+        return false;
+    }
+    return true;
+}
+
+void FbPresenter::drawResults(const QVector<FaceOverlay> &results, double scale)
+{
+    for (const auto &result : results) {
+        cv::Scalar color(0, 0, 255); // 默认为红色 (Unknown)
+        if (result.state == RECOGNITION_STATE_POSITIONING) {
+            color = cv::Scalar(0, 255, 255); // 注册时为黄色
+        } else if (result.state == RECOGNITION_STATE_KNOWN) {
+            color = cv::Scalar(0, 255, 0); // 识别成功为绿色
+        }
+        cv::Rect rect(cvRound(result.rect.x * scale), cvRound(result.rect.y * scale),
+                      cvRound(result.rect.width * scale), cvRound(result.rect.height * scale));
+        cv::rectangle(m_scaled, rect, color, 2);
+        cv::putText(m_scaled, face_recognizer_state_label(result.state, result.identityId), cv::Point(rect.x, rect.y - 5),
+                    cv::FONT_HERSHEY_SIMPLEX, 0.6, cv::Scalar(255, 255, 255), 2);
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef FBPRESENTER_H
+#define FBPRESENTER_H
+
+#include "videoprocessor.h"
+
+#include <QObject>
+#include <QMutex>
+#include <QVector>
+#include <QSocketNotifier>
+#include <QByteArray>
+#include <QString>
+
+#include <opencv2/core.hpp>
+
+extern "C" {
+#include "fb_output.h"
+}
+
+// 绕过Qt控件栈，把处理后的帧和识别框直接写进帧缓冲 (/dev/fb0) 并翻页显示
+class FbPresenter : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FbPresenter(QObject *parent = nullptr);
+    ~FbPresenter();
+
+    /**
+     * @brief 打开帧缓冲。path 不是设备且 fileWidth > 0 时按 fileWidth x fileHeight @ fileBpp 用文件模拟，
+     * fileWidth <= 0 时只接受真实设备。
+     */
+    bool open(const QString &path, int fileWidth, int fileHeight, int fileBpp);
+
+    // 线程安全：只保留最新一帧，显示跟不上时旧帧被合并
+    void submitFrame(const QByteArray &frameData, const FrameFormat &format, const QVector<FaceOverlay> &results);
+
+private slots:
+    void presentPending();
+    void onWake();
+
+private:
+    bool decodeFrame(const QByteArray &frameData, const FrameFormat &format);
+    void drawResults(const QVector<FaceOverlay> &results, double scale);
+
+    FbDevice *m_fb = nullptr;
+
+    QMutex m_mailboxMutex;
+    QByteArray m_pendingData;
+    FrameFormat m_pendingFormat;
+    QVector<FaceOverlay> m_pendingResults;   // 逐个拷贝进来，与 m_presentResults 交换，两者都保留容量
+    bool m_presentScheduled = false;
+    int m_wakeFd = -1;                        // 提交线程写 eventfd 唤醒显示线程，每帧不分配事件对象
+    QSocketNotifier *m_wakeNotifier = nullptr;
+
+    // 以下只在显示线程中使用，尺寸不变时复用内存
+    cv::Mat m_bgr;
+    cv::Mat m_scaled;
+    QVector<FaceOverlay> m_presentResults;
+};
+
+#endif // FBPRESENTER_H
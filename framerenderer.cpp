@@ -0,0 +1,178 @@
+#include "framerenderer.h"
+
+#include <QBuffer>
+#include <QImageReader>
+#include <QPainter>
+#include <QMutexLocker>
+#include <QDebug>
+#include <opencv2/imgproc.hpp>
+#include <cerrno>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+FrameRenderer::FrameRenderer(QObject *parent)
+    : QObject(parent)
+    , m_font("Arial", 14, QFont::Bold)
+    , m_knownPen(Qt::green, 2)
+    , m_unknownPen(Qt::red, 2)
+    , m_positioningPen(Qt::yellow, 2)
+    , m_textPen(Qt::white)
+{
+    // 通知器是本对象的子对象，随 moveToThread 一起移到渲染线程
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeFd >= 0) {
+        m_wakeNotifier = new QSocketNotifier(m_wakeFd, QSocketNotifier::Read, this);
+        connect(m_wakeNotifier, &QSocketNotifier::activated, this, &FrameRenderer::onWake);
+    }
+    m_pendingResults.reserve(64);
+    m_renderResults.reserve(64);
+}
+
+FrameRenderer::~FrameRenderer()
+{
+    delete m_wakeNotifier;
+    if (m_wakeFd >= 0) close(m_wakeFd);
+}
+
+void FrameRenderer::submitFrame(const QByteArray &frameData, const FrameFormat &format, const QVector<FaceOverlay> &results)
+{
+    QMutexLocker locker(&m_mailboxMutex);
+    m_pendingData = frameData;        // 隐式共享，不拷贝像素
+    m_pendingFormat = format;
+    // 逐个拷贝而不是共享提交方的 vector，双方的缓冲区都能原地复用
+    m_pendingResults.clear();
+    for (const auto &r : results) m_pendingResults.append(r);
+    if (m_renderScheduled) return;    // 已经排队的渲染会取到这一帧
+    m_renderScheduled = true;
+    locker.unlock();
+    if (m_wakeFd >= 0) {
+        uint64_t one = 1;
+        if (write(m_wakeFd, &one, sizeof(one)) < 0) perror("write eventfd");
+    } else {
+        QMetaObject::invokeMethod(this, "renderPending", Qt::QueuedConnection);
+    }
+}
+
+void FrameRenderer::onWake()
+{
+    uint64_t count;
+    if (read(m_wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("read eventfd");
+    renderPending();
+}
+
+void FrameRenderer::setTargetSize(const QSize &size)
+{
+    QMutexLocker locker(&m_mailboxMutex);
+    m_targetSize = size;
+}
+
+bool FrameRenderer::takeFrame()
+{
+    m_notifyPending = false;
+    return m_buffers.swap();
+}
+
+void FrameRenderer::renderPending()
+{
+    QByteArray data;
+    FrameFormat format;
+    QVector<FaceOverlay> &results = m_renderResults;
+    QSize target;
+    {
+        QMutexLocker locker(&m_mailboxMutex);
+        data.swap(m_pendingData);
+        format = m_pendingFormat;
+        results.swap(m_pendingResults);
+        target = m_targetSize;
+        m_renderScheduled = false;
+    }
+    if (data.isEmpty() || target.isEmpty()) return;
+    if (!decodeFrame(data, format, target)) return;
+
+    // 按目标尺寸准备 back 缓冲区，尺寸不变时复用内存
+    QImage &out = m_buffers.back();
+    if (out.size() != target) {
+        out = QImage(target, QImage::Format_RGB32);
+    }
+    out.fill(Qt::black);
+
+    // 保持宽高比居中，最近邻缩放直接画进输出缓冲区，省去一次中间拷贝
+    QSize scaled = m_source.size().scaled(target, Qt::KeepAspectRatio);
+    QPoint offset((target.width() - scaled.width()) / 2, (target.height() - scaled.height()) / 2);
+    // 识别框坐标基于摄像头原始分辨率，JPEG 可能已按比例缩小解码
+    int frameWidth = format.width > 0 ? format.width : m_source.width();
+    qreal scale = (qreal)scaled.width() / frameWidth;
+
+    QPainter painter(&out);
+    painter.drawImage(QRect(offset, scaled), m_source);
+    drawResults(painter, results, scale, offset);
+    painter.end();
+
+    m_buffers.publish();
+    // GUI 还没取走上一帧时不再发信号，多余的帧自然被合并
+    if (!m_notifyPending.exchange(true)) {
+        emit frameReady();
+    }
+}
+
+bool FrameRenderer::decodeFrame(const QByteArray &frameData, const FrameFormat &format, const QSize &target)
+{
+    if (format.fourcc == V4L2_PIX_FMT_MJPEG) {
+        QBuffer buffer;
+        buffer.setData(frameData);
+        buffer.open(QIODevice::ReadOnly);
+        QImageReader reader(&buffer, "JPEG");
+        // 目标比原图小一半以上时让 libjpeg 在 DCT 阶段直接缩小解码
+        QSize full = reader.size();
+        QSize scaled = full.scaled(target, Qt::KeepAspectRatio);
+        if (full.isValid() && scaled.width() * 2 <= full.width()) {
+            reader.setScaledSize(scaled);
+        }
+        if (!reader.read(&m_source)) {
+            qWarning() << "渲染线程解码JPEG失败:" << reader.errorString();
+            return false;
+        }
+        return true;
+    }
+
+    if (m_source.width() != format.width || m_source.height() != format.height
+            || m_source.format() != QImage::Format_RGB888) {
+        m_source = QImage(format.width, format.height, QImage::Format_RGB888);
+    }
+    cv::Mat rgb(m_source.height(), m_source.width(), CV_8UC3, m_source.bits(), m_source.bytesPerLine());
+    uchar *data = (uchar *)frameData.constData();
+    if (format.fourcc == V4L2_PIX_FMT_YUYV) {
+        cv::Mat yuyv(format.height, format.width, CV_8UC2, data, format.stride);
+        cv::cvtColor(yuyv, rgb, cv::COLOR_YUV2RGB_YUYV);
+    } else if (format.fourcc == V4L2_PIX_FMT_NV12) {
+        cv::Mat y_plane(format.height, format.width, CV_8UC1, data, format.stride);
+        cv::Mat uv_plane(format.height / 2, format.width / 2, CV_8UC2,
+                         data + (size_t)format.stride * format.height, format.stride);
+        cv::cvtColorTwoPlane(y_plane, uv_plane, rgb, cv::COLOR_YUV2RGB_NV12);
+    } else {
+        qWarning() << "不支持的帧格式";
+        return false;
+    }
+    return true;
+}
+
+void FrameRenderer::drawResults(QPainter &painter, const QVector<FaceOverlay> &results, qreal scale, const QPoint &offset)
+{
+    painter.setFont(m_font);
+    for (const auto &result : results) {
+        const QPen *pen = &m_unknownPen; // 默认为红色 (Unknown)
+        if (result.state == RECOGNITION_STATE_POSITIONING) {
+            pen = &m_positioningPen; // 注册时为黄色
+        } else if (result.state == RECOGNITION_STATE_KNOWN) {
+            pen = &m_knownPen; // 识别成功为绿色
+        }
+
+        QRect rect(offset.x() + qRound(result.rect.x * scale), offset.y() + qRound(result.rect.y * scale),
+                   qRound(result.rect.width * scale), qRound(result.rect.height * scale));
+        painter.setPen(*pen);
+        painter.drawRect(rect);
+
+        painter.setPen(m_textPen);
+        painter.drawText(rect.x(), rect.y() - 5, QString::fromUtf8(face_recognizer_state_label(result.state, result.identityId)));
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef FRAMERENDERER_H
+#define FRAMERENDERER_H
+
+#include "videoprocessor.h"
+
+#include <QObject>
+#include <QImage>
+#include <QFont>
+#include <QPen>
+#include <QSize>
+#include <QMutex>
+#include <QVector>
+#include <QSocketNotifier>
+#include <QByteArray>
+
+#include <atomic>
+
+class QPainter;
+
+// 三缓冲：渲染线程写 back，GUI 线程读 front，middle 用原子变量交换，双方都不需要加锁
+class TripleBuffer
+{
+public:
+    TripleBuffer() : m_middle(1), m_back(0), m_front(2) {}
+
+    // 渲染线程：当前可写的缓冲区
+    QImage &back() { return m_images[m_back]; }
+    // 渲染线程：发布 back，换回上一次的 middle 继续写
+    void publish() { m_back = m_middle.exchange(m_back | FRESH_BIT) & INDEX_MASK; }
+
+    // GUI 线程：如果有新帧则换到 front，返回是否发生了交换
+    bool swap()
+    {
+        if (!(m_middle.load() & FRESH_BIT)) return false;
+        m_front = m_middle.exchange(m_front) & INDEX_MASK;
+        return true;
+    }
+    // GUI 线程：当前用于显示的缓冲区
+    const QImage &front() const { return m_images[m_front]; }
+
+private:
+    static const int FRESH_BIT = 4;
+    static const int INDEX_MASK = 3;
+
+    QImage m_images[3];
+    std::atomic<int> m_middle;
+    int m_back;
+    int m_front;
+};
+
+// 在独立线程中把一帧图像和识别结果渲染成可以直接绘制的 QImage
+class FrameRenderer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FrameRenderer(QObject *parent = nullptr);
+    ~FrameRenderer();
+
+    // 以下两个函数可以在任意线程调用
+    void submitFrame(const QByteArray &frameData, const FrameFormat &format, const QVector<FaceOverlay> &results);
+    void setTargetSize(const QSize &size);
+
+    // 仅在 GUI 线程调用：切换到最新渲染好的帧
+    bool takeFrame();
+    const QImage &currentFrame() const { return m_buffers.front(); }
+
+signals:
+    void frameReady();    // 有新帧可取，GUI 未取走之前不会重复发出
+
+private slots:
+    void renderPending();
+    void onWake();
+
+private:
+    bool decodeFrame(const QByteArray &frameData, const FrameFormat &format, const QSize &target);
+    void drawResults(QPainter &painter, const QVector<FaceOverlay> &results, qreal scale, const QPoint &offset);
+
+    // 邮箱：只保留最新的一帧，渲染跟不上时旧帧直接被覆盖
+    QMutex m_mailboxMutex;
+    QByteArray m_pendingData;
+    FrameFormat m_pendingFormat;
+    QVector<FaceOverlay> m_pendingResults;   // 逐个拷贝进来，与 m_renderResults 交换，两者都保留容量
+    bool m_renderScheduled = false;
+    QSize m_targetSize;
+
+    // 提交线程写 eventfd 唤醒渲染线程，不像排队的函数调用那样每帧分配一个事件
+    int m_wakeFd = -1;
+    QSocketNotifier *m_wakeNotifier = nullptr;
+
+    std::atomic<bool> m_notifyPending{false};
+    TripleBuffer m_buffers;
+
+    // 以下只在渲染线程中使用
+    QImage m_source;      // 解码后的原始尺寸图像，尺寸不变时复用
+    QVector<FaceOverlay> m_renderResults;
+    QFont m_font;
+    QPen m_knownPen;
+    QPen m_unknownPen;
+    QPen m_positioningPen;
+    QPen m_textPen;
+};
+
+#endif // FRAMERENDERER_H
@@ -0,0 +1,408 @@
+#define _GNU_SOURCE   // accept4
+#include "gallery_rpc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+typedef struct {
+    int fd;                     // -1 表示空闲
+    GalleryRpcReader reader;
+} ShardClient;
+
+struct GalleryShardServer {
+    int listen_fd;
+    char unix_path[sizeof(((struct sockaddr_un *)0)->sun_path)];   // unix: 地址的套接字文件，销毁时删除
+    int max_clients;
+    ShardClient *clients;
+};
+
+// --- 字节序 ---
+static void put_u16(unsigned char *p, uint16_t v) {
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static uint16_t get_u16(const unsigned char *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put_float(unsigned char *p, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    put_u32(p, bits);
+}
+
+static float get_float(const unsigned char *p) {
+    uint32_t bits = get_u32(p);
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+static void put_header(unsigned char *p, uint16_t type, uint32_t request_id, uint32_t length) {
+    put_u32(p, GALLERY_RPC_MAGIC);
+    put_u16(p + 4, GALLERY_RPC_VERSION);
+    put_u16(p + 6, type);
+    put_u32(p + 8, request_id);
+    put_u32(p + 12, length);
+}
+
+// 整帧一次写完，写不完按失败处理（见头文件）
+static int send_frame(int fd, const unsigned char *frame, size_t size) {
+    for (;;) {
+        ssize_t n = send(fd, frame, size, MSG_NOSIGNAL);
+        if (n == (ssize_t)size) return 0;
+        if (n < 0 && errno == EINTR) continue;
+        return -1;
+    }
+}
+
+// --- 地址 ---
+// unix:/path 填到 *un 并返回 AF_UNIX；tcp:host:port 或 host:port 解析到 *res 并返回 AF_INET/AF_INET6
+static int resolve_address(const char *address, int passive, struct sockaddr_un *un, struct addrinfo **res) {
+    if (strncmp(address, "unix:", 5) == 0) {
+        const char *path = address + 5;
+        if (strlen(path) == 0 || strlen(path) >= sizeof(un->sun_path)) {
+            fprintf(stderr, "Invalid gallery socket path: %s\n", address);
+            return -1;
+        }
+        memset(un, 0, sizeof(*un));
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, path, strlen(path) + 1);
+        return AF_UNIX;
+    }
+
+    if (strncmp(address, "tcp:", 4) == 0) address += 4;
+    const char *colon = strrchr(address, ':');
+    if (!colon || colon[1] == '\0') {
+        fprintf(stderr, "Gallery address needs a port: %s\n", address);
+        return -1;
+    }
+    char host[256];
+    size_t host_len = colon - address;
+    if (host_len >= sizeof(host)) return -1;
+    memcpy(host, address, host_len);
+    host[host_len] = '\0';
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (passive) hints.ai_flags = AI_PASSIVE;
+    int err = getaddrinfo(host_len ? host : NULL, colon + 1, &hints, res);
+    if (err != 0) {
+        fprintf(stderr, "Cannot resolve gallery address %s: %s\n", address, gai_strerror(err));
+        return -1;
+    }
+    return (*res)->ai_family;
+}
+
+int gallery_rpc_connect(const char *address, int timeout_ms) {
+    struct sockaddr_un un;
+    struct addrinfo *res = NULL;
+    int family = resolve_address(address, 0, &un, &res);
+    if (family < 0) return -1;
+
+    const struct sockaddr *addr = family == AF_UNIX ? (const struct sockaddr *)&un : res->ai_addr;
+    socklen_t addr_len = family == AF_UNIX ? sizeof(un) : res->ai_addrlen;
+    int fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        if (res) freeaddrinfo(res);
+        return -1;
+    }
+
+    int ret = connect(fd, addr, addr_len);
+    if (res) freeaddrinfo(res);
+    if (ret < 0 && errno == EINPROGRESS) {
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        if (poll(&pfd, 1, timeout_ms) == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 && err == 0) {
+            ret = 0;
+        } else {
+            errno = err ? err : ETIMEDOUT;
+        }
+    }
+    if (ret < 0) {
+        close(fd);
+        return -1;
+    }
+    if (family != AF_UNIX) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+int gallery_rpc_send_query(int fd, uint32_t request_id, const float *feature, int dim, int k) {
+    unsigned char frame[GALLERY_RPC_HEADER_SIZE + 4 + GALLERY_RPC_MAX_DIM * 4];
+    if (dim <= 0 || dim > GALLERY_RPC_MAX_DIM) return -1;
+    const uint32_t length = 4 + (uint32_t)dim * 4;
+    put_header(frame, GALLERY_MSG_QUERY, request_id, length);
+    unsigned char *p = frame + GALLERY_RPC_HEADER_SIZE;
+    put_u16(p, (uint16_t)k);
+    put_u16(p + 2, (uint16_t)dim);
+    p += 4;
+    for (int i = 0; i < dim; i++, p += 4) put_float(p, feature[i]);
+    return send_frame(fd, frame, GALLERY_RPC_HEADER_SIZE + length);
+}
+
+// 缓冲区开头是否已有一整帧；头部不合法时返回-1
+static int complete_frame(const GalleryRpcReader *reader, GalleryRpcHeader *header) {
+    if (reader->used < GALLERY_RPC_HEADER_SIZE) return 0;
+    const unsigned char *p = reader->data;
+    if (get_u32(p) != GALLERY_RPC_MAGIC || get_u16(p + 4) != GALLERY_RPC_VERSION) return -1;
+    header->type = get_u16(p + 6);
+    header->request_id = get_u32(p + 8);
+    header->length = get_u32(p + 12);
+    if (header->length > GALLERY_RPC_MAX_PAYLOAD) return -1;
+    return reader->used >= GALLERY_RPC_HEADER_SIZE + header->length;
+}
+
+int gallery_rpc_read_frame(int fd, GalleryRpcReader *reader, GalleryRpcHeader *header, const unsigned char **payload) {
+    // 上一次返回的帧已经用完，把后面的数据移到开头
+    if (reader->frame_size) {
+        reader->used -= reader->frame_size;
+        memmove(reader->data, reader->data + reader->frame_size, reader->used);
+        reader->frame_size = 0;
+    }
+    for (;;) {
+        int ready = complete_frame(reader, header);
+        if (ready < 0) return -1;
+        if (ready) {
+            *payload = reader->data + GALLERY_RPC_HEADER_SIZE;
+            reader->frame_size = GALLERY_RPC_HEADER_SIZE + header->length;
+            return 1;
+        }
+        ssize_t n = read(fd, reader->data + reader->used, sizeof(reader->data) - reader->used);
+        if (n == 0) return -1;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        reader->used += (unsigned int)n;
+    }
+}
+
+int gallery_rpc_decode_reply(const unsigned char *payload, uint32_t length, GalleryHit *hits, int max_hits) {
+    if (length < 2) return -1;
+    const unsigned char *p = payload, *end = payload + length;
+    int count = get_u16(p);
+    p += 2;
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if (p >= end) return -1;
+        unsigned int name_len = *p++;
+        if (name_len >= GALLERY_NAME_MAX || end - p < (long)name_len + 4) return -1;
+        if (n < max_hits) {
+            memcpy(hits[n].name, p, name_len);
+            hits[n].name[name_len] = '\0';
+            hits[n].score = get_float(p + name_len);
+            n++;
+        }
+        p += name_len + 4;
+    }
+    return n;
+}
+
+// --- 分片服务端 ---
+static void close_client(ShardClient *client) {
+    close(client->fd);
+    client->fd = -1;
+}
+
+GalleryShardServer *gallery_shard_server_create(const char *address, int max_clients) {
+    struct sockaddr_un un;
+    struct addrinfo *res = NULL;
+    int family = resolve_address(address, 1, &un, &res);
+    if (family < 0) return NULL;
+
+    GalleryShardServer *server = calloc(1, sizeof(GalleryShardServer));
+    if (!server) {
+        perror("calloc GalleryShardServer");
+        if (res) freeaddrinfo(res);
+        return NULL;
+    }
+    server->listen_fd = -1;
+    server->max_clients = max_clients;
+    server->clients = calloc(max_clients, sizeof(ShardClient));
+    if (!server->clients) {
+        perror("calloc ShardClient");
+        goto fail;
+    }
+    for (int i = 0; i < max_clients; i++) server->clients[i].fd = -1;
+
+    server->listen_fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0) {
+        perror("socket");
+        goto fail;
+    }
+    if (family == AF_UNIX) {
+        unlink(un.sun_path); // 删除上次异常退出残留的套接字文件
+        memcpy(server->unix_path, un.sun_path, strlen(un.sun_path) + 1);   // 长度已在 resolve_address 中检查
+        if (bind(server->listen_fd, (struct sockaddr *)&un, sizeof(un)) < 0) {
+            perror("bind");
+            goto fail;
+        }
+    } else {
+        int one = 1;
+        setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(server->listen_fd, res->ai_addr, res->ai_addrlen) < 0) {
+            perror("bind");
+            goto fail;
+        }
+    }
+    if (listen(server->listen_fd, max_clients) < 0) {
+        perror("listen");
+        goto fail;
+    }
+    if (res) freeaddrinfo(res);
+    printf("Gallery shard listening on %s.\n", address);
+    return server;
+
+fail:
+    if (res) freeaddrinfo(res);
+    gallery_shard_server_destroy(server);
+    return NULL;
+}
+
+static void accept_clients(GalleryShardServer *server) {
+    int fd;
+    while ((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        ShardClient *slot = NULL;
+        for (int i = 0; i < server->max_clients && !slot; i++) {
+            if (server->clients[i].fd < 0) slot = &server->clients[i];
+        }
+        if (!slot) {
+            fprintf(stderr, "Gallery shard: too many clients, rejecting connection\n");
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // Unix 域套接字上会失败，无妨
+        slot->fd = fd;
+        slot->reader.used = 0;
+        slot->reader.frame_size = 0;
+    }
+}
+
+// 处理一条查询并写回复，返回-1 时断开客户端
+static int answer_query(ShardClient *client, const GalleryRpcHeader *header, const unsigned char *payload,
+                        GalleryQueryHandler handler, void *user_data) {
+    if (header->type != GALLERY_MSG_QUERY || header->length < 4) return -1;
+    int k = get_u16(payload);
+    int dim = get_u16(payload + 2);
+    if (dim <= 0 || dim > GALLERY_RPC_MAX_DIM || header->length != 4 + (uint32_t)dim * 4) return -1;
+    if (k > GALLERY_MAX_HITS) k = GALLERY_MAX_HITS;
+
+    float feature[GALLERY_RPC_MAX_DIM];
+    for (int i = 0; i < dim; i++) feature[i] = get_float(payload + 4 + i * 4);
+    GalleryHit hits[GALLERY_MAX_HITS];
+    int count = k > 0 ? handler(feature, dim, k, hits, user_data) : 0;
+    if (count < 0) count = 0;
+
+    unsigned char frame[GALLERY_RPC_HEADER_SIZE + 2 + GALLERY_MAX_HITS * (1 + GALLERY_NAME_MAX + 4)];
+    unsigned char *p = frame + GALLERY_RPC_HEADER_SIZE;
+    put_u16(p, (uint16_t)count);
+    p += 2;
+    for (int i = 0; i < count; i++) {
+        size_t name_len = strnlen(hits[i].name, GALLERY_NAME_MAX - 1);
+        *p++ = (unsigned char)name_len;
+        memcpy(p, hits[i].name, name_len);
+        put_float(p + name_len, hits[i].score);
+        p += name_len + 4;
+    }
+    const uint32_t length = (uint32_t)(p - frame - GALLERY_RPC_HEADER_SIZE);
+    put_header(frame, GALLERY_MSG_REPLY, header->request_id, length);
+    return send_frame(client->fd, frame, GALLERY_RPC_HEADER_SIZE + length);
+}
+
+int gallery_shard_server_run(GalleryShardServer *server, GalleryQueryHandler handler, void *user_data,
+                             volatile sig_atomic_t *stop) {
+    struct pollfd *fds = calloc(server->max_clients + 1, sizeof(struct pollfd));
+    ShardClient **owners = calloc(server->max_clients + 1, sizeof(ShardClient *));
+    if (!fds || !owners) {
+        perror("calloc pollfd");
+        free(fds);
+        free(owners);
+        return -1;
+    }
+
+    int ret = 0;
+    while (!*stop) {
+        int n = 0;
+        fds[n].fd = server->listen_fd;
+        fds[n].events = POLLIN;
+        owners[n++] = NULL;
+        for (int i = 0; i < server->max_clients; i++) {
+            if (server->clients[i].fd < 0) continue;
+            fds[n].fd = server->clients[i].fd;
+            fds[n].events = POLLIN;
+            owners[n++] = &server->clients[i];
+        }
+        // 定时醒来检查 stop
+        int ready = poll(fds, n, 200);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            ret = -1;
+            break;
+        }
+        for (int i = 0; i < n && ready > 0; i++) {
+            if (!fds[i].revents) continue;
+            ready--;
+            if (!owners[i]) {
+                accept_clients(server);
+                continue;
+            }
+            ShardClient *client = owners[i];
+            GalleryRpcHeader header;
+            const unsigned char *payload;
+            int got;
+            while ((got = gallery_rpc_read_frame(client->fd, &client->reader, &header, &payload)) == 1) {
+                if (answer_query(client, &header, payload, handler, user_data) != 0) {
+                    got = -1;
+                    break;
+                }
+            }
+            if (got < 0) close_client(client);
+        }
+    }
+    free(fds);
+    free(owners);
+    return ret;
+}
+
+void gallery_shard_server_destroy(GalleryShardServer *server) {
+    if (!server) return;
+    if (server->clients) {
+        for (int i = 0; i < server->max_clients; i++) {
+            if (server->clients[i].fd >= 0) close_client(&server->clients[i]);
+        }
+        free(server->clients);
+    }
+    if (server->listen_fd >= 0) close(server->listen_fd);
+    if (server->unix_path[0]) unlink(server->unix_path);
+    free(server);
+}
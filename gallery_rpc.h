@@ -0,0 +1,111 @@
+#ifndef GALLERY_RPC_H
+#define GALLERY_RPC_H
+
+#include <stdint.h>
+#include <signal.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 人脸库分片协议：库太大放不进一块板子的内存时，把人分到多个分片进程中，
+// 识别器把特征向量同时发给各个分片，每个分片返回自己那部分人中最相似的 k 个，再由识别器合并。
+//
+// 帧格式（所有整数为大端序，浮点数按 IEEE754 位模式当作 uint32 传输）：
+//   头部 16 字节: magic 'FRGS' | version u16 | type u16 | request_id u32 | payload_len u32
+//   QUERY 载荷:   k u16 | dim u16 | dim 个 float
+//   REPLY 载荷:   count u16 | count 项 { name_len u8 | name | score float }
+// 回复带上请求的 request_id，客户端据此丢弃超时请求迟到的回复。
+// 地址写成 unix:/path、tcp:host:port 或 host:port
+
+#define GALLERY_RPC_MAGIC        0x46524753u   // "FRGS"
+#define GALLERY_RPC_VERSION      1
+#define GALLERY_RPC_HEADER_SIZE  16
+#define GALLERY_RPC_MAX_PAYLOAD  4096
+#define GALLERY_RPC_MAX_DIM      512
+#define GALLERY_MAX_HITS         16             // 每次查询最多返回的人数
+#define GALLERY_NAME_MAX         64             // 名字最长 63 字节，传输时不带结尾的 0
+#define GALLERY_MAX_SHARDS       16             // 一个识别器最多连接的分片数
+
+typedef enum {
+    GALLERY_MSG_QUERY = 1,
+    GALLERY_MSG_REPLY = 2
+} GalleryMessageType;
+
+typedef struct {
+    uint16_t type;
+    uint32_t request_id;
+    uint32_t length;    // 载荷字节数
+} GalleryRpcHeader;
+
+// 分片中的一个人及其最高相似度，名字由客户端映射回本进程的身份 id
+typedef struct {
+    char name[GALLERY_NAME_MAX];
+    float score;
+} GalleryHit;
+
+// 非阻塞套接字上的收帧缓冲区，一个连接一个
+typedef struct {
+    unsigned char data[GALLERY_RPC_HEADER_SIZE + GALLERY_RPC_MAX_PAYLOAD];
+    unsigned int used;
+    unsigned int frame_size;    // 上一次返回的帧的长度，下一次读取时从缓冲区移走
+} GalleryRpcReader;
+
+/**
+ * @brief 连接一个分片。
+ * @param address 分片地址。
+ * @param timeout_ms 建立连接最多等待的毫秒数。
+ * @return 成功返回非阻塞的套接字，失败返回-1。
+ */
+int gallery_rpc_connect(const char *address, int timeout_ms);
+
+/**
+ * @brief 发送一次 top-k 查询。
+ * 一帧只有几百字节，新连接的发送缓冲区总能一次写完；写不完说明对端已经积压，按失败处理。
+ * @return 0 成功，-1 失败（调用者应关闭连接）。
+ */
+int gallery_rpc_send_query(int fd, uint32_t request_id, const float *feature, int dim, int k);
+
+/**
+ * @brief 从非阻塞套接字读取数据，凑齐一帧时返回。
+ * 返回 1 之后 payload 指向 reader 内部，在下一次调用前有效。
+ * @return 1 收到一帧，0 数据还不够，-1 对端关闭或协议错误。
+ */
+int gallery_rpc_read_frame(int fd, GalleryRpcReader *reader, GalleryRpcHeader *header, const unsigned char **payload);
+
+/**
+ * @brief 解析 REPLY 载荷。
+ * @return 命中的人数（不超过 max_hits），载荷格式错误时返回-1。
+ */
+int gallery_rpc_decode_reply(const unsigned char *payload, uint32_t length, GalleryHit *hits, int max_hits);
+
+// 分片服务端收到查询时的回调：在本分片中找出最相似的至多 k 个人写入 hits，返回人数
+typedef int (*GalleryQueryHandler)(const float *feature, int dim, int k, GalleryHit *hits, void *user_data);
+
+typedef struct GalleryShardServer GalleryShardServer;
+
+/**
+ * @brief 在指定地址上监听。unix: 地址上残留的旧套接字文件会被删除。
+ * @param max_clients 最多同时连接的客户端数量，每个识别器的每个推理线程占用一个连接。
+ * @return 成功返回服务端指针，失败返回 NULL。
+ */
+GalleryShardServer *gallery_shard_server_create(const char *address, int max_clients);
+
+/**
+ * @brief 在当前线程中处理连接和查询，直到 *stop 变为非0。
+ * 查询在本线程中依次处理，回复写不进发送缓冲区的客户端会被断开。
+ * @return 0 正常退出，-1 出错。
+ */
+int gallery_shard_server_run(GalleryShardServer *server, GalleryQueryHandler handler, void *user_data,
+                             volatile sig_atomic_t *stop);
+
+/**
+ * @brief 关闭所有连接，删除 unix: 套接字文件并释放资源。
+ */
+void gallery_shard_server_destroy(GalleryShardServer *server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GALLERY_RPC_H
@@ -0,0 +1,199 @@
+#define _GNU_SOURCE   // accept4
+#include "ipc_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define IPC_LINE_MAX 512   // 单条命令的最大长度
+
+typedef struct {
+    int fd;                     // -1 表示空闲
+    size_t used;                // 行缓冲中已有的字节数
+    char line[IPC_LINE_MAX];
+} IpcClient;
+
+struct IpcServer {
+    int listen_fd;
+    char path[108];
+    int max_clients;
+    IpcClient *clients;
+};
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static IpcClient *find_client(IpcServer *server, int fd) {
+    for (int i = 0; i < server->max_clients; i++) {
+        if (server->clients[i].fd == fd) return &server->clients[i];
+    }
+    return NULL;
+}
+
+IpcServer *ipc_server_create(const char *socket_path, int max_clients) {
+    struct sockaddr_un addr;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "IPC socket path too long: %s\n", socket_path);
+        return NULL;
+    }
+
+    IpcServer *server = calloc(1, sizeof(IpcServer));
+    if (!server) {
+        perror("calloc IpcServer");
+        return NULL;
+    }
+    server->listen_fd = -1;
+    server->max_clients = max_clients;
+    server->clients = calloc(max_clients, sizeof(IpcClient));
+    if (!server->clients) {
+        perror("calloc IpcClient");
+        free(server);
+        return NULL;
+    }
+    for (int i = 0; i < max_clients; i++) server->clients[i].fd = -1;
+    strncpy(server->path, socket_path, sizeof(server->path) - 1);
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0) {
+        perror("socket");
+        goto fail;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    unlink(socket_path); // 删除上次异常退出残留的套接字文件
+    if (bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        goto fail;
+    }
+    if (listen(server->listen_fd, max_clients) < 0 || set_nonblocking(server->listen_fd) < 0) {
+        perror("listen");
+        goto fail;
+    }
+
+    printf("IPC server listening on %s.\n", socket_path);
+    return server;
+
+fail:
+    ipc_server_destroy(server);
+    return NULL;
+}
+
+int ipc_server_listen_fd(const IpcServer *server) {
+    return server->listen_fd;
+}
+
+int ipc_server_accept(IpcServer *server) {
+    int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return -1;
+
+    IpcClient *slot = find_client(server, -1);
+    if (!slot) {
+        fprintf(stderr, "IPC: too many clients, rejecting connection\n");
+        close(fd);
+        return -1;
+    }
+    slot->fd = fd;
+    slot->used = 0;
+    return fd;
+}
+
+int ipc_server_handle_readable(IpcServer *server, int client_fd, IpcCommandCallback callback, void *user_data) {
+    IpcClient *client = find_client(server, client_fd);
+    if (!client) return -1;
+
+    for (;;) {
+        ssize_t n = read(client_fd, client->line + client->used, sizeof(client->line) - 1 - client->used);
+        if (n == 0) {
+            ipc_server_close_client(server, client_fd);
+            return -1;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            ipc_server_close_client(server, client_fd);
+            return -1;
+        }
+        client->used += n;
+
+        // 把缓冲区中所有完整的行交给回调
+        size_t start = 0;
+        for (size_t i = 0; i < client->used; i++) {
+            if (client->line[i] != '\n') continue;
+            client->line[i] = '\0';
+            if (i > start && client->line[i - 1] == '\r') client->line[i - 1] = '\0';
+            if (callback) callback(client_fd, client->line + start, user_data);
+            // 回调里可能关闭了这个客户端
+            if (client->fd != client_fd) return -1;
+            start = i + 1;
+        }
+        memmove(client->line, client->line + start, client->used - start);
+        client->used -= start;
+
+        if (client->used >= sizeof(client->line) - 1) {
+            fprintf(stderr, "IPC: command line too long, dropping client\n");
+            ipc_server_close_client(server, client_fd);
+            return -1;
+        }
+    }
+}
+
+int ipc_server_send(IpcServer *server, int client_fd, const char *data, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = send(client_fd, data + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // 发送缓冲区已满说明客户端读得太慢，断开它以免拖慢识别流程
+            ipc_server_close_client(server, client_fd);
+            return -1;
+        }
+        sent += n;
+    }
+    return 0;
+}
+
+int ipc_server_broadcast(IpcServer *server, const char *data, size_t len, int *closed_fds, int max_closed) {
+    int closed = 0;
+    for (int i = 0; i < server->max_clients; i++) {
+        int fd = server->clients[i].fd;
+        if (fd < 0) continue;
+        if (ipc_server_send(server, fd, data, len) < 0) {
+            if (closed_fds && closed < max_closed) closed_fds[closed] = fd;
+            closed++;
+        }
+    }
+    return closed;
+}
+
+void ipc_server_close_client(IpcServer *server, int client_fd) {
+    IpcClient *client = find_client(server, client_fd);
+    if (!client) return;
+    close(client->fd);
+    client->fd = -1;
+    client->used = 0;
+}
+
+void ipc_server_destroy(IpcServer *server) {
+    if (!server) return;
+    if (server->clients) {
+        for (int i = 0; i < server->max_clients; i++) {
+            if (server->clients[i].fd >= 0) close(server->clients[i].fd);
+        }
+        free(server->clients);
+    }
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+        unlink(server->path);
+    }
+    free(server);
+    printf("IPC server closed.\n");
+}
@@ -0,0 +1,70 @@
+#ifndef IPC_SERVER_H
+#define IPC_SERVER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 本地 Unix 域套接字服务端：以换行分隔的文本帧收发消息
+typedef struct IpcServer IpcServer;
+
+// 每收到一行完整命令时的回调，line 不包含换行符
+typedef void (*IpcCommandCallback)(int client_fd, const char *line, void *user_data);
+
+/**
+ * @brief 创建并监听一个 Unix 域套接字。
+ * 路径上残留的旧套接字文件会被删除。所有套接字都是非阻塞的。
+ * @param socket_path 套接字文件路径。
+ * @param max_clients 最多同时连接的客户端数量。
+ * @return 成功返回服务端指针，失败返回 NULL。
+ */
+IpcServer *ipc_server_create(const char *socket_path, int max_clients);
+
+/**
+ * @brief 返回监听套接字的文件描述符，用于放进事件循环（例如 QSocketNotifier）。
+ */
+int ipc_server_listen_fd(const IpcServer *server);
+
+/**
+ * @brief 接受一个新连接。
+ * @return 新客户端的文件描述符；没有待处理连接或客户端已满时返回-1。
+ */
+int ipc_server_accept(IpcServer *server);
+
+/**
+ * @brief 客户端可读时调用：读取数据，按行切分并对每一行调用回调。
+ * @return 0 表示连接仍然有效，-1 表示对端已关闭或出错（连接已被关闭）。
+ */
+int ipc_server_handle_readable(IpcServer *server, int client_fd, IpcCommandCallback callback, void *user_data);
+
+/**
+ * @brief 向单个客户端发送数据。发送缓冲区满的慢客户端会被断开，而不是阻塞调用者。
+ * @return 0 成功，-1 表示客户端已被断开。
+ */
+int ipc_server_send(IpcServer *server, int client_fd, const char *data, size_t len);
+
+/**
+ * @brief 向所有客户端广播数据。
+ * @param closed_fds 可选，用于返回本次被断开的客户端描述符。
+ * @param max_closed closed_fds 的容量。
+ * @return 被断开的客户端数量。
+ */
+int ipc_server_broadcast(IpcServer *server, const char *data, size_t len, int *closed_fds, int max_closed);
+
+/**
+ * @brief 主动关闭一个客户端连接。
+ */
+void ipc_server_close_client(IpcServer *server, int client_fd);
+
+/**
+ * @brief 关闭所有连接，删除套接字文件并释放资源。
+ */
+void ipc_server_destroy(IpcServer *server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IPC_SERVER_H
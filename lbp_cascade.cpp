@@ -0,0 +1,505 @@
+#include "lbp_cascade.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if !defined(FR_DETECTOR_SCALAR) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+
+typedef int32x4_t Vec4i;
+static inline Vec4i vecLoad(const int *p) { return vld1q_s32(p); }
+static inline void vecStore(int *p, Vec4i v) { vst1q_s32(p, v); }
+static inline Vec4i vecZero() { return vdupq_n_s32(0); }
+static inline Vec4i vecAdd(Vec4i a, Vec4i b) { return vaddq_s32(a, b); }
+static inline Vec4i vecSub(Vec4i a, Vec4i b) { return vsubq_s32(a, b); }
+static inline Vec4i vecOr(Vec4i a, Vec4i b) { return vorrq_s32(a, b); }
+// a >= b 的通道为 bit，其余为0
+static inline Vec4i vecGeBit(Vec4i a, Vec4i b, int bit)
+{
+    return vandq_s32(vreinterpretq_s32_u32(vcgeq_s32(a, b)), vdupq_n_s32(bit));
+}
+// 8个像素扩展为两组 int
+static inline void vecLoadBytes8(const unsigned char *p, Vec4i &lo, Vec4i &hi)
+{
+    const uint16x8_t w = vmovl_u8(vld1_u8(p));
+    lo = vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(w)));
+    hi = vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(w)));
+}
+// 通道内的前缀和
+static inline Vec4i vecPrefixSum(Vec4i v)
+{
+    const Vec4i zero = vdupq_n_s32(0);
+    v = vaddq_s32(v, vextq_s32(zero, v, 3));
+    return vaddq_s32(v, vextq_s32(zero, v, 2));
+}
+static inline Vec4i vecBroadcastLast(Vec4i v) { return vdupq_n_s32(vgetq_lane_s32(v, 3)); }
+
+#elif !defined(FR_DETECTOR_SCALAR) && defined(__SSE2__)
+#include <emmintrin.h>
+
+typedef __m128i Vec4i;
+static inline Vec4i vecLoad(const int *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void vecStore(int *p, Vec4i v) { _mm_storeu_si128((__m128i *)p, v); }
+static inline Vec4i vecZero() { return _mm_setzero_si128(); }
+static inline Vec4i vecAdd(Vec4i a, Vec4i b) { return _mm_add_epi32(a, b); }
+static inline Vec4i vecSub(Vec4i a, Vec4i b) { return _mm_sub_epi32(a, b); }
+static inline Vec4i vecOr(Vec4i a, Vec4i b) { return _mm_or_si128(a, b); }
+static inline Vec4i vecGeBit(Vec4i a, Vec4i b, int bit)
+{
+    return _mm_andnot_si128(_mm_cmplt_epi32(a, b), _mm_set1_epi32(bit));
+}
+static inline void vecLoadBytes8(const unsigned char *p, Vec4i &lo, Vec4i &hi)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)p), zero);
+    lo = _mm_unpacklo_epi16(w, zero);
+    hi = _mm_unpackhi_epi16(w, zero);
+}
+static inline Vec4i vecPrefixSum(Vec4i v)
+{
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+    return _mm_add_epi32(v, _mm_slli_si128(v, 8));
+}
+static inline Vec4i vecBroadcastLast(Vec4i v) { return _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3)); }
+
+#else
+// 标量实现，与向量版本逐通道的结果相同
+struct Vec4i { int v[4]; };
+static inline Vec4i vecLoad(const int *p) { Vec4i r = {{p[0], p[1], p[2], p[3]}}; return r; }
+static inline void vecStore(int *p, Vec4i v) { for (int i = 0; i < 4; ++i) p[i] = v.v[i]; }
+static inline Vec4i vecZero() { Vec4i r = {{0, 0, 0, 0}}; return r; }
+static inline Vec4i vecAdd(Vec4i a, Vec4i b) { for (int i = 0; i < 4; ++i) a.v[i] += b.v[i]; return a; }
+static inline Vec4i vecSub(Vec4i a, Vec4i b) { for (int i = 0; i < 4; ++i) a.v[i] -= b.v[i]; return a; }
+static inline Vec4i vecOr(Vec4i a, Vec4i b) { for (int i = 0; i < 4; ++i) a.v[i] |= b.v[i]; return a; }
+static inline Vec4i vecGeBit(Vec4i a, Vec4i b, int bit)
+{
+    for (int i = 0; i < 4; ++i) a.v[i] = a.v[i] >= b.v[i] ? bit : 0;
+    return a;
+}
+static inline void vecLoadBytes8(const unsigned char *p, Vec4i &lo, Vec4i &hi)
+{
+    for (int i = 0; i < 4; ++i) {
+        lo.v[i] = p[i];
+        hi.v[i] = p[i + 4];
+    }
+}
+static inline Vec4i vecPrefixSum(Vec4i v)
+{
+    for (int i = 1; i < 4; ++i) v.v[i] += v.v[i - 1];
+    return v;
+}
+static inline Vec4i vecBroadcastLast(Vec4i v) { Vec4i r = {{v.v[3], v.v[3], v.v[3], v.v[3]}}; return r; }
+#endif
+
+// 与 OpenCV 相同：读入的级联阈值减去一个小量，分组时相似矩形的容差
+static const float THRESHOLD_EPS = 1e-5f;
+static const double GROUP_EPS = 0.2;
+
+// 积分图比图像多一行一列0，行宽为 stride；每行先在寄存器里做前缀和，再加上一行
+static void integralImage(const unsigned char *src, int width, int height, size_t srcStep, int *sum, int stride)
+{
+    std::memset(sum, 0, (width + 1) * sizeof(int));
+    for (int y = 0; y < height; ++y) {
+        const unsigned char *s = src + y * srcStep;
+        const int *prev = sum + (size_t)y * stride;
+        int *row = sum + (size_t)(y + 1) * stride;
+        row[0] = 0;
+        Vec4i carry = vecZero();
+        int x = 0;
+        for (; x + 8 <= width; x += 8) {
+            Vec4i lo, hi;
+            vecLoadBytes8(s + x, lo, hi);
+            lo = vecAdd(vecPrefixSum(lo), carry);
+            hi = vecAdd(vecPrefixSum(hi), vecBroadcastLast(lo));
+            carry = vecBroadcastLast(hi);
+            vecStore(row + 1 + x, vecAdd(lo, vecLoad(prev + 1 + x)));
+            vecStore(row + 1 + x + 4, vecAdd(hi, vecLoad(prev + 1 + x + 4)));
+        }
+        int run = row[x] - prev[x];
+        for (; x < width; ++x) {
+            run += s[x];
+            row[x + 1] = prev[x + 1] + run;
+        }
+    }
+}
+
+// 3x3 个块的 LBP 码：周围8块的和与中心块比较，o 为 4x4 个格点的偏移
+#define LBP_BLOCK(a, b, c, d) (p[o[a]] - p[o[b]] - p[o[c]] + p[o[d]])
+static inline int lbpCode(const int *p, const int *o)
+{
+    const int center = LBP_BLOCK(5, 6, 9, 10);
+    return (LBP_BLOCK(0, 1, 4, 5) >= center ? 128 : 0)
+         | (LBP_BLOCK(1, 2, 5, 6) >= center ? 64 : 0)
+         | (LBP_BLOCK(2, 3, 6, 7) >= center ? 32 : 0)
+         | (LBP_BLOCK(6, 7, 10, 11) >= center ? 16 : 0)
+         | (LBP_BLOCK(10, 11, 14, 15) >= center ? 8 : 0)
+         | (LBP_BLOCK(9, 10, 13, 14) >= center ? 4 : 0)
+         | (LBP_BLOCK(8, 9, 12, 13) >= center ? 2 : 0)
+         | (LBP_BLOCK(4, 5, 8, 9) >= center ? 1 : 0);
+}
+#undef LBP_BLOCK
+
+// 同一行相邻4个窗口的 LBP 码：16个格点各读一次4个连续的积分值
+static inline Vec4i lbpCode4(const int *p, const int *o)
+{
+    Vec4i g[16];
+    for (int i = 0; i < 16; ++i) g[i] = vecLoad(p + o[i]);
+#define LBP_BLOCK4(a, b, c, d) vecAdd(vecSub(vecSub(g[a], g[b]), g[c]), g[d])
+    const Vec4i center = LBP_BLOCK4(5, 6, 9, 10);
+    Vec4i code = vecGeBit(LBP_BLOCK4(0, 1, 4, 5), center, 128);
+    code = vecOr(code, vecGeBit(LBP_BLOCK4(1, 2, 5, 6), center, 64));
+    code = vecOr(code, vecGeBit(LBP_BLOCK4(2, 3, 6, 7), center, 32));
+    code = vecOr(code, vecGeBit(LBP_BLOCK4(6, 7, 10, 11), center, 16));
+    code = vecOr(code, vecGeBit(LBP_BLOCK4(10, 11, 14, 15), center, 8));
+    code = vecOr(code, vecGeBit(LBP_BLOCK4(9, 10, 13, 14), center, 4));
+    code = vecOr(code, vecGeBit(LBP_BLOCK4(8, 9, 12, 13), center, 2));
+    code = vecOr(code, vecGeBit(LBP_BLOCK4(4, 5, 8, 9), center, 1));
+#undef LBP_BLOCK4
+    return code;
+}
+
+std::shared_ptr<const LbpCascade> LbpCascade::load(const std::string &path, std::string *error)
+{
+    std::shared_ptr<LbpCascade> cascade(new LbpCascade);
+    std::string reason;
+    try {
+        cv::FileStorage fs(path, cv::FileStorage::READ);
+        if (!fs.isOpened()) reason = "cannot open " + path;
+        else reason = cascade->read(fs.getFirstTopLevelNode());
+    } catch (const cv::Exception &e) {
+        reason = e.what();
+    }
+    if (!reason.empty()) {
+        if (error) *error = reason;
+        return nullptr;
+    }
+    return cascade;
+}
+
+// 解析 opencv_traincascade 的新格式，不支持时返回原因
+std::string LbpCascade::read(const cv::FileNode &root)
+{
+    if ((std::string)root["stageType"] != "BOOST") return "not a BOOST cascade in the traincascade format";
+    if ((std::string)root["featureType"] != "LBP") return "feature type is not LBP";
+    m_width = (int)root["width"];
+    m_height = (int)root["height"];
+    if (m_width <= 0 || m_height <= 0) return "invalid window size";
+    if ((int)root["featureParams"]["maxCatCount"] != 256) return "LBP features must have 256 categories";
+
+    const cv::FileNode features = root["features"];
+    for (cv::FileNodeIterator it = features.begin(); it != features.end(); ++it) {
+        const cv::FileNode rect = (*it)["rect"];
+        if (rect.size() != 4) return "invalid feature rectangle";
+        Feature f = {(int)rect[0], (int)rect[1], (int)rect[2], (int)rect[3]};
+        if (f.x < 0 || f.y < 0 || f.width <= 0 || f.height <= 0
+            || f.x + 3 * f.width > m_width || f.y + 3 * f.height > m_height) {
+            return "feature outside the detection window";
+        }
+        m_features.push_back(f);
+    }
+
+    const cv::FileNode stages = root["stages"];
+    for (cv::FileNodeIterator it = stages.begin(); it != stages.end(); ++it) {
+        Stage stage;
+        stage.first = (int)m_stumps.size();
+        stage.threshold = (float)(*it)["stageThreshold"] - THRESHOLD_EPS;
+        const cv::FileNode weak = (*it)["weakClassifiers"];
+        for (cv::FileNodeIterator w = weak.begin(); w != weak.end(); ++w) {
+            const cv::FileNode nodes = (*w)["internalNodes"];
+            const cv::FileNode leaves = (*w)["leafValues"];
+            // 单结点：左右子结点、特征下标、8个32位的类别子集
+            if (nodes.size() != 11 || leaves.size() != 2) return "only single-node weak classifiers are supported";
+            Stump stump;
+            stump.feature = (int)nodes[2];
+            if (stump.feature < 0 || stump.feature >= (int)m_features.size()) return "feature index out of range";
+            for (int j = 0; j < 8; ++j) stump.subset[j] = (unsigned int)(int)nodes[3 + j];
+            stump.leaf[0] = (float)leaves[0];
+            stump.leaf[1] = (float)leaves[1];
+            m_stumps.push_back(stump);
+        }
+        stage.count = (int)m_stumps.size() - stage.first;
+        if (stage.count == 0) return "empty stage";
+        m_stages.push_back(stage);
+    }
+    if (m_stages.empty()) return "no stages";
+    return std::string();
+}
+
+// 尺度序列与 OpenCV 相同：窗口放大 scaleFactor 倍直到超出图像，小于 minSize 的跳过。
+// 只在图像尺寸、参数变化时重建
+void LbpCascade::plan(LbpScratch &s, int width, int height, double scaleFactor, cv::Size minSize) const
+{
+    if (s.cascade == this && s.imageWidth == width && s.imageHeight == height && s.scaleFactor == scaleFactor
+        && s.minWidth == minSize.width && s.minHeight == minSize.height) {
+        return;
+    }
+    s.cascade = this;
+    s.imageWidth = width;
+    s.imageHeight = height;
+    s.scaleFactor = scaleFactor;
+    s.minWidth = minSize.width;
+    s.minHeight = minSize.height;
+    s.scales.clear();
+    if (scaleFactor <= 1.0) return;
+
+    // 与 OpenCV 一样，是否超出图像用 double 的倍数判断，是否小于 minSize 用转成 float 之后的
+    for (double factor = 1; ; factor *= scaleFactor) {
+        if (cvRound(m_width * factor) > width || cvRound(m_height * factor) > height) break;
+        const float scale = (float)factor;
+        if (cvRound(m_width * scale) < minSize.width || cvRound(m_height * scale) < minSize.height) continue;
+        s.scales.push_back(scale);
+    }
+    if (s.scales.empty()) return;
+
+    // 第一个尺度最大，缓冲区按它分配；积分图多留4个 int，4个窗口一起读时最后一行会读过行尾
+    const int maxWidth = std::max(cvRound(width / s.scales[0]), 0);
+    const int maxHeight = std::max(cvRound(height / s.scales[0]), 0);
+    s.integralStride = maxWidth + 1;
+    s.stripes = std::max((maxWidth + 1 - m_width + 31) / 32, 1);
+    s.resized.assign((size_t)maxWidth * maxHeight, 0);
+    s.integral.assign((size_t)(maxHeight + 1) * s.integralStride + 4, 0);
+    s.maskColumns.assign(maxWidth, 0);
+
+    s.offsets.resize(m_features.size() * 16);
+    for (size_t f = 0; f < m_features.size(); ++f) {
+        const Feature &feature = m_features[f];
+        for (int r = 0; r < 4; ++r) {
+            for (int c = 0; c < 4; ++c) {
+                s.offsets[f * 16 + r * 4 + c] = (feature.y + r * feature.height) * s.integralStride
+                                                + feature.x + c * feature.width;
+            }
+        }
+    }
+}
+
+// 从第 stage 级开始计算一个窗口：通过返回1，在第 si 级被拒绝返回 -si（第0级被拒绝时为0）
+int LbpCascade::evaluate(const int *p, const int *offsets, int stage) const
+{
+    const Stump *stump = &m_stumps[m_stages[stage].first];
+    for (int si = stage; si < (int)m_stages.size(); ++si) {
+        const Stage &st = m_stages[si];
+        double sum = 0;
+        for (int k = 0; k < st.count; ++k, ++stump) {
+            const int c = lbpCode(p, offsets + stump->feature * 16);
+            sum += stump->leaf[(stump->subset[c >> 5] >> (c & 31)) & 1 ? 0 : 1];
+        }
+        if (sum < st.threshold) return -si;
+    }
+    return 1;
+}
+
+// 同一行相邻4个窗口一起计算，live 的第 j 位为0的窗口不计算、结果为 -1。
+// 每个窗口的叶子值按同样的顺序累加，结果与逐个调用 evaluate 相同；只剩一个窗口时改用 evaluate
+void LbpCascade::evaluate4(const int *p, const int *offsets, unsigned live, int *result) const
+{
+    for (int j = 0; j < 4; ++j) result[j] = (live >> j) & 1 ? 1 : -1;
+    const Stump *stump = &m_stumps[0];
+    for (int si = 0; si < (int)m_stages.size() && live; ++si) {
+        if ((live & (live - 1)) == 0) {
+            const int j = live & 1 ? 0 : live & 2 ? 1 : live & 4 ? 2 : 3;
+            result[j] = evaluate(p + j, offsets, si);
+            return;
+        }
+        const Stage &st = m_stages[si];
+        double sum[4] = {0, 0, 0, 0};
+        int codes[4];
+        for (int k = 0; k < st.count; ++k, ++stump) {
+            vecStore(codes, lbpCode4(p, offsets + stump->feature * 16));
+            for (int j = 0; j < 4; ++j) {
+                const int c = codes[j];
+                sum[j] += stump->leaf[(stump->subset[c >> 5] >> (c & 31)) & 1 ? 0 : 1];
+            }
+        }
+        for (int j = 0; j < 4; ++j) {
+            if ((live >> j) & 1 && sum[j] < st.threshold) {
+                result[j] = -si;
+                live &= ~(1u << j);
+            }
+        }
+        // 第一级被拒绝的窗口后面那个会被调用者跳过，不必再算后面的级
+        if (si == 0) {
+            for (int j = 0; j < 4; j += result[j] == 0 ? 2 : 1) {
+                if (result[j] == 0 && j < 3) live &= ~(2u << j);
+            }
+        }
+    }
+}
+
+// 一个尺度：缩放、积分图、逐行扫描窗口。窗口步长和"第一级就被拒绝时跳过下一个窗口"与 OpenCV 相同
+void LbpCascade::scanScale(const cv::Mat &gray, LbpScratch &s, float scale, const cv::Mat &roiMask,
+                           const cv::Rect &roiBounds) const
+{
+    const cv::Size size(std::max(cvRound(gray.cols / scale), 0), std::max(cvRound(gray.rows / scale), 0));
+    const int xEnd = size.width - m_width, yEnd = size.height - m_height;   // 包含
+    if (xEnd < 0 || yEnd < 0) return;
+    const int step = scale >= 2 ? 1 : 2;
+    const cv::Size window(cvRound(m_width * scale), cvRound(m_height * scale));
+
+    // OpenCV 把行分成固定数目的条带，条带高度向下取整到步长的倍数，步长为2时末尾的行可能不在任何条带里
+    const int stripe = std::max(((yEnd + 1) / step + s.stripes - 1) / s.stripes, 1) * step;
+    int x0 = 0, x1 = xEnd, y0 = 0, y1 = std::min(s.stripes * stripe, yEnd + 1) - 1;
+    // 窗口中心（原图坐标）落在掩码外接矩形内的行列范围，起点对齐到步长
+    if (!roiMask.empty()) {
+        for (int x = 0; x <= xEnd; ++x) {
+            s.maskColumns[x] = std::min(cvRound((x + m_width * 0.5f) * scale), gray.cols - 1);
+        }
+        while (x0 <= xEnd && s.maskColumns[x0] < roiBounds.x) x0 += step;
+        while (x1 >= x0 && s.maskColumns[x1] >= roiBounds.x + roiBounds.width) --x1;
+        while (y0 <= yEnd && cvRound((y0 + m_height * 0.5f) * scale) < roiBounds.y) y0 += step;
+        while (y1 >= y0 && cvRound((y1 + m_height * 0.5f) * scale) >= roiBounds.y + roiBounds.height) --y1;
+        if (x0 > x1 || y0 > y1) return;
+    }
+
+    cv::Mat resized(size, CV_8UC1, s.resized.data());
+    cv::resize(gray, resized, size, 0, 0, cv::INTER_LINEAR_EXACT);
+    integralImage(resized.data, size.width, size.height, resized.step, s.integral.data(), s.integralStride);
+
+    const int *offsets = s.offsets.data();
+    for (int y = y0; y <= y1; y += step) {
+        const int *row = s.integral.data() + (size_t)y * s.integralStride;
+        const unsigned char *maskRow = nullptr;
+        if (!roiMask.empty()) {
+            maskRow = roiMask.ptr<unsigned char>(std::min(cvRound((y + m_height * 0.5f) * scale), gray.rows - 1));
+        }
+
+        int x = x0;
+        while (x <= x1) {
+            int result[4];
+            int count;   // 本次处理到的窗口数，包括被跳过的
+            if (step == 1) {
+                const int lanes = std::min(4, x1 - x + 1);
+                unsigned live = 0;
+                for (int j = 0; j < lanes; ++j) {
+                    if (!maskRow || maskRow[s.maskColumns[x + j]]) live |= 1u << j;
+                }
+                if (!live) {
+                    x += lanes;
+                    continue;
+                }
+                evaluate4(row + x, offsets, live, result);
+                count = lanes;
+            } else {
+                result[0] = !maskRow || maskRow[s.maskColumns[x]] ? evaluate(row + x, offsets, 0) : -1;
+                count = 1;
+            }
+
+            int j = 0;
+            while (j < count) {
+                if (result[j] > 0) {
+                    s.candidates.push_back(cv::Rect(cvRound((x + j * step) * scale), cvRound(y * scale),
+                                                    window.width, window.height));
+                }
+                j += result[j] == 0 ? 2 : 1;
+            }
+            x += j * step;
+        }
+    }
+}
+
+// 与 cv::groupRectangles(rects, threshold, GROUP_EPS) 相同：相似的候选框并为一类取平均，
+// 丢弃成员不超过 threshold 的类，以及被另一个成员更多的类包含的小框
+void LbpCascade::group(LbpScratch &s, int threshold, std::vector<cv::Rect> &objects)
+{
+    const std::vector<cv::Rect> &rects = s.candidates;
+    const int n = (int)rects.size();
+    if (threshold <= 0 || n == 0) {
+        objects.assign(rects.begin(), rects.end());
+        return;
+    }
+
+    // 并查集，类按第一个成员出现的顺序编号
+    std::vector<int> &parent = s.labels;
+    parent.resize(n);
+    for (int i = 0; i < n; ++i) parent[i] = i;
+    for (int i = 0; i < n; ++i) {
+        for (int j = i + 1; j < n; ++j) {
+            const cv::Rect &a = rects[i], &b = rects[j];
+            const double delta = GROUP_EPS * (std::min(a.width, b.width) + std::min(a.height, b.height)) * 0.5;
+            if (std::abs(a.x - b.x) > delta || std::abs(a.y - b.y) > delta
+                || std::abs(a.x + a.width - b.x - b.width) > delta
+                || std::abs(a.y + a.height - b.y - b.height) > delta) {
+                continue;
+            }
+            int ra = i, rb = j;
+            while (parent[ra] != ra) ra = parent[ra];
+            while (parent[rb] != rb) rb = parent[rb];
+            if (ra != rb) parent[std::max(ra, rb)] = std::min(ra, rb);
+        }
+    }
+    // 父结点的下标总比自己小，按下标顺序一遍就能压缩成直接指向根；根是类中下标最小的成员
+    std::vector<int> &classes = s.classes;
+    std::vector<cv::Rect> &sums = s.sums;
+    std::vector<int> &weights = s.weights;
+    classes.resize(n);
+    sums.clear();
+    weights.clear();
+    for (int i = 0; i < n; ++i) {
+        parent[i] = parent[parent[i]];
+        if (parent[i] == i) {
+            classes[i] = (int)sums.size();
+            sums.push_back(cv::Rect(0, 0, 0, 0));
+            weights.push_back(0);
+        } else {
+            classes[i] = classes[parent[i]];
+        }
+        cv::Rect &sum = sums[classes[i]];
+        sum.x += rects[i].x;
+        sum.y += rects[i].y;
+        sum.width += rects[i].width;
+        sum.height += rects[i].height;
+        weights[classes[i]]++;
+    }
+    const int nclasses = (int)sums.size();
+    for (int c = 0; c < nclasses; ++c) {
+        const cv::Rect r = sums[c];
+        const float k = 1.f / weights[c];
+        sums[c] = cv::Rect(cv::saturate_cast<int>(r.x * k), cv::saturate_cast<int>(r.y * k),
+                           cv::saturate_cast<int>(r.width * k), cv::saturate_cast<int>(r.height * k));
+    }
+
+    objects.clear();
+    for (int i = 0; i < nclasses; ++i) {
+        const cv::Rect &r1 = sums[i];
+        const int n1 = weights[i];
+        if (n1 <= threshold) continue;
+        int j = 0;
+        for (; j < nclasses; ++j) {
+            const int n2 = weights[j];
+            if (j == i || n2 <= threshold) continue;
+            const cv::Rect &r2 = sums[j];
+            const int dx = cv::saturate_cast<int>(r2.width * GROUP_EPS);
+            const int dy = cv::saturate_cast<int>(r2.height * GROUP_EPS);
+            if (r1.x >= r2.x - dx && r1.y >= r2.y - dy && r1.x + r1.width <= r2.x + r2.width + dx
+                && r1.y + r1.height <= r2.y + r2.height + dy && (n2 > std::max(3, n1) || n1 < 3)) {
+                break;
+            }
+        }
+        if (j == nclasses) objects.push_back(r1);
+    }
+}
+
+void LbpCascade::detectMultiScale(const cv::Mat &gray, std::vector<cv::Rect> &objects, LbpScratch &scratch,
+                                  double scaleFactor, int minNeighbors, cv::Size minSize,
+                                  const cv::Mat &roiMask) const
+{
+    objects.clear();
+    scratch.candidates.clear();
+    if (gray.empty() || gray.type() != CV_8UC1) return;
+    if (!roiMask.empty() && (roiMask.type() != CV_8UC1 || roiMask.size() != gray.size())) return;
+
+    plan(scratch, gray.cols, gray.rows, scaleFactor, minSize);
+    if (scratch.scales.empty()) return;
+    cv::Rect roiBounds(0, 0, gray.cols, gray.rows);
+    if (!roiMask.empty()) {
+        roiBounds = cv::boundingRect(roiMask);
+        if (roiBounds.empty()) return;
+    }
+    for (float scale : scratch.scales) scanScale(gray, scratch, scale, roiMask, roiBounds);
+    group(scratch, minNeighbors, objects);
+    // 与 OpenCV 一样分组后裁到图像内：窗口坐标取整后可能超出图像一两个像素
+    const cv::Rect image(0, 0, gray.cols, gray.rows);
+    for (cv::Rect &r : objects) r &= image;
+}
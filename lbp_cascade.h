@@ -0,0 +1,98 @@
+#ifndef LBP_CASCADE_H
+#define LBP_CASCADE_H
+
+#include <opencv2/core.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// 自有的 LBP 级联分类器，读取 opencv_traincascade 格式的 LBP 级联 XML（如 lbpcascade_frontalface.xml）。
+// 检测结果与 cv::CascadeClassifier::detectMultiScale 一致：同样的尺度序列、窗口步长、第一级失败时跳过下一个窗口、
+// 同样的分组规则。区别在于计算方式：
+// - 逐个尺度处理：缩放图和积分图只有一份（最大尺度的大小），一个尺度在缓存里算完再算下一个，
+//   OpenCV 则先把所有尺度的积分图排进一块大缓冲区；
+// - 尺度序列、特征偏移和缓冲区保存在调用线程的 LbpScratch 中，图像尺寸和参数不变时跨帧复用，稳态下不分配内存；
+// - 窗口步长为1的尺度上，同一行相邻的4个窗口用 NEON/SSE 一起计算（FR_DETECTOR_SCALAR 时用标量实现，结果相同）；
+// - 可选的 ROI 掩码：窗口中心落在掩码为0处的窗口不计算，掩码外整行整列直接跳过。
+// 分类器加载后只读，多个线程共用一份，每个线程用自己的 LbpScratch。
+
+// 一个线程的检测缓冲区，内容由 LbpCascade 管理
+struct LbpScratch
+{
+    // 尺度计划，图像尺寸、参数或分类器变化时重建
+    const void *cascade = nullptr;
+    int imageWidth = 0, imageHeight = 0;
+    double scaleFactor = 0;
+    int minWidth = 0, minHeight = 0;
+    std::vector<float> scales;
+    int integralStride = 0;          // 所有尺度共用的积分图行宽，特征偏移只算一次
+    int stripes = 1;                 // OpenCV 分给线程的条带数，决定步长为2的尺度扫描到哪一行
+    std::vector<int> offsets;        // 每个特征 4x4 个格点在积分图中的偏移
+
+    std::vector<unsigned char> resized;
+    std::vector<int> integral;
+    std::vector<int> maskColumns;    // 当前尺度每个窗口列的中心在掩码中的列号
+    std::vector<cv::Rect> candidates;
+
+    // 分组用
+    std::vector<int> labels, classes, weights;
+    std::vector<cv::Rect> sums;
+};
+
+class LbpCascade
+{
+public:
+    /**
+     * @brief 加载级联 XML。只支持 LBP 特征、每个弱分类器是单个结点的 BOOST 级联；
+     * Haar 级联、旧格式 XML 或多结点的树返回空并在 error 中说明原因，调用者应改用 cv::CascadeClassifier
+     */
+    static std::shared_ptr<const LbpCascade> load(const std::string &path, std::string *error);
+
+    /**
+     * @brief 同 cv::CascadeClassifier::detectMultiScale(gray, objects, scaleFactor, minNeighbors, 0, minSize)。
+     * @param gray 8位灰度图，调用者负责均衡化。
+     * @param roiMask 空，或与 gray 同样大小的8位掩码，非0处才作为窗口中心。
+     */
+    void detectMultiScale(const cv::Mat &gray, std::vector<cv::Rect> &objects, LbpScratch &scratch,
+                          double scaleFactor, int minNeighbors, cv::Size minSize,
+                          const cv::Mat &roiMask = cv::Mat()) const;
+
+    int stages() const { return (int)m_stages.size(); }
+    cv::Size windowSize() const { return cv::Size(m_width, m_height); }
+
+private:
+    struct Stage
+    {
+        int first;        // 第一个弱分类器在 m_stumps 中的下标
+        int count;
+        float threshold;
+    };
+    // 单结点的弱分类器：特征的 LBP 码落在 subset 中取 leaf[0]，否则取 leaf[1]
+    struct Stump
+    {
+        int feature;
+        unsigned int subset[8];
+        float leaf[2];
+    };
+    struct Feature
+    {
+        int x, y, width, height;   // 3x3 个块中左上角那块在窗口内的位置和大小
+    };
+
+    LbpCascade() {}
+    std::string read(const cv::FileNode &root);
+    void plan(LbpScratch &s, int width, int height, double scaleFactor, cv::Size minSize) const;
+    static void group(LbpScratch &s, int threshold, std::vector<cv::Rect> &objects);
+    int evaluate(const int *p, const int *offsets, int stage) const;
+    void evaluate4(const int *p, const int *offsets, unsigned live, int *result) const;
+    void scanScale(const cv::Mat &gray, LbpScratch &s, float scale, const cv::Mat &roiMask,
+                   const cv::Rect &roiBounds) const;
+
+    int m_width = 0, m_height = 0;
+    std::vector<Stage> m_stages;
+    std::vector<Stump> m_stumps;
+    std::vector<Feature> m_features;
+};
+
+#endif // LBP_CASCADE_H
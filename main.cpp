@@ -1,10 +1,71 @@
 #include "mainwindow.h"
-#include "videoprocessor.h" 
+#include "pipelinemanager.h"
+#include "fbpresenter.h"
+#include "quitsignal.h"
 #include <QApplication>
+#include <QCoreApplication>
+#include <QThread>
+#include <QDebug>
+
+// 帧缓冲输出模式：不创建任何Qt控件，处理结果直接写入 /dev/fb0（或文件模拟的帧缓冲）
+// FR_FB_DEVICE 指定设备路径；路径不在 /dev 下或设置了 FR_FB_SIZE=宽x高x位深（默认 800x480x16）时用文件模拟，
+// 否则必须是真实的帧缓冲设备。多路摄像头时只显示第一路
+static int runFramebufferMode(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QString fbPath = qEnvironmentVariableIsSet("FR_FB_DEVICE") ? qEnvironmentVariable("FR_FB_DEVICE") : "/dev/fb0";
+    int fileWidth = 0, fileHeight = 0, fileBpp = 0;
+    if (qEnvironmentVariableIsSet("FR_FB_SIZE") || !fbPath.startsWith("/dev/")) {
+        QStringList size = qEnvironmentVariable("FR_FB_SIZE", "800x480x16").split('x');
+        fileWidth = size.value(0).toInt();
+        fileHeight = size.value(1).toInt();
+        fileBpp = size.value(2, "16").toInt();
+    }
+
+    QThread presenterThread;
+    FbPresenter *presenter = new FbPresenter();
+    if (!presenter->open(fbPath, fileWidth, fileHeight, fileBpp)) {
+        qCritical() << "错误: 无法打开帧缓冲" << fbPath;
+        delete presenter;
+        return 1;
+    }
+    presenter->moveToThread(&presenterThread);
+
+    PipelineManager pipelines;
+    pipelines.init();
+
+    QObject::connect(&presenterThread, &QThread::finished, presenter, &QObject::deleteLater);
+    QObject::connect(pipelines.processor(0), &VideoProcessor::frameProcessed, presenter, &FbPresenter::submitFrame, Qt::DirectConnection);
+    for (VideoProcessor *processor : pipelines.processors()) {
+        const int camera = processor->camera();
+        QObject::connect(processor, &VideoProcessor::statusMessage, [camera](const QString &message) {
+            qInfo().noquote() << QString("[状态][cam%1]").arg(camera) << message;
+        });
+    }
+
+    QuitSignalNotifier quitSignal;
+
+    presenterThread.start();
+    pipelines.start();
+    int ret = a.exec();
+
+    pipelines.stop();
+    presenterThread.quit();
+    presenterThread.wait();
+    return ret;
+}
 
 int main(int argc, char *argv[])
 {
-    qRegisterMetaType<QList<RecognitionResult>>("QList<RecognitionResult>");
+    qRegisterMetaType<QVector<FaceOverlay>>("QVector<FaceOverlay>");
+    qRegisterMetaType<FrameFormat>("FrameFormat");
+    if (!PipelineManager::loadDatabaseKey()) return 1;
+
+    if (qEnvironmentVariable("FR_OUTPUT") == "fb") {
+        return runFramebufferMode(argc, argv);
+    }
+
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
@@ -4,7 +4,6 @@
 
 #include <QCloseEvent>
 #include <QDebug>
-#include <QPainter>
 #include <QSlider>  
 #include <QMessageBox>
 #include <QTextStream>
@@ -17,14 +16,19 @@ MainWindow::MainWindow(QWidget *parent)
     ui->setupUi(this);
     this->setWindowTitle("i.MX6Ull 人脸识别系统 (核心功能演示)");
 
-    m_processor = new VideoProcessor();
-    m_processor->moveToThread(&m_workerThread);
+    m_pipelines.init();
+    m_processor = m_pipelines.processor(0);
+
+    // 解码、叠加和缩放都在渲染线程完成，GUI 线程只负责交换缓冲区和绘制
+    m_renderer = new FrameRenderer();
+    m_renderer->moveToThread(&m_renderThread);
+    ui->videoView->setRenderer(m_renderer);
 
     // --- 连接信号与槽 ---
-    connect(&m_workerThread, &QThread::started, m_processor, &VideoProcessor::startProcessing);
-    connect(&m_workerThread, &QThread::finished, m_processor, &QObject::deleteLater);
+    connect(&m_renderThread, &QThread::finished, m_renderer, &QObject::deleteLater);
 
-    connect(m_processor, &VideoProcessor::frameProcessed, this, &MainWindow::updateFrame);
+    // submitFrame 是线程安全的邮箱，直接在处理线程中调用，避免排队拷贝信号参数
+    connect(m_processor, &VideoProcessor::frameProcessed, m_renderer, &FrameRenderer::submitFrame, Qt::DirectConnection);
     connect(m_processor, &VideoProcessor::statusMessage, this, &MainWindow::updateStatus);
 
     connect(ui->pushButton, &QPushButton::clicked, this, &MainWindow::on_pushButton_clicked);
@@ -101,7 +105,8 @@ MainWindow::MainWindow(QWidget *parent)
         }
     )");
 
-    m_workerThread.start();
+    m_renderThread.start();
+    m_pipelines.start();
 }
 
 MainWindow::~MainWindow()
@@ -120,45 +125,14 @@ void MainWindow::on_albumButton_clicked()
 void MainWindow::closeEvent(QCloseEvent *event)
 {
     qDebug() << "正在关闭应用程序...";
-    if (m_workerThread.isRunning()) {
-        QMetaObject::invokeMethod(m_processor, "stop", Qt::QueuedConnection);
-        m_workerThread.quit();
-        if (!m_workerThread.wait(3000)) {
-            qWarning("后台线程无法在3秒内正常退出，将强制终止。");
-            m_workerThread.terminate();//强制终止
-            m_workerThread.wait();
-        }
-    }
+    // 每路处理线程最多等3秒，超时强制终止
+    m_pipelines.stop(3000);
+    m_processor = nullptr;
+    m_renderThread.quit();
+    m_renderThread.wait();
     event->accept();
 }
 
-void MainWindow::updateFrame(const QByteArray &jpegData, const QList<RecognitionResult> &results)
-{
-    QPixmap pixmap;
-    if (!pixmap.loadFromData(jpegData, "JPEG")) {
-        qWarning() << "主线程加载pixmap失败!";
-        return;
-    }
-
-    QPainter painter(&pixmap);
-    for (const auto &result : results) {
-        QColor color = Qt::red; // 默认为红色 (Unknown)
-        if (strcmp(result.name, "Positioning...") == 0) {
-            color = Qt::yellow; // 注册时为黄色
-        } else if (strcmp(result.name, "Tracking...") != 0 && strcmp(result.name, "Unknown") != 0) {
-            color = Qt::green; // 识别成功为绿色
-        }
-
-        painter.setPen(QPen(color, 2));
-        painter.drawRect(result.rect.x, result.rect.y, result.rect.width, result.rect.height);
-
-        painter.setPen(Qt::white);
-        painter.setFont(QFont("Arial", 14, QFont::Bold));
-        painter.drawText(result.rect.x, result.rect.y - 5, QString(result.name));
-    }
-    ui->videoLabel->setPixmap(pixmap.scaled(ui->videoLabel->size(), Qt::KeepAspectRatio, Qt::SmoothTransformation));
-}
-
 void MainWindow::updateStatus(const QString &message)
 {
     ui->statusLabel->setText(message);
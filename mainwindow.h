@@ -1,8 +1,9 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
-#include "videoprocessor.h"
+#include "pipelinemanager.h"
 #include "albumdialog.h" 
+#include "framerenderer.h"
 
 #include <QMainWindow>
 #include <QThread>
@@ -27,10 +28,9 @@ protected:
     void closeEvent(QCloseEvent *event) override;
 
 public slots:
-    void updateFrame(const QByteArray &jpegData, const QList<RecognitionResult> &results);
     void updateStatus(const QString &message);
     void onBrightnessChanged(int value);
-//分别为：视频帧数据和识别结果,状态信息字符,亮度滑块
+//分别为：状态信息字符,亮度滑块
 
 private slots:
     void on_pushButton_clicked();
@@ -42,10 +42,12 @@ private slots:
 
 private:
     Ui::MainWindow *ui;
-    QThread m_workerThread;
-    VideoProcessor *m_processor;
+    PipelineManager m_pipelines;
+    VideoProcessor *m_processor;   // 第一路摄像头，界面只显示和控制这一路
+    QThread m_renderThread;
+    FrameRenderer *m_renderer;
     QSocketNotifier *m_stdinNotifier;
-   //分别为:Ui::MainWindow 对象的指针，工作线程对象，视频处理器对象，监视终端输入对象
+   //分别为:Ui::MainWindow 对象的指针，各路摄像头的流水线，第一路的视频处理器对象，渲染线程对象，帧渲染器，监视终端输入对象
 };
 
 #endif // MAINWINDOW_H
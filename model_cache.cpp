@@ -0,0 +1,903 @@
+#include "model_cache.h"
+#include "model_kernels.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/dnn.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char CACHE_MAGIC[4] = {'F', 'R', 'M', 'C'};
+const uint32_t CACHE_FORMAT_VERSION = 2;
+const size_t CACHE_ALIGN = 64;
+
+// 缓存文件头，后面依次是算子表和各算子的权重，都按 CACHE_ALIGN 对齐
+struct CacheHeader {
+    char magic[4];
+    uint32_t format_version;
+    uint64_t model_hash;
+    char opencv_version[32];   // 编译时的 CV_VERSION：比对的基准和层的导入方式都随 OpenCV 版本变化
+    uint32_t input_c, input_h, input_w;
+    uint32_t output_size;
+    uint32_t num_ops;
+    uint32_t reserved;
+    uint64_t ops_offset;
+    uint64_t file_size;
+};
+
+// 编译过程中的一个值（某一层的输出）的形状
+struct ValueShape {
+    int c = 0, h = 0, w = 0;
+    int size() const { return c * h * w; }
+};
+
+// 编译过程中的算子，权重在写出时才排进文件
+struct BuildOp {
+    ModelOp op;
+    std::vector<float> weight, bias, slope;
+    int owner = -1;    // 输出这个值的层 id，判断后面的 BatchNorm/激活能否并进来
+};
+
+uint64_t fnv1a64(const unsigned char *data, size_t size)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool hashFile(const std::string &path, uint64_t &hash)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+    void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) return false;
+    hash = fnv1a64((const unsigned char *)data, (size_t)st.st_size);
+    munmap(data, (size_t)st.st_size);
+    return true;
+}
+
+std::vector<float> matFloats(const cv::Mat &m)
+{
+    std::vector<float> v;
+    if (m.empty() || m.type() != CV_32F || !m.isContinuous()) return v;
+    const float *p = m.ptr<float>();
+    v.assign(p, p + m.total());
+    return v;
+}
+
+// 把只有一个值的斜率或缩放展开到每个通道
+bool expandPerChannel(std::vector<float> &v, int channels)
+{
+    if ((int)v.size() == channels) return true;
+    if (v.size() != 1) return false;
+    v.assign(channels, v[0]);
+    return true;
+}
+
+bool isPointwise(const ModelOp &op)
+{
+    return op.type == MODEL_OP_CONV && op.kernel_h == 1 && op.kernel_w == 1 && op.stride_h == 1 &&
+           op.stride_w == 1 && op.groups == 1 && op.pad_top == 0 && op.pad_left == 0;
+}
+
+size_t alignUp(size_t n)
+{
+    return (n + CACHE_ALIGN - 1) & ~(CACHE_ALIGN - 1);
+}
+
+// 导入后的 cv::dnn 网络展平成算子表；遇到不支持的层返回 false
+class ModelCompiler
+{
+public:
+    ModelCompiler(cv::dnn::Net &net, int inputC, int inputH, int inputW) : m_net(net)
+    {
+        ValueShape input;
+        input.c = inputC;
+        input.h = inputH;
+        input.w = inputW;
+        m_shapes.push_back(input);
+    }
+
+    bool compile();
+    std::vector<char> serialize(uint64_t modelHash) const;
+    const std::string &error() const { return m_error; }
+
+private:
+    bool fail(const std::string &message) { m_error = message; return false; }
+    int addOp(BuildOp &&op, const ValueShape &shape, int layerId);
+    // 层的唯一输入能否把后续的逐通道运算并进来：输入是本层的唯一使用者，且由算子直接输出（不是别名）
+    BuildOp *fusibleProducer(int inputLayer, int value);
+
+    bool addConvolution(int id, const cv::Ptr<cv::dnn::Layer> &layer, int input);
+    bool addInnerProduct(int id, const cv::Ptr<cv::dnn::Layer> &layer, int input);
+    bool addBatchNorm(int id, const cv::Ptr<cv::dnn::Layer> &layer, int inputLayer, int input);
+    bool addActivation(int id, std::vector<float> slope, int inputLayer, int input);
+
+    cv::dnn::Net &m_net;
+    std::vector<ValueShape> m_shapes;               // 值编号 -> 形状
+    std::vector<BuildOp> m_ops;                     // 第 k 个算子输出值 k+1
+    std::unordered_map<int, int> m_layerValue;      // 层 id -> 值编号
+    std::unordered_map<int, int> m_consumers;       // 层 id -> 以它为输入的层数
+    int m_output = -1;
+    std::string m_error;
+};
+
+int ModelCompiler::addOp(BuildOp &&op, const ValueShape &shape, int layerId)
+{
+    op.op.out_c = shape.c;
+    op.op.out_h = shape.h;
+    op.op.out_w = shape.w;
+    op.owner = layerId;
+    m_ops.push_back(std::move(op));
+    m_shapes.push_back(shape);
+    return (int)m_shapes.size() - 1;
+}
+
+BuildOp *ModelCompiler::fusibleProducer(int inputLayer, int value)
+{
+    if (value <= 0) return nullptr;
+    BuildOp &producer = m_ops[value - 1];
+    if (producer.owner != inputLayer || m_consumers[inputLayer] != 1) return nullptr;
+    return &producer;
+}
+
+static BuildOp newOp(ModelOpType type, int input, const ValueShape &in)
+{
+    BuildOp b;
+    std::memset(&b.op, 0, sizeof(b.op));
+    b.op.type = type;
+    b.op.input = input;
+    b.op.input2 = -1;
+    b.op.in_c = in.c;
+    b.op.in_h = in.h;
+    b.op.in_w = in.w;
+    b.op.kernel_h = b.op.kernel_w = 1;
+    b.op.stride_h = b.op.stride_w = 1;
+    b.op.groups = 1;
+    return b;
+}
+
+bool ModelCompiler::addConvolution(int id, const cv::Ptr<cv::dnn::Layer> &layer, int input)
+{
+    cv::Ptr<cv::dnn::BaseConvolutionLayer> conv = layer.dynamicCast<cv::dnn::BaseConvolutionLayer>();
+    if (!conv || layer->blobs.empty()) return fail("convolution " + layer->name + " has no weights");
+    const cv::Mat &weights = layer->blobs[0];
+    if (conv->kernel_size.size() != 2 || conv->strides.size() != 2 || conv->pads_begin.size() != 2 ||
+        conv->pads_end.size() != 2 || weights.dims != 4) {
+        return fail("convolution " + layer->name + " is not 2D");
+    }
+    if (!conv->padMode.empty()) return fail("convolution " + layer->name + " uses pad mode " + conv->padMode);
+    for (size_t d : conv->dilations) {
+        if (d != 1) return fail("convolution " + layer->name + " is dilated");
+    }
+
+    const ValueShape in = m_shapes[input];
+    const int outC = weights.size[0], groupC = weights.size[1];
+    const int kh = (int)conv->kernel_size[0], kw = (int)conv->kernel_size[1];
+    const int sh = (int)conv->strides[0], sw = (int)conv->strides[1];
+    if (groupC <= 0 || in.c % groupC != 0 || outC % (in.c / groupC) != 0 ||
+        weights.size[2] != kh || weights.size[3] != kw || sh <= 0 || sw <= 0) {
+        return fail("convolution " + layer->name + " has unexpected weight shape");
+    }
+    ValueShape out;
+    out.c = outC;
+    out.h = (in.h + (int)conv->pads_begin[0] + (int)conv->pads_end[0] - kh) / sh + 1;
+    out.w = (in.w + (int)conv->pads_begin[1] + (int)conv->pads_end[1] - kw) / sw + 1;
+    if (out.h <= 0 || out.w <= 0) return fail("convolution " + layer->name + " has an empty output");
+
+    BuildOp op = newOp(MODEL_OP_CONV, input, in);
+    op.op.kernel_h = kh;
+    op.op.kernel_w = kw;
+    op.op.stride_h = sh;
+    op.op.stride_w = sw;
+    op.op.pad_top = (uint32_t)conv->pads_begin[0];
+    op.op.pad_left = (uint32_t)conv->pads_begin[1];
+    op.op.groups = in.c / groupC;
+    op.weight = matFloats(weights);
+    op.bias = layer->blobs.size() > 1 ? matFloats(layer->blobs[1]) : std::vector<float>(outC, 0.0f);
+    if ((int)op.weight.size() != outC * groupC * kh * kw || (int)op.bias.size() != outC) {
+        return fail("convolution " + layer->name + " has unexpected weight shape");
+    }
+    m_layerValue[id] = addOp(std::move(op), out, id);
+    return true;
+}
+
+bool ModelCompiler::addInnerProduct(int id, const cv::Ptr<cv::dnn::Layer> &layer, int input)
+{
+    if (layer->blobs.empty() || layer->blobs[0].dims != 2) return fail("inner product " + layer->name + " has no weights");
+    const ValueShape in = m_shapes[input];
+    const cv::Mat &weights = layer->blobs[0];
+    const int outSize = weights.size[0];
+    if (weights.size[1] != in.size()) return fail("inner product " + layer->name + " does not match its input");
+
+    BuildOp op = newOp(MODEL_OP_FC, input, in);
+    op.weight = matFloats(weights);
+    op.bias = layer->blobs.size() > 1 ? matFloats(layer->blobs[1]) : std::vector<float>(outSize, 0.0f);
+    if ((int)op.weight.size() != outSize * in.size() || (int)op.bias.size() != outSize) {
+        return fail("inner product " + layer->name + " has unexpected weight shape");
+    }
+    ValueShape out;
+    out.c = outSize;
+    out.h = out.w = 1;
+    m_layerValue[id] = addOp(std::move(op), out, id);
+    return true;
+}
+
+bool ModelCompiler::addBatchNorm(int id, const cv::Ptr<cv::dnn::Layer> &layer, int inputLayer, int input)
+{
+    cv::Mat scaleMat, shiftMat;
+    layer->getScaleShift(scaleMat, shiftMat);
+    const ValueShape in = m_shapes[input];
+    std::vector<float> scale = matFloats(scaleMat), shift = matFloats(shiftMat);
+    if (scale.empty()) scale.assign(in.c, 1.0f);
+    if (shift.empty()) shift.assign(in.c, 0.0f);
+    if (!expandPerChannel(scale, in.c) || !expandPerChannel(shift, in.c)) {
+        return fail("batch norm " + layer->name + " does not match its input");
+    }
+
+    // 折进前面的卷积或全连接：w' = w * s，b' = b * s + t
+    BuildOp *producer = fusibleProducer(inputLayer, input);
+    if (producer && !producer->op.has_prelu &&
+        (producer->op.type == MODEL_OP_CONV || producer->op.type == MODEL_OP_FC)) {
+        const size_t perChannel = producer->weight.size() / in.c;
+        for (int c = 0; c < in.c; ++c) {
+            float *w = &producer->weight[c * perChannel];
+            for (size_t i = 0; i < perChannel; ++i) w[i] *= scale[c];
+            producer->bias[c] = producer->bias[c] * scale[c] + shift[c];
+        }
+        producer->owner = id;
+        m_layerValue[id] = input;
+        return true;
+    }
+
+    BuildOp op = newOp(MODEL_OP_SCALE, input, in);
+    op.weight = scale;
+    op.bias = shift;
+    op.op.groups = in.c;
+    m_layerValue[id] = addOp(std::move(op), in, id);
+    return true;
+}
+
+bool ModelCompiler::addActivation(int id, std::vector<float> slope, int inputLayer, int input)
+{
+    const ValueShape in = m_shapes[input];
+    if (!expandPerChannel(slope, in.c)) return fail("activation slope does not match its input");
+
+    BuildOp *producer = fusibleProducer(inputLayer, input);
+    if (producer && !producer->op.has_prelu) {
+        producer->op.has_prelu = 1;
+        producer->slope = slope;
+        producer->owner = id;
+        m_layerValue[id] = input;
+        return true;
+    }
+
+    BuildOp op = newOp(MODEL_OP_SCALE, input, in);
+    op.weight.assign(in.c, 1.0f);
+    op.bias.assign(in.c, 0.0f);
+    op.op.groups = in.c;
+    op.op.has_prelu = 1;
+    op.slope = slope;
+    m_layerValue[id] = addOp(std::move(op), in, id);
+    return true;
+}
+
+bool ModelCompiler::compile()
+{
+    // 层按加入网络的顺序编号，导入器按拓扑顺序加入，所以依次处理即可；id 0 是输入层
+    const std::vector<cv::String> names = m_net.getLayerNames();
+    std::vector<int> ids;
+    std::unordered_map<const cv::dnn::Layer *, int> layerIds;
+    const int inputLayer = 0;
+    layerIds[m_net.getLayer(inputLayer).get()] = inputLayer;
+    m_layerValue[inputLayer] = 0;
+    for (const cv::String &name : names) {
+        const int id = m_net.getLayerId(name);
+        ids.push_back(id);
+        layerIds[m_net.getLayer(id).get()] = id;
+    }
+    std::unordered_map<int, std::vector<int>> inputs;
+    for (int id : ids) {
+        for (const cv::Ptr<cv::dnn::Layer> &in : m_net.getLayerInputs(id)) {
+            auto it = layerIds.find(in.get());
+            if (it == layerIds.end()) return fail("layer input outside the network");
+            inputs[id].push_back(it->second);
+            ++m_consumers[it->second];
+        }
+    }
+
+    for (int id : ids) {
+        const cv::Ptr<cv::dnn::Layer> layer = m_net.getLayer(id);
+        const std::vector<int> &in = inputs[id];
+        std::vector<int> values;
+        for (int layerId : in) {
+            auto it = m_layerValue.find(layerId);
+            if (it == m_layerValue.end()) return fail("layer " + layer->name + " is used before its inputs");
+            values.push_back(it->second);
+        }
+        const std::string &type = layer->type;
+        bool ok = true;
+        if (type == "Eltwise" || type == "NaryEltwise") {
+            // 只认两输入求和；其他运算（乘、取最大）会在之后与 cv::dnn 的比对中暴露出来
+            if (values.size() != 2) return fail("eltwise " + layer->name + " does not have two inputs");
+            const ValueShape a = m_shapes[values[0]], b = m_shapes[values[1]];
+            if (a.c != b.c || a.h != b.h || a.w != b.w) return fail("eltwise " + layer->name + " inputs differ in shape");
+            BuildOp op = newOp(MODEL_OP_ADD, values[0], a);
+            op.op.input2 = values[1];
+            m_layerValue[id] = addOp(std::move(op), a, id);
+        } else if (values.size() != 1) {
+            return fail("layer " + layer->name + " (" + type + ") has " + std::to_string(values.size()) + " inputs");
+        } else if (type == "Convolution") {
+            ok = addConvolution(id, layer, values[0]);
+        } else if (type == "InnerProduct") {
+            ok = addInnerProduct(id, layer, values[0]);
+        } else if (type == "BatchNorm") {
+            ok = addBatchNorm(id, layer, in[0], values[0]);
+        } else if (type == "ReLU") {
+            cv::Ptr<cv::dnn::ReLULayer> relu = layer.dynamicCast<cv::dnn::ReLULayer>();
+            ok = addActivation(id, std::vector<float>(1, relu ? relu->negativeSlope : 0.0f), in[0], values[0]);
+        } else if (type == "PReLU") {
+            if (layer->blobs.empty()) return fail("PReLU " + layer->name + " has no slope");
+            ok = addActivation(id, matFloats(layer->blobs[0]), in[0], values[0]);
+        } else if (type == "Flatten" || type == "Reshape") {
+            // 数据按 CHW 连续存放，展平不需要搬动数据，直接沿用输入的值；全连接只按总长度读取它
+            m_layerValue[id] = values[0];
+        } else if (type == "Identity" || type == "Dropout") {
+            m_layerValue[id] = values[0];
+        } else {
+            return fail("unsupported layer " + layer->name + " (" + type + ")");
+        }
+        if (!ok) return false;
+        m_output = m_layerValue[id];
+    }
+    if (m_output <= 0) return fail("network has no operations");
+    if (m_output != (int)m_ops.size()) return fail("network output is not its last operation");
+    return true;
+}
+
+std::vector<char> ModelCompiler::serialize(uint64_t modelHash) const
+{
+    size_t offset = alignUp(sizeof(CacheHeader));
+    const size_t opsOffset = offset;
+    offset = alignUp(offset + m_ops.size() * sizeof(ModelOp));
+    std::vector<ModelOp> ops;
+    std::vector<std::vector<float>> weights;
+    for (const BuildOp &b : m_ops) {
+        ModelOp op = b.op;
+        // 1x1 卷积的权重按执行时的读取顺序重排好，启动后不再处理
+        if (isPointwise(op)) {
+            std::vector<float> packed(modelPackedPointwiseSize(op.out_c, op.in_c));
+            modelPackPointwise(b.weight.data(), op.out_c, op.in_c, packed.data());
+            weights.push_back(std::move(packed));
+            op.weight_layout = MODEL_WEIGHTS_PACKED4;
+        } else {
+            weights.push_back(b.weight);
+            op.weight_layout = MODEL_WEIGHTS_OIHW;
+        }
+        auto place = [&offset](const std::vector<float> &v) -> uint64_t {
+            if (v.empty()) return 0;
+            const uint64_t at = offset;
+            offset = alignUp(offset + v.size() * sizeof(float));
+            return at;
+        };
+        op.weight_offset = place(weights.back());
+        op.bias_offset = place(b.bias);
+        op.slope_offset = place(b.slope);
+        ops.push_back(op);
+    }
+
+    std::vector<char> file(offset, 0);
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.format_version = CACHE_FORMAT_VERSION;
+    header.model_hash = modelHash;
+    std::snprintf(header.opencv_version, sizeof(header.opencv_version), "%s", CV_VERSION);
+    header.input_c = m_shapes[0].c;
+    header.input_h = m_shapes[0].h;
+    header.input_w = m_shapes[0].w;
+    header.output_size = m_shapes[m_output].size();
+    header.num_ops = (uint32_t)ops.size();
+    header.ops_offset = opsOffset;
+    header.file_size = offset;
+    std::memcpy(file.data(), &header, sizeof(header));
+    std::memcpy(file.data() + opsOffset, ops.data(), ops.size() * sizeof(ModelOp));
+    for (size_t i = 0; i < ops.size(); ++i) {
+        auto put = [&file](uint64_t at, const std::vector<float> &v) {
+            if (at) std::memcpy(file.data() + at, v.data(), v.size() * sizeof(float));
+        };
+        put(ops[i].weight_offset, weights[i]);
+        put(ops[i].bias_offset, m_ops[i].bias);
+        put(ops[i].slope_offset, m_ops[i].slope);
+    }
+    return file;
+}
+
+// 与 cv::dnn 比对：同一个确定的伪随机输入，输出逐个元素比较，|out - ref| 不超过 1e-4 * (|ref| + rms(ref))。
+// 只差在 float 累加顺序（SIMD 分组、按通道分块）上时误差比这小得多；rms 项是接近零的元素的绝对容差
+bool validate(cv::dnn::Net &net, const CompiledModel &model, int inputC, int inputH, int inputW, std::string &error)
+{
+    const int shape[4] = {1, inputC, inputH, inputW};
+    cv::Mat blob(4, shape, CV_32F);
+    float *p = blob.ptr<float>();
+    uint32_t state = 12345;
+    for (int i = 0; i < model.inputSize(); ++i) {
+        state = state * 1664525u + 1013904223u;
+        p[i] = (float)(state >> 8) / (float)(1u << 24);
+    }
+    net.setInput(blob);
+    cv::Mat reference = net.forward();
+    if ((int)reference.total() != model.outputSize() || reference.type() != CV_32F) {
+        error = "output size differs from cv::dnn";
+        return false;
+    }
+
+    ModelExecutor executor(std::shared_ptr<const CompiledModel>(&model, [](const CompiledModel *) {}));
+    const float *out = executor.run(p);
+    const float *ref = reference.ptr<float>();
+    double dot = 0, normA = 0, normB = 0;
+    for (int i = 0; i < model.outputSize(); ++i) {
+        dot += (double)out[i] * ref[i];
+        normA += (double)out[i] * out[i];
+        normB += (double)ref[i] * ref[i];
+    }
+    const double rms = std::sqrt(normB / model.outputSize());
+    double maxDiff = 0, worst = 0;
+    int worstIndex = 0;
+    for (int i = 0; i < model.outputSize(); ++i) {
+        const double diff = std::fabs((double)out[i] - ref[i]);
+        const double ratio = diff / (1e-4 * (std::fabs((double)ref[i]) + rms) + 1e-30);
+        maxDiff = std::max(maxDiff, diff);
+        if (!(ratio <= worst)) {   // NaN 也算最差，之后不会被有限值替换
+            worst = ratio == ratio ? ratio : HUGE_VAL;
+            worstIndex = i;
+        }
+    }
+    const double cosine = normA > 0 && normB > 0 ? dot / std::sqrt(normA * normB) : 0.0;
+    if (!(worst <= 1.0)) {
+        char message[128];
+        std::snprintf(message, sizeof(message), "differs from cv::dnn at output %d (%g vs %g, %.1fx the tolerance)",
+                      worstIndex, (double)out[worstIndex], (double)ref[worstIndex], worst);
+        error = message;
+        return false;
+    }
+
+    // 两边第一次执行都包含准备工作，各再跑一次计时，只在编译时记一行日志作对比
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point t0 = Clock::now();
+    net.forward();
+    const Clock::time_point t1 = Clock::now();
+    executor.run(p);
+    const Clock::time_point t2 = Clock::now();
+    printf("Compiled model matches cv::dnn (cosine %.6f, max diff %g, %.2f of the tolerance): %.1f ms vs %.1f ms per inference, "
+           "%zu KB weights, %zu KB activations.\n", cosine, maxDiff, worst,
+           std::chrono::duration<double, std::milli>(t2 - t1).count(),
+           std::chrono::duration<double, std::milli>(t1 - t0).count(),
+           model.sizeBytes() / 1024, executor.bufferBytes() / 1024);
+    return true;
+}
+
+bool writeFileAtomically(const std::string &path, const std::vector<char> &data)
+{
+    const std::string tmp = path + ".tmp." + std::to_string((long)getpid());
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        written += (size_t)n;
+    }
+    const bool ok = written == data.size() && fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        const int saved = errno;
+        unlink(tmp.c_str());
+        errno = saved;
+        return false;
+    }
+    return true;
+}
+
+// 删除同一模型旧版本留下的缓存（模型文件被替换过）
+void removeStaleCaches(const std::string &modelPath, const std::string &keep)
+{
+    const size_t slash = modelPath.rfind('/');
+    const std::string dir = slash == std::string::npos ? "." : modelPath.substr(0, slash);
+    const std::string prefix = (slash == std::string::npos ? modelPath : modelPath.substr(slash + 1)) + ".";
+    const std::string keepName = keep.substr(keep.rfind('/') == std::string::npos ? 0 : keep.rfind('/') + 1);
+    DIR *d = opendir(dir.c_str());
+    if (!d) return;
+    while (struct dirent *entry = readdir(d)) {
+        const std::string name = entry->d_name;
+        if (name == keepName || name.size() <= prefix.size() + 4 || name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - 4, 4, ".frm") != 0) {
+            continue;
+        }
+        if (unlink((dir + "/" + name).c_str()) == 0) printf("Removed stale model cache %s.\n", name.c_str());
+    }
+    closedir(d);
+}
+
+} // namespace
+
+CompiledModel::~CompiledModel()
+{
+    if (m_mapped) munmap((void *)m_base, m_size);
+}
+
+bool CompiledModel::attach(const char *base, size_t size, uint64_t modelHash, int inputC, int inputH, int inputW)
+{
+    if (size < sizeof(CacheHeader)) return false;
+    CacheHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    char version[sizeof(header.opencv_version) + 1] = {0};
+    std::memcpy(version, header.opencv_version, sizeof(header.opencv_version));
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.format_version != CACHE_FORMAT_VERSION || header.model_hash != modelHash ||
+        std::strcmp(version, CV_VERSION) != 0 || header.file_size != size ||
+        (int)header.input_c != inputC || (int)header.input_h != inputH || (int)header.input_w != inputW ||
+        header.num_ops == 0 || header.ops_offset % CACHE_ALIGN != 0 ||
+        header.ops_offset > size || (size - header.ops_offset) / sizeof(ModelOp) < header.num_ops) {
+        return false;
+    }
+
+    // 逐个检查算子：输入只能引用前面的值，形状前后衔接，权重完整落在文件内。
+    // 文件可能被截断或改动，检查通过后执行时就不必再做边界判断
+    const ModelOp *ops = (const ModelOp *)(base + header.ops_offset);
+    std::vector<ValueShape> shapes(1);
+    shapes[0].c = inputC;
+    shapes[0].h = inputH;
+    shapes[0].w = inputW;
+    auto arrayOk = [size](uint64_t offset, uint64_t count) {
+        return offset != 0 && offset % sizeof(float) == 0 && offset <= size &&
+               count <= (size - offset) / sizeof(float);
+    };
+    for (uint32_t i = 0; i < header.num_ops; ++i) {
+        const ModelOp &op = ops[i];
+        if (op.input < 0 || op.input > (int)i) return false;
+        const ValueShape &in = shapes[op.input];
+        if ((int)op.in_c != in.c || (int)op.in_h != in.h || (int)op.in_w != in.w) return false;
+        if (op.out_c == 0 || op.out_h == 0 || op.out_w == 0 || op.out_c > 65536 || op.out_h > 65536 || op.out_w > 65536) {
+            return false;
+        }
+        const uint64_t outC = op.out_c;
+        if (op.weight_layout != MODEL_WEIGHTS_OIHW && op.weight_layout != MODEL_WEIGHTS_PACKED4) return false;
+        if (op.type != MODEL_OP_CONV && op.weight_layout != MODEL_WEIGHTS_OIHW) return false;
+        switch (op.type) {
+        case MODEL_OP_CONV: {
+            if (op.groups == 0 || op.in_c % op.groups != 0 || op.out_c % op.groups != 0 ||
+                op.kernel_h == 0 || op.kernel_w == 0 || op.stride_h == 0 || op.stride_w == 0 ||
+                op.kernel_h > 64 || op.kernel_w > 64 || op.pad_top > 64 || op.pad_left > 64) {
+                return false;
+            }
+            if (op.weight_layout == MODEL_WEIGHTS_PACKED4 && !isPointwise(op)) return false;
+            const uint64_t count = op.weight_layout == MODEL_WEIGHTS_PACKED4
+                ? modelPackedPointwiseSize(op.out_c, op.in_c)
+                : outC * (op.in_c / op.groups) * op.kernel_h * op.kernel_w;
+            if (!arrayOk(op.weight_offset, count) || !arrayOk(op.bias_offset, outC)) return false;
+            break;
+        }
+        case MODEL_OP_FC:
+            if (op.out_h != 1 || op.out_w != 1 ||
+                !arrayOk(op.weight_offset, outC * in.size()) || !arrayOk(op.bias_offset, outC)) {
+                return false;
+            }
+            break;
+        case MODEL_OP_ADD:
+            if (op.input2 < 0 || op.input2 > (int)i) return false;
+            if (shapes[op.input2].c != in.c || shapes[op.input2].h != in.h || shapes[op.input2].w != in.w) return false;
+            // fallthrough
+        case MODEL_OP_SCALE:
+            if ((int)op.out_c != in.c || (int)op.out_h != in.h || (int)op.out_w != in.w) return false;
+            if (op.type == MODEL_OP_SCALE && (!arrayOk(op.weight_offset, outC) || !arrayOk(op.bias_offset, outC))) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+        if (op.has_prelu && !arrayOk(op.slope_offset, outC)) return false;
+        ValueShape out;
+        out.c = op.out_c;
+        out.h = op.out_h;
+        out.w = op.out_w;
+        shapes.push_back(out);
+    }
+    if (shapes.back().size() != (int)header.output_size) return false;
+
+    m_base = base;
+    m_size = size;
+    m_ops = ops;
+    m_numOps = header.num_ops;
+    m_inputSize = inputC * inputH * inputW;
+    m_outputSize = (int)header.output_size;
+    return true;
+}
+
+std::shared_ptr<CompiledModel> CompiledModel::map(const std::string &cachePath, uint64_t modelHash,
+                                                  int inputC, int inputH, int inputW)
+{
+    int fd = ::open(cachePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (data == MAP_FAILED) return nullptr;
+    std::shared_ptr<CompiledModel> model(new CompiledModel);
+    if (!model->attach((const char *)data, (size_t)st.st_size, modelHash, inputC, inputH, inputW)) {
+        munmap(data, (size_t)st.st_size);
+        printf("Model cache %s is stale or damaged, recompiling.\n", cachePath.c_str());
+        return nullptr;
+    }
+    model->m_mapped = true;
+    return model;
+}
+
+std::shared_ptr<CompiledModel> CompiledModel::open(const std::string &modelPath, int inputC, int inputH, int inputW)
+{
+    uint64_t hash = 0;
+    if (!hashFile(modelPath, hash)) return nullptr;
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), ".%016llx.frm", (unsigned long long)hash);
+    const std::string cachePath = modelPath + suffix;
+
+    std::shared_ptr<CompiledModel> model = map(cachePath, hash, inputC, inputH, inputW);
+    if (model) {
+        printf("Loaded compiled model %s (%d ops).\n", cachePath.c_str(), model->numOps());
+        return model;
+    }
+
+    // 没有可用的缓存：用 cv::dnn 导入一次，展平、比对，再写出
+    std::string error;
+    try {
+        cv::dnn::Net net = cv::dnn::readNet(modelPath);
+        if (net.empty()) return nullptr;
+        ModelCompiler compiler(net, inputC, inputH, inputW);
+        model.reset(new CompiledModel);
+        if (!compiler.compile()) {
+            error = compiler.error();
+        } else {
+            model->m_memory = compiler.serialize(hash);
+            if (!model->attach(model->m_memory.data(), model->m_memory.size(), hash, inputC, inputH, inputW)) {
+                error = "compiled model failed its own checks";
+            } else if (validate(net, *model, inputC, inputH, inputW, error)) {
+                if (!writeFileAtomically(cachePath, model->m_memory)) {
+                    fprintf(stderr, "Cannot write model cache %s: %s; using the compiled model in memory.\n",
+                            cachePath.c_str(), strerror(errno));
+                    return model;
+                }
+                printf("Compiled model cache %s (%d ops, %zu bytes).\n",
+                       cachePath.c_str(), model->numOps(), model->m_memory.size());
+                removeStaleCaches(modelPath, cachePath);
+                // 改用映射的文件，内存中的副本随之释放，守护进程和界面程序共享同一份页缓存
+                std::shared_ptr<CompiledModel> mapped = map(cachePath, hash, inputC, inputH, inputW);
+                return mapped ? mapped : model;
+            }
+        }
+    } catch (const cv::Exception &e) {
+        error = e.what();
+    }
+    fprintf(stderr, "Model %s is not compiled (%s), using cv::dnn.\n", modelPath.c_str(), error.c_str());
+    return nullptr;
+}
+
+ModelExecutor::ModelExecutor(std::shared_ptr<const CompiledModel> model)
+    : m_model(std::move(model))
+{
+    // 每个值最后一次被读取的算子；最终输出一直保留
+    const int numOps = m_model->numOps();
+    std::vector<int> lastUse(numOps + 1, -1);
+    for (int i = 0; i < numOps; ++i) {
+        const ModelOp &op = m_model->op(i);
+        lastUse[op.input] = i;
+        if (op.type == MODEL_OP_ADD) lastUse[op.input2] = i;
+    }
+    lastUse[numOps] = numOps;
+
+    // 按执行顺序分配：算子 i 的输出可以复用在 i 之前已经读完的值的缓冲区（不与自己的输入共用）
+    m_valueBuffer.assign(numOps + 1, -1);
+    std::vector<size_t> sizes;
+    std::vector<int> freeBuffers;
+    for (int i = 0; i < numOps; ++i) {
+        const ModelOp &op = m_model->op(i);
+        for (int v = 1; v <= i; ++v) {
+            if (lastUse[v] == i - 1 && m_valueBuffer[v] >= 0) freeBuffers.push_back(m_valueBuffer[v]);
+        }
+        const size_t need = (size_t)op.out_c * op.out_h * op.out_w;
+        int buffer;
+        if (!freeBuffers.empty()) {
+            buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+            sizes[buffer] = std::max(sizes[buffer], need);
+        } else {
+            buffer = (int)sizes.size();
+            sizes.push_back(need);
+        }
+        m_valueBuffer[i + 1] = buffer;
+    }
+    m_buffers.resize(sizes.size());
+    for (size_t i = 0; i < sizes.size(); ++i) m_buffers[i].assign(sizes[i], 0.0f);
+}
+
+size_t ModelExecutor::bufferBytes() const
+{
+    size_t bytes = 0;
+    for (const std::vector<float> &buffer : m_buffers) bytes += buffer.size() * sizeof(float);
+    return bytes;
+}
+
+const float *ModelExecutor::value(int index, const float *input) const
+{
+    return index == 0 ? input : m_buffers[m_valueBuffer[index]].data();
+}
+
+// 一个算子在一次推理中的参数，按输出通道分段执行
+struct ModelExecutor::OpTask {
+    const ModelOp *op;
+    const float *in;
+    const float *in2;
+    float *out;
+    const float *weight;
+    const float *bias;
+    const float *slope;
+};
+
+// 计算输出通道 [begin, end)；1x1 卷积按4个通道一组分段，begin/end 是组号
+void ModelExecutor::runRange(void *context, int begin, int end)
+{
+    const OpTask &t = *(const OpTask *)context;
+    const ModelOp &op = *t.op;
+    const int plane = op.out_h * op.out_w;
+    bool preluDone = false;   // 专用内核在写出时已经做了 PReLU
+    switch (op.type) {
+    case MODEL_OP_CONV:
+        if (op.weight_layout == MODEL_WEIGHTS_PACKED4) {
+            begin *= 4;
+            end = std::min(end * 4, (int)op.out_c);
+            modelConvPointwise(op, t.in, t.weight, t.bias, t.slope, t.out, begin, end);
+            preluDone = true;
+        } else if (modelConvDepthwise(op, t.in, t.weight, t.bias, t.slope, t.out, begin, end)) {
+            preluDone = true;
+        } else {
+            modelConvGeneric(op, t.in, t.weight, t.bias, t.out, begin, end);
+        }
+        break;
+    case MODEL_OP_FC:
+        modelFullyConnected(op, t.in, t.weight, t.bias, t.out, begin, end);
+        break;
+    case MODEL_OP_ADD: {
+        const size_t first = (size_t)begin * plane;
+        modelAdd(t.in + first, t.in2 + first, (size_t)(end - begin) * plane, t.out + first);
+        break;
+    }
+    case MODEL_OP_SCALE:
+        modelScale(op, t.in, t.weight, t.bias, t.out, begin, end);
+        break;
+    }
+    if (t.slope && !preluDone) modelPrelu(t.out + (size_t)begin * plane, end - begin, plane, t.slope + begin);
+}
+
+const float *ModelExecutor::run(const float *input)
+{
+    const CompiledModel &model = *m_model;
+    for (int i = 0; i < model.numOps(); ++i) {
+        const ModelOp &op = model.op(i);
+        OpTask task;
+        task.op = &op;
+        task.in = value(op.input, input);
+        task.in2 = op.type == MODEL_OP_ADD ? value(op.input2, input) : nullptr;
+        task.out = m_buffers[m_valueBuffer[i + 1]].data();
+        task.weight = model.floats(op.weight_offset);
+        task.bias = model.floats(op.bias_offset);
+        task.slope = op.has_prelu ? model.floats(op.slope_offset) : nullptr;
+        const int units = op.weight_layout == MODEL_WEIGHTS_PACKED4 ? ((int)op.out_c + 3) / 4 : (int)op.out_c;
+
+        // 唤醒辅助线程要几十微秒，计算量太小的算子（逐元素运算、最后的全连接）直接在本线程中算
+        uint64_t work = (uint64_t)op.out_c * op.out_h * op.out_w;
+        if (op.type == MODEL_OP_CONV) work *= (uint64_t)(op.in_c / op.groups) * op.kernel_h * op.kernel_w;
+        if (op.type == MODEL_OP_FC) work *= (uint64_t)op.in_c * op.in_h * op.in_w;
+        if (m_pool && m_pool->threads() > 1 && work >= 128 * 1024) {
+            m_pool->parallelFor(units, &ModelExecutor::runRange, &task);
+        } else {
+            runRange(&task, 0, units);
+        }
+    }
+    return m_buffers[m_valueBuffer[model.numOps()]].data();
+}
+
+ModelThreadPool::ModelThreadPool(int helpers, std::function<void()> threadInit)
+    : m_numThreads(std::max(0, helpers) + 1)
+{
+    for (int i = 0; i < m_numThreads - 1; ++i) {
+        m_threads.push_back(std::thread(&ModelThreadPool::helperLoop, this, i, threadInit));
+    }
+}
+
+ModelThreadPool::~ModelThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exiting = true;
+    }
+    m_start.notify_all();
+    for (std::thread &thread : m_threads) thread.join();
+}
+
+void ModelThreadPool::helperLoop(int index, std::function<void()> threadInit)
+{
+    if (threadInit) threadInit();
+    unsigned int seen = 0;
+    for (;;) {
+        RangeFunc func;
+        void *context;
+        int count;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_start.wait(lock, [this, seen] { return m_exiting || m_generation != seen; });
+            if (m_exiting) return;
+            seen = m_generation;
+            func = m_func;
+            context = m_context;
+            count = m_count;
+        }
+        // 第 index 个辅助线程算第 index+1 段，第0段由调用者算
+        const int begin = (int)((long long)count * (index + 1) / m_numThreads);
+        const int end = (int)((long long)count * (index + 2) / m_numThreads);
+        if (begin < end) func(context, begin, end);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_running == 0) m_done.notify_one();
+        }
+    }
+}
+
+void ModelThreadPool::parallelFor(int count, RangeFunc func, void *context)
+{
+    if (count <= 0) return;
+    if (m_threads.empty() || count == 1) {
+        func(context, 0, count);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_func = func;
+        m_context = context;
+        m_count = count;
+        m_running = (int)m_threads.size();
+        ++m_generation;
+    }
+    m_start.notify_all();
+    const int end = (int)((long long)count / m_numThreads);
+    if (end > 0) func(context, 0, end);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_running == 0; });
+}
@@ -0,0 +1,155 @@
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 识别模型的编译缓存和执行器
+// cv::dnn::readNet 每次启动都要解析 ONNX 图并做层融合，在 Cortex-A7 上要好几秒。第一次启动时把导入后的网络
+// 展平成按执行顺序排列的算子表：BatchNorm 折进前面卷积/全连接的权重，ReLU/PReLU 并进产生其输入的算子，
+// 权重连续存放、64 字节对齐，写到模型旁边的缓存文件 <模型>.<哈希>.frm。之后启动只需 mmap 这个文件，
+// 由 ModelExecutor 用自己的内核（model_kernels）执行，不再经过 cv::dnn。
+// 文件名中的哈希来自模型文件的内容，文件头还记录格式版本和 OpenCV 版本，任何一项不符都重新编译；
+// 编译结果先与 net.forward() 的输出比对，不一致就不用它，调用者退回 cv::dnn。
+
+enum ModelOpType {
+    MODEL_OP_CONV = 1,    // 卷积（含分组和逐通道），可带偏置和 PReLU
+    MODEL_OP_FC = 2,      // 全连接，输入按 CHW 顺序展平
+    MODEL_OP_ADD = 3,     // 两个同形状的输入逐元素相加（残差）
+    MODEL_OP_SCALE = 4    // 逐通道 y = x * weight + bias：无法折叠的 BatchNorm，或单独的激活
+};
+
+enum ModelWeightLayout {
+    MODEL_WEIGHTS_OIHW = 0,       // [out_c][in_c/groups][kernel_h][kernel_w]，全连接为 [out][in]
+    MODEL_WEIGHTS_PACKED4 = 1     // 1x1 卷积按4个输出通道交错：[out_c/4][in_c][4]，见 model_kernels.h
+};
+
+// 缓存文件中的一个算子。值的编号：0 是网络输入，k 是第 k-1 个算子的输出
+struct ModelOp {
+    uint32_t type;
+    int32_t input;
+    int32_t input2;          // MODEL_OP_ADD 的第二个输入，其余为 -1
+    uint32_t in_c, in_h, in_w;
+    uint32_t out_c, out_h, out_w;
+    uint32_t kernel_h, kernel_w;
+    uint32_t stride_h, stride_w;
+    uint32_t pad_top, pad_left;
+    uint32_t groups;
+    uint32_t has_prelu;      // 输出经过 PReLU（ReLU 是斜率为0的 PReLU）
+    uint32_t weight_layout;  // ModelWeightLayout
+    uint64_t weight_offset;  // 以下是相对文件开头的字节偏移，0 表示没有
+    uint64_t bias_offset;
+    uint64_t slope_offset;   // PReLU 的每通道斜率
+};
+
+// 编译好的模型：算子表和权重，只读，多个推理线程共享一份
+class CompiledModel
+{
+public:
+    ~CompiledModel();
+
+    /**
+     * @brief 打开模型的编译缓存；没有或已失效时从 ONNX 模型编译，与 cv::dnn 的输出比对通过后写入缓存。
+     * 缓存写不进模型所在的目录时，本次直接使用内存中的编译结果。
+     * @param inputC/inputH/inputW 网络输入的形状（批大小为1）。
+     * @return 编译好的模型；模型中有不支持的层、比对不通过或出错时返回空指针，调用者继续使用 cv::dnn。
+     */
+    static std::shared_ptr<CompiledModel> open(const std::string &modelPath, int inputC, int inputH, int inputW);
+
+    int numOps() const { return (int)m_numOps; }
+    const ModelOp &op(int i) const { return m_ops[i]; }
+    const float *floats(uint64_t offset) const { return offset ? (const float *)(m_base + offset) : nullptr; }
+    int inputSize() const { return m_inputSize; }
+    int outputSize() const { return m_outputSize; }
+    // 权重占用的字节数（映射的文件或内存中的编译结果）
+    size_t sizeBytes() const { return m_size; }
+
+private:
+    CompiledModel() = default;
+    // 映射并检查缓存文件，不存在或与模型不符时返回空指针
+    static std::shared_ptr<CompiledModel> map(const std::string &cachePath, uint64_t modelHash,
+                                              int inputC, int inputH, int inputW);
+    bool attach(const char *base, size_t size, uint64_t modelHash, int inputC, int inputH, int inputW);
+
+    const char *m_base = nullptr;
+    size_t m_size = 0;
+    bool m_mapped = false;           // m_base 由 mmap 得到，否则指向 m_memory
+    std::vector<char> m_memory;
+    const ModelOp *m_ops = nullptr;
+    uint32_t m_numOps = 0;
+    int m_inputSize = 0;
+    int m_outputSize = 0;
+};
+
+// 一次推理内部的并行：执行器把每个较大的算子按输出通道切成几段，调用 parallelFor 的线程自己算第一段，
+// 辅助线程各算一段，全部算完才返回。每个推理线程一个，不在多个执行器之间共享
+class ModelThreadPool
+{
+public:
+    typedef void (*RangeFunc)(void *context, int begin, int end);
+
+    // helpers 个辅助线程，每个线程开始时先调用一次 threadInit（设置 CPU 亲和性和优先级），可以为空
+    ModelThreadPool(int helpers, std::function<void()> threadInit);
+    ~ModelThreadPool();
+
+    // 参与计算的线程数，包括调用者
+    int threads() const { return m_numThreads; }
+
+    // 把 [0, count) 均分给各线程调用 func，返回时全部完成
+    void parallelFor(int count, RangeFunc func, void *context);
+
+private:
+    void helperLoop(int index, std::function<void()> threadInit);
+
+    const int m_numThreads;
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    RangeFunc m_func = nullptr;       // 以下受 m_mutex 保护
+    void *m_context = nullptr;
+    int m_count = 0;
+    unsigned int m_generation = 0;    // 每次 parallelFor 加一，辅助线程据此知道有新任务
+    int m_running = 0;                // 还没算完本次任务的辅助线程数
+    bool m_exiting = false;
+};
+
+// 一个推理线程的执行状态。激活缓冲区在构造时按值的生存期分配好并复用，
+// 推理时不再分配内存；每个推理线程一个，共享同一个 CompiledModel
+class ModelExecutor
+{
+public:
+    explicit ModelExecutor(std::shared_ptr<const CompiledModel> model);
+
+    // 之后的 run 把大的算子分给线程池中的线程；pool 为空时只在调用线程中执行。pool 由调用者持有
+    void setThreadPool(ModelThreadPool *pool) { m_pool = pool; }
+
+    /**
+     * @brief 执行一次前向推理。
+     * @param input NCHW 排列的输入，inputSize() 个 float。
+     * @return 输出，outputSize() 个 float，在下一次 run 之前有效。
+     */
+    const float *run(const float *input);
+
+    // 激活缓冲区占用的字节数
+    size_t bufferBytes() const;
+
+private:
+    struct OpTask;
+    static void runRange(void *context, int begin, int end);
+    const float *value(int index, const float *input) const;
+
+    std::shared_ptr<const CompiledModel> m_model;
+    ModelThreadPool *m_pool = nullptr;
+    std::vector<std::vector<float>> m_buffers;
+    std::vector<int> m_valueBuffer;  // 值编号 -> 缓冲区下标，值0（网络输入）不占缓冲区
+};
+
+#endif // MODEL_CACHE_H
@@ -0,0 +1,307 @@
+#include "model_kernels.h"
+
+#include <algorithm>
+
+#if !defined(FR_MODEL_SCALAR) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+
+typedef float32x4_t Vec4;
+static inline Vec4 vecLoad(const float *p) { return vld1q_f32(p); }
+// p[0], p[2], p[4], p[6]，会读到 p[7]
+static inline Vec4 vecLoadEven(const float *p) { return vld2q_f32(p).val[0]; }
+static inline void vecStore(float *p, Vec4 v) { vst1q_f32(p, v); }
+static inline Vec4 vecSet(float x) { return vdupq_n_f32(x); }
+static inline Vec4 vecAdd(Vec4 a, Vec4 b) { return vaddq_f32(a, b); }
+static inline Vec4 vecMulAdd(Vec4 acc, Vec4 a, Vec4 b) { return vmlaq_f32(acc, a, b); }
+static inline Vec4 vecPrelu(Vec4 x, Vec4 slope)
+{
+    const Vec4 zero = vdupq_n_f32(0.0f);
+    return vmlaq_f32(vmaxq_f32(x, zero), vminq_f32(x, zero), slope);
+}
+static inline float vecSum(Vec4 v)
+{
+    const float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(s, s), 0);
+}
+
+#elif !defined(FR_MODEL_SCALAR) && defined(__SSE2__)
+#include <emmintrin.h>
+
+typedef __m128 Vec4;
+static inline Vec4 vecLoad(const float *p) { return _mm_loadu_ps(p); }
+static inline Vec4 vecLoadEven(const float *p)
+{
+    return _mm_shuffle_ps(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _MM_SHUFFLE(2, 0, 2, 0));
+}
+static inline void vecStore(float *p, Vec4 v) { _mm_storeu_ps(p, v); }
+static inline Vec4 vecSet(float x) { return _mm_set1_ps(x); }
+static inline Vec4 vecAdd(Vec4 a, Vec4 b) { return _mm_add_ps(a, b); }
+static inline Vec4 vecMulAdd(Vec4 acc, Vec4 a, Vec4 b) { return _mm_add_ps(acc, _mm_mul_ps(a, b)); }
+static inline Vec4 vecPrelu(Vec4 x, Vec4 slope)
+{
+    const Vec4 zero = _mm_setzero_ps();
+    return _mm_add_ps(_mm_max_ps(x, zero), _mm_mul_ps(_mm_min_ps(x, zero), slope));
+}
+static inline float vecSum(Vec4 v)
+{
+    float lanes[4];
+    _mm_storeu_ps(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+#else
+// 标量实现，与向量版本逐元素的运算顺序相同
+struct Vec4 { float v[4]; };
+static inline Vec4 vecLoad(const float *p) { Vec4 r = {{p[0], p[1], p[2], p[3]}}; return r; }
+static inline Vec4 vecLoadEven(const float *p) { Vec4 r = {{p[0], p[2], p[4], p[6]}}; return r; }
+static inline void vecStore(float *p, Vec4 v) { for (int i = 0; i < 4; ++i) p[i] = v.v[i]; }
+static inline Vec4 vecSet(float x) { Vec4 r = {{x, x, x, x}}; return r; }
+static inline Vec4 vecAdd(Vec4 a, Vec4 b) { for (int i = 0; i < 4; ++i) a.v[i] += b.v[i]; return a; }
+static inline Vec4 vecMulAdd(Vec4 acc, Vec4 a, Vec4 b) { for (int i = 0; i < 4; ++i) acc.v[i] += a.v[i] * b.v[i]; return acc; }
+static inline Vec4 vecPrelu(Vec4 x, Vec4 slope)
+{
+    for (int i = 0; i < 4; ++i) {
+        if (x.v[i] < 0.0f) x.v[i] *= slope.v[i];
+    }
+    return x;
+}
+static inline float vecSum(Vec4 v) { return (v.v[0] + v.v[1]) + (v.v[2] + v.v[3]); }
+#endif
+
+size_t modelPackedPointwiseSize(int outC, int inC)
+{
+    return (size_t)((outC + 3) / 4) * 4 * inC;
+}
+
+void modelPackPointwise(const float *weight, int outC, int inC, float *packed)
+{
+    for (int ob = 0; ob < outC; ob += 4) {
+        float *block = packed + (size_t)ob * inC;
+        for (int ic = 0; ic < inC; ++ic) {
+            for (int j = 0; j < 4; ++j) {
+                block[ic * 4 + j] = ob + j < outC ? weight[(size_t)(ob + j) * inC + ic] : 0.0f;
+            }
+        }
+    }
+}
+
+// 每次算4个输出通道 x 8个像素，8个累加器；输入的每个元素读一次供4个通道使用
+void modelConvPointwise(const ModelOp &op, const float *in, const float *packed, const float *bias,
+                        const float *slope, float *out, int begin, int end)
+{
+    const int inC = op.in_c, plane = op.in_h * op.in_w;
+    for (int ob = begin; ob < end; ob += 4) {
+        const int lanes = std::min(4, end - ob);
+        const float *w = packed + (size_t)ob * inC;
+        float b[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        float s[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+        for (int j = 0; j < lanes; ++j) {
+            b[j] = bias[ob + j];
+            if (slope) s[j] = slope[ob + j];
+        }
+
+        int p = 0;
+        for (; p + 8 <= plane; p += 8) {
+            Vec4 lo[4], hi[4];
+            for (int j = 0; j < 4; ++j) lo[j] = hi[j] = vecSet(b[j]);
+            const float *x = in + p;
+            const float *wk = w;
+            for (int ic = 0; ic < inC; ++ic, x += plane, wk += 4) {
+                const Vec4 x0 = vecLoad(x), x1 = vecLoad(x + 4);
+                for (int j = 0; j < 4; ++j) {
+                    const Vec4 wj = vecSet(wk[j]);
+                    lo[j] = vecMulAdd(lo[j], x0, wj);
+                    hi[j] = vecMulAdd(hi[j], x1, wj);
+                }
+            }
+            for (int j = 0; j < lanes; ++j) {
+                if (slope) {
+                    const Vec4 sj = vecSet(s[j]);
+                    lo[j] = vecPrelu(lo[j], sj);
+                    hi[j] = vecPrelu(hi[j], sj);
+                }
+                float *o = out + (size_t)(ob + j) * plane + p;
+                vecStore(o, lo[j]);
+                vecStore(o + 4, hi[j]);
+            }
+        }
+        for (; p < plane; ++p) {
+            float acc[4] = {b[0], b[1], b[2], b[3]};
+            for (int ic = 0; ic < inC; ++ic) {
+                const float xv = in[(size_t)ic * plane + p];
+                for (int j = 0; j < 4; ++j) acc[j] += xv * w[ic * 4 + j];
+            }
+            for (int j = 0; j < lanes; ++j) {
+                if (slope && acc[j] < 0.0f) acc[j] *= s[j];
+                out[(size_t)(ob + j) * plane + p] = acc[j];
+            }
+        }
+    }
+}
+
+// 逐通道卷积的一个输出像素，带边界判断（边缘和向量化区域之外的像素）
+template <int K>
+static inline float depthwisePixel(const float *x, const float *w, float bias, const float *slope, float s,
+                                   int inH, int inW, int iy0, int ix0)
+{
+    float acc = bias;
+    for (int ky = 0; ky < K; ++ky) {
+        const int iy = iy0 + ky;
+        if (iy < 0 || iy >= inH) continue;
+        for (int kx = 0; kx < K; ++kx) {
+            const int ix = ix0 + kx;
+            if (ix < 0 || ix >= inW) continue;
+            acc += x[iy * inW + ix] * w[ky * K + kx];
+        }
+    }
+    if (slope && acc < 0.0f) acc *= s;
+    return acc;
+}
+
+template <int K, int S>
+static void depthwise(const ModelOp &op, const float *in, const float *weight, const float *bias,
+                      const float *slope, float *out, int begin, int end)
+{
+    static_assert(S == 1 || S == 2, "depthwise kernels are specialized for stride 1 and 2");
+    const int inH = op.in_h, inW = op.in_w, outH = op.out_h, outW = op.out_w;
+    const int padT = op.pad_top, padL = op.pad_left;
+    // 向量化的列范围 [oxBegin, oxEnd)：其中每个输出像素读取的列（步长2时 vecLoadEven 多读一列）都在行内
+    const int oxBegin = std::min(outW, (padL + S - 1) / S);
+    const int lastStart = inW - K - (S - 1) + padL;
+    const int oxEnd = lastStart < 0 ? oxBegin : std::max(oxBegin, std::min(outW, lastStart / S + 1));
+
+    for (int c = begin; c < end; ++c) {
+        const float *x = in + (size_t)c * inH * inW;
+        const float *w = weight + c * K * K;
+        float *o = out + (size_t)c * outH * outW;
+        const float b = bias[c];
+        const float s = slope ? slope[c] : 1.0f;
+        Vec4 wv[K * K];
+        for (int k = 0; k < K * K; ++k) wv[k] = vecSet(w[k]);
+        const Vec4 bv = vecSet(b), sv = vecSet(s);
+
+        for (int oy = 0; oy < outH; ++oy) {
+            const int iy0 = oy * S - padT;
+            float *orow = o + (size_t)oy * outW;
+            int ox = 0;
+            if (iy0 >= 0 && iy0 + K <= inH) {
+                for (; ox < oxBegin; ++ox) orow[ox] = depthwisePixel<K>(x, w, b, slope, s, inH, inW, iy0, ox * S - padL);
+                for (; ox + 4 <= oxEnd; ox += 4) {
+                    Vec4 acc = bv;
+                    for (int ky = 0; ky < K; ++ky) {
+                        const float *row = x + (size_t)(iy0 + ky) * inW + ox * S - padL;
+                        for (int kx = 0; kx < K; ++kx) {
+                            const Vec4 xv = S == 1 ? vecLoad(row + kx) : vecLoadEven(row + kx);
+                            acc = vecMulAdd(acc, xv, wv[ky * K + kx]);
+                        }
+                    }
+                    if (slope) acc = vecPrelu(acc, sv);
+                    vecStore(orow + ox, acc);
+                }
+            }
+            for (; ox < outW; ++ox) orow[ox] = depthwisePixel<K>(x, w, b, slope, s, inH, inW, iy0, ox * S - padL);
+        }
+    }
+}
+
+bool modelConvDepthwise(const ModelOp &op, const float *in, const float *weight, const float *bias,
+                        const float *slope, float *out, int begin, int end)
+{
+    if (op.groups != op.in_c || op.in_c != op.out_c || op.kernel_h != op.kernel_w || op.stride_h != op.stride_w) {
+        return false;
+    }
+    if (op.kernel_h == 3 && op.stride_h == 1) {
+        depthwise<3, 1>(op, in, weight, bias, slope, out, begin, end);
+    } else if (op.kernel_h == 3 && op.stride_h == 2) {
+        depthwise<3, 2>(op, in, weight, bias, slope, out, begin, end);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// 通用的分组卷积。对每个卷积核位置预先算出不越界的输出列范围，内层循环不做边界判断
+void modelConvGeneric(const ModelOp &op, const float *in, const float *weight, const float *bias, float *out,
+                      int begin, int end)
+{
+    const int inC = op.in_c, inH = op.in_h, inW = op.in_w;
+    const int outH = op.out_h, outW = op.out_w;
+    const int kh = op.kernel_h, kw = op.kernel_w, sh = op.stride_h, sw = op.stride_w;
+    const int padT = op.pad_top, padL = op.pad_left;
+    const int groupIn = inC / op.groups, groupOut = op.out_c / op.groups;
+    for (int oc = begin; oc < end; ++oc) {
+        float *o = out + (size_t)oc * outH * outW;
+        std::fill(o, o + outH * outW, bias[oc]);
+        const int firstIn = (oc / groupOut) * groupIn;
+        for (int ic = 0; ic < groupIn; ++ic) {
+            const float *x = in + (size_t)(firstIn + ic) * inH * inW;
+            const float *w = weight + ((size_t)oc * groupIn + ic) * kh * kw;
+            for (int ky = 0; ky < kh; ++ky) {
+                for (int kx = 0; kx < kw; ++kx) {
+                    const float k = w[ky * kw + kx];
+                    // ix = ox * sw - padL + kx 落在 [0, inW) 内的 ox 范围
+                    int oxBegin = padL > kx ? (padL - kx + sw - 1) / sw : 0;
+                    int oxEnd = std::min(outW, (inW - 1 + padL - kx) / sw + 1);
+                    if (oxBegin >= oxEnd) continue;
+                    for (int oy = 0; oy < outH; ++oy) {
+                        const int iy = oy * sh - padT + ky;
+                        if (iy < 0 || iy >= inH) continue;
+                        const float *row = x + (size_t)iy * inW - padL + kx;
+                        float *orow = o + (size_t)oy * outW;
+                        for (int ox = oxBegin; ox < oxEnd; ++ox) orow[ox] += k * row[ox * sw];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void modelFullyConnected(const ModelOp &op, const float *in, const float *weight, const float *bias, float *out,
+                         int begin, int end)
+{
+    const int inSize = op.in_c * op.in_h * op.in_w;
+    for (int o = begin; o < end; ++o) {
+        const float *w = weight + (size_t)o * inSize;
+        Vec4 acc0 = vecSet(0.0f), acc1 = vecSet(0.0f);
+        int i = 0;
+        for (; i + 8 <= inSize; i += 8) {
+            acc0 = vecMulAdd(acc0, vecLoad(in + i), vecLoad(w + i));
+            acc1 = vecMulAdd(acc1, vecLoad(in + i + 4), vecLoad(w + i + 4));
+        }
+        float sum = bias[o] + vecSum(vecAdd(acc0, acc1));
+        for (; i < inSize; ++i) sum += w[i] * in[i];
+        out[o] = sum;
+    }
+}
+
+void modelAdd(const float *a, const float *b, size_t count, float *out)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) vecStore(out + i, vecAdd(vecLoad(a + i), vecLoad(b + i)));
+    for (; i < count; ++i) out[i] = a[i] + b[i];
+}
+
+void modelScale(const ModelOp &op, const float *in, const float *weight, const float *bias, float *out,
+                int begin, int end)
+{
+    const int plane = op.out_h * op.out_w;
+    for (int c = begin; c < end; ++c) {
+        const float *x = in + (size_t)c * plane;
+        float *o = out + (size_t)c * plane;
+        const Vec4 sv = vecSet(weight[c]), bv = vecSet(bias[c]);
+        int k = 0;
+        for (; k + 4 <= plane; k += 4) vecStore(o + k, vecMulAdd(bv, vecLoad(x + k), sv));
+        for (; k < plane; ++k) o[k] = bias[c] + x[k] * weight[c];
+    }
+}
+
+void modelPrelu(float *data, int channels, int plane, const float *slope)
+{
+    for (int c = 0; c < channels; ++c) {
+        float *p = data + (size_t)c * plane;
+        const float s = slope[c];
+        for (int i = 0; i < plane; ++i) {
+            if (p[i] < 0.0f) p[i] *= s;
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef MODEL_KERNELS_H
+#define MODEL_KERNELS_H
+
+#include "model_cache.h"
+
+// 编译模型（model_cache）各算子的计算内核。
+// 人脸识别模型的绝大部分计算在 1x1 卷积和 3x3 逐通道卷积上，这两类有专门的内核：
+// 1x1 卷积的权重在编译时按每4个输出通道一组交错重排（见 modelPackPointwise），一次算4个通道x8个像素；
+// 逐通道卷积按卷积核大小和步长用模板展开（3x3 步长1/2），内部区域按4个输出像素向量化，边缘逐像素处理。
+// 向量部分在 ARM 上用 NEON，在 x86 上用 SSE，其他平台（或定义 FR_MODEL_SCALAR）退回标量实现，结果相同。
+// 带 slope 参数的内核在写出结果时直接做 PReLU，slope 为空时不做；其余内核由调用者另外调用 modelPrelu。
+// 卷积、全连接和缩放只计算输出通道 [begin, end)，一次推理内的多个线程各算一段（见 ModelThreadPool）。
+
+// 打包后 1x1 卷积权重的元素个数：输出通道向上取整到4的倍数，补的通道权重为0
+size_t modelPackedPointwiseSize(int outC, int inC);
+
+// OIHW 排列的 1x1 卷积权重重排为 [outC/4][inC][4]
+void modelPackPointwise(const float *weight, int outC, int inC, float *packed);
+
+// 1x1、步长1、不分组、不填充的卷积，权重为打包后的排列；begin 必须是4的倍数
+void modelConvPointwise(const ModelOp &op, const float *in, const float *packed, const float *bias,
+                        const float *slope, float *out, int begin, int end);
+
+// 逐通道卷积（groups == in_c == out_c），有专门实现的卷积核返回 true，否则不做任何事返回 false
+bool modelConvDepthwise(const ModelOp &op, const float *in, const float *weight, const float *bias,
+                        const float *slope, float *out, int begin, int end);
+
+// 任意分组卷积，OIHW 权重
+void modelConvGeneric(const ModelOp &op, const float *in, const float *weight, const float *bias, float *out,
+                      int begin, int end);
+
+void modelFullyConnected(const ModelOp &op, const float *in, const float *weight, const float *bias, float *out,
+                         int begin, int end);
+
+void modelAdd(const float *a, const float *b, size_t count, float *out);
+
+void modelScale(const ModelOp &op, const float *in, const float *weight, const float *bias, float *out,
+                int begin, int end);
+
+void modelPrelu(float *data, int channels, int plane, const float *slope);
+
+#endif // MODEL_KERNELS_H
@@ -0,0 +1,274 @@
+#include "photo_writer.h"
+
+#include <opencv2/imgcodecs.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t DIRECT_ALIGNMENT = 4096;   // O_DIRECT 要求缓冲区、偏移和长度按逻辑块对齐，4K 覆盖常见的块设备
+const size_t FAILED_HISTORY = 256;      // 记住的失败票号数；调用者每帧轮询，不会落后这么多
+
+bool writeFully(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+std::string parentDirectory(const std::string &path)
+{
+    const size_t slash = path.rfind('/');
+    if (slash == std::string::npos) return ".";
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+} // namespace
+
+PhotoWriter::PhotoWriter(const Options &options)
+    : m_options(options)
+{
+    m_writer = std::thread(&PhotoWriter::writerLoop, this);
+}
+
+PhotoWriter::~PhotoWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exiting = true;
+    }
+    m_wake.notify_one();
+    m_writer.join();
+    free(m_directBuffer);
+}
+
+uint64_t PhotoWriter::submit(const std::string &path, const QByteArray &jpeg)
+{
+    Job job;
+    job.path = path;
+    job.jpeg = jpeg;
+    job.bytes = jpeg.size();
+    return enqueue(job);
+}
+
+uint64_t PhotoWriter::submit(const std::string &path, const cv::Mat &bgr)
+{
+    if (bgr.empty()) return 0;
+    Job job;
+    job.path = path;
+    job.bytes = bgr.total() * bgr.elemSize();
+    {
+        // 先按大小检查一次，队列满时省掉这次复制
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queuedJobs >= m_options.maxQueued || m_queuedBytes + job.bytes > m_options.maxQueuedBytes) {
+            m_stats.rejected++;
+            return 0;
+        }
+    }
+    bgr.copyTo(job.bgr);
+    return enqueue(job);
+}
+
+uint64_t PhotoWriter::enqueue(Job &job)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // 队列空时总接受一张，单张照片超过字节上限也能写
+    if (m_queuedJobs > 0 && (m_queuedJobs >= m_options.maxQueued ||
+                             m_queuedBytes + job.bytes > m_options.maxQueuedBytes)) {
+        m_stats.rejected++;
+        return 0;
+    }
+    job.ticket = m_nextTicket++;
+    m_queuedJobs++;
+    m_queuedBytes += job.bytes;
+    m_stats.submitted++;
+    m_queue.push_back(std::move(job));
+    m_wake.notify_one();
+    return m_queue.back().ticket;
+}
+
+PhotoWriter::Result PhotoWriter::result(uint64_t ticket) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (ticket == 0 || ticket >= m_nextTicket) return FAILED;
+    if (ticket > m_completed) return PENDING;
+    return std::find(m_failed.begin(), m_failed.end(), ticket) != m_failed.end() ? FAILED : WRITTEN;
+}
+
+void PhotoWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const uint64_t last = m_nextTicket - 1;
+    m_doneCv.wait(lock, [&] { return m_completed >= last; });
+}
+
+PhotoWriter::Stats PhotoWriter::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+const char *PhotoWriter::syncPolicyName(SyncPolicy policy)
+{
+    switch (policy) {
+    case SYNC_NONE: return "none";
+    case SYNC_DIRECT: return "direct";
+    default: return "batch";
+    }
+}
+
+bool PhotoWriter::parseSyncPolicy(const std::string &name, SyncPolicy *policy)
+{
+    if (name == "none") *policy = SYNC_NONE;
+    else if (name == "batch") *policy = SYNC_BATCH;
+    else if (name == "direct") *policy = SYNC_DIRECT;
+    else return false;
+    return true;
+}
+
+// 通过对齐的缓冲区写入，长度补齐到整块，再截断到实际大小。
+// 文件系统不支持 O_DIRECT（例如 tmpfs 在 open 时就报 EINVAL，有的文件系统在写时才报）时去掉标志按普通方式写
+bool PhotoWriter::writeDirect(int fd, const char *data, size_t size)
+{
+    const size_t padded = (size + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+    if (padded > m_directCapacity) {
+        free(m_directBuffer);
+        m_directBuffer = nullptr;
+        m_directCapacity = 0;
+        if (posix_memalign(&m_directBuffer, DIRECT_ALIGNMENT, padded) != 0) {
+            m_directBuffer = nullptr;
+            return false;
+        }
+        m_directCapacity = padded;
+    }
+    memcpy(m_directBuffer, data, size);
+    memset((char *)m_directBuffer + size, 0, padded - size);
+    if (writeFully(fd, (const char *)m_directBuffer, padded)) return ftruncate(fd, size) == 0;
+    if (errno != EINVAL) return false;
+    if (lseek(fd, 0, SEEK_SET) != 0 || ftruncate(fd, 0) != 0) return false;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+    return writeFully(fd, data, size);
+}
+
+// 编码（需要时）并写进临时文件；写好的文件留在 written 中等组末统一落盘
+bool PhotoWriter::writeJob(const Job &job, std::vector<Written> &written)
+{
+    const char *data;
+    size_t size;
+    if (!job.bgr.empty()) {
+        const std::vector<int> params = { cv::IMWRITE_JPEG_QUALITY, m_options.jpegQuality };
+        if (!cv::imencode(".jpg", job.bgr, m_encoded, params)) {
+            fprintf(stderr, "Photo writer: cannot encode %s\n", job.path.c_str());
+            return false;
+        }
+        data = (const char *)m_encoded.data();
+        size = m_encoded.size();
+    } else {
+        data = job.jpeg.constData();
+        size = job.jpeg.size();
+    }
+
+    const std::string tmpPath = job.path + ".tmp";
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int fd = -1;
+    bool direct = false;
+    if (m_options.sync == SYNC_DIRECT) {
+        fd = open(tmpPath.c_str(), flags | O_DIRECT, 0644);
+        direct = fd >= 0;
+    }
+    if (fd < 0) fd = open(tmpPath.c_str(), flags, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Photo writer: cannot create %s: %s\n", tmpPath.c_str(), strerror(errno));
+        return false;
+    }
+    const bool ok = direct ? writeDirect(fd, data, size) : writeFully(fd, data, size);
+    if (!ok) {
+        fprintf(stderr, "Photo writer: cannot write %s: %s\n", tmpPath.c_str(), strerror(errno));
+        close(fd);
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.bytes += size;
+    }
+    written.push_back(Written{ fd, tmpPath, &job });
+    return true;
+}
+
+// 写一组照片：全部写完之后才逐个落盘，内核可以把这些写请求合并下发；
+// 改名之后目录也要落盘，新文件名才不会在掉电后丢失，一组内同一目录只同步一次
+void PhotoWriter::writeBatch()
+{
+    std::vector<Written> written;
+    std::vector<uint64_t> failed;
+    for (const Job &job : m_batch) {
+        if (!writeJob(job, written)) failed.push_back(job.ticket);
+    }
+
+    std::vector<std::string> dirs;
+    for (const Written &w : written) {
+        bool ok = m_options.sync == SYNC_NONE || fdatasync(w.fd) == 0;
+        ok = close(w.fd) == 0 && ok;
+        if (ok && rename(w.tmpPath.c_str(), w.job->path.c_str()) != 0) ok = false;
+        if (!ok) {
+            fprintf(stderr, "Photo writer: cannot save %s: %s\n", w.job->path.c_str(), strerror(errno));
+            unlink(w.tmpPath.c_str());
+            failed.push_back(w.job->ticket);
+            continue;
+        }
+        const std::string dir = parentDirectory(w.job->path);
+        if (std::find(dirs.begin(), dirs.end(), dir) == dirs.end()) dirs.push_back(dir);
+    }
+    if (m_options.sync != SYNC_NONE) {
+        for (const std::string &dir : dirs) {
+            const int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd >= 0) {
+                fsync(fd);
+                close(fd);
+            }
+        }
+    }
+
+    size_t bytes = 0;
+    for (const Job &job : m_batch) bytes += job.bytes;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (uint64_t ticket : failed) {
+        m_failed.push_back(ticket);
+        if (m_failed.size() > FAILED_HISTORY) m_failed.pop_front();
+    }
+    m_completed = m_batch.back().ticket;
+    m_queuedJobs -= m_batch.size();
+    m_queuedBytes -= bytes;
+    m_stats.written += m_batch.size() - failed.size();
+    m_stats.failed += failed.size();
+    m_stats.batches++;
+}
+
+void PhotoWriter::writerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_wake.wait(lock, [this] { return m_exiting || !m_queue.empty(); });
+        if (m_queue.empty()) break;   // 退出前写完剩余的照片
+        m_batch.swap(m_queue);
+        lock.unlock();
+        writeBatch();
+        m_batch.clear();
+        lock.lock();
+        m_doneCv.notify_all();
+    }
+}
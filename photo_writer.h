@@ -0,0 +1,118 @@
+#ifndef PHOTO_WRITER_H
+#define PHOTO_WRITER_H
+
+#include <QByteArray>
+#include <opencv2/core.hpp>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 照片的异步写入：拍照和注册采集把照片交给后台写线程，处理线程上不做文件 I/O。
+// 队列按张数和字节数限长，满了 submit 立即返回 0（背压），由调用者决定放弃还是下一帧再试。
+// 写线程一次取出队列中的全部照片成组写入：先写到 <路径>.tmp，按同步策略在组末统一落盘，再改名为正式的文件名，
+// 相册等读者不会看到写了一半的照片。非 MJPEG 采集时交进来的是彩色图，JPEG 编码也在写线程上做。
+// 每张照片有一个递增的票号，调用者用 result() 轮询写入结果。
+class PhotoWriter
+{
+public:
+    enum SyncPolicy {
+        SYNC_NONE,     // 只写进页缓存，由内核择时落盘
+        SYNC_BATCH,    // 每组写完后逐个 fdatasync，涉及的目录各 fsync 一次
+        SYNC_DIRECT,   // 用 O_DIRECT 绕过页缓存写入（不挤掉检测和识别要用的缓存），再 fdatasync；文件系统不支持时按 SYNC_BATCH 写
+    };
+
+    enum Result {
+        PENDING,       // 还在队列中或正在写
+        WRITTEN,       // 已经按同步策略写完并改名
+        FAILED,        // 编码或写入失败，也包括无效的票号
+    };
+
+    struct Options {
+        int maxQueued = 16;                   // 最多排队的照片数（含正在写的一组）
+        size_t maxQueuedBytes = 16 << 20;     // 排队照片最多占用的内存
+        SyncPolicy sync = SYNC_BATCH;
+        int jpegQuality = 95;                 // 彩色图编码为 JPEG 的质量
+    };
+
+    struct Stats {
+        uint64_t submitted = 0;
+        uint64_t written = 0;
+        uint64_t failed = 0;
+        uint64_t rejected = 0;    // 队列满而被拒绝的照片数
+        uint64_t batches = 0;     // 写入的组数
+        uint64_t bytes = 0;       // 写入的 JPEG 字节数
+    };
+
+    explicit PhotoWriter(const Options &options);
+    // 写完队列中剩余的照片，停止写线程
+    ~PhotoWriter();
+
+    /**
+     * @brief 把一张 JPEG 写到 path，不等待写入。数据是隐式共享的，不复制。可以从多个线程调用。
+     * @return 票号；队列已满时返回 0，照片没有被接受。
+     */
+    uint64_t submit(const std::string &path, const QByteArray &jpeg);
+    // 同上，bgr 在这里复制一份，由写线程编码为 JPEG
+    uint64_t submit(const std::string &path, const cv::Mat &bgr);
+
+    // 查询一张照片的写入结果，不阻塞
+    Result result(uint64_t ticket) const;
+    // 等待此前提交的照片全部写完
+    void flush();
+
+    Stats stats() const;
+    static const char *syncPolicyName(SyncPolicy policy);
+    // 解析 "none" / "batch" / "direct"，无法识别时返回 false
+    static bool parseSyncPolicy(const std::string &name, SyncPolicy *policy);
+
+private:
+    struct Job {
+        uint64_t ticket = 0;
+        std::string path;
+        QByteArray jpeg;
+        cv::Mat bgr;          // 非空时先编码
+        size_t bytes = 0;     // 计入队列内存的字节数
+    };
+
+    // 一组中一个已经写完、等待落盘和改名的文件
+    struct Written {
+        int fd;
+        std::string tmpPath;
+        const Job *job;
+    };
+
+    uint64_t enqueue(Job &job);
+    bool writeJob(const Job &job, std::vector<Written> &written);
+    bool writeDirect(int fd, const char *data, size_t size);
+    void writeBatch();
+    void writerLoop();
+
+    const Options m_options;
+
+    mutable std::mutex m_mutex;             // 保护队列、结果和统计
+    std::condition_variable m_wake;         // 通知写线程：有新照片或退出
+    std::condition_variable m_doneCv;       // 通知 flush：一组照片已写完
+    std::deque<Job> m_queue;
+    int m_queuedJobs = 0;                   // 排队和正在写的照片数
+    size_t m_queuedBytes = 0;
+    uint64_t m_nextTicket = 1;
+    uint64_t m_completed = 0;               // 写线程按顺序处理，票号不大于它的照片都已有结果
+    std::deque<uint64_t> m_failed;          // 最近失败的票号，只保留有限个
+    bool m_exiting = false;
+    Stats m_stats;
+
+    // 以下只由写线程访问
+    std::deque<Job> m_batch;
+    std::vector<uchar> m_encoded;
+    void *m_directBuffer = nullptr;         // O_DIRECT 要求对齐的缓冲区，按需增长
+    size_t m_directCapacity = 0;
+    std::thread m_writer;
+};
+
+#endif // PHOTO_WRITER_H
@@ -0,0 +1,78 @@
+#include "photoalbummodel.h"
+#include "thumbnailcache.h"
+
+#include <QDir>
+#include <QFileInfo>
+
+PhotoAlbumModel::PhotoAlbumModel(const QString &photoDir, ThumbnailCache *cache, QObject *parent)
+    : QAbstractListModel(parent)
+    , m_photoDir(photoDir)
+    , m_cache(cache)
+    , m_placeholder(cache->thumbnailSize())
+{
+    m_placeholder.fill(QColor("#444444"));
+    connect(m_cache, &ThumbnailCache::thumbnailReady, this, &PhotoAlbumModel::onThumbnailReady);
+}
+
+void PhotoAlbumModel::reload()
+{
+    beginResetModel();
+    // 只取文件名，不读图片；排序要 stat 每个文件，几千张也只要几毫秒
+    QDir dir(m_photoDir);
+    m_names = dir.entryList(QStringList() << "*.jpg" << "*.jpeg" << "*.png", QDir::Files, QDir::Time);
+    rebuildRows();
+    endResetModel();
+}
+
+QString PhotoAlbumModel::path(int row) const
+{
+    if (row < 0 || row >= m_names.size()) return QString();
+    return QDir(m_photoDir).filePath(m_names[row]);
+}
+
+void PhotoAlbumModel::removePhoto(int row)
+{
+    if (row < 0 || row >= m_names.size()) return;
+    beginRemoveRows(QModelIndex(), row, row);
+    m_names.removeAt(row);
+    rebuildRows();
+    endRemoveRows();
+}
+
+int PhotoAlbumModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_names.size();
+}
+
+QVariant PhotoAlbumModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_names.size()) return QVariant();
+    switch (role) {
+    case Qt::DisplayRole:
+        return m_names[index.row()];
+    case Qt::DecorationRole: {
+        // 视图只为要绘制的行取图标，缩略图就在这时才请求
+        QPixmap thumbnail = m_cache->thumbnail(path(index.row()));
+        return thumbnail.isNull() ? m_placeholder : thumbnail;
+    }
+    case PathRole:
+        return path(index.row());
+    default:
+        return QVariant();
+    }
+}
+
+void PhotoAlbumModel::onThumbnailReady(const QString &path)
+{
+    const int row = m_rows.value(QFileInfo(path).fileName(), -1);
+    if (row < 0) return;
+    const QModelIndex i = index(row);
+    emit dataChanged(i, i, QVector<int>() << Qt::DecorationRole);
+}
+
+void PhotoAlbumModel::rebuildRows()
+{
+    m_rows.clear();
+    m_rows.reserve(m_names.size());
+    for (int i = 0; i < m_names.size(); ++i) m_rows.insert(m_names[i], i);
+}
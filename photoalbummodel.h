@@ -0,0 +1,45 @@
+#ifndef PHOTOALBUMMODEL_H
+#define PHOTOALBUMMODEL_H
+
+#include <QAbstractListModel>
+#include <QHash>
+#include <QPixmap>
+#include <QStringList>
+
+class ThumbnailCache;
+
+// 相册列表的模型：只保存文件名，图标在视图绘制某一行、来取 DecorationRole 时才向 ThumbnailCache 要。
+// 配合 QListView 的 uniformItemSizes 和 Batched 布局，几千张照片也只加载看得见的那几十张缩略图
+class PhotoAlbumModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    enum { PathRole = Qt::UserRole };   // 照片的完整路径
+
+    PhotoAlbumModel(const QString &photoDir, ThumbnailCache *cache, QObject *parent = nullptr);
+
+    // 重新列出目录中的照片，新的在前
+    void reload();
+    QString path(int row) const;
+    // 只从列表中移除，文件由调用者删除
+    void removePhoto(int row);
+    const QStringList &fileNames() const { return m_names; }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role) const override;
+
+private slots:
+    void onThumbnailReady(const QString &path);
+
+private:
+    void rebuildRows();
+
+    QString m_photoDir;
+    ThumbnailCache *m_cache;
+    QStringList m_names;          // 按修改时间从新到旧
+    QHash<QString, int> m_rows;   // 文件名 -> 行号
+    QPixmap m_placeholder;        // 缩略图加载出来之前显示的占位图
+};
+
+#endif // PHOTOALBUMMODEL_H
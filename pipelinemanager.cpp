@@ -0,0 +1,292 @@
+#include "pipelinemanager.h"
+#include "db_crypto.h"
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+PipelineManager::PipelineManager()
+    : m_startupMs(face_recognizer_now_ms())
+{
+}
+
+PipelineManager::~PipelineManager()
+{
+    stop();
+}
+
+QStringList PipelineManager::videoSources()
+{
+    QStringList sources;
+    for (const QString &s : qEnvironmentVariable("FR_VIDEO_SOURCES", "/dev/video1").split(',')) {
+        if (!s.trimmed().isEmpty()) sources << s.trimmed();
+    }
+    if (sources.isEmpty()) sources << "/dev/video1";
+    return sources;
+}
+
+QStringList PipelineManager::galleryShards()
+{
+    QStringList shards;
+    for (const QString &s : qEnvironmentVariable("FR_GALLERY_SHARDS").split(',')) {
+        if (!s.trimmed().isEmpty()) shards << s.trimmed();
+    }
+    return shards;
+}
+
+int PipelineManager::recognizerWorkers()
+{
+    bool ok = false;
+    int workers = qEnvironmentVariable("FR_RECOGNIZER_WORKERS").toInt(&ok);
+    return ok && workers > 0 ? workers : 1;
+}
+
+// 在线的 CPU 数，最多到位图能表示的个数
+static int onlineCpus()
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (int)qBound(1L, cpus, (long)(sizeof(unsigned long) * CHAR_BIT));
+}
+
+unsigned long PipelineManager::reservedCpuMask()
+{
+    bool ok = false;
+    int reserved = qEnvironmentVariable("FR_RESERVED_CPUS").toInt(&ok);
+    if (!ok || reserved < 0) reserved = 1;
+    // 保留全部 CPU 等于不保留
+    if (reserved == 0 || reserved >= onlineCpus()) return 0;
+    return (1UL << reserved) - 1;
+}
+
+RecognizerCpuConfig PipelineManager::recognizerCpuConfig()
+{
+    const int cpus = onlineCpus();
+    const unsigned long reserved = reservedCpuMask();
+    const unsigned long all = cpus >= (int)(sizeof(unsigned long) * CHAR_BIT) ? ~0UL : (1UL << cpus) - 1;
+
+    RecognizerCpuConfig config;
+    config.cpu_mask = reserved ? all & ~reserved : 0;
+    bool ok = false;
+    config.nice = qEnvironmentVariable("FR_INFER_NICE").toInt(&ok);
+    if (!ok) config.nice = 5;
+    config.intra_op_threads = qEnvironmentVariable("FR_INFER_THREADS").toInt(&ok);
+    if (!ok || config.intra_op_threads <= 0) {
+        const int inferenceCpus = config.cpu_mask ? qPopulationCount((quint64)config.cpu_mask) : cpus;
+        config.intra_op_threads = qMax(1, inferenceCpus / recognizerWorkers());
+    }
+    return config;
+}
+
+bool PipelineManager::loadDatabaseKey()
+{
+    const QString path = qEnvironmentVariable("FR_DB_KEY_FILE", FR_DB_KEY_FILE);
+    if (path.isEmpty()) {
+        qInfo() << "人脸库不加密";
+        return true;
+    }
+    // 密钥直接读进栈上的数组，用完清零，不经过 QByteArray 留在堆里
+    const QByteArray fileName = QFile::encodeName(path);
+    unsigned char key[DB_KEY_BYTES];
+    bool ok = false;
+    int fd = open(fileName.constData(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        ok = read(fd, key, sizeof(key)) == (ssize_t)sizeof(key);
+        close(fd);
+        if (!ok) qCritical().noquote() << "错误: 人脸库密钥文件" << path << "不足 32 字节";
+    } else if (errno == ENOENT) {
+        // 第一次运行时生成随机密钥，只有属主可读写；O_EXCL 保证不会覆盖已有的密钥
+        fd = open(fileName.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        ok = fd >= 0 && dbRandom(key, sizeof(key)) &&
+             write(fd, key, sizeof(key)) == (ssize_t)sizeof(key) && fsync(fd) == 0;
+        const int error = errno;
+        if (fd >= 0) close(fd);
+        if (ok) {
+            qInfo().noquote() << "已生成人脸库密钥" << path;
+        } else {
+            qCritical().noquote() << "错误: 无法生成人脸库密钥" << path << ":" << strerror(error);
+            if (fd >= 0) unlink(fileName.constData());
+        }
+    } else {
+        qCritical().noquote() << "错误: 无法读取人脸库密钥" << path << ":" << strerror(errno);
+    }
+    if (ok && face_recognizer_set_database_key(key) != 0) {
+        qCritical() << "错误: 无法为人脸库密钥分配锁定内存";
+        ok = false;
+    }
+    dbWipe(key, sizeof(key));
+    return ok;
+}
+
+void PipelineManager::init()
+{
+    // 调用者是界面（或守护进程的主）线程，与采集/检测共用保留的 CPU；之后启动的处理线程继承这个亲和性。
+    // 在加载级联之前设置，OpenCV 从此不在这个线程中创建自己的线程池
+    face_recognizer_set_thread_cpu(reservedCpuMask(), 0);
+    if (face_detector_init(FR_CASCADE_FILE) != 0) {
+        qCritical() << "错误: 人脸检测器初始化失败!";
+    } else {
+        m_detectorReady = true;
+        qDebug() << "人脸检测器初始化成功。";
+        const int parity = qEnvironmentVariableIntValue("FR_DETECTOR_PARITY");
+        if (parity > 0) {
+            face_detector_set_parity_check(parity);
+            qInfo().noquote() << QString("检测器对照检查: 每 %1 次检测用 OpenCV 复核一次").arg(parity);
+        }
+    }
+
+    openEventLog();
+    createPhotoWriter();
+
+    const QStringList sources = videoSources();
+    for (int i = 0; i < sources.size(); ++i) {
+        QThread *thread = new QThread;
+        thread->setObjectName(QString("cam%1").arg(i));
+        VideoProcessor *processor = new VideoProcessor(sources[i], i, m_startupMs);
+        processor->setEventLog(m_eventLog.get());
+        processor->setPhotoWriter(m_photoWriter.get());
+        processor->moveToThread(thread);
+        QObject::connect(thread, &QThread::started, processor, &VideoProcessor::startProcessing);
+        QObject::connect(thread, &QThread::finished, processor, &QObject::deleteLater);
+        m_threads << thread;
+        m_processors << processor;
+    }
+    const RecognizerCpuConfig cpu = recognizerCpuConfig();
+    qInfo().noquote() << QString("%1 路视频源: %2，推理线程 %3 个，每次推理 %4 个线程")
+                         .arg(sources.size()).arg(sources.join(", ")).arg(recognizerWorkers()).arg(cpu.intra_op_threads);
+    qInfo().noquote() << QString("CPU: 采集/检测和界面 0x%1，推理 0x%2（0 表示不限制），推理 nice %3")
+                         .arg(reservedCpuMask(), 0, 16).arg(cpu.cpu_mask, 0, 16).arg(cpu.nice);
+}
+
+void PipelineManager::openEventLog()
+{
+    const QString dir = qEnvironmentVariable("FR_EVENT_LOG_DIR", FR_EVENT_LOG_DIR);
+    if (dir.isEmpty()) return;
+    EventLog::Options options;
+    const int segmentKb = qEnvironmentVariableIntValue("FR_EVENT_LOG_SEGMENT_KB");
+    if (segmentKb > 0) options.segmentBytes = (size_t)segmentKb * 1024;
+    const int segments = qEnvironmentVariableIntValue("FR_EVENT_LOG_SEGMENTS");
+    if (segments > 0) options.maxSegments = segments;
+    bool ok = false;
+    const int commitMs = qEnvironmentVariable("FR_EVENT_LOG_COMMIT_MS").toInt(&ok);
+    if (ok && commitMs >= 0) options.commitIntervalMs = commitMs;
+
+    QDir().mkpath(dir);
+    std::string error;
+    m_eventLog = EventLog::open(dir.toStdString(), options, &error);
+    if (!m_eventLog) {
+        qWarning().noquote() << "无法打开事件日志" << dir << ":" << QString::fromStdString(error) << "，识别事件不记录";
+        return;
+    }
+    qInfo().noquote() << QString("事件日志: %1，%2 段，段大小 %3 KB，提交间隔 %4 ms")
+                         .arg(dir).arg(m_eventLog->stats().segments)
+                         .arg(options.segmentBytes / 1024).arg(options.commitIntervalMs);
+}
+
+void PipelineManager::createPhotoWriter()
+{
+    PhotoWriter::Options options;
+    const QString sync = qEnvironmentVariable("FR_PHOTO_SYNC");
+    if (!sync.isEmpty() && !PhotoWriter::parseSyncPolicy(sync.toStdString(), &options.sync)) {
+        qWarning().noquote() << "未知的照片同步策略" << sync << "，使用 batch";
+    }
+    const int queue = qEnvironmentVariableIntValue("FR_PHOTO_QUEUE");
+    if (queue > 0) options.maxQueued = queue;
+    m_photoWriter.reset(new PhotoWriter(options));
+    qInfo().noquote() << QString("照片写入: 同步策略 %1，队列 %2 张")
+                         .arg(PhotoWriter::syncPolicyName(options.sync)).arg(options.maxQueued);
+}
+
+// 在后台线程中加载模型并预热，完成后把识别器交给各路；各路在此期间已经在出图和追踪
+void PipelineManager::loadRecognizer()
+{
+    // 加载和预热也是推理的工作，不占保留的 CPU；推理线程由本线程创建，继承这里的亲和性和 nice 值
+    const RecognizerCpuConfig cpu = recognizerCpuConfig();
+    face_recognizer_set_thread_cpu(cpu.cpu_mask, cpu.nice);
+
+    const long long start = face_recognizer_now_ms();
+    FaceRecognizer *recognizer = face_recognizer_create(FR_MODEL_FILE, FR_DATABASE_FILE, recognizerWorkers());
+    if (!recognizer) {
+        qCritical() << "错误: 人脸识别器初始化失败!";
+        return;
+    }
+    face_recognizer_set_cpu_config(recognizer, &cpu);
+
+    // 远程人脸库分片：必须在各路打开结果流之前设置
+    const QStringList shards = galleryShards();
+    if (!shards.isEmpty()) {
+        QList<QByteArray> addresses;
+        QVector<const char *> pointers;
+        for (const QString &shard : shards) addresses << shard.toUtf8();
+        for (const QByteArray &address : addresses) pointers << address.constData();
+        int timeoutMs = qEnvironmentVariableIntValue("FR_SHARD_TIMEOUT_MS");
+        if (face_recognizer_set_gallery_shards(recognizer, pointers.constData(), pointers.size(), timeoutMs) != 0) {
+            qCritical() << "错误: 无法使用人脸库分片" << shards;
+        }
+    }
+
+    m_recognizer = recognizer;
+    const long long now = face_recognizer_now_ms();
+    qInfo().noquote() << QString("[startup] 识别模型加载和预热用时 %1 ms，启动后 %2 ms")
+                         .arg(now - start).arg(now - m_startupMs);
+    for (VideoProcessor *processor : m_processors) {
+        QMetaObject::invokeMethod(processor, [processor, recognizer]() {
+            processor->attachRecognizer(recognizer);
+        }, Qt::QueuedConnection);
+    }
+}
+
+void PipelineManager::start()
+{
+    m_started = true;
+    for (QThread *thread : m_threads) thread->start();
+    // 检测器都不可用时识别也无从谈起，各路只出图
+    if (m_detectorReady) m_loader = std::thread(&PipelineManager::loadRecognizer, this);
+}
+
+void PipelineManager::stop(int timeoutMs)
+{
+    // 模型加载不能中途取消，等它结束；之后 m_recognizer 不再被加载线程修改
+    if (m_loader.joinable()) m_loader.join();
+    for (VideoProcessor *processor : m_processors) {
+        QMetaObject::invokeMethod(processor, "stop", Qt::QueuedConnection);
+    }
+    for (QThread *thread : m_threads) {
+        thread->quit();
+        if (!thread->wait(timeoutMs < 0 ? ULONG_MAX : (unsigned long)timeoutMs)) {
+            qWarning("处理线程 %s 无法在 %d 毫秒内正常退出，将强制终止。", qPrintable(thread->objectName()), timeoutMs);
+            thread->terminate();
+            thread->wait();
+        }
+    }
+    // 线程结束时处理器由 deleteLater 释放（并关闭各自的结果流）；从未启动的线程不会触发它
+    if (!m_started) qDeleteAll(m_processors);
+    m_processors.clear();
+    qDeleteAll(m_threads);
+    m_threads.clear();
+
+    face_recognizer_destroy(m_recognizer);
+    m_recognizer = nullptr;
+    // 写完各路交来的照片
+    if (m_photoWriter) {
+        m_photoWriter->flush();
+        const PhotoWriter::Stats s = m_photoWriter->stats();
+        qInfo().noquote() << QString("照片写入: 本次保存 %1 张（%2 组），失败 %3 张，队列满拒绝 %4 张")
+                             .arg(s.written).arg(s.batches).arg(s.failed).arg(s.rejected);
+        m_photoWriter.reset();
+    }
+    // 各路都已停止，关闭前提交剩余的事件
+    if (m_eventLog) {
+        m_eventLog->flush();
+        const EventLog::Stats s = m_eventLog->stats();
+        qInfo().noquote() << QString("事件日志: 本次记录 %1 条，提交 %2 次，丢弃 %3 条，写入失败 %4 条")
+                             .arg(s.committed).arg(s.commits).arg(s.dropped).arg(s.writeErrors);
+        m_eventLog.reset();
+    }
+    if (m_detectorReady) face_detector_cleanup();
+    m_detectorReady = false;
+    m_started = false;
+}
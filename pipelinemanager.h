@@ -0,0 +1,82 @@
+#ifndef PIPELINEMANAGER_H
+#define PIPELINEMANAGER_H
+
+#include "videoprocessor.h"
+
+#include <QList>
+#include <QStringList>
+#include <QThread>
+#include <QVector>
+
+#include <memory>
+#include <thread>
+
+// 多路摄像头：一个共享的识别器实例，每路视频源一个 VideoProcessor 和一个处理线程。
+// 启动时先出图：start() 立即启动各路，识别模型在后台线程中加载、预热，就绪后再交给各路。
+// 视频源由 FR_VIDEO_SOURCES 指定，逗号分隔，默认只有 /dev/video1，例如
+//   FR_VIDEO_SOURCES=/dev/video1,/dev/video2,replay:/root/replay
+// 推理线程数由 FR_RECOGNIZER_WORKERS 指定，默认1；各路的识别任务在推理线程上轮流执行。
+// FR_GALLERY_SHARDS 指定远程人脸库分片（逗号分隔，见 gallery_rpc.h），FR_SHARD_TIMEOUT_MS 为等待分片的期限，默认30。
+// CPU 分配：从 CPU0 起的 FR_RESERVED_CPUS 个 CPU（默认1）只给采集/检测线程和界面线程，推理线程和它们的
+// 辅助线程用其余的 CPU；只有一个 CPU 时不限制亲和性。推理线程的 nice 值为 FR_INFER_NICE（默认5），
+// 单核上也能保证采集/检测和界面优先。FR_INFER_THREADS 为每次推理使用的线程数，默认把推理可用的 CPU 均分给各推理线程。
+// OpenCV 自己的线程池不用，否则它的线程会跨过这个划分（见 face_recognizer_set_thread_cpu）。
+// FR_DETECTOR_PARITY=N 时每个检测线程每 N 次检测用 cv::CascadeClassifier 复核一次，定期打印两者的差异和耗时
+// 各路的识别事件写进 FR_EVENT_LOG_DIR（默认 /root/event_log，设为空则不记录）下的事件日志，见 event_log.h；
+// FR_EVENT_LOG_SEGMENT_KB、FR_EVENT_LOG_SEGMENTS 和 FR_EVENT_LOG_COMMIT_MS 分别指定段大小、保留的段数和提交间隔
+// 各路的拍照和注册照片由一个共享的后台写线程保存（见 photo_writer.h）；FR_PHOTO_SYNC=none|batch|direct 选择落盘方式，
+// 默认 batch，FR_PHOTO_QUEUE 为最多排队的照片数，默认16
+// 人脸库用 FR_DB_KEY_FILE（默认 /root/face_database.key，32 字节）中的密钥加密，文件不存在时生成一个；设为空则不加密
+class PipelineManager
+{
+public:
+    PipelineManager();
+    ~PipelineManager();
+
+    // 初始化检测器，并为每路视频源创建处理器；不加载识别模型
+    void init();
+    // 启动各路处理线程，并开始在后台加载识别器；识别器加载失败时各路只做检测和追踪
+    void start();
+
+    /**
+     * @brief 停止所有处理线程并等待它们退出，然后释放识别器和检测器。
+     * @param timeoutMs 每个线程最多等待的毫秒数，超时后强制终止；<0 表示一直等待。
+     */
+    void stop(int timeoutMs = -1);
+
+    int count() const { return m_processors.size(); }
+    VideoProcessor *processor(int camera) const { return m_processors.value(camera); }
+    const QList<VideoProcessor *> &processors() const { return m_processors; }
+    // 识别事件日志，没有打开时为 NULL；stop() 之后失效
+    EventLog *eventLog() const { return m_eventLog.get(); }
+
+    // 解析 FR_VIDEO_SOURCES
+    static QStringList videoSources();
+    // 解析 FR_GALLERY_SHARDS
+    static QStringList galleryShards();
+    // 解析 FR_RECOGNIZER_WORKERS
+    static int recognizerWorkers();
+    // 留给采集/检测和界面的 CPU 位图，不限制时为0
+    static unsigned long reservedCpuMask();
+    // 推理线程的 CPU 设置，解析 FR_RESERVED_CPUS、FR_INFER_THREADS 和 FR_INFER_NICE
+    static RecognizerCpuConfig recognizerCpuConfig();
+    // 读取 FR_DB_KEY_FILE 中的人脸库密钥并交给识别器，应在创建任何识别器之前调用；密钥文件不可用时返回 false
+    static bool loadDatabaseKey();
+
+private:
+    void loadRecognizer();
+    void openEventLog();
+    void createPhotoWriter();
+
+    long long m_startupMs;                      // 构造的时刻，作为首帧和首次识别耗时的起点
+    std::thread m_loader;                       // 后台加载识别器的线程
+    FaceRecognizer *m_recognizer = nullptr;     // 由加载线程写入，stop() 等它结束之后才读
+    bool m_detectorReady = false;
+    bool m_started = false;
+    std::unique_ptr<EventLog> m_eventLog;
+    std::unique_ptr<PhotoWriter> m_photoWriter;
+    QList<VideoProcessor *> m_processors;
+    QList<QThread *> m_threads;
+};
+
+#endif // PIPELINEMANAGER_H
@@ -0,0 +1,65 @@
+#include "quitsignal.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// [0] 由信号处理函数写，[1] 由事件循环读
+static int signalFds[2] = {-1, -1};
+
+QuitSignalNotifier::QuitSignalNotifier(QObject *parent)
+    : QObject(parent)
+{
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, signalFds) != 0) {
+        qWarning() << "无法创建信号通知套接字:" << strerror(errno);
+        signalFds[0] = signalFds[1] = -1;
+        return;
+    }
+    // 两端都非阻塞：连续收到很多信号、缓冲区写满时丢掉多余的字节即可，不能卡在处理函数里；读端读空为止
+    for (int fd : signalFds) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    m_notifier = new QSocketNotifier(signalFds[1], QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &QuitSignalNotifier::onActivated);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+}
+
+QuitSignalNotifier::~QuitSignalNotifier()
+{
+    if (!m_notifier) return;
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    delete m_notifier;
+    close(signalFds[0]);
+    close(signalFds[1]);
+    signalFds[0] = signalFds[1] = -1;
+}
+
+void QuitSignalNotifier::handleSignal(int)
+{
+    const int savedErrno = errno;
+    const char byte = 1;
+    if (write(signalFds[0], &byte, 1) < 0) {
+        // 缓冲区满说明已经有未处理的退出请求
+    }
+    errno = savedErrno;
+}
+
+void QuitSignalNotifier::onActivated()
+{
+    char buf[16];
+    while (read(signalFds[1], buf, sizeof(buf)) > 0) {
+    }
+    QCoreApplication::quit();
+}
@@ -0,0 +1,27 @@
+#ifndef QUITSIGNAL_H
+#define QUITSIGNAL_H
+
+#include <QObject>
+#include <QSocketNotifier>
+
+// SIGINT/SIGTERM 时退出 Qt 事件循环。信号处理函数中只能调用异步信号安全的函数，QCoreApplication::quit()
+// 要加锁并投递事件，在处理函数中调用可能死锁；因此处理函数只向 socketpair 写一个字节，
+// 事件循环中的 QSocketNotifier 读到后再在主线程调用 quit()。同一时间只能有一个实例
+class QuitSignalNotifier : public QObject
+{
+public:
+    // 创建后立即接管 SIGINT 和 SIGTERM，析构时恢复默认处理
+    explicit QuitSignalNotifier(QObject *parent = nullptr);
+    ~QuitSignalNotifier();
+
+    // socketpair 创建失败时为 false，此时信号按默认方式处理（直接终止进程）
+    bool isValid() const { return m_notifier != nullptr; }
+
+private:
+    static void handleSignal(int signal);
+    void onActivated();
+
+    QSocketNotifier *m_notifier = nullptr;
+};
+
+#endif // QUITSIGNAL_H
@@ -0,0 +1,154 @@
+#include "replay_source.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static int is_jpeg_name(const char *name) {
+    const char *dot = strrchr(name, '.');
+    return dot && (strcasecmp(dot, ".jpg") == 0 || strcasecmp(dot, ".jpeg") == 0);
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// 把整个文件读进 src->buffer，返回字节数，失败返回-1。
+// 用 open/read 而不是 fopen，避免每帧为 FILE 分配内存；只有文件比以往都大时才扩大缓冲区
+static long read_file(ReplaySource *src, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+    long size = (long)st.st_size;
+    if ((unsigned long)size > src->capacity) {
+        unsigned char *grown = realloc(src->buffer, size);
+        if (!grown) {
+            perror("realloc replay buffer");
+            close(fd);
+            return -1;
+        }
+        src->buffer = grown;
+        src->capacity = size;
+    }
+    long done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, src->buffer + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    close(fd);
+    return done == size ? size : -1;
+}
+
+// 在 JPEG 的 SOF 段中读出图像尺寸，不解码像素
+static int jpeg_dimensions(const unsigned char *data, long size, int *width, int *height) {
+    long pos = 2;   // 跳过 SOI
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return -1;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) return -1;
+        unsigned char marker = data[pos + 1];
+        long len = (data[pos + 2] << 8) | data[pos + 3];
+        // SOF0-SOF15，除去 DHT(C4)、JPG(C8)、DAC(CC)
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (pos + 9 > size) return -1;
+            *height = (data[pos + 5] << 8) | data[pos + 6];
+            *width = (data[pos + 7] << 8) | data[pos + 8];
+            return 0;
+        }
+        pos += 2 + len;
+    }
+    return -1;
+}
+
+ReplaySource *replay_source_open(const char *dir_path) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        perror(dir_path);
+        return NULL;
+    }
+    ReplaySource *src = calloc(1, sizeof(ReplaySource));
+    if (!src) {
+        perror("calloc ReplaySource");
+        closedir(dir);
+        return NULL;
+    }
+    src->pixelformat = V4L2_PIX_FMT_MJPEG;
+
+    int capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || !is_jpeg_name(entry->d_name)) continue;
+        if (src->file_count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char **grown = realloc(src->files, capacity * sizeof(char *));
+            if (!grown) break;
+            src->files = grown;
+        }
+        size_t len = strlen(dir_path) + strlen(entry->d_name) + 2;
+        char *path = malloc(len);
+        if (!path) break;
+        snprintf(path, len, "%s/%s", dir_path, entry->d_name);
+        src->files[src->file_count++] = path;
+    }
+    closedir(dir);
+
+    if (src->file_count == 0) {
+        fprintf(stderr, "No JPEG files to replay in %s\n", dir_path);
+        replay_source_close(src);
+        return NULL;
+    }
+    qsort(src->files, src->file_count, sizeof(char *), compare_paths);
+
+    long size = read_file(src, src->files[0]);
+    if (size < 0 || jpeg_dimensions(src->buffer, size, &src->width, &src->height) != 0) {
+        fprintf(stderr, "Cannot read JPEG size from %s\n", src->files[0]);
+        replay_source_close(src);
+        return NULL;
+    }
+    printf("Replay source opened (%d files, %dx%d) from %s.\n", src->file_count, src->width, src->height, dir_path);
+    return src;
+}
+
+VideoFrame *replay_source_get_frame(ReplaySource *src) {
+    // 读不出来的文件跳过，整轮都失败才放弃
+    for (int tries = 0; tries < src->file_count; tries++) {
+        const char *path = src->files[src->next];
+        if (++src->next == src->file_count) {
+            src->next = 0;
+            src->loops++;
+        }
+        long size = read_file(src, path);
+        if (size < 0) continue;
+        src->frame.start = src->buffer;
+        src->frame.length = (unsigned int)size;
+        src->frame.index = 0;
+        return &src->frame;
+    }
+    return NULL;
+}
+
+void replay_source_release_frame(ReplaySource *src, VideoFrame *frame) {
+    (void)src;
+    (void)frame;
+}
+
+void replay_source_close(ReplaySource *src) {
+    if (!src) return;
+    for (int i = 0; i < src->file_count; i++) free(src->files[i]);
+    free(src->files);
+    free(src->buffer);
+    free(src);
+}
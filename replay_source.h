@@ -0,0 +1,44 @@
+#ifndef REPLAY_SOURCE_H
+#define REPLAY_SOURCE_H
+
+#include "video_manager.h"
+
+// 回放源：按文件名顺序循环读取一个目录下的 JPEG 文件，当作 MJPEG 摄像头使用，
+// 用于没有摄像头时调试，或者在一块板子上模拟多路摄像头
+typedef struct {
+    char **files;                 // 按名字排序的 JPEG 文件路径
+    int file_count;
+    int next;                     // 下一帧的文件下标
+    int loops;                    // 已经完整播放的轮数
+    unsigned char *buffer;        // 当前帧的数据，文件变大时才重新分配
+    unsigned int capacity;
+    VideoFrame frame;             // 每次返回同一个结构体，不为每帧分配
+    int width;                    // 第一张图片的尺寸
+    int height;
+    unsigned int pixelformat;     // 固定为 V4L2_PIX_FMT_MJPEG
+} ReplaySource;
+
+/**
+ * @brief 打开回放目录。
+ * @param dir_path 目录路径，其中的 .jpg/.jpeg 文件按名字排序后依次播放。
+ * @return 成功返回回放源，目录不存在或没有可用的 JPEG 文件时返回 NULL。
+ */
+ReplaySource *replay_source_open(const char *dir_path);
+
+/**
+ * @brief 读取下一帧，播放到末尾后从头开始。
+ * @return 成功返回帧，数据在下一次调用之前有效；读取失败返回 NULL。
+ */
+VideoFrame *replay_source_get_frame(ReplaySource *src);
+
+/**
+ * @brief 与 video_capture_release_frame 对应，回放源没有需要归还的缓冲区。
+ */
+void replay_source_release_frame(ReplaySource *src, VideoFrame *frame);
+
+/**
+ * @brief 关闭回放源并释放所有内存。
+ */
+void replay_source_close(ReplaySource *src);
+
+#endif // REPLAY_SOURCE_H
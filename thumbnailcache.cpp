@@ -0,0 +1,245 @@
+#include "thumbnailcache.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QSaveFile>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define THUMBNAIL_QUALITY 85          // 磁盘缓存中缩略图的 JPEG 质量
+#define THUMBNAIL_CACHE_KB 4096       // 内存中缩略图的上限，100x100 的缩略图约可放 100 张
+#define IMAGE_CACHE_KB 8192           // 内存中大图的上限，当前照片和前后各一张
+#define MAX_PENDING_THUMBNAILS 48     // 排队的缩略图请求上限，约为一屏半
+#define MAX_PENDING_IMAGES 4
+#define WORKER_NICE 10                // 相册是偶尔用的功能，解码不能和采集、检测抢 CPU
+
+ThumbnailCache::ThumbnailCache(const QString &photoDir, const QSize &thumbnailSize, QObject *parent)
+    : QObject(parent)
+    , m_thumbDir(QDir(photoDir).filePath(".thumbnails") + "/")
+    , m_thumbnailSize(thumbnailSize)
+{
+    QDir().mkpath(m_thumbDir);
+    m_thumbnails.setMaxCost(THUMBNAIL_CACHE_KB);
+    m_images.setMaxCost(IMAGE_CACHE_KB);
+    m_worker = std::thread(&ThumbnailCache::run, this);
+}
+
+ThumbnailCache::~ThumbnailCache()
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        m_exiting = true;
+        m_wake.wakeOne();
+    }
+    m_worker.join();
+}
+
+QPixmap ThumbnailCache::thumbnail(const QString &path)
+{
+    if (QPixmap *cached = m_thumbnails.object(path)) return *cached;
+    if (m_requested.contains(path) || m_failed.contains(path)) return QPixmap();
+
+    m_requested.insert(path);
+    QString dropped;
+    {
+        QMutexLocker lock(&m_mutex);
+        Job job;
+        job.type = JOB_THUMBNAIL;
+        job.path = path;
+        m_thumbnailJobs.push_back(job);
+        if (m_thumbnailJobs.size() > MAX_PENDING_THUMBNAILS) {
+            // 最旧的请求多半已经滚出了视野
+            dropped = m_thumbnailJobs.front().path;
+            m_thumbnailJobs.pop_front();
+        }
+        m_wake.wakeOne();
+    }
+    if (!dropped.isNull()) m_requested.remove(dropped);
+    return QPixmap();
+}
+
+QPixmap ThumbnailCache::image(const QString &path, const QSize &bound)
+{
+    if (QPixmap *cached = m_images.object(imageKey(path, bound))) return *cached;
+    if (!m_failed.contains(path)) requestImage(path, bound, true);
+    return QPixmap();
+}
+
+void ThumbnailCache::prefetchImage(const QString &path, const QSize &bound)
+{
+    if (m_images.contains(imageKey(path, bound)) || m_failed.contains(path)) return;
+    requestImage(path, bound, false);
+}
+
+void ThumbnailCache::requestImage(const QString &path, const QSize &bound, bool urgent)
+{
+    const QString key = imageKey(path, bound);
+    if (m_requested.contains(key)) {
+        // 已经作为预取排队的照片被选中时提到最前面；正在解码的找不到，等它完成即可
+        if (!urgent) return;
+        QMutexLocker lock(&m_mutex);
+        for (auto it = m_imageJobs.begin(); it != m_imageJobs.end(); ++it) {
+            if (imageKey(it->path, it->bound) != key) continue;
+            Job job = *it;
+            m_imageJobs.erase(it);
+            m_imageJobs.push_front(job);
+            break;
+        }
+        return;
+    }
+
+    m_requested.insert(key);
+    QString dropped;
+    {
+        QMutexLocker lock(&m_mutex);
+        Job job;
+        job.type = JOB_IMAGE;
+        job.path = path;
+        job.bound = bound;
+        if (urgent) m_imageJobs.push_front(job);
+        else m_imageJobs.push_back(job);
+        if (m_imageJobs.size() > MAX_PENDING_IMAGES) {
+            dropped = imageKey(m_imageJobs.back().path, m_imageJobs.back().bound);
+            m_imageJobs.pop_back();
+        }
+        m_wake.wakeOne();
+    }
+    if (!dropped.isNull()) m_requested.remove(dropped);
+}
+
+void ThumbnailCache::remove(const QString &path)
+{
+    m_thumbnails.remove(path);
+    const QString prefix = path + '@';
+    for (const QString &key : m_images.keys()) {
+        if (key.startsWith(prefix)) m_images.remove(key);
+    }
+    m_failed.remove(path);
+    QFile::remove(thumbnailPath(path));
+}
+
+void ThumbnailCache::prune(const QStringList &fileNames)
+{
+    QMutexLocker lock(&m_mutex);
+    Job job;
+    job.type = JOB_PRUNE;
+    job.names = fileNames;
+    m_pruneJobs.push_back(job);
+    m_wake.wakeOne();
+}
+
+QString ThumbnailCache::imageKey(const QString &path, const QSize &bound)
+{
+    return QString("%1@%2x%3").arg(path).arg(bound.width()).arg(bound.height());
+}
+
+QString ThumbnailCache::thumbnailPath(const QString &path) const
+{
+    return m_thumbDir + QFileInfo(path).fileName();
+}
+
+// 先找磁盘缓存，没有或已过期时从原图生成并写回缓存
+QImage ThumbnailCache::loadThumbnail(const QString &path)
+{
+    const QString cachedPath = thumbnailPath(path);
+    const QFileInfo cached(cachedPath);
+    if (cached.exists() && cached.lastModified() >= QFileInfo(path).lastModified()) {
+        QImage image(cachedPath);
+        if (!image.isNull()) return image;
+    }
+
+    // 只读文件头拿到原图尺寸，设置缩放尺寸后 JPEG 解码器按最接近的 DCT 缩放比例解码，再做剩下的一点缩放
+    QImageReader reader(path);
+    const QSize size = reader.size();
+    if (size.isValid()) reader.setScaledSize(size.scaled(m_thumbnailSize, Qt::KeepAspectRatio));
+    QImage image = reader.read();
+    if (image.isNull()) {
+        qWarning() << "无法生成缩略图" << path << ":" << reader.errorString();
+        return image;
+    }
+    // 先写临时文件再改名，中途退出不会留下半张缩略图
+    QSaveFile file(cachedPath);
+    if (!file.open(QIODevice::WriteOnly) || !image.save(&file, "JPG", THUMBNAIL_QUALITY) || !file.commit()) {
+        qWarning() << "无法保存缩略图" << cachedPath;
+    }
+    return image;
+}
+
+void ThumbnailCache::pruneThumbnails(const QStringList &names)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    const QSet<QString> photos(names.begin(), names.end());
+#else
+    const QSet<QString> photos = names.toSet();   // Qt 5.14 之前没有按迭代器区间构造
+#endif
+    QDir dir(m_thumbDir);
+    for (const QString &name : dir.entryList(QDir::Files)) {
+        if (!photos.contains(name)) dir.remove(name);
+    }
+}
+
+// 后台线程：结果连同请求一起交回界面线程，在那里转成 QPixmap 放进内存缓存
+void ThumbnailCache::finish(const Job &job, const QImage &image)
+{
+    QMetaObject::invokeMethod(this, [this, job, image]() {
+        const bool isImage = job.type == JOB_IMAGE;
+        const QString key = isImage ? imageKey(job.path, job.bound) : job.path;
+        m_requested.remove(key);
+        if (image.isNull()) {
+            m_failed.insert(job.path);
+        } else {
+            QCache<QString, QPixmap> &cache = isImage ? m_images : m_thumbnails;
+            cache.insert(key, new QPixmap(QPixmap::fromImage(image)), qMax(1, image.width() * image.height() * 4 / 1024));
+        }
+        if (isImage) emit imageReady(job.path);
+        else emit thumbnailReady(job.path);
+    }, Qt::QueuedConnection);
+}
+
+void ThumbnailCache::run()
+{
+    // Linux 的 nice 值属于线程，按线程号设置只影响本线程
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), WORKER_NICE);
+
+    for (;;) {
+        Job job;
+        {
+            QMutexLocker lock(&m_mutex);
+            while (!m_exiting && m_imageJobs.empty() && m_thumbnailJobs.empty() && m_pruneJobs.empty()) {
+                m_wake.wait(&m_mutex);
+            }
+            if (m_exiting) return;
+            if (!m_imageJobs.empty()) {
+                job = m_imageJobs.front();
+                m_imageJobs.pop_front();
+            } else if (!m_thumbnailJobs.empty()) {
+                job = m_thumbnailJobs.back();
+                m_thumbnailJobs.pop_back();
+            } else {
+                job = m_pruneJobs.front();
+                m_pruneJobs.pop_front();
+            }
+        }
+
+        switch (job.type) {
+        case JOB_IMAGE: {
+            QImageReader reader(job.path);
+            const QSize size = reader.size();
+            if (size.isValid()) reader.setScaledSize(size.scaled(job.bound, Qt::KeepAspectRatio));
+            finish(job, reader.read());
+            break;
+        }
+        case JOB_THUMBNAIL:
+            finish(job, loadThumbnail(job.path));
+            break;
+        case JOB_PRUNE:
+            pruneThumbnails(job.names);
+            break;
+        }
+    }
+}
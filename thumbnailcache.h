@@ -0,0 +1,89 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QObject>
+#include <QCache>
+#include <QImage>
+#include <QPixmap>
+#include <QSet>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <deque>
+#include <thread>
+
+// 相册的缩略图和大图加载。所有解码都在一个低优先级的后台线程上做，界面线程只取结果：
+// - 缩略图持久保存在照片目录下的 .thumbnails/ 中，与原图同名；原图比缓存新时重新生成。
+//   生成时让 JPEG 解码器直接做 1/2、1/4、1/8 的 DCT 缩放解码，不解出整张原图。
+// - 内存中按字节数限量缓存最近用过的缩略图和几张大图。
+// - 缩略图请求后进先出：滚动时最新可见的行先加载，排队太多时丢弃最旧的请求，滚回来时视图会重新请求。
+class ThumbnailCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    ThumbnailCache(const QString &photoDir, const QSize &thumbnailSize, QObject *parent = nullptr);
+    // 丢弃排队的请求，等后台线程做完手上的一张后退出
+    ~ThumbnailCache();
+
+    const QSize &thumbnailSize() const { return m_thumbnailSize; }
+
+    // 以下函数只在界面线程调用
+
+    // 内存中的缩略图；还没有时返回空 QPixmap 并在后台加载，加载好后发出 thumbnailReady
+    QPixmap thumbnail(const QString &path);
+    // 缩放到 bound 以内的大图；还没有时返回空 QPixmap 并优先加载，加载好后发出 imageReady
+    QPixmap image(const QString &path, const QSize &bound);
+    // 预取大图（例如相邻的照片），排在 image() 的请求之后
+    void prefetchImage(const QString &path, const QSize &bound);
+    // 照片无法解码，之后的请求都直接返回空 QPixmap
+    bool failed(const QString &path) const { return m_failed.contains(path); }
+    // 照片被删除：丢掉内存中的缓存和磁盘上的缩略图
+    void remove(const QString &path);
+    // 在后台删除 .thumbnails/ 中原图已经不在 fileNames 里的缩略图
+    void prune(const QStringList &fileNames);
+
+signals:
+    void thumbnailReady(const QString &path);
+    void imageReady(const QString &path);   // 也在加载失败时发出，此时 image() 返回空 QPixmap
+
+private:
+    enum JobType { JOB_IMAGE, JOB_THUMBNAIL, JOB_PRUNE };
+    struct Job {
+        JobType type = JOB_THUMBNAIL;
+        QString path;
+        QSize bound;
+        QStringList names;
+    };
+
+    static QString imageKey(const QString &path, const QSize &bound);
+    QString thumbnailPath(const QString &path) const;
+    QImage loadThumbnail(const QString &path);
+    void pruneThumbnails(const QStringList &names);
+    void requestImage(const QString &path, const QSize &bound, bool urgent);
+    void finish(const Job &job, const QImage &image);
+    void run();
+
+    const QString m_thumbDir;
+    const QSize m_thumbnailSize;
+
+    // 界面线程的状态，只在界面线程读写，不受 m_mutex 保护（后台线程的结果由 finish 排队交回界面线程再修改）
+    QCache<QString, QPixmap> m_thumbnails;   // 路径 -> 缩略图，代价为 KB
+    QCache<QString, QPixmap> m_images;       // 路径@尺寸 -> 大图
+    QSet<QString> m_requested;               // 已经排队、还没有结果的缩略图和大图
+    QSet<QString> m_failed;                  // 无法解码的照片，不再反复请求
+
+    // 队列，由 m_mutex 保护
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    std::deque<Job> m_imageJobs;             // 大图请求，先于缩略图处理
+    std::deque<Job> m_thumbnailJobs;         // 缩略图请求，从尾部取
+    std::deque<Job> m_pruneJobs;             // 最后处理
+    bool m_exiting = false;
+    std::thread m_worker;
+};
+
+#endif // THUMBNAILCACHE_H
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
@@ -48,6 +49,19 @@ VideoCaptureDevice* video_capture_init(const char *device_path, int width, int h
         perror("VIDIOC_S_FMT");
         goto fail;
     }
+    // 驱动可能会悄悄换成它支持的格式，这里必须确认
+    if (fmt.fmt.pix.pixelformat != format) {
+        fprintf(stderr, "Device does not support pixel format %s\n", video_capture_format_name(format));
+        goto fail;
+    }
+    dev->width = fmt.fmt.pix.width;
+    dev->height = fmt.fmt.pix.height;
+    dev->pixelformat = fmt.fmt.pix.pixelformat;
+    dev->bytesperline = fmt.fmt.pix.bytesperline;
+    if (dev->bytesperline == 0) {
+        // 部分驱动不填写步长，按紧凑排列计算
+        dev->bytesperline = (format == V4L2_PIX_FMT_YUYV) ? dev->width * 2 : dev->width;
+    }
 
     // 申请DMA缓冲区（内存映射方式）
     struct v4l2_requestbuffers req;
@@ -108,7 +122,8 @@ VideoCaptureDevice* video_capture_init(const char *device_path, int width, int h
         goto fail;
     }
 
-    printf("Video capture initialized successfully.\n");
+    printf("Video capture initialized successfully (%dx%d %s).\n",
+           dev->width, dev->height, video_capture_format_name(dev->pixelformat));
     return dev;
 
 fail:
@@ -200,3 +215,20 @@ void video_capture_cleanup(VideoCaptureDevice *dev) {
     free(dev);
     printf("Video capture cleaned up.\n");
 }
+
+unsigned int video_capture_format_from_name(const char *name) {
+    if (!name) return 0;
+    if (strcasecmp(name, "mjpeg") == 0 || strcasecmp(name, "mjpg") == 0) return V4L2_PIX_FMT_MJPEG;
+    if (strcasecmp(name, "yuyv") == 0) return V4L2_PIX_FMT_YUYV;
+    if (strcasecmp(name, "nv12") == 0) return V4L2_PIX_FMT_NV12;
+    return 0;
+}
+
+const char *video_capture_format_name(unsigned int format) {
+    switch (format) {
+    case V4L2_PIX_FMT_MJPEG: return "MJPEG";
+    case V4L2_PIX_FMT_YUYV:  return "YUYV";
+    case V4L2_PIX_FMT_NV12:  return "NV12";
+    default:                 return "unknown";
+    }
+}
@@ -9,6 +9,10 @@ typedef struct {
     int buffer_count;
     void **buffers;         // 指向 mmap 映射的缓冲区指针数组
     unsigned int *buffer_lengths; // 每个缓冲区的长度，用于 munmap
+    int width;                    // 驱动实际协商得到的宽度
+    int height;                   // 驱动实际协商得到的高度
+    unsigned int pixelformat;     // 实际像素格式 (V4L2_PIX_FMT_*)
+    unsigned int bytesperline;    // 每行字节数 (原始格式时为Y平面/打包行的步长)
 } VideoCaptureDevice;
 
 // 用于保存捕获到的单个视频帧信息的结构体
@@ -25,7 +29,8 @@ typedef struct {
  * @param device_path 视频设备的路径 (例如 "/dev/video0")
  * @param width  期望的捕获宽度
  * @param height 期望的捕获高度
- * @param format 期望的像素格式 (例如 V4L2_PIX_FMT_MJPEG)
+ * @param format 期望的像素格式，支持 V4L2_PIX_FMT_MJPEG、V4L2_PIX_FMT_YUYV 和 V4L2_PIX_FMT_NV12。
+ *               驱动不支持该格式时初始化失败，由调用者决定是否回退到其他格式。
  * @return 成功则返回一个指向 VideoCaptureDevice 结构体的指针，失败返回 NULL
  */
 VideoCaptureDevice* video_capture_init(const char *device_path, int width, int height, unsigned int format);
@@ -56,4 +61,16 @@ int video_capture_release_frame(VideoCaptureDevice *dev, VideoFrame *frame);
  */
 void video_capture_cleanup(VideoCaptureDevice *dev);
 
-#endif // VIDEO_CAPTURE_H
\ No newline at end of file
+/**
+ * @brief 将 "mjpeg" / "yuyv" / "nv12" 形式的名字解析为 V4L2 像素格式。
+ * @param name 格式名，大小写不敏感。
+ * @return 对应的 V4L2_PIX_FMT_* 值，无法识别时返回 0。
+ */
+unsigned int video_capture_format_from_name(const char *name);
+
+/**
+ * @brief 返回像素格式的可读名字，用于日志输出。
+ */
+const char *video_capture_format_name(unsigned int format);
+
+#endif // VIDEO_CAPTURE_H
\ No newline at end of file
@@ -1,59 +1,91 @@
 #include "videoprocessor.h"
+#include "pipelinemanager.h"
 #include <QDebug>
-#include <QThread>
 #include <QDir>
 #include <QDateTime>
 #include <sys/ioctl.h>
+#include <time.h>
 #include <vector>
 #include <opencv2/opencv.hpp>
 #include <cstdio> 
+#include <cstring>
+#include <algorithm>
+#include <climits>
 
 // 嵌入式优化性能参数
 #define TRACKER_LIFESPAN 30      
-#define MAX_TRACKERS 3           
-#define RECOGNITION_INTERVAL 15  
+#define MAX_TRACKERS 64          // 大厅场景需要同时追踪几十张人脸
+#define RECOGNITION_INTERVAL 15  // 新出现/身份不确定的人脸的识别间隔，身份稳定后由追踪器逐步拉长
 #define DETECTION_INTERVAL 5    
 #define IOU_MATCH_THRESHOLD 0.3f 
 #define FRAME_INTERVAL_MS 100    
+#define PERF_REPORT_FRAMES 100   // 每隔多少帧输出一次帧率/CPU统计
+#define RESULT_RING_CAPACITY 64  // 识别结果环形缓冲区的容量，必须是2的幂
+#define QUALITY_WINDOW_FRAMES 15 // 在多少帧内为每个追踪器挑选质量最好的人脸切片
+#define QUALITY_MIN 0.35f        // 低于该质量分的切片不送去识别
+#define QUALITY_EXCELLENT 0.8f   // 达到该质量分立即提交，不等窗口结束
+#define RECOGNITION_DEADLINE_MS 2000  // 切片采集后超过该时间仍未开始推理就丢弃
+#define ALLOC_AUDIT_WARMUP_FRAMES 300 // 之后的帧才计入堆分配统计，之前是各缓冲区增长到稳定大小的过程
+#define EVENT_THUMBNAIL_SIZE 64       // 事件日志中人脸缩略图的边长
 
 // 注册流程常量
 const int REGISTRATION_PHOTO_COUNT = 5;                
-const int REGISTRATION_CAPTURE_INTERVAL_FRAMES = 10;   
+const int REGISTRATION_CAPTURE_INTERVAL_MS = 1000;     // 两次采集尝试（质量检查）之间的间隔
+const int REGISTRATION_POSE_CHANGE_MS = 3000;          // 采集成功后留给用户调整姿势的时间，期间照常处理视频
+const float REGISTRATION_MIN_QUALITY = 0.6f;           // 注册照片的最低质量分
 const QString PHOTO_SAVE_PATH = "/root/photos/";
 const QString REG_TEMP_PATH = "/root/reg_temp/";
 
-//初始化底层C-API模块。传入模型和数据库文件的硬编码路径，并检查初始化是否成功
-VideoProcessor::VideoProcessor(QObject *parent) : QObject(parent)
+// 统计一段代码在本线程中的堆分配次数并累加到 counter，用于把允许的分配从每帧的检查中扣除；
+// 不用 CONFIG+=alloc_audit 编译时什么也不做
+class AllocScope
 {
-    const char *cascade_file    = "/root/lbpcascade_frontalface.xml"; 
-    const char *onnx_model_file = "/root/models/mobilefacenet.onnx";  
-    const char *database_file   = "/root/face_database.db";           
-
-    if (face_detector_init(cascade_file) != 0) {
-        qCritical() << "错误: 人脸检测器初始化失败!";
-        return;
-    }
-    qDebug() << "人脸检测器初始化成功。";
-
-    if (face_recognizer_init(onnx_model_file, database_file) != 0) {
-        face_detector_cleanup();
-        qCritical() << "错误: 人脸识别器初始化失败!";
-        return;
+public:
+    explicit AllocScope(long &counter) : m_counter(counter), m_start(alloc_audit_thread_count()) {}
+    ~AllocScope() { if (m_start >= 0) m_counter += alloc_audit_thread_count() - m_start; }
+
+private:
+    long &m_counter;
+    long m_start;
+};
+
+// 检测器和识别器由 PipelineManager 初始化，识别器就绪后由 attachRecognizer 交给本路
+VideoProcessor::VideoProcessor(const QString &source, int camera, long long startupMs, QObject *parent)
+    : QObject(parent)
+    , m_source(source)
+    , m_camera(camera)
+    , m_logTag(QString("[cam%1]").arg(camera))
+    , m_startupMs(startupMs)
+    , m_tracker(MAX_TRACKERS, TRACKER_LIFESPAN, IOU_MATCH_THRESHOLD, RECOGNITION_INTERVAL)
+{
+    // 采集格式: FR_PIXEL_FORMAT=mjpeg|yuyv|nv12，默认 MJPEG
+    m_pixelFormat = V4L2_PIX_FMT_MJPEG;
+    const QByteArray fmtName = qgetenv("FR_PIXEL_FORMAT");
+    if (!fmtName.isEmpty()) {
+        unsigned int fmt = video_capture_format_from_name(fmtName.constData());
+        if (fmt) m_pixelFormat = fmt;
+        else qWarning() << "未知的采集格式" << fmtName << "，使用 MJPEG";
     }
-    qDebug() << "人脸识别器初始化成功。";
+    // 时序投票的确认差值: FR_VOTE_MARGIN，越大身份越稳定、需要的识别次数越多
+    bool marginOk = false;
+    float margin = qEnvironmentVariable("FR_VOTE_MARGIN").toFloat(&marginOk);
+    if (marginOk && margin > 0) m_tracker.setVoteMargin(margin);
 
-    // 演示注册
-    const char* person1_image_paths[] = { "/root/face_database/yy/001.jpg", "/root/face_database/yy/002.jpg", "/root/face_database/yy/003.jpg", "/root/face_database/yy/004.jpg", "/root/face_database/yy/005.jpg", "/root/face_database/yy/006.jpg", "/root/face_database/yy/007.jpg", "/root/face_database/yy/008.jpg", "/root/face_database/yy/009.jpg", "/root/face_database/yy/010.jpg" };
-    int num_images = sizeof(person1_image_paths) / sizeof(person1_image_paths[0]);
-    if (num_images >= 3) {
-        int count = face_recognizer_register_faces_from_paths(person1_image_paths, num_images, "yy");
-        if(count > 0) qDebug() << "示例用户 'yy' 已注册。";
-    }
+    // 识别结果直接写进本对象拥有的环形缓冲区
+    m_resultRing.resize(RESULT_RING_CAPACITY);
 
-    m_trackers.resize(MAX_TRACKERS);  
     QDir().mkpath(PHOTO_SAVE_PATH);   
     QDir().mkpath(REG_TEMP_PATH);      
 
+    m_detectedFaces.reserve(MAX_TRACKERS);
+    m_newIds.reserve(MAX_TRACKERS);
+    m_lostIds.reserve(MAX_TRACKERS);
+    m_overlays.reserve(MAX_TRACKERS);
+    m_submitChips.reserve(MAX_TRACKERS);
+    m_submitIndices.reserve(MAX_TRACKERS);
+    m_chipCandidates.resize(MAX_TRACKERS);
+    m_traceTrackers = qEnvironmentVariableIntValue("FR_TRACE_TRACKERS") != 0;
+
     m_timer = new QTimer(this);
     connect(m_timer, &QTimer::timeout, this, &VideoProcessor::processSingleFrame);
 }
@@ -64,9 +96,13 @@ VideoProcessor::~VideoProcessor()
     if (m_cam) {
         video_capture_cleanup(m_cam); 
     }
-    face_recognizer_cleanup();
-    face_detector_cleanup();
-    qDebug() << "VideoProcessor cleaned up.";
+    replay_source_close(m_replay);
+    // 入库线程还在用识别器，识别器在本对象之后才释放
+    if (m_regWorker.joinable()) m_regWorker.join();
+    delete m_resultNotifier;   // 先停止监视 eventfd，再由识别器关闭它
+    m_resultNotifier = nullptr;
+    face_recognizer_close_stream(m_stream);
+    qDebug().noquote() << m_logTag << "VideoProcessor cleaned up.";
 }
 
 void VideoProcessor::startProcessing()
@@ -76,21 +112,63 @@ void VideoProcessor::startProcessing()
         return;
     }
 
-    m_cam = video_capture_init("/dev/video1", 640, 480, V4L2_PIX_FMT_MJPEG);
-    if (!m_cam) {
-        emit statusMessage("摄像头初始化失败!");
-        qCritical() << "错误: 无法打开摄像头。";
-        return;
+    if (m_source.startsWith("replay:")) {
+        m_replay = replay_source_open(m_source.mid(7).toUtf8().constData());
+        if (!m_replay) {
+            emit statusMessage("回放目录打开失败!");
+            qCritical().noquote() << m_logTag << "错误: 无法打开回放源" << m_source;
+            return;
+        }
+        m_lastFormat.width = m_replay->width;
+        m_lastFormat.height = m_replay->height;
+        m_lastFormat.stride = 0;
+        m_lastFormat.fourcc = m_replay->pixelformat;
+    } else {
+        const QByteArray device = m_source.toUtf8();
+        m_cam = video_capture_init(device.constData(), 640, 480, m_pixelFormat);
+        if (!m_cam && m_pixelFormat != V4L2_PIX_FMT_MJPEG) {
+            qWarning().noquote() << m_logTag << "摄像头不支持" << video_capture_format_name(m_pixelFormat) << "，回退到 MJPEG";
+            m_cam = video_capture_init(device.constData(), 640, 480, V4L2_PIX_FMT_MJPEG);
+        }
+        if (!m_cam) {
+            emit statusMessage("摄像头初始化失败!");
+            qCritical().noquote() << m_logTag << "错误: 无法打开摄像头" << m_source;
+            return;
+        }
+        m_lastFormat.width = m_cam->width;
+        m_lastFormat.height = m_cam->height;
+        m_lastFormat.stride = m_cam->bytesperline;
+        m_lastFormat.fourcc = m_cam->pixelformat;
     }
 
     m_stopped = false;       
     m_frameCounter = 0;       
-    emit statusMessage("视频流已启动...");
-    qDebug() << "摄像头已成功启动，处理定时器开启。";
+    m_statFrames = 0;
+    m_statWallNs = 0;
+    emit statusMessage(m_stream ? "视频流已启动..." : "视频流已启动，识别模型加载中...");
+    qDebug().noquote() << m_logTag << m_source << "已成功启动，处理定时器开启。";
 
     m_timer->start(FRAME_INTERVAL_MS);
 }
 
+void VideoProcessor::attachRecognizer(FaceRecognizer *recognizer)
+{
+    if (m_stream || !recognizer) return;
+    m_stream = face_recognizer_open_stream(recognizer, QString("cam%1").arg(m_camera).toUtf8().constData(),
+                                           m_resultRing.data(), m_resultRing.size());
+    if (!m_stream) {
+        qWarning().noquote() << m_logTag << "无法打开识别结果流，只做检测和追踪";
+        return;
+    }
+    m_recognizer = recognizer;
+    // 识别结果到达时由事件循环立即通知，通知器必须在本线程中创建
+    m_resultNotifier = new QSocketNotifier(face_recognizer_result_fd(m_stream), QSocketNotifier::Read, this);
+    connect(m_resultNotifier, &QSocketNotifier::activated, this, &VideoProcessor::onRecognitionResults);
+    emit statusMessage("识别模型已就绪");
+    qInfo().noquote() << QString("[startup]%1 识别器就绪: 启动后 %2 ms")
+                         .arg(m_logTag).arg(face_recognizer_now_ms() - m_startupMs);
+}
+
 void VideoProcessor::processSingleFrame()
 {
     if (m_stopped) {
@@ -101,123 +179,499 @@ void VideoProcessor::processSingleFrame()
         return;
     }
 
-    VideoFrame *frame = video_capture_get_frame(m_cam);
+    VideoFrame *frame = grabFrame();
     if (!frame) {
          qDebug() << "DEBUG: Loop" << m_frameCounter << "- Failed to get frame, continuing.";
          return; 
     }
+    if (!m_firstFrameSeen) {
+        m_firstFrameSeen = true;
+        qInfo().noquote() << QString("[startup]%1 首帧: 启动后 %2 ms")
+                             .arg(m_logTag).arg(face_recognizer_now_ms() - m_startupMs);
+    }
 
-    m_lastFrameJpeg = QByteArray((const char*)frame->start, frame->length);
+    const long allocsBefore = alloc_audit_thread_count();
+    m_frameDecoderAllocs = 0;
+    m_frameNotifyAllocs = 0;
+    copyFrame(frame);
+    m_lastFrameBgrValid = false;
+
+    std::vector<FaceRect> &detected_faces = m_detectedFaces;
+    detected_faces.clear();
+    // 定期进行人脸检测，采集注册照片时每帧检测
+    const bool capturing = m_regStage == REGISTRATION_CAPTURING;
+    if (m_frameCounter % DETECTION_INTERVAL == 0 || capturing) {
+        detectFaces(frame, detected_faces);
+    }
 
-    std::vector<FaceRect> detected_faces;
-    // 定期进行人脸检测
-    if (m_frameCounter % DETECTION_INTERVAL == 0 || m_registrationMode.load()) {
-        FaceRect *p = nullptr; int n = face_detector_detect((unsigned char*)frame->start, frame->length, &p);
-        if (n > 0) { detected_faces.assign(p, p + n); }　// 从C数组高效构造std::vector
-        if(p) free(p);
+    // --- 正常的追踪和识别流程，注册期间也不停 ---
+    // 卡尔曼滤波预测目标位置
+    m_tracker.predict();
+
+    // 检测框与跟踪器全局匹配，未匹配的检测新建追踪器
+    m_newIds.clear();
+    m_tracker.update(detected_faces.data(), detected_faces.size(), &m_newIds);
+    if (m_traceTrackers) {
+        for (int id : m_newIds) qDebug()<<"新追踪器 #"<<id;
     }
 
-    if (m_registrationMode.load()) {
-        handleRegistration(frame, detected_faces);
-    } else {
-        // --- 正常的追踪和识别流程 ---
-        for (auto& tracker : m_trackers) { 
-            // 卡尔曼滤波预测目标位置
-            if (tracker.active) { 
-                cv::Mat p = tracker.kf.predict(); 
-                tracker.rect = {int(p.at<float>(0)-p.at<float>(2)/2), int(p.at<float>(1)-p.at<float>(3)/2), int(p.at<float>(2)), int(p.at<float>(3))};
-            } 
-        }
+    // 异步任务提交：只送本帧检测到、且追踪器认为需要（重新）识别的人脸。
+    // 识别器还在加载时不挑选切片，省下的CPU留给加载；此前出现的人脸就绪后按新人脸处理
+    if (!detected_faces.empty() && m_stream) {
+        submitRecognition();
+    }
+
+    // 识别结果由 onRecognitionResults 在结果写入时立即合并，这里不再轮询
 
-        // IOU匹配算法（检测框与跟踪器关联）
-        if (!detected_faces.empty()) {
-            std::vector<bool> used(detected_faces.size(), false);
-            // 优先匹配现有跟踪器
-            for (auto& t : m_trackers) { 
-                if (!t.active) continue; 
-                float best_iou = 0; int best_idx = -1;
-                for (size_t i=0; i<detected_faces.size(); ++i) { 
-                    if (used[i]) continue;  
-                    float iou = calculate_iou(t.rect, detected_faces[i]); 
-                    if (iou > best_iou) { 
-                        best_iou = iou;
-                        best_idx = i; 
-                    } 
-                }
-                if (best_iou > IOU_MATCH_THRESHOLD) { // 更新卡尔曼滤波器
-                    const auto& r = detected_faces[best_idx]; 
-                    cv::Mat m = (cv::Mat_<float>(4,1) << r.x+r.width/2.0f, r.y+r.height/2.0f, r.width, r.height); 
-                    t.kf.correct(m); t.lifespan = TRACKER_LIFESPAN; 
-                    used[best_idx] = true;
-                } else { 
-                    t.lifespan--; 
-                }
+    //状态聚合与信号发射
+    m_lostIds.clear();
+    m_tracker.removeExpired(&m_lostIds);
+    for (int id : m_lostIds) {
+        if (m_traceTrackers) qDebug()<<"追踪器 #"<<id<<" 丢失";
+        if (ChipCandidate *c = chipCandidate(id, false)) c->trackId = -1;
+    }
+
+    if (m_regStage != REGISTRATION_IDLE) handleRegistration(detected_faces);
+    // 采集注册照片时界面上显示的是定位框，由 handleRegistration 发布
+    if (!capturing) publishTrackers();
+    if (!m_pendingPhotos.empty()) checkPendingPhotos();
+    // 资源释放
+    releaseFrame(frame);
+    m_frameCounter++;
+    if (allocsBefore >= 0 && m_frameCounter > ALLOC_AUDIT_WARMUP_FRAMES) {
+        const long allocs = alloc_audit_thread_count() - allocsBefore - m_frameDecoderAllocs - m_frameNotifyAllocs;
+        m_statAllocs += allocs;
+        m_statDecoderAllocs += m_frameDecoderAllocs;
+        m_statNotifyAllocs += m_frameNotifyAllocs;
+        m_allocAuditFrames++;
+        if (allocs > 0) {
+            m_statAllocFrames++;
+            // 按 1、2、4、8... 次打印，日志本身也要分配
+            const long failures = ++m_allocAuditFailures;
+            if ((failures & (failures - 1)) == 0) {
+                qWarning().noquote() << QString("[alloc]%1 第 %2 帧有 %3 次堆分配（第 %4 个这样的帧）")
+                                        .arg(m_logTag).arg(m_frameCounter).arg(allocs).arg(failures);
             }
+        }
+    }
+    reportPerformance();
+}
+
+VideoFrame *VideoProcessor::grabFrame()
+{
+    if (m_replay) return replay_source_get_frame(m_replay);
+    return m_cam ? video_capture_get_frame(m_cam) : nullptr;
+}
 
-            // 新目标初始化
-            for (size_t i=0; i<detected_faces.size(); ++i) {
-                if (!used[i]) {
-                    for (auto& t : m_trackers) { 
-                        if (!t.active) { 
-                            initKalmanFilter(t.kf, detected_faces[i]);
-                            t.active=1; t.rect=detected_faces[i]; strncpy(t.name,"Tracking...",63); 
-                            t.score=0; t.lifespan=TRACKER_LIFESPAN; t.id=m_nextTrackerId++; 
-                            qDebug()<<"新追踪器 #"<<t.id; break; 
-                        }
-                    }
-                }
+void VideoProcessor::releaseFrame(VideoFrame *frame)
+{
+    if (m_replay) replay_source_release_frame(m_replay, frame);
+    else video_capture_release_frame(m_cam, frame);
+}
+
+// 把摄像头缓冲区拷贝到帧池中一个没有被显示线程引用的缓冲区（摄像头缓冲区马上要还给驱动）。
+// 缓冲区只在第一次使用或帧变大时分配，之后每帧只做一次 memcpy
+void VideoProcessor::copyFrame(const VideoFrame *frame)
+{
+    m_lastFrame.clear();   // 先放掉对上一帧的引用，它才可能被复用
+    QByteArray *buf = nullptr;
+    for (QByteArray &b : m_framePool) {
+        if (b.isEmpty() || b.isDetached()) { buf = &b; break; }
+    }
+    if (!buf) {
+        // 显示线程同时占着所有缓冲区，只能换一块新的
+        buf = &m_framePool[m_frameCounter % FRAME_POOL_SIZE];
+        *buf = QByteArray();
+    }
+    if (buf->capacity() < (int)frame->length) buf->reserve(frame->length);
+    buf->resize(frame->length);
+    memcpy(buf->data(), frame->start, frame->length);
+    m_lastFrame = *buf;
+}
+
+// 识别结果的 eventfd 可读：把环形缓冲区中的结果按追踪器 id 合并，
+// 名字有变化时立即用最近一帧重新发布，不必等到下一个定时器周期
+void VideoProcessor::onRecognitionResults()
+{
+    face_recognizer_clear_result_event(m_stream);
+
+    bool changed = false;
+    const RecognitionResult *res = nullptr;
+    int n_res;
+    while ((n_res = face_recognizer_peek_results(m_stream, &res)) > 0) {
+        if (!m_firstResultSeen) {
+            m_firstResultSeen = true;
+            qInfo().noquote() << QString("[startup]%1 首次识别: 启动后 %2 ms")
+                                 .arg(m_logTag).arg(face_recognizer_now_ms() - m_startupMs);
+        }
+        for (int i = 0; i < n_res; ++i) {
+            const RecognitionResult &r = res[i];
+            int t = m_tracker.indexOf(r.track_id);
+            if (t < 0) continue;   // 结果返回前追踪器已经丢失
+
+            bool nameChanged = m_tracker.applyRecognition(t, r, m_frameCounter);
+            changed = changed || nameChanged;
+
+            RecognitionEvent ev;
+            ev.camera = m_camera;
+            ev.trackerId = m_tracker.id(t);
+            ev.state = m_tracker.state(t);
+            ev.identityId = m_tracker.identity(t);
+            ev.score = r.score;
+            ev.rect = m_tracker.rect(t);
+            ev.timestampMs = QDateTime::currentMSecsSinceEpoch();
+            emit recognitionEvent(ev);
+            logEvent(ev, nameChanged);
+
+            if (m_tracker.identified(t)) {
+                m_tracker.refresh(t);
+                if (nameChanged) qDebug().noquote()<<m_logTag<<"识别成功: "<<face_recognizer_state_label(m_tracker.state(t), m_tracker.identity(t)) << "(Tracker #" << m_tracker.id(t) << ")";
             }
-        } else { 
-            for (auto& t : m_trackers) { if (t.active) t.lifespan--; } 
         }
+        face_recognizer_consume_results(m_stream, n_res);
+    }
+
+    if (changed && !m_stopped && m_regStage != REGISTRATION_CAPTURING) {
+        publishTrackers();
+    }
+}
 
-        // 异步任务提交
-        if (m_frameCounter % RECOGNITION_INTERVAL == 0 && !detected_faces.empty()) { 
-            face_recognizer_submit_task((const unsigned char*)frame->start, frame->length, detected_faces.data(), detected_faces.size()); 
+// 识别事件写进事件日志；身份刚确定时附上这张脸在最近一帧中的缩略图
+void VideoProcessor::logEvent(const RecognitionEvent &ev, bool identityChanged)
+{
+    if (!m_eventLog) return;
+    EventRecord rec = {};
+    rec.timestampMs = ev.timestampMs;
+    rec.identity = ev.state == RECOGNITION_STATE_KNOWN ? logIdentity(ev.identityId) : EVENT_LOG_NO_IDENTITY;
+    rec.trackerId = ev.trackerId;
+    rec.score = ev.score;
+    rec.camera = (uint16_t)ev.camera;
+    rec.state = (uint8_t)ev.state;
+
+    bool thumbnail = false;
+    if (identityChanged && ev.state == RECOGNITION_STATE_KNOWN) {
+        if (cropLastFrame(ev.rect, m_thumbnailChip)) {
+            cv::resize(m_thumbnailChip.view, m_thumbnailBgr, cv::Size(EVENT_THUMBNAIL_SIZE, EVENT_THUMBNAIL_SIZE), 0, 0, cv::INTER_AREA);
+            thumbnail = cv::imencode(".jpg", m_thumbnailBgr, m_thumbnailJpeg);
         }
+    }
+    // 队列满时日志自己统计丢弃数，这里不等待
+    m_eventLog->append(rec, thumbnail ? m_thumbnailJpeg.data() : nullptr, thumbnail ? m_thumbnailJpeg.size() : 0);
+}
+
+// 识别器的身份 id 只在本进程内有效，按名字换成日志的身份编号并缓存
+int VideoProcessor::logIdentity(int identityId)
+{
+    if (identityId < 0) return EVENT_LOG_NO_IDENTITY;
+    if (identityId >= (int)m_logIdentities.size()) m_logIdentities.resize(identityId + 1, INT_MIN);   // INT_MIN: 还没查过
+    int &logId = m_logIdentities[identityId];
+    if (logId == INT_MIN) {
+        const char *name = face_recognizer_identity_name(identityId);
+        logId = name ? m_eventLog->identity(name) : EVENT_LOG_NO_IDENTITY;
+    }
+    return logId;
+}
+
+// 把所有追踪器的当前状态连同最近一帧发给界面
+void VideoProcessor::publishTrackers()
+{
+    QVector<FaceOverlay> &final_results = m_overlays;
+    final_results.clear();   // 不与其他线程共享时保留容量
+    int statusIdentity = FACE_IDENTITY_NONE;
+    for (int t = 0; t < m_tracker.size(); ++t) {
+        FaceOverlay r; r.rect=m_tracker.rect(t); r.state=m_tracker.state(t); r.identityId=m_tracker.identity(t); r.score=m_tracker.score(t); r.trackerId=m_tracker.id(t);
+        final_results.append(r); 
+        if(r.state==RECOGNITION_STATE_KNOWN) statusIdentity = r.identityId;
+    }
+
+    emit frameProcessed(m_lastFrame, m_lastFormat, final_results);
+    // 状态文字跨线程发送，只在内容变化时构造和发送
+    if (statusIdentity != m_statusIdentity) {
+        AllocScope notify(m_frameNotifyAllocs);
+        m_statusIdentity = statusIdentity;
+        if (statusIdentity == FACE_IDENTITY_NONE) emit statusMessage("正在监控...");
+        else emit statusMessage(QString("检测到: %1").arg(QString::fromUtf8(face_recognizer_identity_name(statusIdentity))));
+    }
+}
+
+// 根据采集格式得到灰度图再检测：MJPEG 解码为灰度，YUYV 只抽取Y分量，NV12 直接使用Y平面。
+// 灰度图保存在 m_grayView 中，本帧内还用于人脸质量评估
+int VideoProcessor::detectFaces(const VideoFrame *frame, std::vector<FaceRect> &faces)
+{
+    const unsigned char *data = (const unsigned char *)frame->start;
+    switch (m_lastFormat.fourcc) {
+    case V4L2_PIX_FMT_YUYV: {
+        cv::Mat yuyv(m_lastFormat.height, m_lastFormat.width, CV_8UC2, (void *)data, m_lastFormat.stride);
+        cv::extractChannel(yuyv, m_gray, 0);
+        m_grayView = m_gray;
+        break;
+    }
+    case V4L2_PIX_FMT_NV12:
+        m_grayView = cv::Mat(m_lastFormat.height, m_lastFormat.width, CV_8UC1, (void *)data, m_lastFormat.stride);
+        break;
+    default: {
+        AllocScope decoder(m_frameDecoderAllocs);
+        cv::Mat jpeg(1, (int)frame->length, CV_8UC1, (void *)data);
+        cv::imdecode(jpeg, cv::IMREAD_GRAYSCALE, &m_gray);
+        m_grayView = m_gray;
+        break;
+    }
+    }
+    if (m_grayView.empty()) return -1;
+
+    // 结果直接写进预留好容量的 vector，不经过 malloc 的C数组
+    faces.resize(faces.capacity());
+    int n = face_detector_detect_gray_into(m_grayView.data, m_grayView.cols, m_grayView.rows, (int)m_grayView.step,
+                                           faces.data(), (int)faces.size());
+    faces.resize(std::max(0, std::min(n, (int)faces.size())));
+    return n;
+}
 
-        // 异步结果获取与整合
-        RecognitionResult *res=nullptr; int n_res=face_recognizer_get_results(&res);
-        if (n_res > 0) {
-            for (int i=0; i<n_res; ++i) {
-                const auto& r = res[i]; float best_iou = 0; FaceTracker* best_t = nullptr;
-                for (auto& t : m_trackers) { 
-                    if (t.active) { 
-                        float iou = calculate_iou(t.rect, r.rect); 
-                        if (iou > best_iou) { best_iou = iou; best_t = &t; } 
-                    } 
-                }
-                if (best_t && best_iou > IOU_MATCH_THRESHOLD && strcmp(r.name,"Unknown") != 0) {
-                    strncpy(best_t->name, r.name, 63);
-                    best_t->score = r.score;
-                    best_t->lifespan = TRACKER_LIFESPAN;
-                    qDebug()<<"识别成功: "<<r.name << "(Tracker #" << best_t->id << " refreshed)";
-                }
+// 为每个需要识别的追踪器在 QUALITY_WINDOW_FRAMES 帧内挑选质量最好的切片，
+// 窗口结束（或遇到质量极好的切片）时才提交，一个窗口内每个人最多做一次前向推理。
+// 只有切片质量刷新了纪录时才裁剪彩色切片，YUYV/NV12 只转换人脸区域
+int VideoProcessor::submitRecognition()
+{
+    m_submitChips.clear();
+    m_submitIndices.clear();
+    for (int t = 0; t < m_tracker.size(); ++t) {
+        if (!m_tracker.matched(t) || !m_tracker.needsRecognition(t, m_frameCounter)) continue;
+
+        const int id = m_tracker.id(t);
+        ChipCandidate *candidate = chipCandidate(id, true);
+        if (!candidate) continue;
+        ChipCandidate &c = *candidate;
+
+        const FaceRect &det = m_tracker.detection(t);
+        FaceQuality q;
+        if (face_quality_evaluate(m_grayView.data, m_grayView.cols, m_grayView.rows, (int)m_grayView.step, &det, &q) == 0
+            && q.score >= QUALITY_MIN && q.score > c.quality) {
+            if (cropLastFrame(det, c.chip)) {
+                c.rect = det;
+                c.quality = q.score;
+                c.captureMs = face_recognizer_now_ms();
             }
-            free(res);
         }
 
-        //状态聚合与信号发射
-        QList<RecognitionResult> final_results; QString status="正在监控...";
-        for (auto& t : m_trackers) {
-            if (t.active && t.lifespan > 0) { 
-                RecognitionResult r; r.rect=t.rect; strncpy(r.name,t.name,63); r.score=t.score; 
-                final_results.append(r); 
-                if(strcmp(t.name,"Tracking...")!=0 && strcmp(t.name,"Unknown")!=0) 
-                    status=QString("检测到: %1").arg(t.name); 
-                }
-            else { 
-                if(t.active) { qDebug()<<"追踪器 #"<<t.id<<" 丢失"; } 
-                t.active = 0; 
-            }
+        const bool windowDone = m_frameCounter - c.windowStart >= QUALITY_WINDOW_FRAMES;
+        const cv::Mat &bgr = c.chip.view;
+        if (!bgr.empty() && (c.quality >= QUALITY_EXCELLENT || windowDone)) {
+            FaceChip chip;
+            chip.bgr = bgr.data;
+            chip.width = bgr.cols;
+            chip.height = bgr.rows;
+            chip.stride = (int)bgr.step;
+            chip.rect = c.rect;
+            chip.track_id = id;
+            // 身份未知的最先处理，新人脸其次，已确定身份的复核最后
+            if (m_tracker.identified(t)) chip.priority = RECOGNITION_PRIORITY_REVERIFY;
+            else if (m_tracker.state(t) == RECOGNITION_STATE_UNKNOWN) chip.priority = RECOGNITION_PRIORITY_UNKNOWN;
+            else chip.priority = RECOGNITION_PRIORITY_NEW;
+            chip.capture_ms = c.captureMs;
+            chip.deadline_ms = c.captureMs + RECOGNITION_DEADLINE_MS;
+            m_submitChips.push_back(chip);
+            m_submitIndices.push_back(t);
+        } else if (windowDone) {
+            // 整个窗口都没有合格的切片，重新开始挑选
+            c.restart(id, m_frameCounter);
         }
+    }
+    if (m_submitChips.empty() || !m_stream) return 0;
 
-        emit frameProcessed(m_lastFrameJpeg, final_results);
-        emit statusMessage(status);
+    int ret = face_recognizer_submit_chips(m_stream, m_submitChips.data(), m_submitChips.size());
+    if (ret > 0) {
+        for (int t : m_submitIndices) {
+            m_tracker.markSubmitted(t, m_frameCounter);
+            if (ChipCandidate *c = chipCandidate(m_tracker.id(t), false)) c->trackId = -1;
+        }
+        m_statSubmittedFaces += m_submitChips.size();
     }
-    // 资源释放
-    video_capture_release_frame(m_cam, frame);
-    m_frameCounter++;
+    return ret;
+}
+
+cv::Mat &VideoProcessor::ImageBuffer::fit(int rows, int cols, int type)
+{
+    if (storage.type() != type || storage.rows < rows || storage.cols < cols) {
+        storage.create(std::max(rows, storage.rows), std::max(cols, storage.cols), type);
+    }
+    view = storage(cv::Rect(0, 0, cols, rows));
+    return view;
+}
+
+void VideoProcessor::ChipCandidate::restart(int id, int frame)
+{
+    trackId = id;
+    chip.view = cv::Mat();
+    rect = {0, 0, 0, 0};
+    quality = 0.0f;
+    windowStart = frame;
+    captureMs = 0;
+}
+
+// 返回追踪器的候选切片槽位；create 时没有就占用一个空闲槽位，从本帧开始挑选
+VideoProcessor::ChipCandidate *VideoProcessor::chipCandidate(int trackId, bool create)
+{
+    ChipCandidate *free = nullptr;
+    for (ChipCandidate &c : m_chipCandidates) {
+        if (c.trackId == trackId) return &c;
+        if (!free && c.trackId < 0) free = &c;
+    }
+    if (!create || !free) return nullptr;
+    free->restart(trackId, m_frameCounter);
+    return free;
+}
+
+// 把最近一帧转换为 BGR，每帧最多转换一次
+const cv::Mat &VideoProcessor::lastFrameBgr()
+{
+    if (m_lastFrameBgrValid) return m_lastFrameBgr;
+    m_lastFrameBgrValid = true;
+    // 不释放上一帧的彩色图，尺寸不变时转换直接写进原来的内存
+    if (m_lastFrame.isEmpty()) {
+        m_lastFrameBgr.release();
+        return m_lastFrameBgr;
+    }
+
+    uchar *data = (uchar *)m_lastFrame.data();
+    if (m_lastFormat.fourcc == V4L2_PIX_FMT_YUYV) {
+        cv::Mat yuyv(m_lastFormat.height, m_lastFormat.width, CV_8UC2, data, m_lastFormat.stride);
+        cv::cvtColor(yuyv, m_lastFrameBgr, cv::COLOR_YUV2BGR_YUYV);
+    } else if (m_lastFormat.fourcc == V4L2_PIX_FMT_NV12) {
+        cv::Mat y_plane(m_lastFormat.height, m_lastFormat.width, CV_8UC1, data, m_lastFormat.stride);
+        cv::Mat uv_plane(m_lastFormat.height / 2, m_lastFormat.width / 2, CV_8UC2,
+                         data + (size_t)m_lastFormat.stride * m_lastFormat.height, m_lastFormat.stride);
+        cv::cvtColorTwoPlane(y_plane, uv_plane, m_lastFrameBgr, cv::COLOR_YUV2BGR_NV12);
+    } else {
+        AllocScope decoder(m_frameDecoderAllocs);
+        cv::Mat jpeg(1, m_lastFrame.size(), CV_8UC1, data);
+        cv::imdecode(jpeg, cv::IMREAD_COLOR, &m_lastFrameBgr);
+    }
+    return m_lastFrameBgr;
+}
+
+// 从最近一帧裁剪 rect（与图像求交）的彩色切片到 bgr.view，不超过 bgr 见过的最大尺寸时不分配内存。
+// YUYV/NV12 直接从原始数据只转换这一块；MJPEG 无法只解码一部分，整帧解码一次后裁剪
+bool VideoProcessor::cropLastFrame(const FaceRect &rect, ImageBuffer &bgr)
+{
+    if (m_lastFrame.isEmpty()) return false;
+    const cv::Rect roi = cv::Rect(rect.x, rect.y, rect.width, rect.height)
+                         & cv::Rect(0, 0, m_lastFormat.width, m_lastFormat.height);
+    if (roi.width <= 1 || roi.height <= 1) return false;
+
+    if (m_lastFormat.fourcc == V4L2_PIX_FMT_MJPEG) {
+        const cv::Mat &frame = lastFrameBgr();
+        if ((roi & cv::Rect(0, 0, frame.cols, frame.rows)) != roi) return false;
+        frame(roi).copyTo(bgr.fit(roi.height, roi.width, CV_8UC3));
+        return true;
+    }
+    // 先裁剪到中间缓冲区，失败时 bgr 中原来的切片保持不变
+    const FaceRect clipped = {roi.x, roi.y, roi.width, roi.height};
+    cv::Mat &crop = m_cropBgr.fit(roi.height, roi.width, CV_8UC3);
+    if (face_recognizer_crop_raw((const unsigned char *)m_lastFrame.constData(), m_lastFrame.size(),
+                                 m_lastFormat.width, m_lastFormat.height, m_lastFormat.stride, m_lastFormat.fourcc,
+                                 &clipped, crop.data, (int)crop.step) != 0) {
+        return false;
+    }
+    crop.copyTo(bgr.fit(roi.height, roi.width, CV_8UC3));
+    return true;
+}
+
+// 把最近一帧交给写入器保存为 JPEG，返回写入票号，没有图像或写入队列已满时返回0。
+// MJPEG 采集时直接共享摄像头输出，不复制；其他格式交出彩色图，由写线程编码
+uint64_t VideoProcessor::saveLastFrame(const QString &path)
+{
+    if (m_lastFrame.isEmpty() || !m_photoWriter) return 0;
+    const std::string file = path.toStdString();
+    if (m_lastFormat.fourcc == V4L2_PIX_FMT_MJPEG) return m_photoWriter->submit(file, m_lastFrame);
+    return m_photoWriter->submit(file, lastFrameBgr());
+}
+
+// 报告已经写完的拍照
+void VideoProcessor::checkPendingPhotos()
+{
+    auto it = m_pendingPhotos.begin();
+    while (it != m_pendingPhotos.end()) {
+        const PhotoWriter::Result r = m_photoWriter->result(it->ticket);
+        if (r == PhotoWriter::PENDING) {
+            ++it;
+            continue;
+        }
+        if (r == PhotoWriter::WRITTEN) {
+            emit statusMessage(QString("照片已保存: %1").arg(QDir(it->fileName).dirName()));
+            qDebug() << "Photo saved to" << it->fileName;
+        } else {
+            emit statusMessage("拍照失败: 无法写入文件");
+            qWarning() << "Failed to save photo to" << it->fileName;
+        }
+        it = m_pendingPhotos.erase(it);
+    }
+}
+
+static qint64 clockNs(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 周期性输出帧率和CPU占用，用于比较不同采集格式的开销
+void VideoProcessor::reportPerformance()
+{
+    qint64 wall = clockNs(CLOCK_MONOTONIC);
+    qint64 threadCpu = clockNs(CLOCK_THREAD_CPUTIME_ID);
+    qint64 processCpu = clockNs(CLOCK_PROCESS_CPUTIME_ID);
+    if (m_statWallNs == 0) {
+        m_statWallNs = wall; m_statThreadCpuNs = threadCpu; m_statProcessCpuNs = processCpu;
+        m_statFrames = 0;
+        return;
+    }
+    m_statTrackedFaces += m_tracker.size();
+    if (++m_statFrames < PERF_REPORT_FRAMES) return;
+
+    double elapsed = (wall - m_statWallNs) / 1e9;
+    if (elapsed > 0) {
+        qInfo().noquote() << QString("[perf]%1 %2 %3x%4: %5 fps, 处理线程CPU %6%, 进程CPU %7%")
+                             .arg(m_logTag)
+                             .arg(video_capture_format_name(m_lastFormat.fourcc))
+                             .arg(m_lastFormat.width).arg(m_lastFormat.height)
+                             .arg(m_statFrames / elapsed, 0, 'f', 1)
+                             .arg(100.0 * (threadCpu - m_statThreadCpuNs) / 1e9 / elapsed, 0, 'f', 1)
+                             .arg(100.0 * (processCpu - m_statProcessCpuNs) / 1e9 / elapsed, 0, 'f', 1);
+        qInfo().noquote() << QString("[perf]%1 追踪 %2 人脸帧，提交识别 %3 张人脸")
+                             .arg(m_logTag).arg(m_statTrackedFaces).arg(m_statSubmittedFaces);
+        reportRecognitionStats();
+        if (alloc_audit_thread_count() >= 0 && m_frameCounter > ALLOC_AUDIT_WARMUP_FRAMES) {
+            qInfo().noquote() << QString("[alloc]%1 处理线程 %2 帧中 %3 帧有堆分配，共 %4 次（另有 JPEG 解码器 %5 次，状态通知 %6 次）")
+                                 .arg(m_logTag).arg(m_statFrames).arg(m_statAllocFrames).arg(m_statAllocs)
+                                 .arg(m_statDecoderAllocs).arg(m_statNotifyAllocs);
+        }
+    }
+    m_statWallNs = wall; m_statThreadCpuNs = threadCpu; m_statProcessCpuNs = processCpu;
+    m_statFrames = 0;
+    m_statTrackedFaces = 0;
+    m_statSubmittedFaces = 0;
+    m_statAllocs = 0;
+    m_statAllocFrames = 0;
+    m_statDecoderAllocs = 0;
+    m_statNotifyAllocs = 0;
+}
+
+// 本路结果流在这个统计周期内的识别情况：各路共用推理线程，排队等待时间反映了其他摄像头的负载
+void VideoProcessor::reportRecognitionStats()
+{
+    if (!m_stream) return;
+    RecognitionStreamStats now;
+    face_recognizer_stream_stats(m_stream, &now);
+    const RecognitionStreamStats &prev = m_statStream;
+    const unsigned long completed = now.completed - prev.completed;
+    qInfo().noquote() << QString("[perf]%1 识别完成 %2 张，过期 %3，替换 %4，拒绝 %5，丢弃 %6，平均等待 %7 ms，推理 %8 ms，排队 %9")
+                         .arg(m_logTag).arg(completed)
+                         .arg(now.expired - prev.expired).arg(now.replaced - prev.replaced)
+                         .arg(now.rejected - prev.rejected).arg(now.dropped - prev.dropped)
+                         .arg(completed ? (double)(now.wait_ms_total - prev.wait_ms_total) / completed : 0.0, 0, 'f', 1)
+                         .arg(completed ? (double)(now.inference_ms_total - prev.inference_ms_total) / completed : 0.0, 0, 'f', 1)
+                         .arg(now.queued);
+    m_statStream = now;
 }
 
 void VideoProcessor::stop()
@@ -226,50 +680,56 @@ void VideoProcessor::stop()
     qDebug() << "Stop requested. Timer will halt on next cycle.";
 }
 
+// 只把照片交给写入器，写完后由 checkPendingPhotos 报告结果
 void VideoProcessor::takePhoto()
 {
-    if (m_lastFrameJpeg.isEmpty()) {
+    if (m_lastFrame.isEmpty()) {
         emit statusMessage("拍照失败: 无有效图像");
         return;
     }
 
     QString fileName = PHOTO_SAVE_PATH + QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss") + ".jpg";
-    QFile file(fileName);
-    if (file.open(QIODevice::WriteOnly)) {
-        file.write(m_lastFrameJpeg);
-        file.close();
-        emit statusMessage(QString("照片已保存: %1").arg(QDir(fileName).dirName()));
-        qDebug() << "Photo saved to" << fileName;
-    } else {
-        emit statusMessage("拍照失败: 无法写入文件");
-        qWarning() << "Failed to save photo to" << fileName;
+    const uint64_t ticket = saveLastFrame(fileName);
+    if (!ticket) {
+        emit statusMessage("拍照失败: 照片写入繁忙，请稍后再试");
+        qWarning() << "Photo writer queue full, dropped" << fileName;
+        return;
     }
+    m_pendingPhotos.push_back(PendingPhoto{ ticket, fileName });
 }
 
 void VideoProcessor::startRegistration(const QString &name)
 {
-    if (m_registrationMode.load()) {
+    if (m_regStage != REGISTRATION_IDLE) {
         emit statusMessage("错误: 正在进行另一个注册任务");
         return;
     }
+    if (!m_recognizer) {
+        emit statusMessage("错误: 识别模型尚未加载完成");
+        return;
+    }
+    if (!m_photoWriter) {
+        emit statusMessage("错误: 无法保存注册照片");
+        return;
+    }
     //  使用QDir来递归地删除并重建临时目录
     QDir tempDir(REG_TEMP_PATH);
     tempDir.removeRecursively();
     tempDir.mkpath(".");
 
     m_registrationName = name;
-    m_photosToTake = REGISTRATION_PHOTO_COUNT;
     m_takenPhotoPaths.clear();
-    m_regCaptureInterval = 0;
-    m_registrationMode = true; 
+    m_regTickets.clear();
+    m_regNextCaptureMs = face_recognizer_now_ms() + REGISTRATION_CAPTURE_INTERVAL_MS;
+    m_regStage = REGISTRATION_CAPTURING;
 
-    emit statusMessage(QString("注册 '%1': 请正对摄像头 (0/%2)").arg(name).arg(m_photosToTake));
+    emit statusMessage(QString("注册 '%1': 请正对摄像头 (0/%2)").arg(name).arg(REGISTRATION_PHOTO_COUNT));
     qDebug() << "Starting registration for" << name;
 }
 
 void VideoProcessor::clearDatabase()
 {
-    if (face_recognizer_clear_database() == 0) {
+    if (m_recognizer && face_recognizer_clear_database(m_recognizer) == 0) {
         emit statusMessage("数据库已清空");
         qDebug() << "Face database cleared successfully.";
     } else {
@@ -278,70 +738,137 @@ void VideoProcessor::clearDatabase()
     }
 }
 
-void VideoProcessor::handleRegistration(VideoFrame *frame, const std::vector<FaceRect> &detected_faces)
+void VideoProcessor::deletePerson(const QString &name)
+{
+    if (m_recognizer && face_recognizer_delete_person(m_recognizer, name.toUtf8().constData()) == 0) {
+        emit statusMessage(QString("已删除 '%1'").arg(name));
+    } else {
+        emit statusMessage(QString("错误: 删除 '%1' 失败").arg(name));
+    }
+}
+
+// 注册状态机，每帧推进一步
+void VideoProcessor::handleRegistration(const std::vector<FaceRect> &detected_faces)
+{
+    switch (m_regStage) {
+    case REGISTRATION_CAPTURING:
+        captureRegistrationPhoto(detected_faces);
+        break;
+    case REGISTRATION_WRITING: {
+        bool pending = false, failed = false;
+        for (uint64_t ticket : m_regTickets) {
+            const PhotoWriter::Result r = m_photoWriter->result(ticket);
+            pending = pending || r == PhotoWriter::PENDING;
+            failed = failed || r == PhotoWriter::FAILED;
+        }
+        if (pending) break;
+        if (failed) {
+            qWarning() << "Failed to write registration photos for" << m_registrationName;
+            emit statusMessage(QString("'%1' 注册失败: 无法保存照片").arg(m_registrationName));
+            finishRegistration();
+        } else {
+            startEnrollment();
+        }
+        break;
+    }
+    case REGISTRATION_ENROLLING: {
+        const int registered_count = m_regResult.load();
+        if (registered_count < 0) break;
+        m_regWorker.join();
+        if (registered_count > 0) {
+             qDebug() << "Successfully registered" << m_registrationName;
+             emit statusMessage(QString("'%1' 注册成功!").arg(m_registrationName));
+        } else {
+             qWarning() << "Failed to register" << m_registrationName;
+             emit statusMessage(QString("'%1' 注册失败，请重试").arg(m_registrationName));
+        }
+        finishRegistration();
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// 画出定位框；只有一张脸、到了采集时刻且质量合格时把这一帧交给写入器。
+// 采集成功后给用户留出调整姿势的时间，期间照常出图和识别
+void VideoProcessor::captureRegistrationPhoto(const std::vector<FaceRect> &detected_faces)
 {
     // 在屏幕上绘制一个提示框
-    QList<RecognitionResult> ui_results;
+    QVector<FaceOverlay> &ui_results = m_overlays;
+    ui_results.clear();
     if(!detected_faces.empty()){
-        RecognitionResult r;
+        FaceOverlay r;
         r.rect = detected_faces[0];                          
-        snprintf(r.name, sizeof(r.name), "Positioning..."); 
-        r.score = 0;
+        r.state = RECOGNITION_STATE_POSITIONING;
         ui_results.append(r);
     }
-    emit frameProcessed(m_lastFrameJpeg, ui_results);
-
-    m_regCaptureInterval++;
-    if (detected_faces.size() == 1 && m_regCaptureInterval >= REGISTRATION_CAPTURE_INTERVAL_FRAMES) {
-        m_regCaptureInterval = 0;
-        int photo_num = m_takenPhotoPaths.size() + 1;
-        QString filePath = REG_TEMP_PATH + QString("%1.jpg").arg(photo_num, 3, 10, QChar('0'));
-        QFile file(filePath);
-        if (file.open(QIODevice::WriteOnly)) {
-            file.write(m_lastFrameJpeg);
-            file.close();
-            m_takenPhotoPaths.append(filePath);
-            qDebug() << "Registration photo taken:" << filePath;
-
-            if (m_takenPhotoPaths.size() >= m_photosToTake) {
-                emit statusMessage(QString("采集完毕，正在处理照片..."));
-            } else {
-                emit statusMessage(QString("第 %1/%2 张采集成功，请调整姿势...")
-                                       .arg(photo_num)
-                                       .arg(m_photosToTake));
-                QThread::sleep(3);
-            }
-        }
-        //照片采集完毕，开始真正的注册
-        if (m_takenPhotoPaths.size() >= m_photosToTake) {
-            std::vector<const char*> c_paths;
-            std::vector<QByteArray> c_paths_storage;
-            for(const QString& p : m_takenPhotoPaths) {
-                c_paths_storage.push_back(p.toUtf8());
-                c_paths.push_back(c_paths_storage.back().constData());
-            }
-            //调用注册API:
-            int registered_count = face_recognizer_register_faces_from_paths(
-                c_paths.data(), c_paths.size(), m_registrationName.toUtf8().constData());
-
-            if (registered_count > 0) {
-                 qDebug() << "Successfully registered" << m_registrationName;
-                 emit statusMessage(QString("'%1' 注册成功!").arg(m_registrationName));
-                 cleanupRegistration(true);
-            } else {
-                 qWarning() << "Failed to register" << m_registrationName;
-                 emit statusMessage(QString("'%1' 注册失败，请重试").arg(m_registrationName));
-                 cleanupRegistration(false);
-            }
-        }
+    emit frameProcessed(m_lastFrame, m_lastFormat, ui_results);
+
+    const long long now = face_recognizer_now_ms();
+    if (detected_faces.size() != 1 || now < m_regNextCaptureMs) return;
+    m_regNextCaptureMs = now + REGISTRATION_CAPTURE_INTERVAL_MS;
+
+    // 只保留质量合格的注册照片，模糊、过暗、侧脸的照片会拉低聚类中心的质量
+    FaceQuality q;
+    face_quality_evaluate(m_grayView.data, m_grayView.cols, m_grayView.rows, (int)m_grayView.step,
+                          &detected_faces[0], &q);
+    if (q.score < REGISTRATION_MIN_QUALITY) {
+        emit statusMessage(QString("照片质量不足 (%1)，请调整姿势或光线")
+                               .arg(QString::fromUtf8(face_quality_problem(&q, REGISTRATION_MIN_QUALITY))));
+        return;
+    }
+    int photo_num = m_takenPhotoPaths.size() + 1;
+    QString filePath = REG_TEMP_PATH + QString("%1.jpg").arg(photo_num, 3, 10, QChar('0'));
+    // 写入队列满时这一张不算，到下次采集时刻再试
+    const uint64_t ticket = saveLastFrame(filePath);
+    if (!ticket) return;
+    m_takenPhotoPaths.append(filePath);
+    m_regTickets.push_back(ticket);
+    qDebug() << "Registration photo taken:" << filePath;
+
+    if (m_takenPhotoPaths.size() >= REGISTRATION_PHOTO_COUNT) {
+        emit statusMessage(QString("采集完毕，正在处理照片..."));
+        m_regStage = REGISTRATION_WRITING;
+    } else {
+        emit statusMessage(QString("第 %1/%2 张采集成功，请调整姿势...")
+                               .arg(photo_num)
+                               .arg(REGISTRATION_PHOTO_COUNT));
+        m_regNextCaptureMs = now + REGISTRATION_POSE_CHANGE_MS;
     }
 }
 
-void VideoProcessor::cleanupRegistration(bool success)
+// 提取特征要对每张照片做检测和前向推理，单核上要好几秒，放到后台线程；
+// 它借用推理线程的网络，也和推理线程一样只用推理的 CPU、调低优先级，不挤占采集和检测
+void VideoProcessor::startEnrollment()
+{
+    std::vector<std::string> paths;
+    for (const QString &p : m_takenPhotoPaths) paths.push_back(p.toUtf8().constData());
+    const std::string name = m_registrationName.toUtf8().constData();
+    const RecognizerCpuConfig cpu = PipelineManager::recognizerCpuConfig();
+    FaceRecognizer *recognizer = m_recognizer;
+
+    m_regResult = -1;
+    m_regStage = REGISTRATION_ENROLLING;
+    m_regWorker = std::thread([this, recognizer, paths, name, cpu]() {
+        face_recognizer_set_thread_cpu(cpu.cpu_mask, cpu.nice);
+        std::vector<const char*> c_paths;
+        for (const std::string &p : paths) c_paths.push_back(p.c_str());
+        //调用注册API:
+        const int registered_count = face_recognizer_register_faces_from_paths(
+            recognizer, c_paths.data(), c_paths.size(), name.c_str());
+        m_regResult = std::max(0, registered_count);
+    });
+}
+
+void VideoProcessor::finishRegistration()
 {
     QDir tempDir(REG_TEMP_PATH);
     tempDir.removeRecursively();
-    m_registrationMode = false;
+    m_takenPhotoPaths.clear();
+    m_regTickets.clear();
+    m_regStage = REGISTRATION_IDLE;
+    m_statusIdentity = -1;   // 注册提示之后重新显示监控状态
 }
 
 void VideoProcessor::setBrightness(int v) { 
@@ -351,32 +878,3 @@ void VideoProcessor::setBrightness(int v) {
     if(ioctl(m_cam->fd, VIDIOC_S_CTRL, &ctl)<0) 
     qWarning("设置亮度失败"); 
 }
-
-//卡尔曼滤波器的核心初始化
-void VideoProcessor::initKalmanFilter(cv::KalmanFilter& kf, const FaceRect& r) 
-{ 
-    kf.init(8,4,0,CV_32F);
-    kf.transitionMatrix=(cv::Mat_<float>(8,8)<<1,0,0,0,1,0,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0,1); 
-    kf.measurementMatrix=cv::Mat::eye(4,8,CV_32F); 
-
-    cv::setIdentity(kf.processNoiseCov,cv::Scalar::all(1e-2)); 
-    cv::setIdentity(kf.measurementNoiseCov,cv::Scalar::all(1e-1)); 
-    cv::setIdentity(kf.errorCovPost,cv::Scalar::all(1)); 
-    
-    //滤波器的初始状态
-    kf.statePost.at<float>(0)=r.x+r.width/2.f; 
-    kf.statePost.at<float>(1)=r.y+r.height/2.f; 
-    kf.statePost.at<float>(2)=r.width; 
-    kf.statePost.at<float>(3)=r.height; 
-    kf.statePost.at<float>(4)=0; 
-    kf.statePost.at<float>(5)=0; 
-    kf.statePost.at<float>(6)=0; 
-    kf.statePost.at<float>(7)=0; 
-}
-//计算交集的左上角和右下角坐标，从而得到交集面积
-float VideoProcessor::calculate_iou(const FaceRect& r1, const FaceRect& r2) { 
-    int x1=std::max(r1.x,r2.x), y1=std::max(r1.y,r2.y), x2=std::min(r1.x+r1.width, r2.x+r2.width), y2=std::min(r1.y+r1.height, r2.y+r2.height); 
-    int w=std::max(0,x2-x1), h=std::max(0,y2-y1); int inter=w*h; 
-    int unio=r1.width*r1.height+r2.width*r2.height-inter; 
-    return unio>0? (float)inter/unio : 0.0f; 
-}
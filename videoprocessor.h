@@ -2,14 +2,20 @@
 #define VIDEOPROCESSOR_H
 
 #include <QObject>
-#include <QPixmap>
 #include <QList>
+#include <QVector>
 #include <QByteArray>
 #include <QStringList>
 #include <QTimer> 
+#include <QSocketNotifier>
 
 #include <atomic>
-#include <opencv2/video/tracking.hpp>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "face_tracker.h"
+#include "event_log.h"
+#include "photo_writer.h"
 // POSIX C 头文件
 #include <fcntl.h>
 #include <unistd.h>
@@ -17,31 +23,87 @@
 
 extern "C" {
 #include "video_manager.h"
+#include "replay_source.h"
 #include "face_detector.h"
 #include "face_recognizer.h"
+#include "face_quality.h"
+#include "alloc_audit.h"
 }
 
-//声明自定义类型qRegisterMetaType
-Q_DECLARE_METATYPE(QList<RecognitionResult>)
-// 封装一个被追踪的人脸的所有信息
-struct FaceTracker {                
-    int active = 0;                   
-    FaceRect rect = {0,0,0,0};      
-    char name[64] = "Tracking...";  
-    float score = 0.0f;                 
-    int lifespan = 0;               
-    int id = -1;                    
-    cv::KalmanFilter kf;            
+// 模型和人脸数据库的路径（守护进程的批量导入模式也使用这些路径）
+#define FR_CASCADE_FILE  "/root/lbpcascade_frontalface.xml"
+#define FR_MODEL_FILE    "/root/models/mobilefacenet.onnx"
+#define FR_DATABASE_FILE "/root/face_database.db"
+#define FR_DB_KEY_FILE   "/root/face_database.key"
+#define FR_EVENT_LOG_DIR "/root/event_log"
+
+// 描述 frameProcessed 中一帧图像数据的格式
+struct FrameFormat {
+    int width = 0;
+    int height = 0;
+    int stride = 0;               // 每行字节数，MJPEG 时无意义
+    unsigned int fourcc = 0;      // V4L2_PIX_FMT_MJPEG / YUYV / NV12
+};
+
+// 界面上的一个人脸框：只带身份状态和身份 id，文字在绘制时由 face_recognizer_state_label 解析
+struct FaceOverlay {
+    FaceRect rect = {0,0,0,0};
+    RecognitionState state = RECOGNITION_STATE_TRACKING;
+    int identityId = FACE_IDENTITY_NONE;
+    float score = 0.0f;
+    int trackerId = -1;
+};
+
+// 一次识别事件：某个追踪器被识别为某人（或未知）
+struct RecognitionEvent {
+    int camera = 0;               // 来自第几路摄像头（FR_VIDEO_SOURCES 中的顺序）
+    int trackerId = -1;
+    RecognitionState state = RECOGNITION_STATE_TRACKING;
+    int identityId = FACE_IDENTITY_NONE;
+    float score = 0.0f;
+    FaceRect rect = {0,0,0,0};
+    qint64 timestampMs = 0;       // 自1970年以来的毫秒数
 };
 
+//声明自定义类型qRegisterMetaType
+Q_DECLARE_METATYPE(QVector<FaceOverlay>)
+Q_DECLARE_METATYPE(FrameFormat)
+Q_DECLARE_METATYPE(RecognitionEvent)
+
+// 一路摄像头的采集、检测、追踪流水线。识别器由多路共享，每路在其中打开自己的结果流。
+// 视频不等识别模型：识别器在后台加载好之后才通过 attachRecognizer 交给各路，此前只做检测和追踪
 class VideoProcessor : public QObject
 {
     Q_OBJECT
 
 public:
-    explicit VideoProcessor(QObject *parent = nullptr);
+    /**
+     * @param source 视频源：V4L2 设备路径，或 "replay:<目录>" 循环播放目录中的 JPEG 文件。
+     * @param camera 第几路摄像头，用于日志和识别事件。
+     * @param startupMs 程序启动的时刻 (face_recognizer_now_ms)，用于报告首帧和首次识别的耗时。
+     */
+    VideoProcessor(const QString &source, int camera, long long startupMs, QObject *parent = nullptr);
     ~VideoProcessor();
 
+    int camera() const { return m_camera; }
+    const QString &source() const { return m_source; }
+
+    /**
+     * @brief 在共享的识别器中打开本路的结果流，之后追踪到的人脸才会送去识别。
+     * 必须在本对象所在的线程中调用（结果通知器要在这里创建）；识别器必须比本对象活得更久。
+     */
+    void attachRecognizer(FaceRecognizer *recognizer);
+
+    // 识别事件同时写进事件日志；必须在处理线程启动之前设置，日志必须比本对象活得更久
+    void setEventLog(EventLog *log) { m_eventLog = log; }
+    // 拍照和注册采集的照片交给它写入；必须在处理线程启动之前设置，写入器必须比本对象活得更久
+    void setPhotoWriter(PhotoWriter *writer) { m_photoWriter = writer; }
+
+    // 堆分配检查（只在 CONFIG+=alloc_audit 编译时统计，可从任意线程读取）：预热之后处理过的帧数，
+    // 以及其中处理线程有堆分配的帧数。JPEG 解码器内部和状态文字变化时的分配单独统计，不算在内
+    long allocAuditFrames() const { return m_allocAuditFrames; }
+    long allocAuditFailures() const { return m_allocAuditFailures; }
+
 public slots:
     void startProcessing();                        
     void processSingleFrame();                      
@@ -50,31 +112,142 @@ public slots:
     void takePhoto();                               
     void startRegistration(const QString &name);
     void clearDatabase();                           
+    void deletePerson(const QString &name);
 
 signals:
-    void frameProcessed(const QByteArray &jpegData, const QList<RecognitionResult> &results);
+    // 参数引用的是本对象复用的缓冲区，只能用 Qt::DirectConnection 连接，接收方需要自己拷贝识别框
+    void frameProcessed(const QByteArray &frameData, const FrameFormat &format, const QVector<FaceOverlay> &overlays);
     void statusMessage(const QString &message);    
+    void recognitionEvent(const RecognitionEvent &event);
     void finished();    
 
 private:
+    FaceRecognizer *m_recognizer = nullptr;        // 后台加载完成前为 NULL
+    RecognitionStream *m_stream = nullptr;         // 本路摄像头在识别器中的结果流
+    QString m_source;
+    int m_camera;
+    QString m_logTag;                              // 日志前缀，例如 "[cam0]"
+    long long m_startupMs;                         // 程序启动的时刻，首帧和首次识别的耗时从这里算起
+    bool m_firstFrameSeen = false;
+    bool m_firstResultSeen = false;
     QTimer *m_timer = nullptr; 
+    QSocketNotifier *m_resultNotifier = nullptr;   // 监视识别结果的 eventfd
+    std::vector<RecognitionResult> m_resultRing;   // 识别线程写入的结果环形缓冲区
     VideoCaptureDevice *m_cam = nullptr;    
+    ReplaySource *m_replay = nullptr;       // 视频源为 replay: 时代替摄像头
     volatile bool m_stopped = false;        
-    std::vector<FaceTracker> m_trackers;   
-    int m_nextTrackerId = 0;                
+    TrackerEngine m_tracker;                
     int m_frameCounter = 0;                 
 
-    QByteArray m_lastFrameJpeg;             
-    std::atomic<bool> m_registrationMode{false};    
-    QString m_registrationName;             
-    int m_photosToTake;                     
-    QStringList m_takenPhotoPaths;          
-    int m_regCaptureInterval;              
-
-    void initKalmanFilter(cv::KalmanFilter& kf, const FaceRect& initial_rect); 
-    float calculate_iou(const FaceRect& r1, const FaceRect& r2);   
-    void handleRegistration(VideoFrame *frame, const std::vector<FaceRect> &detected_faces);
-    void cleanupRegistration(bool success);
+    unsigned int m_pixelFormat;             // 请求的采集格式，可用环境变量 FR_PIXEL_FORMAT 选择
+    QByteArray m_lastFrame;                 // 最近一帧的原始数据（MJPEG 时即为 JPEG），与 m_framePool 中的一个共享
+    static const int FRAME_POOL_SIZE = 4;   // 本线程、显示线程的待处理帧和正在绘制的帧各占一个，再留一个余量
+    QByteArray m_framePool[FRAME_POOL_SIZE];
+    FrameFormat m_lastFormat;
+    cv::Mat m_gray;                         // YUYV/MJPEG 得到灰度图时复用的缓冲区
+    cv::Mat m_grayView;                     // 本帧检测用的灰度图（NV12 时直接指向Y平面）
+    cv::Mat m_lastFrameBgr;                 // 最近一帧的彩色图，按需转换（拍照和 MJPEG 的人脸切片才需要）
+    bool m_lastFrameBgrValid = false;
+    ImageBuffer m_cropBgr;                  // 从原始帧裁剪人脸切片时的中间缓冲区
+
+    // 简单的性能统计：帧率以及处理线程/整个进程的CPU占用
+    int m_statFrames = 0;
+    qint64 m_statWallNs = 0;
+    qint64 m_statThreadCpuNs = 0;
+    qint64 m_statProcessCpuNs = 0;
+    int m_statTrackedFaces = 0;             // 统计周期内每帧追踪人脸数之和
+    int m_statSubmittedFaces = 0;           // 统计周期内送去识别的人脸数
+    long m_statAllocs = 0;                  // 统计周期内处理线程的堆分配次数（仅 FR_ALLOC_AUDIT），不含下面两项
+    int m_statAllocFrames = 0;              // 其中发生了分配的帧数
+    long m_statDecoderAllocs = 0;           // JPEG 解码器内部的分配，OpenCV 每次解码都要分配，不计入检查
+    long m_statNotifyAllocs = 0;            // 状态文字变化时发信号的分配，只在显示的身份变化时发生
+    long m_frameDecoderAllocs = 0;          // 本帧中上面两项的次数
+    long m_frameNotifyAllocs = 0;
+    std::atomic<long> m_allocAuditFrames{0};     // 预热之后检查过的帧数
+    std::atomic<long> m_allocAuditFailures{0};   // 其中有堆分配（不含解码器和状态通知）的帧数
+    RecognitionStreamStats m_statStream = {};   // 上个统计周期结束时结果流的累计统计
+
+    // 每帧复用的缓冲区，预热后稳态处理不再分配内存
+    std::vector<FaceRect> m_detectedFaces;
+    std::vector<int> m_newIds;
+    std::vector<int> m_lostIds;
+    QVector<FaceOverlay> m_overlays;
+    int m_statusIdentity = -1;              // 状态栏上一次显示的身份，-1 表示需要重新发送
+    bool m_traceTrackers = false;           // FR_TRACE_TRACKERS=1 时打印追踪器的新建和丢失（每条日志都要分配内存）
+
+    // 按见过的最大尺寸分配、只用左上角一块的图像缓冲区，人脸大小来回变化时不重新分配
+    struct ImageBuffer {
+        cv::Mat storage;
+        cv::Mat view;
+        cv::Mat &fit(int rows, int cols, int type);
+    };
+
+    // 每个追踪器在当前挑选窗口内质量最好的人脸切片；槽位在构造时按追踪器容量分配好，trackId 为 -1 表示空闲
+    struct ChipCandidate {
+        int trackId = -1;
+        ImageBuffer chip;          // chip.view 为空表示还没有合格的切片
+        FaceRect rect = {0,0,0,0};
+        float quality = 0.0f;
+        int windowStart = 0;
+        long long captureMs = 0;   // 切片所在帧的时间 (face_recognizer_now_ms)
+        void restart(int id, int frame);   // 开始新的挑选窗口，保留缓冲区
+    };
+    std::vector<ChipCandidate> m_chipCandidates;
+
+    // 事件日志
+    EventLog *m_eventLog = nullptr;
+    std::vector<int> m_logIdentities;       // 识别器身份 id -> 日志的身份编号，按需查找
+    ImageBuffer m_thumbnailChip;            // 事件缩略图裁剪出的人脸
+    cv::Mat m_thumbnailBgr;                 // 事件缩略图，复用缓冲区
+    std::vector<uchar> m_thumbnailJpeg;
+
+    // 提交识别时复用的缓冲区
+    std::vector<FaceChip> m_submitChips;
+    std::vector<int> m_submitIndices;
+
+    // 照片由写入器在后台写，处理线程每帧轮询结果
+    PhotoWriter *m_photoWriter = nullptr;
+    struct PendingPhoto {
+        uint64_t ticket;
+        QString fileName;
+    };
+    std::vector<PendingPhoto> m_pendingPhotos;   // 等待写入结果的拍照
+
+    // 注册是一个逐帧推进的状态机，任何一步都不阻塞处理线程，注册期间追踪和识别照常进行
+    enum RegistrationStage {
+        REGISTRATION_IDLE,
+        REGISTRATION_CAPTURING,   // 逐帧检测，间隔到了且只有一张合格的脸时采集一张
+        REGISTRATION_WRITING,     // 采集够了，等写入器把照片写完
+        REGISTRATION_ENROLLING,   // 在后台线程中提取特征入库
+    };
+    RegistrationStage m_regStage = REGISTRATION_IDLE;
+    QString m_registrationName;
+    QStringList m_takenPhotoPaths;
+    std::vector<uint64_t> m_regTickets;     // 各张注册照片的写入票号
+    long long m_regNextCaptureMs = 0;       // 下一张照片最早的采集时刻 (face_recognizer_now_ms)
+    std::thread m_regWorker;                // 入库线程
+    std::atomic<int> m_regResult{-1};       // 入库的照片数，-1 表示还没有完成
+
+    VideoFrame *grabFrame();
+    void releaseFrame(VideoFrame *frame);
+    void onRecognitionResults();
+    void logEvent(const RecognitionEvent &ev, bool identityChanged);
+    int logIdentity(int identityId);
+    void reportRecognitionStats();
+    void publishTrackers();
+    void copyFrame(const VideoFrame *frame);
+    int detectFaces(const VideoFrame *frame, std::vector<FaceRect> &faces);
+    int submitRecognition();
+    const cv::Mat &lastFrameBgr();
+    bool cropLastFrame(const FaceRect &rect, ImageBuffer &bgr);
+    ChipCandidate *chipCandidate(int trackId, bool create);
+    uint64_t saveLastFrame(const QString &path);
+    void checkPendingPhotos();
+    void reportPerformance();
+    void handleRegistration(const std::vector<FaceRect> &detected_faces);
+    void captureRegistrationPhoto(const std::vector<FaceRect> &detected_faces);
+    void startEnrollment();
+    void finishRegistration();
 };
 
 #endif // VIDEOPROCESSOR_H
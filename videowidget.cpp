@@ -0,0 +1,51 @@
+#include "videowidget.h"
+#include "framerenderer.h"
+
+#include <QPainter>
+#include <QResizeEvent>
+
+VideoWidget::VideoWidget(QWidget *parent) : QWidget(parent)
+{
+    // 每次都会完整覆盖控件区域，不需要Qt先擦除背景
+    setAttribute(Qt::WA_OpaquePaintEvent);
+}
+
+void VideoWidget::setRenderer(FrameRenderer *renderer)
+{
+    m_renderer = renderer;
+    connect(m_renderer, &FrameRenderer::frameReady, this, &VideoWidget::onFrameReady, Qt::QueuedConnection);
+    m_renderer->setTargetSize(size());
+}
+
+void VideoWidget::onFrameReady()
+{
+    if (m_renderer && m_renderer->takeFrame()) {
+        m_hasFrame = true;
+        update();
+    }
+}
+
+void VideoWidget::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    if (m_hasFrame && m_renderer->currentFrame().size() == size()) {
+        painter.drawImage(0, 0, m_renderer->currentFrame());
+        return;
+    }
+    // 还没有尺寸匹配的帧（刚启动或正在调整大小）
+    painter.fillRect(rect(), Qt::black);
+    if (m_hasFrame) {
+        const QImage &frame = m_renderer->currentFrame();
+        QSize scaled = frame.size().scaled(size(), Qt::KeepAspectRatio);
+        painter.drawImage(QRect(QPoint((width() - scaled.width()) / 2, (height() - scaled.height()) / 2), scaled), frame);
+    } else {
+        painter.setPen(Qt::white);
+        painter.drawText(rect(), Qt::AlignCenter, "等待视频流...");
+    }
+}
+
+void VideoWidget::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    if (m_renderer) m_renderer->setTargetSize(event->size());
+}
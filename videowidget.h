@@ -0,0 +1,30 @@
+#ifndef VIDEOWIDGET_H
+#define VIDEOWIDGET_H
+
+#include <QWidget>
+
+class FrameRenderer;
+
+// 显示视频的控件：渲染工作全部在 FrameRenderer 线程中完成，这里只负责交换缓冲区并绘制
+class VideoWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit VideoWidget(QWidget *parent = nullptr);
+
+    void setRenderer(FrameRenderer *renderer);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+
+private slots:
+    void onFrameReady();
+
+private:
+    FrameRenderer *m_renderer = nullptr;
+    bool m_hasFrame = false;
+};
+
+#endif // VIDEOWIDGET_H